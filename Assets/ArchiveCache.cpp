@@ -13,10 +13,11 @@
 #include "../Utility/Streams/StreamFormatter.h"
 #include "../Utility/Streams/Stream.h"
 #include "../Utility/PtrUtils.h"
-#include "../Utility/HeapUtils.h"
 #include "../Utility/MemoryUtils.h"
 #include "../Utility/IteratorUtils.h"
+#include "../Utility/SystemUtils.h"
 #include <algorithm>
+#include <limits>
 
 #pragma GCC diagnostic ignored "-Wmultichar"
 namespace Assets
@@ -30,14 +31,23 @@ namespace Assets
         unsigned _start, _size;
     };
     
+        //  The data file is append-only (a simple log of blocks). Replacing a block
+        //  appends the new version and leaves the old one as dead space, which is
+        //  reclaimed by compaction into a new "generation" of the data file.
+        //  The directory is always written to a temporary file and then swapped in with
+        //  an atomic rename, so an interrupted flush leaves the previous directory (and
+        //  all of the data it refers to) intact.
+    static const unsigned ArchiveDirectoryVersion = 1;
+
     class DirectoryChunk
     {
     public:
         unsigned _blockCount;
-        unsigned _spanningHeapSize;
+        unsigned _dataGeneration;
+        uint64_t _committedDataSize;    // anything in the data file after this point is left over from an interrupted flush
 
-            // list of blocks follows, and then the flattened spanning heap data
-        DirectoryChunk() : _blockCount(0), _spanningHeapSize(0) {}
+            // list of blocks follows
+        DirectoryChunk() : _blockCount(0), _dataGeneration(0), _committedDataSize(0) {}
 
         class CompareBlock
         {
@@ -126,73 +136,110 @@ namespace Assets
         }
     }
 
-    static bool LoadBlockList(const utf8 filename[], std::vector<ArchiveDirectoryBlock>& blocks)
+    static bool LoadBlockList(const utf8 filename[], std::vector<ArchiveDirectoryBlock>& blocks, DirectoryChunk& dirHdr)
     {
         using namespace Serialization::ChunkFile;
         std::unique_ptr<IFileInterface> directoryFile;
         if (MainFileSystem::TryOpen(directoryFile, filename, "rb") != MainFileSystem::IOReason::Success)
             return false;
 
-        auto chunkTable = LoadChunkTable(*directoryFile);
-        auto chunk = FindChunk(filename, chunkTable, ChunkType_ArchiveDirectory, 0);
+        TRY {
+            auto chunkTable = LoadChunkTable(*directoryFile);
+            auto chunk = FindChunk(filename, chunkTable, ChunkType_ArchiveDirectory, ArchiveDirectoryVersion);
 
-        DirectoryChunk dirHdr;
-        directoryFile->Seek(chunk._fileOffset);
-        directoryFile->Read(&dirHdr, sizeof(dirHdr), 1);
+            directoryFile->Seek(chunk._fileOffset);
+            directoryFile->Read(&dirHdr, sizeof(dirHdr), 1);
 
-        // we're going to remove any previous contents of "blocks"
-        blocks.clear();
-        blocks.resize(dirHdr._blockCount);
-        directoryFile->Read(AsPointer(blocks.begin()), sizeof(ArchiveDirectoryBlock), dirHdr._blockCount);
+            // we're going to remove any previous contents of "blocks"
+            blocks.clear();
+            blocks.resize(dirHdr._blockCount);
+            directoryFile->Read(AsPointer(blocks.begin()), sizeof(ArchiveDirectoryBlock), dirHdr._blockCount);
+        } CATCH (...) {
+            blocks.clear();
+            dirHdr = DirectoryChunk();
+            return false;
+        } CATCH_END
         return true;
     }
 
-    auto ArchiveCache::GetBlockList() const -> const std::vector<ArchiveDirectoryBlock>*
+    auto ArchiveCache::GetBlockList() const -> const std::vector<ArchiveDirectoryBlock>&
     {
         if (!_cachedBlockListValid) {
-            // note that on failure, we will continue to attempt to open the file each time
-            if (!LoadBlockList(_directoryFileName.c_str(), _cachedBlockList))
-                return nullptr;
-
+                // The directory file is only written by FlushToDisk (which updates the
+                // resident list itself), so we only need to load it once. If it's missing
+                // or invalid (including directories from older versions), we just treat the
+                // archive as empty
+            DirectoryChunk dirHdr;
+            if (!LoadBlockList(_directoryFileName.c_str(), _cachedBlockList, dirHdr)) {
+                _cachedBlockList.clear();
+                dirHdr = DirectoryChunk();
+            }
+            _dataGeneration = dirHdr._dataGeneration;
+            _committedDataSize = dirHdr._committedDataSize;
             _cachedBlockListValid = true;
         }
-        return &_cachedBlockList;
+        return _cachedBlockList;
     }
 
-    auto ArchiveCache::TryOpenFromCache(uint64_t id) -> BlockAndSize
+    std::basic_string<utf8> ArchiveCache::GetDataFileName(unsigned generation) const
     {
-            // first, check our pending commits
-            // if it's not there, we have to lock and open the file
-            // note that we're keeping the pending block lock permanently locked
-        ScopedLock(_pendingBlocksLock);
-        auto i = std::lower_bound(_pendingBlocks.begin(), _pendingBlocks.end(), id, ComparePendingCommit());
-        if (i!=_pendingBlocks.end() && i->_id == id) {
-            return i->_data;
+            // generation 0 uses the plain archive name
+        if (!generation) return _mainFileName;
+        auto suffix = "." + std::to_string(generation);
+        return _mainFileName + std::basic_string<utf8>((const utf8*)suffix.c_str());
+    }
+
+    auto ArchiveCache::GetMappedData(size_t minimumSize) const -> const std::shared_ptr<MemoryMappedFile>&
+    {
+            // If the file has grown since we mapped it (or the mapping was released for a
+            // flush), we need a new mapping. Views on the old mapping keep it alive
+        if (!_mappedData || _mappedData->GetSize() < minimumSize) {
+            _mappedData.reset();
+            MemoryMappedFile mappedFile;
+            if (MainFileSystem::TryOpen(mappedFile, GetDataFileName(_dataGeneration).c_str(), 0, "rb", FileShareMode::Read|FileShareMode::Write) == MainFileSystem::IOReason::Success)
+                _mappedData = std::make_shared<MemoryMappedFile>(std::move(mappedFile));
         }
+        return _mappedData;
+    }
 
-            // lock and open the directory, and look for the given item
-            // note that a flush could be happening in a background 
-            // thread -- in that case, we need to stall waiting for the
-            // flush to complete.
+    auto ArchiveCache::TryOpenView(uint64_t id) -> BlockView
+    {
+        ScopedLock(_pendingBlocksLock);
+        auto i = std::lower_bound(_pendingBlocks.begin(), _pendingBlocks.end(), id, ComparePendingCommit());
+        if (i!=_pendingBlocks.end() && i->_id == id)
+            return BlockView(i->_data);
+
+            // we maintain the blocks array sorted by id to make this check faster...
+        const auto& blocks = GetBlockList();
+        auto bi = std::lower_bound(blocks.begin(), blocks.end(), id, DirectoryChunk::CompareBlock());
+        if (bi == blocks.end() || bi->_id != id)
+            return {};     // this block doesn't exist in the cache
+
+        size_t blockEnd = size_t(bi->_start) + size_t(bi->_size);
+        const auto& mappedData = GetMappedData(blockEnd);
+        if (!mappedData || mappedData->GetSize() < blockEnd)
+            return {};
+
+        auto* start = PtrAdd(mappedData->GetData().begin(), bi->_start);
+        return BlockView(mappedData, MakeIteratorRange(start, PtrAdd(start, bi->_size)));
+    }
 
+    auto ArchiveCache::TryOpenFromCache(uint64_t id) -> BlockAndSize
+    {
         {
-            const auto* blocks = GetBlockList();
-            if (!blocks) return nullptr;
-
-                // we maintain the blocks array sorted by id to make this check faster...
-            auto bi = std::lower_bound(blocks->begin(), blocks->end(), id, DirectoryChunk::CompareBlock());
-            if (bi != blocks->end() && bi->_id == id) {
-                BasicFile dataFile;
-                if (MainFileSystem::TryOpen(dataFile, _mainFileName.c_str(), "rb") == MainFileSystem::IOReason::Success) {
-                    dataFile.Seek(bi->_start);
-                    auto result = std::make_shared<std::vector<uint8>>(bi->_size);
-                    dataFile.Read(AsPointer(result->begin()), 1, bi->_size);
-                    return result;
-                }
-            }
+                // pending commits can be returned directly
+            ScopedLock(_pendingBlocksLock);
+            auto i = std::lower_bound(_pendingBlocks.begin(), _pendingBlocks.end(), id, ComparePendingCommit());
+            if (i!=_pendingBlocks.end() && i->_id == id)
+                return i->_data;
         }
 
-        return nullptr;     // this block doesn't exist in the cache
+            // Blobs are owned by the caller, so we have to copy out of the mapping here.
+            // Use TryOpenView() to avoid the copy
+        auto view = TryOpenView(id);
+        if (!view) return nullptr;
+        auto data = view.GetData();
+        return std::make_shared<std::vector<uint8>>((const uint8*)data.begin(), (const uint8*)data.end());
     }
     
     bool ArchiveCache::HasItem(uint64_t id) const
@@ -203,13 +250,9 @@ namespace Assets
             return true;
         }
 
-        TRY {
-            const auto* blocks = GetBlockList();
-            auto bi = std::lower_bound(blocks->begin(), blocks->end(), id, DirectoryChunk::CompareBlock());
-            return (bi != blocks->end() && bi->_id == id);
-        } CATCH (...) {
-            return false;
-        } CATCH_END
+        const auto& blocks = GetBlockList();
+        auto bi = std::lower_bound(blocks.begin(), blocks.end(), id, DirectoryChunk::CompareBlock());
+        return (bi != blocks.end() && bi->_id == id);
     }
 
 	static std::vector<std::pair<std::string, std::string>> TryParseStringTable(IteratorRange<const void*> data)
@@ -232,167 +275,196 @@ namespace Assets
 		return result;
 	}
 
-    void ArchiveCache::FlushToDisk()
+    static const uint64_t s_compactionMinimumSize = 1024*1024;
+    static const float s_compactionThreshold = 0.5f;       // fraction of the data file that can be dead space before we compact
+
+    void ArchiveCache::WriteDirectory(const std::vector<ArchiveDirectoryBlock>& blocks, unsigned generation, uint64_t committedDataSize)
     {
-        ScopedLock(_pendingBlocksLock);
-        if (_pendingBlocks.empty()) { return; }
+        using namespace Serialization::ChunkFile;
 
-        _cachedBlockListValid = false;
+        auto tempFileName = _directoryFileName + u(".tmp");
+        {
+            auto directoryFile = MainFileSystem::OpenFileInterface(tempFileName.c_str(), "wb");
+
+            ChunkFileHeader fileHeader;
+            XlZeroMemory(fileHeader);
+            fileHeader._magic = MagicHeader;
+            fileHeader._fileVersionNumber = 0;
+            XlCopyString(fileHeader._buildVersion, dimof(fileHeader._buildVersion), _buildVersionString);
+            XlCopyString(fileHeader._buildDate, dimof(fileHeader._buildDate), _buildDateString);
+            fileHeader._chunkCount = 1;
+
+            ChunkHeader chunkHeader(
+                ChunkType_ArchiveDirectory, ArchiveDirectoryVersion, "ArchiveCache", unsigned(sizeof(DirectoryChunk) + blocks.size() * sizeof(ArchiveDirectoryBlock)));
+            chunkHeader._fileOffset = sizeof(ChunkFileHeader) + sizeof(ChunkHeader);
+
+            DirectoryChunk chunkData;
+            chunkData._blockCount = (unsigned)blocks.size();
+            chunkData._dataGeneration = generation;
+            chunkData._committedDataSize = committedDataSize;
+
+            directoryFile->Write(&fileHeader, sizeof(fileHeader), 1);
+            directoryFile->Write(&chunkHeader, sizeof(chunkHeader), 1);
+            directoryFile->Write(&chunkData, sizeof(chunkData), 1);
+            directoryFile->Write(AsPointer(blocks.begin()), sizeof(ArchiveDirectoryBlock), blocks.size());
+        }
 
-            // 1.   Open the directory and initialize our heap
-            //      representation
-            // 2.   Find older versions of the same blocks we
-            //      want to write
-            // 3.   Deallocate all blocks that have changed size
-            // 4.   Allocate new blocks as required
-            // 5.   Open the data file and write all the new blocks
-            //      to disk
-            // 6.   Flush out the new directory file
-            //
-            //  Note that the table of blocks is stored in order of id (for fast
-            //  searches) not in the order that they appear in the file.
+            // This is the commit point for the flush. Before the swap, the old directory
+            // is still valid (since we never overwrite data it refers to); after the swap the
+            // new directory and all of its data is complete.
+            // Note that we're relying on the OS to order the data writes before the rename;
+            // that's true for a process crash, but not necessarily for a power failure.
+        if (!XlReplaceFile(_directoryFileName.c_str(), tempFileName.c_str()))
+            Throw(::Exceptions::BasicLabel("Failed while replacing archive directory (%s)", (const char*)_directoryFileName.c_str()));
+    }
 
-        using namespace Serialization::ChunkFile;
+    void ArchiveCache::AppendAndFlush()
+    {
+            //  Append the pending blocks to the end of the committed part of the
+            //  data file, and then swap in a new directory. Existing data is never touched,
+            //  so the cost of this is proportional to the size of the pending blocks
+        auto blocks = _cachedBlockList;
+        auto dataFileName = GetDataFileName(_dataGeneration);
+        auto writePtr = _committedDataSize;
         {
-            DirectoryChunk dirHdr;
-            std::vector<ArchiveDirectoryBlock> blocks;
-            std::unique_ptr<uint8[]> flattenedSpanningHeap;
-        
-            std::unique_ptr<IFileInterface> directoryFile;
-            bool directoryFileOpened = false;
-
-            // using a soft "TryOpen" to prevent annoying exception messages when the file is being created for the first time
-            if (MainFileSystem::TryOpen(directoryFile, _directoryFileName.c_str(), "r+b") == MainFileSystem::IOReason::Success) {
-                TRY {
-                    auto chunkTable = LoadChunkTable(*directoryFile);
-                    auto chunk = FindChunk(_directoryFileName.c_str(), chunkTable, ChunkType_ArchiveDirectory, 0);
+            BasicFile dataFile;
+            if (MainFileSystem::TryOpen(dataFile, dataFileName.c_str(), "r+b") != MainFileSystem::IOReason::Success)
+                dataFile = MainFileSystem::OpenBasicFile(dataFileName.c_str(), "wb");
+
+            dataFile.Seek((size_t)writePtr);
+            for (auto& i:_pendingBlocks) {
+                auto size = (unsigned)i._data->size();
+                if (size) dataFile.Write(i._data->data(), 1, size);
+                i._pendingCommitPtr = (unsigned)writePtr;
+                writePtr += size;
+
+                ArchiveDirectoryBlock newBlock = { i._id, i._pendingCommitPtr, size };
+                auto b = std::lower_bound(blocks.begin(), blocks.end(), i._id, DirectoryChunk::CompareBlock());
+                if (b != blocks.end() && b->_id == i._id) {
+                    *b = newBlock;      // old version becomes dead space
+                } else
+                    blocks.insert(b, newBlock);
+            }
+            dataFile.Flush();
+        }
 
-                    directoryFile->Seek(chunk._fileOffset);
-                    directoryFile->Read(&dirHdr, sizeof(dirHdr), 1);
+        WriteDirectory(blocks, _dataGeneration, writePtr);
 
-                    blocks.resize(dirHdr._blockCount);
-                    directoryFile->Read(AsPointer(blocks.begin()), sizeof(ArchiveDirectoryBlock), dirHdr._blockCount);
-                    flattenedSpanningHeap = std::make_unique<uint8[]>(dirHdr._spanningHeapSize);
-                    directoryFile->Read(flattenedSpanningHeap.get(), 1, dirHdr._spanningHeapSize);
-                    directoryFileOpened = true;
-                } CATCH (...) {
-                    // We can get format errors while reading. In this case, will just overwrite the file
-                } CATCH_END
-            }
+            // the new block list becomes our resident directory
+            // (existing mappings remain valid, since we've only appended)
+        _cachedBlockList = std::move(blocks);
+        _committedDataSize = writePtr;
+        _cachedBlockListValid = true;
+    }
 
-            if (!directoryFileOpened) {
-                directoryFile.reset();
-                directoryFile = MainFileSystem::OpenFileInterface(_directoryFileName.c_str(), "wb");
-            }
+    void ArchiveCache::CompactAndFlush()
+    {
+            //  Write every live block (including the pending blocks) into a new generation
+            //  of the data file. The old generation remains valid until the directory swap,
+            //  so an interrupted compaction just leaves an orphaned file behind
+        auto oldGeneration = _dataGeneration;
+        auto newGeneration = oldGeneration+1;
+        auto newDataFileName = GetDataFileName(newGeneration);
 
-            SpanningHeap<uint32> spanningHeap(flattenedSpanningHeap.get(), dirHdr._spanningHeapSize);
-            for (auto i=_pendingBlocks.begin(); i!=_pendingBlocks.end(); ++i) {
-                i->_pendingCommitPtr = ~unsigned(0x0);
-
-                // find an existing block with the same id
-                auto b = std::lower_bound(blocks.cbegin(), blocks.cend(), i->_id, DirectoryChunk::CompareBlock());
-                if (b != blocks.cend() && b->_id == i->_id) {
-                        // todo -- Often we just want to resize the last block. This would be better if
-                        //          we could reallocate that last block (by shortening or expanding it)
-                    if (b->_size == i->_data->size()) {
-                            // same size; just reuse
-                        i->_pendingCommitPtr = b->_start;
-                    } else {
-                            // destroy the old block (new block will be reallocated later)
-                        spanningHeap.Deallocate(b->_start, b->_size);
-                        blocks.erase(b);
+        const auto& oldBlocks = _cachedBlockList;
+        std::vector<ArchiveDirectoryBlock> blocks;
+        blocks.reserve(oldBlocks.size() + _pendingBlocks.size());
+
+        auto oldMapping = _committedDataSize ? GetMappedData((size_t)_committedDataSize) : nullptr;
+
+        uint64_t writePtr = 0;
+        {
+            auto dataFile = MainFileSystem::OpenBasicFile(newDataFileName.c_str(), "wb");
+
+                // Both _pendingBlocks and the old directory are sorted by id, so we can merge them
+            auto p = _pendingBlocks.begin();
+            auto o = oldBlocks.begin();
+            while (p != _pendingBlocks.end() || o != oldBlocks.end()) {
+                ArchiveDirectoryBlock newBlock;
+                if (p != _pendingBlocks.end() && (o == oldBlocks.end() || p->_id <= o->_id)) {
+                    if (o != oldBlocks.end() && o->_id == p->_id) ++o;     // replaced by the pending block
+                    newBlock = { p->_id, (unsigned)writePtr, (unsigned)p->_data->size() };
+                    if (newBlock._size) dataFile.Write(p->_data->data(), 1, newBlock._size);
+                    p->_pendingCommitPtr = newBlock._start;
+                    ++p;
+                } else {
+                    if (!oldMapping || oldMapping->GetSize() < size_t(o->_start) + size_t(o->_size)) {
+                        Log(Warning) << "Dropping block from archive (" << (const char*)_mainFileName.c_str() << ") during compaction, because the data file is truncated" << std::endl;
+                        ++o;
+                        continue;
                     }
+                    newBlock = { o->_id, (unsigned)writePtr, o->_size };
+                    if (newBlock._size) dataFile.Write(PtrAdd(oldMapping->GetData().begin(), o->_start), 1, newBlock._size);
+                    ++o;
                 }
+                writePtr += newBlock._size;
+                blocks.push_back(newBlock);
             }
+            dataFile.Flush();
+        }
 
-                // Allocate space for new blocks. Allocate from largest to smallest.
-            std::sort(_pendingBlocks.begin(), _pendingBlocks.end(), 
-                [](const PendingCommit& lhs, const PendingCommit& rhs) { return lhs._data->size() > rhs._data->size(); });
-            for (auto i=_pendingBlocks.begin(); i!=_pendingBlocks.end(); ++i) {
-                if (i->_pendingCommitPtr == ~unsigned(0x0)) {
+        WriteDirectory(blocks, newGeneration, writePtr);
 
-                        // we need to allocate a new block
-                    auto newBlockSize = (unsigned)i->_data->size();
-                    
-                    #if !defined(NDEBUG)
-                        auto originalHeapSize = spanningHeap.CalculateHeapSize();
-                        auto originalAllocatedSize = spanningHeap.CalculateAllocatedSpace();
-                    #endif
-
-                    i->_pendingCommitPtr = spanningHeap.Allocate(newBlockSize);
-                    if (i->_pendingCommitPtr == ~unsigned(0x0)) {
-                        i->_pendingCommitPtr = spanningHeap.AppendNewBlock(newBlockSize);
-                    }
+        _cachedBlockList = std::move(blocks);
+        _dataGeneration = newGeneration;
+        _committedDataSize = writePtr;
+        _cachedBlockListValid = true;
 
-                    assert(spanningHeap.CalculateAllocatedSpace() >= (originalAllocatedSize + newBlockSize));
-                    assert(spanningHeap.CalculateHeapSize() >= originalHeapSize);
-
-                        // make sure we're not overlapping another block (just to make sure the allocators are working)
-                    #if !defined(NDEBUG)
-                        for (auto b=blocks.cbegin(); b!=blocks.cend(); ++b) {
-                            assert((b->_start + b->_size) <= originalHeapSize);
-                            assert(
-                                ((i->_pendingCommitPtr + newBlockSize) <= b->_start)
-                                || (i->_pendingCommitPtr >= (b->_start + b->_size)));
-                        }
-                    #endif
-
-                    auto b = std::lower_bound(blocks.begin(), blocks.end(), i->_id, DirectoryChunk::CompareBlock());
-                    assert(b==blocks.cend() || b->_id != i->_id);
-                    ArchiveDirectoryBlock newBlock = { i->_id, i->_pendingCommitPtr, newBlockSize };
-                    blocks.insert(b, newBlock);
+            // Views on the old generation keep their mapping alive. Deleting the file
+            // underneath them is fine on POSIX; on Windows the delete will fail while
+            // any views are outstanding, and the file will be orphaned
+        _mappedData.reset();
+        oldMapping.reset();
+        XlDeleteFile(GetDataFileName(oldGeneration).c_str());
+    }
 
-                }
-            }
+    void ArchiveCache::FlushToDisk()
+    {
+        ScopedLock(_pendingBlocksLock);
+        FlushInternal(false);
+    }
 
-                //  everything is allocated... we need to write the blocks to the data file
-                //  sort by pending commit ptr for convenience
-            std::sort(_pendingBlocks.begin(), _pendingBlocks.end(), 
-                [](const PendingCommit& lhs, const PendingCommit& rhs) { return lhs._pendingCommitPtr < rhs._pendingCommitPtr; });
-            {
-                BasicFile dataFile;
-                bool good = MainFileSystem::TryOpen(dataFile, _mainFileName.c_str(), "r+b") == MainFileSystem::IOReason::Success;
-                if (!good)
-                    dataFile = MainFileSystem::OpenBasicFile(_mainFileName.c_str(), "wb");
-                for (auto i=_pendingBlocks.begin(); i!=_pendingBlocks.end(); ++i) {
-                    dataFile.Seek(i->_pendingCommitPtr);
-                    dataFile.Write(AsPointer(i->_data->cbegin()), 1, i->_data->size());
-                }
-            }
+    void ArchiveCache::Compact()
+    {
+        ScopedLock(_pendingBlocksLock);
+        FlushInternal(true);
+    }
 
-                // write the new directory file (including the blocks list and spanning heap)
-            {
-                ChunkFileHeader fileHeader;
-                XlZeroMemory(fileHeader);
-                fileHeader._magic = MagicHeader;
-                fileHeader._fileVersionNumber = 0;
-                XlCopyString(fileHeader._buildVersion, dimof(fileHeader._buildVersion), _buildVersionString);
-                XlCopyString(fileHeader._buildDate, dimof(fileHeader._buildDate), _buildDateString);
-                fileHeader._chunkCount = 1;
-
-                auto flattenedHeap = spanningHeap.Flatten();
-            
-                ChunkHeader chunkHeader(
-                    ChunkType_ArchiveDirectory, 0, "ArchiveCache", unsigned(sizeof(DirectoryChunk) + blocks.size() * sizeof(ArchiveDirectoryBlock) + flattenedHeap.second));
-                chunkHeader._fileOffset = sizeof(ChunkFileHeader) + sizeof(ChunkHeader);
-
-                DirectoryChunk chunkData;
-                chunkData._blockCount = (unsigned)blocks.size();
-                chunkData._spanningHeapSize = (unsigned)flattenedHeap.second;
-
-                    // Write blank header data to the file
-                    //  note that there's a potential problem here, because
-                    //  we don't truncate the file before writing this. So if there is
-                    //  some data in there (but invalid data), then it will remain in the file
-                directoryFile->Seek(0);
-                directoryFile->Write(&fileHeader, sizeof(fileHeader), 1);
-                directoryFile->Write(&chunkHeader, sizeof(chunkHeader), 1);
-                directoryFile->Write(&chunkData, sizeof(chunkData), 1);
-                directoryFile->Write(AsPointer(blocks.begin()), sizeof(ArchiveDirectoryBlock), blocks.size());
-                directoryFile->Write(flattenedHeap.first.get(), 1, flattenedHeap.second);
-            }
+    void ArchiveCache::FlushInternal(bool forceCompaction)
+    {
+        if (_pendingBlocks.empty() && !forceCompaction) { return; }
+
+            //  Note that the table of blocks is stored in order of id (for fast
+            //  searches) not in the order that they appear in the file.
+            //  Also, _pendingBlocks is sorted by id (see Commit())
+        const auto& oldBlocks = GetBlockList();
+
+            // Check how much dead space we would have after appending the pending blocks
+        uint64_t newDataSize = _committedDataSize, liveSize = 0;
+        for (const auto& b:oldBlocks) liveSize += b._size;
+        for (const auto& i:_pendingBlocks) {
+            newDataSize += i._data->size();
+            liveSize += i._data->size();
+            auto b = std::lower_bound(oldBlocks.begin(), oldBlocks.end(), i._id, DirectoryChunk::CompareBlock());
+            if (b != oldBlocks.end() && b->_id == i._id)
+                liveSize -= b->_size;
         }
 
+        if (_pendingBlocks.empty() && liveSize == newDataSize) return;     // nothing to do
+
+        bool compact = forceCompaction
+            ||  (newDataSize >= s_compactionMinimumSize && float(newDataSize - liveSize) > s_compactionThreshold * float(newDataSize))
+            ||  (newDataSize > std::numeric_limits<unsigned>::max());     // block offsets are 32 bit
+        if (compact && liveSize > std::numeric_limits<unsigned>::max())
+            Throw(::Exceptions::BasicLabel("Archive (%s) is too large", (const char*)_mainFileName.c_str()));
+
+            // If we throw part way through, we'll reload the directory from disk on the next lookup
+        _cachedBlockListValid = false;
+        if (compact) {
+            CompactAndFlush();
+        } else
+            AppendAndFlush();
+
         #if defined(ARCHIVE_CACHE_ATTACHED_STRINGS)
             {
                         //  read the old string table, and then merge it
@@ -443,24 +515,8 @@ namespace Assets
     {
         using namespace Serialization::ChunkFile;
 
-            // We need to open the file and get metrics information
-            // for the blocks contained within
-        ////////////////////////////////////////////////////////////////////////////////////
-        std::vector<ArchiveDirectoryBlock> fileBlocks;
-        TRY {
-            auto directoryFile = MainFileSystem::OpenFileInterface(_directoryFileName.c_str(), "rb");
-
-            auto chunkTable = LoadChunkTable(*directoryFile);
-            auto chunk = FindChunk(_directoryFileName.c_str(), chunkTable, ChunkType_ArchiveDirectory, 0);
-
-            directoryFile->Seek(chunk._fileOffset);
-            DirectoryChunk dirHdr;
-            directoryFile->Read(&dirHdr, sizeof(dirHdr), 1);
-
-            fileBlocks.resize(dirHdr._blockCount);
-            directoryFile->Read(AsPointer(fileBlocks.begin()), sizeof(ArchiveDirectoryBlock), dirHdr._blockCount);
-        } CATCH (...) {
-        } CATCH_END
+        ScopedLock(_pendingBlocksLock);
+        const auto& fileBlocks = GetBlockList();
 
         ////////////////////////////////////////////////////////////////////////////////////
         #if defined(ARCHIVE_CACHE_ATTACHED_STRINGS)
@@ -525,7 +581,7 @@ namespace Assets
         Metrics result;
         result._blocks = std::move(blocks);
         result._usedSpace = usedSpace;
-        result._allocatedFileSize = unsigned(MainFileSystem::TryGetDesc(_mainFileName.c_str())._size);
+        result._allocatedFileSize = unsigned(_committedDataSize);
         return result;
     }
 
@@ -537,6 +593,8 @@ namespace Assets
     , _buildVersionString(buildVersionString)
     , _buildDateString(buildDateString)
     , _cachedBlockListValid(false)
+    , _dataGeneration(0)
+    , _committedDataSize(0)
     {
         _directoryFileName = _mainFileName + u(".dir");
 
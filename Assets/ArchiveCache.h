@@ -9,6 +9,7 @@
 #include "../Assets/AssetsCore.h"
 #include "../Utility/Threading/Mutex.h"
 #include "../Utility/UTFUtils.h"
+#include "../Utility/IteratorUtils.h"
 #include "../Core/Types.h"
 
 #include <memory>
@@ -18,6 +19,8 @@
 
 #define ARCHIVE_CACHE_ATTACHED_STRINGS
 
+namespace Utility { class MemoryMappedFile; }
+
 namespace Assets
 {
     class ArchiveDirectoryBlock;
@@ -27,13 +30,42 @@ namespace Assets
     public:
         using BlockAndSize = ::Assets::Blob;
 
+        /// <summary>Read-only view of a block within the archive</summary>
+        /// Holds a reference on the underlying storage (either the memory mapped data file, or
+        /// a pending commit), so the data stays valid for the lifetime of the view, even across
+        /// FlushToDisk() and Compact(). Since the data file is append-only (and compaction writes
+        /// a new generation), the contents seen through a view never change.
+        class BlockView
+        {
+        public:
+            IteratorRange<const void*> GetData() const { return _data; }
+            explicit operator bool() const { return _mappedFile || _pendingData; }
+
+            BlockView() {}
+            BlockView(std::shared_ptr<MemoryMappedFile> mappedFile, IteratorRange<const void*> data)
+            : _mappedFile(std::move(mappedFile)), _data(data) {}
+            BlockView(BlockAndSize pendingData)
+            : _pendingData(std::move(pendingData)), _data(MakeIteratorRange(*_pendingData)) {}
+        private:
+            std::shared_ptr<MemoryMappedFile> _mappedFile;
+            BlockAndSize _pendingData;
+            IteratorRange<const void*> _data;
+        };
+
         void            Commit(
 			uint64_t id, const BlockAndSize& data, 
 			const std::string& attachedStringName, const std::string& attachedString, 
 			std::function<void()>&& onFlush);
         BlockAndSize    TryOpenFromCache(uint64_t id);
+        BlockView       TryOpenView(uint64_t id);
         bool            HasItem(uint64_t id) const;
         void            FlushToDisk();
+
+        /// <summary>Rewrite the archive without any dead space</summary>
+        /// FlushToDisk() only ever appends to the data file, so replacing a block leaves dead
+        /// space behind. FlushToDisk() compacts automatically once the dead space passes a
+        /// threshold, but compaction can also be forced with this method.
+        void            Compact();
         
         class BlockMetrics
         {
@@ -101,9 +133,22 @@ namespace Assets
             bool operator()(const PendingCommit& lhs, const PendingCommit& rhs) { return lhs._id < rhs._id; }
         };
 
+            // The directory is kept resident (sorted by id) after it's first loaded, and
+            // replaced with the new block list on FlushToDisk. The data file is memory
+            // mapped on demand, and the mapping is released before writing.
         mutable std::vector<ArchiveDirectoryBlock> _cachedBlockList;
         mutable bool _cachedBlockListValid;
-        const std::vector<ArchiveDirectoryBlock>* GetBlockList() const;
+        mutable unsigned _dataGeneration;
+        mutable uint64_t _committedDataSize;
+        mutable std::shared_ptr<MemoryMappedFile> _mappedData;
+        const std::vector<ArchiveDirectoryBlock>& GetBlockList() const;
+        const std::shared_ptr<MemoryMappedFile>& GetMappedData(size_t minimumSize) const;
+
+        std::basic_string<utf8> GetDataFileName(unsigned generation) const;
+        void WriteDirectory(const std::vector<ArchiveDirectoryBlock>& blocks, unsigned generation, uint64_t committedDataSize);
+        void FlushInternal(bool forceCompaction);
+        void CompactAndFlush();
+        void AppendAndFlush();
     };
 
 
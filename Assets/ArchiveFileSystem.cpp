@@ -0,0 +1,494 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#include "ArchiveFileSystem.h"
+#include "MemoryFile.h"
+#include "../Utility/Streams/PathUtils.h"
+#include "../Utility/Streams/FileUtils.h"
+#include "../Utility/StringUtils.h"
+#include "../Utility/PtrUtils.h"
+#include "../Utility/Conversion.h"
+#include "../Utility/BitUtils.h"
+#include "../Core/Exceptions.h"
+#include <algorithm>
+#include <regex>
+#if !defined(EXCLUDE_Z_LIB)
+    #include "../Foreign/zlib/zlib.h"
+#endif
+
+namespace Assets
+{
+	namespace Internal
+	{
+			//
+			//	Archive layout:
+			//		ArchiveHeader
+			//		ArchiveEntry[_entryCount]		(sorted by _pathHash)
+			//		string table					(entry names, not null terminated)
+			//		file data						(each file aligned to ArchiveDataAlignment)
+			//
+			//	All offsets are from the start of the archive
+			//
+		static const uint32 ArchiveMagic = 0x52414c58;	// 'XLAR'
+		static const uint32 ArchiveVersion = 1;
+		static const unsigned ArchiveDataAlignment = 16;
+		static const unsigned ArchiveDeflateWindowBits = 15;
+
+		struct ArchiveHeader
+		{
+			uint32 _magic;
+			uint32 _version;
+			uint32 _entryCount;
+			uint32 _stringTableSize;
+			uint64 _entriesOffset;
+			uint64 _stringTableOffset;
+		};
+
+		struct ArchiveEntry
+		{
+			uint64 _pathHash;
+			uint64 _dataOffset;
+			uint64 _storedSize;
+			uint64 _size;
+			uint64 _modificationTime;
+			uint32 _nameOffset;
+			uint32 _nameLength;
+			uint32 _compression;		// (ArchiveCompression)
+			uint32 _padding;
+		};
+
+		static StringSection<utf8> StripLeadingSeparators(StringSection<utf8> name)
+		{
+			for (;;) {
+				if (!name.IsEmpty() && (*name.begin() == '/' || *name.begin() == '\\')) {
+					++name._start;
+				} else if (name.Length() >= 2 && name[0] == '.' && (name[1] == '/' || name[1] == '\\')) {
+					name._start += 2;
+				} else
+					return name;
+			}
+		}
+
+		static uint64 HashArchivePath(StringSection<utf8> name)
+		{
+			// Always case insensitive, so the archive doesn't depend on the filename rules
+			// of the machine that built it
+			static FilenameRules s_archiveRules('/', false);
+			return HashFilenameAndPath(StripLeadingSeparators(name), s_archiveRules);
+		}
+
+		struct CompareEntryHash
+		{
+			bool operator()(const ArchiveEntry& lhs, uint64 rhs) const { return lhs._pathHash < rhs; }
+			bool operator()(uint64 lhs, const ArchiveEntry& rhs) const { return lhs < rhs._pathHash; }
+		};
+
+		static bool IsSeparator(utf8 c) { return c == '/' || c == '\\'; }
+
+			// Compare 2 paths with the same rules as HashArchivePath (ie, case insensitive, and
+			// treating any sequence of separators as a single separator)
+		static bool ArchivePathsEqual(StringSection<utf8> lhs, StringSection<utf8> rhs)
+		{
+			lhs = StripLeadingSeparators(lhs);
+			rhs = StripLeadingSeparators(rhs);
+			auto l = lhs.begin(), r = rhs.begin();
+			while (l < lhs.end() && r < rhs.end()) {
+				if (IsSeparator(*l)) {
+					if (!IsSeparator(*r)) return false;
+					while (l < lhs.end() && IsSeparator(*l)) ++l;
+					while (r < rhs.end() && IsSeparator(*r)) ++r;
+				} else {
+					if (std::tolower(utf8_nextchar(l, lhs.end())) != std::tolower(utf8_nextchar(r, rhs.end())))
+						return false;
+				}
+			}
+			return l == lhs.end() && r == rhs.end();
+		}
+	}
+
+	class FileSystem_Archive : public IFileSystem, public ISearchableFileSystem
+	{
+	public:
+		virtual TranslateResult		TryTranslate(Marker& result, StringSection<utf8> filename);
+		virtual TranslateResult		TryTranslate(Marker& result, StringSection<utf16> filename);
+
+		virtual IOReason	TryOpen(std::unique_ptr<IFileInterface>& result, const Marker& uri, const char openMode[], FileShareMode::BitField shareMode);
+		virtual IOReason	TryOpen(BasicFile& result, const Marker& uri, const char openMode[], FileShareMode::BitField shareMode);
+		virtual IOReason	TryOpen(MemoryMappedFile& result, const Marker& uri, uint64 size, const char openMode[], FileShareMode::BitField shareMode);
+		virtual IOReason	TryMonitor(const Marker& marker, const std::shared_ptr<IFileMonitor>& evnt);
+		virtual	FileDesc	TryGetDesc(const Marker& marker);
+
+		virtual std::vector<IFileSystem::Marker> FindFiles(
+			StringSection<utf8> baseDirectory,
+			StringSection<utf8> regexMatchPattern);
+		virtual std::vector<std::basic_string<utf8>> FindSubDirectories(
+			StringSection<utf8> baseDirectory);
+
+		FileSystem_Archive(StringSection<utf8> archiveFilename);
+		~FileSystem_Archive();
+
+	protected:
+		std::shared_ptr<MemoryMappedFile> _archive;
+		const Internal::ArchiveEntry* _entries;
+		unsigned _entryCount;
+		const utf8* _stringTable;
+
+		struct MarkerStruct
+		{
+			unsigned _entryIdx;
+		};
+
+		const Internal::ArchiveEntry* GetEntry(const Marker& marker) const;
+		StringSection<utf8> GetName(const Internal::ArchiveEntry& entry) const;
+		IteratorRange<const void*> GetStoredData(const Internal::ArchiveEntry& entry) const;
+		void MakeMarker(Marker& result, const Internal::ArchiveEntry& entry) const;
+	};
+
+	static bool IsWriteMode(const char openMode[])
+	{
+		return XlFindChar(openMode, 'w') || XlFindChar(openMode, 'a') || XlFindChar(openMode, '+');
+	}
+
+	auto FileSystem_Archive::GetEntry(const Marker& marker) const -> const Internal::ArchiveEntry*
+	{
+		if (marker.size() < sizeof(MarkerStruct)) return nullptr;
+		const auto& m = *(const MarkerStruct*)AsPointer(marker.begin());
+		if (m._entryIdx >= _entryCount) return nullptr;
+		return &_entries[m._entryIdx];
+	}
+
+	StringSection<utf8> FileSystem_Archive::GetName(const Internal::ArchiveEntry& entry) const
+	{
+		return MakeStringSection(&_stringTable[entry._nameOffset], &_stringTable[entry._nameOffset + entry._nameLength]);
+	}
+
+	IteratorRange<const void*> FileSystem_Archive::GetStoredData(const Internal::ArchiveEntry& entry) const
+	{
+		auto* start = PtrAdd(_archive->GetData().begin(), (ptrdiff_t)entry._dataOffset);
+		return MakeIteratorRange(start, PtrAdd(start, (ptrdiff_t)entry._storedSize));
+	}
+
+	void FileSystem_Archive::MakeMarker(Marker& result, const Internal::ArchiveEntry& entry) const
+	{
+		result.resize(sizeof(MarkerStruct));
+		auto* out = (MarkerStruct*)AsPointer(result.begin());
+		out->_entryIdx = unsigned(&entry - _entries);
+	}
+
+	auto FileSystem_Archive::TryTranslate(Marker& result, StringSection<utf8> filename) -> TranslateResult
+	{
+		if (filename.IsEmpty())
+			return TranslateResult::Invalid;
+
+		auto hash = Internal::HashArchivePath(filename);
+		auto range = std::equal_range(
+			_entries, &_entries[_entryCount], hash,
+			Internal::CompareEntryHash());
+
+		// Normally there will only be 1 entry in the range (the builder rejects archives with
+		// duplicate hashes); but we still need to compare names to protect against a query for
+		// a file that isn't in the archive colliding with one that is
+		for (auto i=range.first; i!=range.second; ++i)
+			if (Internal::ArchivePathsEqual(GetName(*i), filename)) {
+				MakeMarker(result, *i);
+				return TranslateResult::Success;
+			}
+
+		return TranslateResult::Invalid;
+	}
+
+	auto FileSystem_Archive::TryTranslate(Marker& result, StringSection<utf16> filename) -> TranslateResult
+	{
+		if (filename.IsEmpty())
+			return TranslateResult::Invalid;
+
+		auto converted = Conversion::Convert<std::basic_string<utf8>>(filename);
+		return TryTranslate(result, MakeStringSection(converted));
+	}
+
+	auto FileSystem_Archive::TryOpen(std::unique_ptr<IFileInterface>& result, const Marker& marker, const char openMode[], FileShareMode::BitField shareMode) -> IOReason
+	{
+		auto* entry = GetEntry(marker);
+		if (!entry) return IOReason::FileNotFound;
+		if (IsWriteMode(openMode)) return IOReason::WriteProtect;
+
+		if (entry->_compression == (uint32)ArchiveCompression::Deflate) {
+			#if !defined(EXCLUDE_Z_LIB)
+				result = CreateDecompressOnReadFile(_archive, GetStoredData(*entry), (size_t)entry->_size, Internal::ArchiveDeflateWindowBits);
+				return IOReason::Success;
+			#else
+				return IOReason::Invalid;
+			#endif
+		}
+
+		result = CreateSubFile(_archive, GetStoredData(*entry));
+		return IOReason::Success;
+	}
+
+	auto FileSystem_Archive::TryOpen(BasicFile& result, const Marker& marker, const char openMode[], FileShareMode::BitField shareMode) -> IOReason
+	{
+		// Cannot open archive files in this way
+		return IOReason::Invalid;
+	}
+
+	auto FileSystem_Archive::TryOpen(MemoryMappedFile& result, const Marker& marker, uint64 size, const char openMode[], FileShareMode::BitField shareMode) -> IOReason
+	{
+		auto* entry = GetEntry(marker);
+		if (!entry) return IOReason::FileNotFound;
+		if (IsWriteMode(openMode)) return IOReason::WriteProtect;
+
+		// Only uncompressed files can be mapped; the result is a view into the archive mapping
+		// (which is kept alive until the result is closed)
+		if (entry->_compression != (uint32)ArchiveCompression::None || size > entry->_size)
+			return IOReason::Invalid;
+
+		auto data = GetStoredData(*entry);
+		auto archive = _archive;
+		result = MemoryMappedFile(
+			MakeIteratorRange(const_cast<void*>(data.begin()), const_cast<void*>(data.end())),
+			[archive](IteratorRange<const void*>) {});
+		return IOReason::Success;
+	}
+
+	auto FileSystem_Archive::TryMonitor(const Marker& marker, const std::shared_ptr<IFileMonitor>& evnt) -> IOReason
+	{
+		// Archive contents never change
+		return IOReason::Invalid;
+	}
+
+	FileDesc FileSystem_Archive::TryGetDesc(const Marker& marker)
+	{
+		auto* entry = GetEntry(marker);
+		if (!entry)
+			return FileDesc{ std::basic_string<utf8>(), std::basic_string<utf8>(), FileDesc::State::DoesNotExist };
+
+		auto name = GetName(*entry).AsString();
+		return FileDesc
+			{
+				name, name,
+				FileDesc::State::Normal,
+				entry->_modificationTime, entry->_size
+			};
+	}
+
+	std::vector<IFileSystem::Marker> FileSystem_Archive::FindFiles(
+		StringSection<utf8> baseDirectory,
+		StringSection<utf8> regexMatchPattern)
+	{
+		auto baseDir = Internal::StripLeadingSeparators(baseDirectory);
+		while (!baseDir.IsEmpty() && Internal::IsSeparator(*(baseDir.end()-1))) --baseDir._end;
+
+		std::vector<IFileSystem::Marker> res;
+		std::regex r(regexMatchPattern.Cast<char>().AsString());
+		for (unsigned c=0; c<_entryCount; ++c) {
+			auto splitter = MakeFileNameSplitter(GetName(_entries[c]));
+			auto dir = splitter.DriveAndPath();
+			while (!dir.IsEmpty() && Internal::IsSeparator(*(dir.end()-1))) --dir._end;
+			if (!Internal::ArchivePathsEqual(dir, baseDir)) continue;
+
+			auto fn = splitter.FileAndExtension().Cast<char>();
+			if (!std::regex_match(fn.begin(), fn.end(), r)) continue;
+
+			res.emplace_back();
+			MakeMarker(res.back(), _entries[c]);
+		}
+		return res;
+	}
+
+	std::vector<std::basic_string<utf8>> FileSystem_Archive::FindSubDirectories(
+		StringSection<utf8> baseDirectory)
+	{
+		auto baseSplit = MakeSplitPath(Internal::StripLeadingSeparators(baseDirectory));
+		auto baseSections = baseSplit.GetSections();
+
+		std::vector<std::basic_string<utf8>> res;
+		std::vector<uint64> foundHashes;
+		for (unsigned c=0; c<_entryCount; ++c) {
+			auto splitter = MakeFileNameSplitter(GetName(_entries[c]));
+			auto dirSplit = MakeSplitPath(splitter.DriveAndPath());
+			auto dirSections = dirSplit.GetSections();
+			if (dirSections.size() <= baseSections.size()) continue;
+
+			bool match = true;
+			for (unsigned s=0; s<baseSections.size(); ++s)
+				if (!Internal::ArchivePathsEqual(dirSections[s], baseSections[s])) {
+					match = false;
+					break;
+				}
+			if (!match) continue;
+
+			auto subDir = dirSections[baseSections.size()];
+			auto hash = Internal::HashArchivePath(subDir);
+			if (std::find(foundHashes.begin(), foundHashes.end(), hash) != foundHashes.end()) continue;
+			foundHashes.push_back(hash);
+			res.push_back(subDir.AsString());
+		}
+		return res;
+	}
+
+	FileSystem_Archive::FileSystem_Archive(StringSection<utf8> archiveFilename)
+	{
+		_archive = std::make_shared<MemoryMappedFile>(MainFileSystem::OpenMemoryMappedFile(archiveFilename, 0, "r"));
+
+		using namespace Internal;
+		auto data = _archive->GetData();
+		if (data.size() < sizeof(ArchiveHeader))
+			Throw(::Exceptions::BasicLabel("Archive file (%s) is truncated", archiveFilename.Cast<char>().AsString().c_str()));
+
+		const auto& hdr = *(const ArchiveHeader*)data.begin();
+		if (hdr._magic != ArchiveMagic || hdr._version != ArchiveVersion)
+			Throw(::Exceptions::BasicLabel("Archive file (%s) is not a packed archive, or has an unsupported version", archiveFilename.Cast<char>().AsString().c_str()));
+
+		if (	(hdr._entriesOffset + uint64(hdr._entryCount) * sizeof(ArchiveEntry)) > data.size()
+			||	(hdr._stringTableOffset + hdr._stringTableSize) > data.size()
+			||	(hdr._entriesOffset % sizeof(uint64)) != 0)
+			Throw(::Exceptions::BasicLabel("Archive file (%s) is truncated", archiveFilename.Cast<char>().AsString().c_str()));
+
+		_entries = (const ArchiveEntry*)PtrAdd(data.begin(), (ptrdiff_t)hdr._entriesOffset);
+		_entryCount = hdr._entryCount;
+		_stringTable = (const utf8*)PtrAdd(data.begin(), (ptrdiff_t)hdr._stringTableOffset);
+
+		for (unsigned c=0; c<_entryCount; ++c) {
+			const auto& e = _entries[c];
+			if (	(e._dataOffset + e._storedSize) > data.size()
+				||	(uint64(e._nameOffset) + e._nameLength) > hdr._stringTableSize
+				||	e._compression > (uint32)ArchiveCompression::Deflate
+				||	(c != 0 && _entries[c-1]._pathHash > e._pathHash))
+				Throw(::Exceptions::BasicLabel("Archive file (%s) has a corrupt directory", archiveFilename.Cast<char>().AsString().c_str()));
+		}
+	}
+
+	FileSystem_Archive::~FileSystem_Archive() {}
+
+	std::shared_ptr<IFileSystem>	CreateFileSystem_Archive(StringSection<utf8> archiveFilename)
+	{
+		return std::make_shared<FileSystem_Archive>(archiveFilename);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	#if !defined(EXCLUDE_Z_LIB)
+		static std::vector<uint8> DeflateBlock(IteratorRange<const void*> input)
+		{
+			z_stream stream;
+			stream.zalloc = (alloc_func)0;
+			stream.zfree = (free_func)0;
+			stream.opaque = nullptr;
+			auto err = deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -(signed)Internal::ArchiveDeflateWindowBits, 8, Z_DEFAULT_STRATEGY);
+			if (err != Z_OK)
+				Throw(::Exceptions::BasicLabel("Failed to initialize zlib while building archive"));
+
+			std::vector<uint8> result(deflateBound(&stream, (uLong)input.size()));
+			stream.next_in = (z_const Bytef*)input.begin();
+			stream.avail_in = (uInt)input.size();
+			stream.next_out = (Bytef*)result.data();
+			stream.avail_out = (uInt)result.size();
+			err = deflate(&stream, Z_FINISH);
+			result.resize(stream.total_out);
+			deflateEnd(&stream);
+			if (err != Z_STREAM_END)
+				Throw(::Exceptions::BasicLabel("Failed while compressing file for archive"));
+			return result;
+		}
+	#endif
+
+	void WriteFileSystemArchive(
+		StringSection<utf8> archiveFilename,
+		IteratorRange<const ArchiveFileSystemEntry*> entries,
+		ArchiveCompression compression)
+	{
+		using namespace Internal;
+
+		struct PendingEntry
+		{
+			const ArchiveFileSystemEntry* _src;
+			std::basic_string<utf8> _name;
+			std::vector<uint8> _compressed;
+			ArchiveEntry _entry;
+		};
+		std::vector<PendingEntry> pending;
+		pending.reserve(entries.size());
+
+		std::basic_string<utf8> stringTable;
+		for (const auto& e:entries) {
+			PendingEntry p;
+			p._src = &e;
+				// normalize separators, so FindFiles & FindSubDirectories don't need to consider both types
+			p._name = StripLeadingSeparators(MakeStringSection(e._name)).AsString();
+			std::replace(p._name.begin(), p._name.end(), (utf8)'\\', (utf8)'/');
+			p._entry = {};
+			p._entry._pathHash = HashArchivePath(MakeStringSection(p._name));
+			p._entry._nameOffset = (uint32)stringTable.size();
+			p._entry._nameLength = (uint32)p._name.size();
+			p._entry._modificationTime = e._modificationTime;
+			p._entry._size = e._data ? e._data->size() : 0;
+			p._entry._compression = (uint32)ArchiveCompression::None;
+			stringTable += p._name;
+
+			#if !defined(EXCLUDE_Z_LIB)
+					// Only keep the compressed version when it's at least 1/8th smaller; otherwise
+					// it's not worth paying for decompression while loading
+				const size_t minimumCompressSize = 256;
+				if (compression == ArchiveCompression::Deflate && p._entry._size >= minimumCompressSize) {
+					auto compressed = DeflateBlock(MakeIteratorRange(*e._data));
+					if (compressed.size() < (p._entry._size - p._entry._size / 8)) {
+						p._compressed = std::move(compressed);
+						p._entry._compression = (uint32)ArchiveCompression::Deflate;
+					}
+				}
+			#endif
+
+			pending.emplace_back(std::move(p));
+		}
+
+		std::sort(
+			pending.begin(), pending.end(),
+			[](const PendingEntry& lhs, const PendingEntry& rhs) { return lhs._entry._pathHash < rhs._entry._pathHash; });
+		for (size_t c=1; c<pending.size(); ++c)
+			if (pending[c]._entry._pathHash == pending[c-1]._entry._pathHash)
+				Throw(::Exceptions::BasicLabel(
+					"Duplicate (or hash colliding) filenames while building archive (%s) and (%s)",
+					pending[c-1]._name.c_str(), pending[c]._name.c_str()));
+
+		ArchiveHeader hdr;
+		hdr._magic = ArchiveMagic;
+		hdr._version = ArchiveVersion;
+		hdr._entryCount = (uint32)pending.size();
+		hdr._stringTableSize = (uint32)stringTable.size();
+		hdr._entriesOffset = sizeof(ArchiveHeader);
+		hdr._stringTableOffset = hdr._entriesOffset + pending.size() * sizeof(ArchiveEntry);
+
+		uint64 dataIterator = CeilToMultiple(hdr._stringTableOffset + stringTable.size(), ArchiveDataAlignment);
+		std::vector<ArchiveEntry> finalEntries;
+		finalEntries.reserve(pending.size());
+		for (auto& p:pending) {
+			p._entry._storedSize = (p._entry._compression == (uint32)ArchiveCompression::None) ? p._entry._size : p._compressed.size();
+			p._entry._dataOffset = dataIterator;
+			dataIterator = CeilToMultiple(dataIterator + p._entry._storedSize, ArchiveDataAlignment);
+			finalEntries.push_back(p._entry);
+		}
+
+		auto outputFile = MainFileSystem::OpenBasicFile(archiveFilename, "wb");
+		outputFile.Write(&hdr, sizeof(hdr), 1);
+		outputFile.Write(finalEntries.data(), sizeof(ArchiveEntry), finalEntries.size());
+		outputFile.Write(stringTable.data(), 1, stringTable.size());
+
+		const uint8 padding[ArchiveDataAlignment] = {};
+		uint64 writeIterator = hdr._stringTableOffset + stringTable.size();
+		for (const auto& p:pending) {
+			assert(p._entry._dataOffset >= writeIterator);
+			outputFile.Write(padding, 1, size_t(p._entry._dataOffset - writeIterator));
+			if (p._entry._compression == (uint32)ArchiveCompression::None) {
+				if (p._entry._storedSize)
+					outputFile.Write(p._src->_data->data(), 1, p._src->_data->size());
+			} else {
+				outputFile.Write(p._compressed.data(), 1, p._compressed.size());
+			}
+			writeIterator = p._entry._dataOffset + p._entry._storedSize;
+		}
+	}
+}
+
@@ -0,0 +1,43 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#pragma once
+
+#include "IFileSystem.h"
+#include <string>
+
+namespace Assets
+{
+	/// <summary>Opens a packed, read-only archive as a filesystem</summary>
+	/// The archive is memory mapped once, and all lookups go through a path hash index stored
+	/// in the archive itself; so there are no OS calls while translating or opening files.
+	/// Uncompressed files are returned as views directly into the mapping, compressed files
+	/// are decompressed as they are read.
+	///
+	/// The result should be mounted on the MountingTree like any other filesystem (and
+	/// follows the same priority rules). Lookups are case insensitive, and either type of
+	/// path separator can be used. Throws if the archive can't be opened or is invalid.
+	std::shared_ptr<IFileSystem>	CreateFileSystem_Archive(StringSection<utf8> archiveFilename);
+
+	class ArchiveFileSystemEntry
+	{
+	public:
+		std::basic_string<utf8>	_name;				///< relative to the root of the archive, with either type of path separator
+		Blob					_data;
+		uint64_t				_modificationTime = 0;
+	};
+
+	enum class ArchiveCompression { None, Deflate };
+
+	/// <summary>Writes a packed archive for use with CreateFileSystem_Archive</summary>
+	/// With ArchiveCompression::Deflate, each file is compressed individually, and stored
+	/// compressed only when that saves a meaningful amount of space.
+	void WriteFileSystemArchive(
+		StringSection<utf8> archiveFilename,
+		IteratorRange<const ArchiveFileSystemEntry*> entries,
+		ArchiveCompression compression = ArchiveCompression::Deflate);
+}
+
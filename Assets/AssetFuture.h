@@ -98,7 +98,7 @@ namespace Assets
 		template<typename AssetType, typename std::enable_if<!HasGetDependencyValidation<AssetType>::value>::type* =nullptr>
 			inline DepValPtr GetDependencyValidation(const AssetType&) { return nullptr; }
 
-		unsigned RegisterFrameBarrierCallback(std::function<void()>&& fn);
+		unsigned RegisterFrameBarrierCallback(InlineFunction<void()>&& fn);
 		void DeregisterFrameBarrierCallback(unsigned);
 
 		void CheckMainThreadStall(std::chrono::steady_clock::time_point stallStartTime);
@@ -9,7 +9,9 @@
 #include "../Utility/Threading/ThreadingUtils.h"
 #include "../Utility/Threading/Mutex.h"
 #include "../Utility/IteratorUtils.h"
+#include "../Utility/Streams/FileSystemMonitor.h"
 #include <vector>
+#include <iterator>
 #include <memory>
 #include <assert.h>
 
@@ -20,13 +22,14 @@ namespace Assets
 	public:
 		std::vector<std::pair<size_t, std::unique_ptr<IDefaultAssetHeap>>> _sets;
 		std::vector<std::pair<size_t, std::unique_ptr<IDefaultAssetHeap>>> _setsPendingIteration;
-		std::vector<std::pair<unsigned, std::function<void()>>> _frameBarrierFunctions;
-		std::vector<std::pair<unsigned, std::function<void()>>> _pendingFrameBarrierFunctions;
+		std::vector<std::pair<unsigned, FrameBarrierCallback>> _frameBarrierFunctions;
+		std::vector<std::pair<unsigned, FrameBarrierCallback>> _pendingFrameBarrierFunctions;
 		std::vector<unsigned> _pendingRemoveFrameBarrierFunctions;
 		unsigned _nextFrameBufferMarkerId = 1;
 		Threading::RecursiveMutex _lock;
 
 		bool _inIterationOperation = false;
+		bool _deferringFileSystemEvents = false;
 	};
 
 	IDefaultAssetHeap * AssetSetManager::GetSetForTypeCode(size_t typeCode)
@@ -95,6 +98,16 @@ namespace Assets
 
 	void AssetSetManager::OnFrameBarrier()
 	{
+			// Once frame barriers are running, file system changes are queued and delivered
+			// here, so that dependency validation callbacks are executed once per frame (and on
+			// the main thread), regardless of how many changes came in. Until the first barrier,
+			// they are delivered immediately (since there may never be a barrier to flush them)
+		if (!_pimpl->_deferringFileSystemEvents) {
+			SetFileSystemMonitorDeferredDelivery(true);
+			_pimpl->_deferringFileSystemEvents = true;
+		}
+		FlushFileSystemMonitorEvents();
+
 		std::unique_lock<decltype(_pimpl->_lock)> lock(_pimpl->_lock);
 		_pimpl->_inIterationOperation = true;
 		
@@ -108,7 +121,10 @@ namespace Assets
 			_pimpl->_sets.insert(LowerBound(_pimpl->_sets, set.first), std::move(set));
 		_pimpl->_setsPendingIteration.clear();
 
-		_pimpl->_frameBarrierFunctions.insert(_pimpl->_frameBarrierFunctions.end(), _pimpl->_pendingFrameBarrierFunctions.begin(), _pimpl->_pendingFrameBarrierFunctions.end());
+		_pimpl->_frameBarrierFunctions.insert(
+			_pimpl->_frameBarrierFunctions.end(),
+			std::make_move_iterator(_pimpl->_pendingFrameBarrierFunctions.begin()),
+			std::make_move_iterator(_pimpl->_pendingFrameBarrierFunctions.end()));
 		_pimpl->_pendingFrameBarrierFunctions.clear();
 
 		for (auto r:_pimpl->_pendingRemoveFrameBarrierFunctions) {
@@ -121,7 +137,7 @@ namespace Assets
 		_pimpl->_inIterationOperation = false;
 	}
 
-	unsigned AssetSetManager::RegisterFrameBarrierCallback(std::function<void()>&& fn)
+	unsigned AssetSetManager::RegisterFrameBarrierCallback(FrameBarrierCallback&& fn)
 	{
 		ScopedLock(_pimpl->_lock);
 		auto result = _pimpl->_nextFrameBufferMarkerId++;
@@ -154,12 +170,15 @@ namespace Assets
     }
 
     AssetSetManager::~AssetSetManager()
-    {}
+    {
+		if (_pimpl->_deferringFileSystemEvents)
+			SetFileSystemMonitorDeferredDelivery(false);
+	}
 
 
 	namespace Internal
 	{
-		unsigned RegisterFrameBarrierCallback(std::function<void()>&& fn)
+		unsigned RegisterFrameBarrierCallback(AssetSetManager::FrameBarrierCallback&& fn)
 		{
 			return GetAssetSetManager().RegisterFrameBarrierCallback(std::move(fn));
 		}
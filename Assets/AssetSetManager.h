@@ -7,6 +7,7 @@
 #pragma once
 
 #include "../Core/Types.h"
+#include "../Utility/Threading/InlineTask.h"
 #include <memory>
 #include <string>
 #include <vector>
@@ -35,7 +36,8 @@ namespace Assets
         void Lock();
         void Unlock();
 
-		unsigned RegisterFrameBarrierCallback(std::function<void()>&& fn);
+		using FrameBarrierCallback = InlineFunction<void()>;
+		unsigned RegisterFrameBarrierCallback(FrameBarrierCallback&& fn);
 		void DeregisterFrameBarrierCallback(unsigned);
 
         AssetSetManager();
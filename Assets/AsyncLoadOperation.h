@@ -20,6 +20,15 @@ namespace Assets
     public:
         static void Enqueue(const std::shared_ptr<AsyncLoadOperation>& op, StringSection<ResChar> filename, CompletionThreadPool& pool);
 
+            /// <summary>Queue a batch of loads together</summary>
+            /// Where the platform supports it, all of the reads are submitted to the OS with a
+            /// single call, which is much cheaper than individual Enqueue() calls when loading
+            /// many small files. Complete() and OnFailure() are always called from a pool thread.
+        static void Enqueue(
+            IteratorRange<const std::shared_ptr<AsyncLoadOperation>*> ops,
+            IteratorRange<const StringSection<ResChar>*> filenames,
+            CompletionThreadPool& pool);
+
         AsyncLoadOperation();
         virtual ~AsyncLoadOperation();
 
@@ -0,0 +1,538 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#include "AsyncLoadOperation.h"
+#include "IFileSystem.h"
+#include "../ConsoleRig/Log.h"
+#include "../Utility/Threading/CompletionThreadPool.h"
+#include "../Utility/Threading/LockFree.h"
+#include "../Utility/Threading/Mutex.h"
+#include "../Utility/StringUtils.h"
+#include "../Core/SelectConfiguration.h"
+
+#if PLATFORMOS_ACTIVE != PLATFORMOS_LINUX
+    #error AsyncLoadOperation_Linux.cpp only implemented for Linux targets
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+    // io_uring is used directly through the system calls (rather than liburing), so
+    // there are no extra build dependencies. If the kernel doesn't support it (or it's
+    // blocked by a security policy) we fall back to blocking reads on the pool thread
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+    #include <linux/io_uring.h>
+    #define ASYNC_LOAD_HAS_IO_URING 1
+#else
+    #define ASYNC_LOAD_HAS_IO_URING 0
+#endif
+
+namespace Assets
+{
+    namespace Internal
+    {
+        /// <summary>A single read request for the Linux IO backend</summary>
+        /// Plays the same role as OVERLAPPED on Windows; the AsyncLoadOperation's state
+        /// derives from this.
+        class LinuxReadRequest
+        {
+        public:
+            int _fd = -1;
+            struct iovec _iov;
+            uint64 _offset = 0;
+
+                /// Called with the number of bytes read, or a negative errno value
+            virtual void OnReadComplete(int result) = 0;
+            virtual ~LinuxReadRequest() {}
+        };
+
+        class LinuxIOBackend
+        {
+        public:
+            void Submit(IteratorRange<LinuxReadRequest*const*> requests);
+            bool IsAsync() const { return _ringFD >= 0; }
+
+            static LinuxIOBackend& GetInstance();
+
+            LinuxIOBackend();
+            ~LinuxIOBackend();
+        private:
+            #if ASYNC_LOAD_HAS_IO_URING
+                int _ringFD = -1;
+                unsigned* _sqHead = nullptr; unsigned* _sqTail = nullptr; unsigned* _sqMask = nullptr; unsigned* _sqArray = nullptr;
+                unsigned* _cqHead = nullptr; unsigned* _cqTail = nullptr; unsigned* _cqMask = nullptr;
+                io_uring_sqe* _sqes = nullptr;
+                io_uring_cqe* _cqes = nullptr;
+                unsigned _sqEntries = 0, _cqEntries = 0;
+                void* _sqRingPtr = nullptr; size_t _sqRingSize = 0;
+                void* _cqRingPtr = nullptr; size_t _cqRingSize = 0;
+                size_t _sqesSize = 0;
+
+                    // Requests waiting for space in the ring. We never allow more requests in
+                    // flight than there are completion queue entries, so the CQ can't overflow
+                LockFree::MPMCQueue<LinuxReadRequest*> _pending;
+                Threading::Mutex _submitLock;
+                std::atomic<unsigned> _inFlight;
+                std::atomic<bool> _quit;
+                std::thread _reaperThread;
+
+                bool InitRing(unsigned entries);
+                void ShutdownRing();
+                void FlushPending();
+                void ReaperThread();
+            #else
+                static const int _ringFD = -1;
+            #endif
+        };
+    }
+
+    class AsyncLoadOperation::SpecialOverlapped : public Internal::LinuxReadRequest
+    {
+    public:
+        std::shared_ptr<AsyncLoadOperation> _returnPointer;
+        CompletionThreadPool* _pool = nullptr;
+        std::basic_string<utf8> _naturalName;
+        size_t _fileSize = 0;
+        size_t _bytesRead = 0;
+        bool _directIO = false;
+
+        static SpecialOverlapped* BeginLoad(const std::shared_ptr<AsyncLoadOperation>& op, CompletionThreadPool& pool);
+
+        void OnReadComplete(int result) override;
+        void Finish(bool success);
+        bool ReopenBuffered();
+        void PrepareNextRead();
+    };
+
+        //  Large files are read with O_DIRECT, so that streaming through big blobs
+        //  doesn't evict everything else from the page cache (and saves a copy).
+        //  O_DIRECT requires the buffer, offset and size to be aligned to the
+        //  logical block size; 4096 is safe for all common devices
+    static const size_t s_directIOThreshold = 1024*1024;
+    static const size_t s_directIOAlignment = 4096;
+
+    static size_t AlignUp(size_t value, size_t alignment) { return (value + alignment - 1) & ~(alignment - 1); }
+
+    void AsyncLoadOperation::SpecialOverlapped::PrepareNextRead()
+    {
+        if (_directIO) {
+                // with O_DIRECT we always request a whole number of blocks (the buffer
+                // was allocated large enough). The final read will be short
+            _iov.iov_len = AlignUp(_fileSize, s_directIOAlignment) - _bytesRead;
+        } else
+            _iov.iov_len = _fileSize - _bytesRead;
+        _iov.iov_base = PtrAdd(_returnPointer->_buffer.get(), _bytesRead);
+        _offset = _bytesRead;
+    }
+
+    bool AsyncLoadOperation::SpecialOverlapped::ReopenBuffered()
+    {
+            // Some filesystems (eg, tmpfs, some network mounts) reject O_DIRECT reads,
+            // and a partial read can leave us at an unaligned offset. In either case,
+            // just continue with normal buffered IO
+        int newFD = open((const char*)_naturalName.c_str(), O_RDONLY | O_CLOEXEC);
+        if (newFD < 0) return false;
+        close(_fd);
+        _fd = newFD;
+        _directIO = false;
+        return true;
+    }
+
+    void AsyncLoadOperation::SpecialOverlapped::OnReadComplete(int result)
+    {
+        if (result < 0) {
+            if (result == -EINTR || result == -EAGAIN) {
+                // just try again
+            } else if (result == -EINVAL && _directIO && ReopenBuffered()) {
+                // retry without O_DIRECT
+            } else {
+                Finish(false);
+                return;
+            }
+        } else if (result == 0) {
+                // unexpected end of file (the file must have been truncated since we opened it)
+            Finish(false);
+            return;
+        } else {
+            _bytesRead += result;
+            if (_bytesRead >= _fileSize) {
+                Finish(true);
+                return;
+            }
+
+            if (_directIO && (_bytesRead % s_directIOAlignment) != 0 && !ReopenBuffered()) {
+                Finish(false);
+                return;
+            }
+        }
+
+        PrepareNextRead();
+        Internal::LinuxReadRequest* r = this;
+        Internal::LinuxIOBackend::GetInstance().Submit(IteratorRange<Internal::LinuxReadRequest*const*>(&r, &r+1));
+    }
+
+    void AsyncLoadOperation::SpecialOverlapped::Finish(bool success)
+    {
+        if (_fd >= 0) {
+            close(_fd);
+            _fd = -1;
+        }
+
+            // As with the Windows implementation, releasing _returnPointer may destroy
+            // the AsyncLoadOperation (and this object along with it). If that happens, no
+            // clients are waiting on the result, and we can consider it a cancel.
+            // Note that "this" must not be used after the reset.
+        std::weak_ptr<AsyncLoadOperation> weakToThis = _returnPointer;
+        auto* pool = _pool;
+        _returnPointer.reset();
+
+        if (weakToThis.expired()) return;
+
+            // Complete() and OnFailure() always happen on the completion thread pool (never
+            // on the io_uring reaper thread), since they can be expensive
+        pool->EnqueueBasic(
+            [weakToThis, success]() {
+                auto obj = weakToThis.lock();
+                if (!obj) return;
+                if (success) {
+                    obj->Complete(obj->GetBuffer(), obj->GetBufferSize());
+                } else
+                    obj->OnFailure();
+            });
+    }
+
+    void AsyncLoadOperation::Enqueue(const std::shared_ptr<AsyncLoadOperation>& op, StringSection<ResChar> filename, CompletionThreadPool& pool)
+    {
+        Enqueue(
+            IteratorRange<const std::shared_ptr<AsyncLoadOperation>*>(&op, &op+1),
+            IteratorRange<const StringSection<ResChar>*>(&filename, &filename+1),
+            pool);
+    }
+
+    void AsyncLoadOperation::Enqueue(
+        IteratorRange<const std::shared_ptr<AsyncLoadOperation>*> ops,
+        IteratorRange<const StringSection<ResChar>*> filenames,
+        CompletionThreadPool& pool)
+    {
+        assert(ops.size() == filenames.size());
+
+            // As with the Windows implementation, we only hold weak references until
+            // the files have been opened. If all clients release their references before
+            // then, the load is cancelled
+        std::vector<std::weak_ptr<AsyncLoadOperation>> weakOps;
+        weakOps.reserve(ops.size());
+        for (size_t c=0; c<ops.size(); ++c) {
+            assert(!ops[c]->_hasBeenQueued);
+            ops[c]->_hasBeenQueued = true;
+            XlCopyString(ops[c]->_filename, filenames[c]);
+            weakOps.push_back(ops[c]);
+        }
+
+            // The files are opened on a pool thread, and then all of the reads are submitted
+            // to the kernel together (so a batch of small reads only requires a single system call)
+        pool.EnqueueBasic(
+            [weakOps=std::move(weakOps), &pool]()
+            {
+                std::vector<Internal::LinuxReadRequest*> requests;
+                requests.reserve(weakOps.size());
+                for (const auto& w:weakOps) {
+                    auto thisOp = w.lock();
+                    if (!thisOp) continue;      // cancelled
+
+                    auto* request = SpecialOverlapped::BeginLoad(thisOp, pool);
+                    if (request) {
+                        requests.push_back(request);
+                    } else
+                        thisOp->OnFailure();
+                }
+
+                if (!requests.empty())
+                    Internal::LinuxIOBackend::GetInstance().Submit(
+                        IteratorRange<Internal::LinuxReadRequest*const*>(requests.data(), requests.data() + requests.size()));
+            });
+    }
+
+    auto AsyncLoadOperation::SpecialOverlapped::BeginLoad(const std::shared_ptr<AsyncLoadOperation>& thisOp, CompletionThreadPool& pool) -> SpecialOverlapped*
+    {
+        auto translated = MainFileSystem::TryGetDesc(thisOp->_filename);
+        if (translated._state != FileDesc::State::Normal || translated._naturalName.empty())
+            return nullptr;
+
+        bool directIO = translated._size >= s_directIOThreshold;
+        int fd = open((const char*)translated._naturalName.c_str(), O_RDONLY | O_CLOEXEC | (directIO ? O_DIRECT : 0));
+        if (fd < 0 && directIO) {
+            directIO = false;
+            fd = open((const char*)translated._naturalName.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        if (fd < 0) return nullptr;     // failed to open the file -- probably because it's missing
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            close(fd);
+            return nullptr;
+        }
+
+        auto fileSize = (size_t)st.st_size;
+        auto bufferSize = directIO ? AlignUp(fileSize, s_directIOAlignment) : fileSize;
+        thisOp->_buffer.reset((uint8*)XlMemAlign(bufferSize, directIO ? s_directIOAlignment : 16));
+        thisOp->_bufferLength = fileSize;
+
+        thisOp->_overlapped = std::make_unique<SpecialOverlapped>();
+        auto& o = *thisOp->_overlapped;
+        o._fd = fd;
+        o._directIO = directIO;
+        o._fileSize = fileSize;
+        o._naturalName = std::move(translated._naturalName);
+        o._pool = &pool;
+            // we cannot cancel from here until the read operation has completed
+        o._returnPointer = thisOp;
+        o.PrepareNextRead();
+
+        return &o;
+    }
+
+    const uint8* AsyncLoadOperation::GetBuffer() const { return  AsPointer(_buffer.get()); }
+    size_t AsyncLoadOperation::GetBufferSize() const { return _bufferLength; }
+
+    AsyncLoadOperation::AsyncLoadOperation()
+    {
+        _filename[0] = '\0';
+        _bufferLength = 0;
+        _hasBeenQueued = false;
+    }
+
+    AsyncLoadOperation::~AsyncLoadOperation() {}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+    namespace Internal
+    {
+        static void ExecuteBlockingRead(LinuxReadRequest& request)
+        {
+            auto result = preadv(request._fd, &request._iov, 1, (off_t)request._offset);
+            request.OnReadComplete((result < 0) ? -errno : (int)result);
+        }
+
+        #if ASYNC_LOAD_HAS_IO_URING
+
+            static int SysIOUringSetup(unsigned entries, io_uring_params* p) { return (int)syscall(__NR_io_uring_setup, entries, p); }
+            static int SysIOUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+            {
+                return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+            }
+
+            bool LinuxIOBackend::InitRing(unsigned entries)
+            {
+                io_uring_params params;
+                XlZeroMemory(params);
+                int fd = SysIOUringSetup(entries, &params);
+                if (fd < 0) return false;
+
+                _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                #if defined(IORING_FEAT_SINGLE_MMAP)
+                    bool singleMap = !!(params.features & IORING_FEAT_SINGLE_MMAP);
+                #else
+                    bool singleMap = false;
+                #endif
+                if (singleMap)
+                    _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+
+                _sqRingPtr = mmap(nullptr, _sqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+                if (_sqRingPtr == MAP_FAILED) { _sqRingPtr = nullptr; close(fd); return false; }
+
+                if (singleMap) {
+                    _cqRingPtr = _sqRingPtr;
+                } else {
+                    _cqRingPtr = mmap(nullptr, _cqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+                    if (_cqRingPtr == MAP_FAILED) { _cqRingPtr = nullptr; _ringFD = fd; ShutdownRing(); return false; }
+                }
+
+                _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+                auto* sqes = mmap(nullptr, _sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+                if (sqes == MAP_FAILED) { _ringFD = fd; ShutdownRing(); return false; }
+                _sqes = (io_uring_sqe*)sqes;
+
+                _sqHead = (unsigned*)PtrAdd(_sqRingPtr, params.sq_off.head);
+                _sqTail = (unsigned*)PtrAdd(_sqRingPtr, params.sq_off.tail);
+                _sqMask = (unsigned*)PtrAdd(_sqRingPtr, params.sq_off.ring_mask);
+                _sqArray = (unsigned*)PtrAdd(_sqRingPtr, params.sq_off.array);
+                _cqHead = (unsigned*)PtrAdd(_cqRingPtr, params.cq_off.head);
+                _cqTail = (unsigned*)PtrAdd(_cqRingPtr, params.cq_off.tail);
+                _cqMask = (unsigned*)PtrAdd(_cqRingPtr, params.cq_off.ring_mask);
+                _cqes = (io_uring_cqe*)PtrAdd(_cqRingPtr, params.cq_off.cqes);
+                _sqEntries = params.sq_entries;
+                _cqEntries = params.cq_entries;
+                _ringFD = fd;
+                return true;
+            }
+
+            void LinuxIOBackend::ShutdownRing()
+            {
+                if (_sqes) munmap(_sqes, _sqesSize);
+                if (_cqRingPtr && _cqRingPtr != _sqRingPtr) munmap(_cqRingPtr, _cqRingSize);
+                if (_sqRingPtr) munmap(_sqRingPtr, _sqRingSize);
+                if (_ringFD >= 0) close(_ringFD);
+                _sqes = nullptr; _cqRingPtr = _sqRingPtr = nullptr;
+                _ringFD = -1;
+            }
+
+            void LinuxIOBackend::FlushPending()
+            {
+                    //  Move as many pending requests as possible into the submission queue,
+                    //  and then submit them all with a single system call.
+                    //  Only one thread writes to the submission queue at a time
+                ScopedLock(_submitLock);
+                unsigned toSubmit = 0;
+                auto tail = *_sqTail;
+                for (;;) {
+                    auto head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+                    if ((tail - head) >= _sqEntries) break;
+                    if (_inFlight.load() >= _cqEntries) break;
+
+                    LinuxReadRequest* request = nullptr;
+                    if (!_pending.try_pop(request)) break;
+
+                    auto index = tail & *_sqMask;
+                    auto& sqe = _sqes[index];
+                    XlZeroMemory(sqe);
+                    sqe.opcode = IORING_OP_READV;
+                    sqe.fd = request->_fd;
+                    sqe.off = request->_offset;
+                    sqe.addr = (uint64)&request->_iov;
+                    sqe.len = 1;
+                    sqe.user_data = (uint64)request;
+                    _sqArray[index] = index;
+                    ++tail;
+                    ++toSubmit;
+                    ++_inFlight;
+                }
+
+                if (!toSubmit) return;
+                __atomic_store_n(_sqTail, tail, __ATOMIC_RELEASE);
+
+                while (toSubmit) {
+                    int submitted = SysIOUringEnter(_ringFD, toSubmit, 0, 0);
+                    if (submitted < 0) {
+                        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+                        Log(Error) << "io_uring_enter failed while submitting reads (errno: " << errno << ")" << std::endl;
+                        break;
+                    }
+                    toSubmit -= std::min((unsigned)submitted, toSubmit);
+                }
+            }
+
+            void LinuxIOBackend::Submit(IteratorRange<LinuxReadRequest*const*> requests)
+            {
+                if (_ringFD < 0) {
+                        // Fallback path -- blocking reads on this thread (which will normally
+                        // be a pool thread)
+                    for (auto* r:requests)
+                        ExecuteBlockingRead(*r);
+                    return;
+                }
+
+                for (auto* r:requests)
+                    _pending.push(r);
+                FlushPending();
+            }
+
+            void LinuxIOBackend::ReaperThread()
+            {
+                while (!_quit.load()) {
+                    int result = SysIOUringEnter(_ringFD, 0, 1, IORING_ENTER_GETEVENTS);
+                    if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                        Log(Error) << "io_uring_enter failed while waiting for completions (errno: " << errno << ")" << std::endl;
+                        break;
+                    }
+
+                    auto head = *_cqHead;
+                    for (;;) {
+                        auto tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+                        if (head == tail) break;
+                        auto& cqe = _cqes[head & *_cqMask];
+                        auto* request = (LinuxReadRequest*)cqe.user_data;
+                        auto res = cqe.res;
+                        ++head;
+                        __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+                        --_inFlight;
+
+                            // (a null request is the wake up we send during shutdown)
+                        if (request)
+                            request->OnReadComplete(res);
+                    }
+
+                        // completions free up space for requests that couldn't fit before
+                    FlushPending();
+                }
+            }
+
+            static const unsigned s_ringEntries = 256;
+
+            LinuxIOBackend::LinuxIOBackend()
+            {
+                _inFlight = 0;
+                _quit = false;
+                if (InitRing(s_ringEntries)) {
+                    _reaperThread = std::thread(&LinuxIOBackend::ReaperThread, this);
+                } else
+                    Log(Verbose) << "io_uring not available; falling back to blocking reads for AsyncLoadOperation" << std::endl;
+            }
+
+            LinuxIOBackend::~LinuxIOBackend()
+            {
+                if (_ringFD < 0) return;
+
+                    // Wake the reaper thread with a NOP, so it notices the quit flag
+                _quit = true;
+                {
+                    ScopedLock(_submitLock);
+                    auto tail = *_sqTail;
+                    auto index = tail & *_sqMask;
+                    XlZeroMemory(_sqes[index]);
+                    _sqes[index].opcode = IORING_OP_NOP;
+                    _sqes[index].user_data = 0;
+                    _sqArray[index] = index;
+                    __atomic_store_n(_sqTail, tail+1, __ATOMIC_RELEASE);
+                    SysIOUringEnter(_ringFD, 1, 0, 0);
+                }
+                _reaperThread.join();
+                ShutdownRing();
+            }
+
+        #else
+
+            void LinuxIOBackend::Submit(IteratorRange<LinuxReadRequest*const*> requests)
+            {
+                for (auto* r:requests)
+                    ExecuteBlockingRead(*r);
+            }
+
+            LinuxIOBackend::LinuxIOBackend() {}
+            LinuxIOBackend::~LinuxIOBackend() {}
+
+        #endif
+
+        LinuxIOBackend& LinuxIOBackend::GetInstance()
+        {
+                // The ring is shared by every AsyncLoadOperation in the process; it's created
+                // on first use, and shut down during static destruction
+            static LinuxIOBackend s_instance;
+            return s_instance;
+        }
+    }
+
+}
+
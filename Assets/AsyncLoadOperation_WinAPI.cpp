@@ -135,6 +135,18 @@ namespace Assets
             });
     }
 
+    void AsyncLoadOperation::Enqueue(
+        IteratorRange<const std::shared_ptr<AsyncLoadOperation>*> ops,
+        IteratorRange<const StringSection<ResChar>*> filenames,
+        CompletionThreadPool& pool)
+    {
+            // ReadFileEx has no batched form; each read is still overlapped, so
+            // there's little to gain from anything more complex here
+        assert(ops.size() == filenames.size());
+        for (size_t c=0; c<ops.size(); ++c)
+            Enqueue(ops[c], filenames[c], pool);
+    }
+
     const uint8* AsyncLoadOperation::GetBuffer() const { return  AsPointer(_buffer.get()); }
     size_t AsyncLoadOperation::GetBufferSize() const { return _bufferLength; }
 
@@ -5,147 +5,378 @@
 // http://www.opensource.org/licenses/mit-license.php)
 
 #include "CompilationThread.h"
+#include "AssetServices.h"
+#include "CompileAndAsyncManager.h"
 #include "../ConsoleRig/Log.h"
 #include "../ConsoleRig/GlobalServices.h"
+#include "../ConsoleRig/IProgress.h"
 #include "../Utility/Threading/CompletionThreadPool.h"
+#include "../Utility/Threading/Mutex.h"
+#include <deque>
+#include <vector>
+#include <thread>
+#include <unordered_map>
+#include <chrono>
+#include <algorithm>
 
-namespace Assets 
+namespace Assets
 {
-    void CompilationThread::StallOnPendingOperations(bool cancelAll)
+    class CompilationThread::Pimpl
     {
-        if (!_workerQuit) {
-            _workerQuit = true;
-            XlSetEvent(_events[1]);   // trigger a manual reset event should wake all threads (and keep them awake)
-            _thread.join();
+    public:
+        struct Request
+        {
+            std::weak_ptr<::Assets::ArtifactFuture> _future;
+            CompileOperation _operation;
+            uint64 _artifactHash = 0;
+            const void* _owner = nullptr;
+
+                // (only used while the request is in the delayed list)
+            std::chrono::steady_clock::time_point _retryTime;
+            unsigned _retryCount = 0;
+        };
+
+        std::vector<std::thread> _workers;
+        mutable Threading::Mutex _lock;
+        Threading::Conditional _wakeWorkers;
+        Threading::Conditional _idle;
+        bool _workerQuit = false;
+
+        std::deque<Request> _queues[unsigned(CompileStage::Max)];
+        std::deque<Request> _delayed;
+        unsigned _runningCount = 0;
+        std::vector<const void*> _runningOwners;       // (one entry per running request)
+
+            // (artifact hash) -> future, for every request that is queued, running or delayed
+        std::unordered_map<uint64, std::weak_ptr<::Assets::ArtifactFuture>> _inFlight;
+
+        std::shared_ptr<ConsoleRig::IProgress> _progress;
+        std::shared_ptr<ConsoleRig::IStep> _progressStep;
+        unsigned _progressStepMax = 0;
+        unsigned _batchTotal = 0, _batchCompleted = 0;
+
+        unsigned _completedCount = 0, _dedupedCount = 0;
+
+        unsigned QueuedCount() const
+        {
+            unsigned result = 0;
+            for (const auto&q:_queues) result += (unsigned)q.size();
+            return result;
+        }
+
+        bool IsIdle() const { return !_runningCount && _delayed.empty() && !QueuedCount(); }
+
+            // True if there are queued or running requests for the given owner (or for
+            // any owner, if "owner" is null). Delayed requests are not included
+        bool HasPendingRequests(const void* owner) const
+        {
+            if (!owner) return _runningCount || QueuedCount();
+            if (std::find(_runningOwners.begin(), _runningOwners.end(), owner) != _runningOwners.end())
+                return true;
+            for (const auto&q:_queues)
+                for (const auto&r:q)
+                    if (r._owner == owner) return true;
+            return false;
+        }
+
+        std::deque<Request>::iterator NextDelayed()
+        {
+            return std::min_element(
+                _delayed.begin(), _delayed.end(),
+                [](const Request& lhs, const Request& rhs) { return lhs._retryTime < rhs._retryTime; });
         }
+
+        void Delay(Request&& request)
+        {
+                // back off exponentially (up to 64ms) while the request keeps failing
+            auto backoff = std::chrono::milliseconds(1u << std::min(request._retryCount, 6u));
+            request._retryTime = std::chrono::steady_clock::now() + backoff;
+            ++request._retryCount;
+            _delayed.push_back(std::move(request));
+        }
+
+        void RemoveInFlight(const Request& request)
+        {
+            if (!request._artifactHash) return;
+                // (only if this request hasn't been replaced with a newer request with the same hash)
+            auto i = _inFlight.find(request._artifactHash);
+            if (i != _inFlight.end() && !i->second.owner_before(request._future) && !request._future.owner_before(i->second))
+                _inFlight.erase(i);
+        }
+
+        void CancelRequests(std::deque<Request>& requests, const void* owner)
+        {
+                // (partition rather than remove_if, since we need the removed requests intact)
+            auto i = std::stable_partition(
+                requests.begin(), requests.end(),
+                [owner](const Request& r) { return owner && r._owner != owner; });
+            for (auto r=i; r!=requests.end(); ++r) {
+                CancelRequest(*r);
+                RemoveInFlight(*r);
+            }
+            requests.erase(i, requests.end());
+        }
+
+        bool TryPopQueued(Request& result)
+        {
+                // earlier stages first (see CompileStage)
+            for (auto&q:_queues)
+                if (!q.empty()) {
+                    result = std::move(q.front());
+                    q.pop_front();
+                    return true;
+                }
+            return false;
+        }
+
+        void OnRequestFinished(const Request& request)
+        {
+            RemoveInFlight(request);
+            ++_completedCount;
+            ++_batchCompleted;
+
+            if (_progress) {
+                    // IStep has a fixed maximum, so if more requests were queued since this
+                    // step began, we have to start a new step with the new total
+                if (!_progressStep || _progressStepMax < _batchTotal) {
+                    _progressStep.reset();
+                    _progressStep = _progress->BeginStep("Compiling assets", _batchTotal, false);
+                    _progressStepMax = _batchTotal;
+                }
+                if (_progressStep)
+                    _progressStep->SetProgress(_batchCompleted);
+            }
+
+            if (IsIdle()) {
+                _progressStep.reset();
+                _progressStepMax = _batchTotal = _batchCompleted = 0;
+            }
+
+                // The completed request might be the one that the delayed requests are
+                // waiting on, so they can be retried straight away
+            if (!_delayed.empty()) {
+                auto now = std::chrono::steady_clock::now();
+                for (auto&r:_delayed) r._retryTime = std::min(r._retryTime, now);
+                _wakeWorkers.notify_one();
+            }
+
+                // (StallOnPendingOperations may be waiting on just this request's owner)
+            _idle.notify_all();
+        }
+
+        static void CancelRequest(Request& request)
+        {
+            auto future = request._future.lock();
+            if (future && future->GetAssetState() == ::Assets::AssetState::Pending)
+                future->SetState(::Assets::AssetState::Invalid);
+        }
+    };
+
+        //  Returns false if the operation must be delayed (because it depends on
+        //  some asset that is still pending)
+    static bool ExecuteOperation(CompileOperation& fn, ::Assets::ArtifactFuture& future)
+    {
+        TRY
+        {
+            fn(future);
+        }
+        CATCH (const ::Assets::Exceptions::PendingAsset&)
+        {
+                // We need to stall on a pending asset while compiling
+                // All we can do is delay the request, and try again later.
+            return false;
+        }
+		CATCH (const ::Assets::Exceptions::ConstructionError& e)
+		{
+			auto artifact = std::make_shared<::Assets::CompilerExceptionArtifact>(e.GetActualizationLog(), e.GetDependencyValidation());
+			future.AddArtifact("exception", artifact);
+			future.SetState(::Assets::AssetState::Invalid);
+		}
+        CATCH (const std::exception& e)
+        {
+			auto artifact = std::make_shared<::Assets::CompilerExceptionArtifact>(::Assets::AsBlob(e), nullptr);
+			future.AddArtifact("exception", artifact);
+			future.SetState(::Assets::AssetState::Invalid);
+        }
+		CATCH (...)
+		{
+			future.SetState(::Assets::AssetState::Invalid);
+		}
+        CATCH_END
+        return true;
     }
-    
-    void CompilationThread::Push(
+
+    void CompilationThread::StallOnPendingOperations(bool cancelAll, const void* owner)
+    {
+        std::unique_lock<decltype(_pimpl->_lock)> autoLock(_pimpl->_lock);
+        if (cancelAll) {
+                // Anything that hasn't started yet is abandoned. We still have to wait
+                // for operations that are currently running
+            for (auto&q:_pimpl->_queues)
+                _pimpl->CancelRequests(q, owner);
+            _pimpl->CancelRequests(_pimpl->_delayed, owner);
+        }
+
+            // Delayed operations are waiting on some other asset, which might never be
+            // completed. So we only wait until they are the only thing remaining
+        while (_pimpl->HasPendingRequests(owner))
+            _pimpl->_idle.wait(autoLock);
+    }
+
+    std::shared_ptr<::Assets::ArtifactFuture> CompilationThread::Push(
 		std::shared_ptr<::Assets::ArtifactFuture> future,
-		std::function<void(::Assets::ArtifactFuture&)> operation)
+		CompileOperation&& operation,
+        CompileStage stage,
+        uint64 artifactHash,
+        const void* owner)
     {
-        if (!_workerQuit) {
-			_queue.push_overflow(Element{future, std::move(operation)});
-            XlSetEvent(_events[0]);
+        assert(unsigned(stage) < unsigned(CompileStage::Max));
+        {
+            ScopedLock(_pimpl->_lock);
+            if (_pimpl->_workerQuit) return future;
+
+            if (artifactHash) {
+                auto i = _pimpl->_inFlight.find(artifactHash);
+                if (i != _pimpl->_inFlight.end()) {
+                    auto existing = i->second.lock();
+                    if (existing) {
+                        ++_pimpl->_dedupedCount;
+                        return existing;
+                    }
+                    i->second = future;
+                } else
+                    _pimpl->_inFlight.insert(std::make_pair(artifactHash, std::weak_ptr<::Assets::ArtifactFuture>(future)));
+            }
+
+            Pimpl::Request request;
+            request._future = future;
+            request._operation = std::move(operation);
+            request._artifactHash = artifactHash;
+            request._owner = owner;
+            _pimpl->_queues[unsigned(stage)].push_back(std::move(request));
+            ++_pimpl->_batchTotal;
         }
+        _pimpl->_wakeWorkers.notify_one();
+        return future;
     }
 
-    void CompilationThread::ThreadFunction()
+    void CompilationThread::SetProgress(const std::shared_ptr<ConsoleRig::IProgress>& progress)
     {
-        while (!_workerQuit) {
-			Element* op = nullptr;
-            if (_queue.try_front(op)) {
-                auto future = op->_future.lock();
-				auto fn = std::move(op->_operation);
-				_queue.pop();
-
-                TRY
-                {
-                    fn(*future);
-                }
-                CATCH (const ::Assets::Exceptions::PendingAsset&)
-                {
-                    // We need to stall on a pending asset while compiling
-                    // All we can do is delay the request, and try again later.
-                    // Let's move the request into a separate queue, so that
-                    // new request get processed first.
-                    _delayedQueue.push(Element{future, std::move(fn)});
-                }
-				CATCH (const ::Assets::Exceptions::ConstructionError& e)
-				{
-					auto artifact = std::make_shared<::Assets::CompilerExceptionArtifact>(e.GetActualizationLog(), e.GetDependencyValidation());
-					future->AddArtifact("exception", artifact);
-					future->SetState(::Assets::AssetState::Invalid);
-				}
-                CATCH (const std::exception& e)
-                {
-					auto artifact = std::make_shared<::Assets::CompilerExceptionArtifact>(::Assets::AsBlob(e), nullptr);
-					future->AddArtifact("exception", artifact);
-					future->SetState(::Assets::AssetState::Invalid);
-                }
-				CATCH (...)
-				{
-					future->SetState(::Assets::AssetState::Invalid);
-				}
-                CATCH_END
-
-            } else if (_delayedQueue.try_front(op)) {
-                
-                    // do a short sleep first, do avoid too much
-                    // trashing while processing delayed items. Note
-                    // that if any new request comes in during this Sleep,
-                    // then we won't handle that request in a prompt manner.
-                Threading::Sleep(1);
-				auto future = op->_future.lock();
-				auto fn = std::move(op->_operation);
-				_delayedQueue.pop();
-
-                TRY
-                {
-					fn(*future);
+        ScopedLock(_pimpl->_lock);
+        _pimpl->_progressStep.reset();
+        _pimpl->_progressStepMax = 0;
+        _pimpl->_progress = progress;
+    }
+
+    auto CompilationThread::GetMetrics() const -> Metrics
+    {
+        ScopedLock(_pimpl->_lock);
+        Metrics result;
+        result._queuedCount = _pimpl->QueuedCount();
+        result._runningCount = _pimpl->_runningCount;
+        result._delayedCount = (unsigned)_pimpl->_delayed.size();
+        result._completedCount = _pimpl->_completedCount;
+        result._dedupedCount = _pimpl->_dedupedCount;
+        return result;
+    }
+
+    void CompilationThread::WorkerFunction()
+    {
+        auto& pimpl = *_pimpl;
+        std::unique_lock<decltype(pimpl._lock)> autoLock(pimpl._lock);
+        for (;;) {
+            Pimpl::Request request;
+            if (pimpl._workerQuit) break;
+
+            if (!pimpl.TryPopQueued(request)) {
+                if (pimpl._delayed.empty()) {
+                    pimpl._wakeWorkers.wait(autoLock);
+                    continue;
                 }
-                CATCH (const ::Assets::Exceptions::PendingAsset&)
-                {
-                    // We need to stall on a pending asset while compiling
-                    // All we can do is delay the request, and try again later.
-                    // Let's move the request into a separate queue, so that
-                    // new request get processed first.
-					_delayedQueue.push(Element{ future, std::move(fn) });
+
+                    // Sleep until the earliest delayed request is due to be retried. New
+                    // requests (and completed requests) will wake us early
+                auto next = pimpl.NextDelayed();
+                if (std::chrono::steady_clock::now() < next->_retryTime) {
+                    pimpl._wakeWorkers.wait_until(autoLock, next->_retryTime);
+                    continue;
                 }
-				CATCH (const ::Assets::Exceptions::ConstructionError& e)
-				{
-					auto artifact = std::make_shared<::Assets::CompilerExceptionArtifact>(e.GetActualizationLog(), e.GetDependencyValidation());
-					future->AddArtifact("exception", artifact);
-					future->SetState(::Assets::AssetState::Invalid);
-				}
-				CATCH (const std::exception& e)
-				{
-					auto artifact = std::make_shared<::Assets::CompilerExceptionArtifact>(::Assets::AsBlob(e), nullptr);
-					future->AddArtifact("exception", artifact);
-					future->SetState(::Assets::AssetState::Invalid);
-				}
-				CATCH (...)
-				{
-					future->SetState(::Assets::AssetState::Invalid);
-				}
-                CATCH_END
+                request = std::move(*next);
+                pimpl._delayed.erase(next);
+            }
+
+            auto future = request._future.lock();
+            if (!future) {
+                    // nobody is waiting on the result anymore, so there's no point compiling it
+                pimpl.OnRequestFinished(request);
+                continue;
+            }
+
+            ++pimpl._runningCount;
+            pimpl._runningOwners.push_back(request._owner);
+            autoLock.unlock();
+            bool finished = ExecuteOperation(request._operation, *future);
+            future.reset();
+            autoLock.lock();
+            --pimpl._runningCount;
+            pimpl._runningOwners.erase(std::find(pimpl._runningOwners.begin(), pimpl._runningOwners.end(), request._owner));
 
+            if (finished) {
+                pimpl.OnRequestFinished(request);
             } else {
-                XlWaitForMultipleSyncObjects(
-                    2, this->_events,
-                    false, XL_INFINITE, true);
+                pimpl.Delay(std::move(request));
+                pimpl._idle.notify_all();
             }
         }
     }
 
-    CompilationThread::CompilationThread()
+    CompilationThread::CompilationThread(unsigned workerCount)
     {
-        _events[0] = XlCreateEvent(false);
-        _events[1] = XlCreateEvent(true);
-        _workerQuit = false;
-
-        _thread = std::thread(std::bind(&CompilationThread::ThreadFunction, this));
+        _pimpl = std::make_unique<Pimpl>();
+        if (!workerCount) {
+                // leave one hardware thread free for the main thread
+            auto hardwareThreads = std::thread::hardware_concurrency();
+            workerCount = (hardwareThreads > 1) ? (hardwareThreads - 1) : 1;
+        }
+        _pimpl->_workers.reserve(workerCount);
+        for (unsigned c=0; c<workerCount; ++c)
+            _pimpl->_workers.emplace_back(std::bind(&CompilationThread::WorkerFunction, this));
     }
 
     CompilationThread::~CompilationThread()
     {
-        StallOnPendingOperations(true);
-        XlCloseSyncObject(_events[0]);
-        XlCloseSyncObject(_events[1]);
+        {
+            ScopedLock(_pimpl->_lock);
+            _pimpl->_workerQuit = true;
+        }
+        _pimpl->_wakeWorkers.notify_all();
+        for (auto&t:_pimpl->_workers) t.join();
+
+            // anything left in the queues will never complete
+        for (auto&q:_pimpl->_queues)
+            for (auto&r:q) Pimpl::CancelRequest(r);
+        for (auto&r:_pimpl->_delayed) Pimpl::CancelRequest(r);
     }
 
-	void QueueCompileOperation(
+	std::shared_ptr<::Assets::ArtifactFuture> QueueCompileOperation(
 		const std::shared_ptr<::Assets::ArtifactFuture>& future,
-		std::function<void(::Assets::ArtifactFuture&)>&& operation)
+		CompileOperation&& operation,
+        CompileStage stage,
+        uint64 artifactHash)
 	{
+            // Prefer the shared compilation scheduler, so that dependency ordering and
+            // deduplication apply across all of the compilers
+        if (::Assets::Services::HasInstance())
+            return ::Assets::Services::GetAsyncMan().GetCompilationThread().Push(future, std::move(operation), stage, artifactHash);
+
         if (!ConsoleRig::GlobalServices::GetInstance().GetLongTaskThreadPool().IsGood()) {
             operation(*future);
-            return;
+            return future;
         }
 
-		auto fn = std::move(operation);
+			// note -- the lambda must be mutable, since CompileOperation::operator() is non-const
 		ConsoleRig::GlobalServices::GetInstance().GetLongTaskThreadPool().EnqueueBasic(
-			[future, fn]() {
+			[future, fn=std::move(operation)]() mutable {
 				TRY
 				{
 					fn(*future);
@@ -169,6 +400,7 @@ namespace Assets
 				CATCH_END
 				assert(future->GetAssetState() != ::Assets::AssetState::Pending);	// if it is still marked "pending" at this stage, it will never change state
 		});
+        return future;
 	}
 
 }
@@ -8,45 +8,85 @@
 
 #include "AssetsCore.h"
 #include "IArtifact.h"
-#include "../Utility/Threading/LockFree.h"
+#include "../Utility/Threading/InlineTask.h"
+#include "../Core/Types.h"
 #include <memory>
-#include <thread>
 #include <functional>
 
-namespace Utility { class ThreadPool; }
+namespace ConsoleRig { class IProgress; }
 
-namespace Assets 
+namespace Assets
 {
+    using CompileOperation = InlineFunction<void(::Assets::ArtifactFuture&)>;
+
+    /// <summary>Dependency ordering for compile operations</summary>
+    /// Queued operations are always started in this order. So, for example, all shader
+    /// (and shader patch) compiles that are waiting will be started before any waiting
+    /// material compiles, and materials before models. Since the later stages tend to
+    /// depend on the results of the earlier stages, this minimizes the number of operations
+    /// that must be delayed with a PendingAsset exception.
+    enum class CompileStage { Shader, Material, Model, General, Max };
+
     /// <summary>Used by the compiler types to manage background operations</summary>
+    /// Compile operations are executed on a small pool of dedicated worker threads (not
+    /// the shared long task thread pool, since compiles can run for a long time).
+    ///
+    /// Operations can be given an artifact hash. If an operation is pushed while another
+    /// operation with the same hash is still queued or running, the new operation is discarded,
+    /// and the future for the existing operation is returned instead.
+    ///
+    /// If an operation throws a PendingAsset exception, it's moved into a delayed list, and
+    /// retried after all other queued operations have been started. Each retry of a delayed
+    /// operation waits a little longer than the last (unless some other operation completes
+    /// in the meantime).
+    ///
+    /// The scheduler is shared by several compilers, so operations can be tagged with an
+    /// owner. StallOnPendingOperations can then wait for (or cancel) only the operations
+    /// belonging to that owner.
     class CompilationThread
     {
     public:
-        void Push(
+        std::shared_ptr<::Assets::ArtifactFuture> Push(
 			std::shared_ptr<::Assets::ArtifactFuture> future,
-			std::function<void(::Assets::ArtifactFuture&)> operation);
-        void StallOnPendingOperations(bool cancelAll);
+			CompileOperation&& operation,
+            CompileStage stage = CompileStage::General,
+            uint64 artifactHash = 0,
+            const void* owner = nullptr);
+
+            /// <summary>Wait for queued and running operations</summary>
+            /// If "owner" is not null, only operations pushed with that owner are waited
+            /// for (or cancelled). Otherwise all operations are affected.
+        void StallOnPendingOperations(bool cancelAll, const void* owner = nullptr);
+
+            /// <summary>Report compile progress through the given interface</summary>
+            /// A step is started as the first operations in a batch complete (and restarted
+            /// if the batch grows), and released when all queued operations have completed
+        void SetProgress(const std::shared_ptr<ConsoleRig::IProgress>& progress);
 
-        CompilationThread();
+        struct Metrics
+        {
+            unsigned _queuedCount = 0, _runningCount = 0, _delayedCount = 0;
+            unsigned _completedCount = 0, _dedupedCount = 0;
+        };
+        Metrics GetMetrics() const;
+
+        CompilationThread(unsigned workerCount = 0);
         ~CompilationThread();
+
+        CompilationThread(const CompilationThread&) = delete;
+        CompilationThread& operator=(const CompilationThread&) = delete;
     protected:
-        std::thread _thread;
-        XlHandle _events[2];
-        volatile bool _workerQuit;
-		struct Element
-		{
-			std::weak_ptr<::Assets::ArtifactFuture> _future;
-			std::function<void(::Assets::ArtifactFuture&)> _operation;
-		};
-        using Queue = LockFree::FixedSizeQueue<Element, 256>;
-        Queue _queue;
-        Queue _delayedQueue;
-
-        void ThreadFunction();
+        class Pimpl;
+        std::unique_ptr<Pimpl> _pimpl;
+
+        void WorkerFunction();
     };
 
-	void QueueCompileOperation(
+	std::shared_ptr<::Assets::ArtifactFuture> QueueCompileOperation(
 		const std::shared_ptr<::Assets::ArtifactFuture>& future,
-		std::function<void(::Assets::ArtifactFuture&)>&& operation);
-		
+		CompileOperation&& operation,
+        CompileStage stage = CompileStage::General,
+        uint64 artifactHash = 0);
+
 }
 
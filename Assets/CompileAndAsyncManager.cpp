@@ -6,7 +6,9 @@
 
 #include "CompileAndAsyncManager.h"
 #include "IntermediateAssets.h"
+#include "CompilationThread.h"
 #include "../ConsoleRig/Log.h"
+#include "../ConsoleRig/IProgress.h"
 #include "../Utility/Threading/Mutex.h"
 #include "../Utility/Threading/ThreadingUtils.h"
 #include "../Utility/StringUtils.h"
@@ -27,6 +29,42 @@ namespace Assets
 
         ////////////////////////////////////////////////////////////
 
+        //  Default progress reporting for background compiles. Writes a line to the log
+        //  as the step begins, and then each time another tenth of it is completed
+    class CompileProgressLog : public ConsoleRig::IProgress
+    {
+    public:
+        class Step : public ConsoleRig::IStep
+        {
+        public:
+            void SetProgress(unsigned progress) override
+            {
+                _progress = progress;
+                auto tenth = _progressMax ? (progress * 10 / _progressMax) : 10;
+                if (tenth > _lastTenthLogged) {
+                    _lastTenthLogged = tenth;
+                    Log(Verbose) << _name << ": " << progress << "/" << _progressMax << std::endl;
+                }
+            }
+            void Advance() override { SetProgress(_progress+1); }
+            bool IsCancelled() const override { return false; }
+
+            Step(const char name[], unsigned progressMax) : _name(name), _progressMax(progressMax) {}
+        private:
+            std::string _name;
+            unsigned _progressMax;
+            unsigned _progress = 0, _lastTenthLogged = 0;
+        };
+
+        std::shared_ptr<ConsoleRig::IStep> BeginStep(const char name[], unsigned progressMax, bool cancellable) override
+        {
+            Log(Verbose) << name << ": " << progressMax << " operation(s) queued" << std::endl;
+            return std::make_shared<Step>(name, progressMax);
+        }
+    };
+
+        ////////////////////////////////////////////////////////////
+
 	class CompileAndAsyncManager::Pimpl
 	{
 	public:
@@ -36,6 +74,10 @@ namespace Assets
 		std::vector<std::shared_ptr<IPollingAsyncProcess>> _pollingProcesses;
 
 		Utility::Threading::Mutex _pollingProcessesLock;
+
+        std::unique_ptr<CompilationThread> _compilationThread;
+        std::shared_ptr<ConsoleRig::IProgress> _compilationProgress;
+        Utility::Threading::Mutex _compilationThreadLock;      // (used while initialising _compilationThread for the first time)
 	};
 
     void CompileAndAsyncManager::Update()
@@ -79,6 +121,30 @@ namespace Assets
 		return *_pimpl->_intMan.get();
     }
 
+    CompilationThread& CompileAndAsyncManager::GetCompilationThread()
+    {
+        ScopedLock(_pimpl->_compilationThreadLock);
+        if (!_pimpl->_compilationThread) {
+            _pimpl->_compilationThread = std::make_unique<CompilationThread>();
+            _pimpl->_compilationThread->SetProgress(_pimpl->_compilationProgress);
+        }
+        return *_pimpl->_compilationThread;
+    }
+
+    void CompileAndAsyncManager::SetCompilationProgress(const std::shared_ptr<ConsoleRig::IProgress>& progress)
+    {
+        ScopedLock(_pimpl->_compilationThreadLock);
+        _pimpl->_compilationProgress = progress;
+        if (_pimpl->_compilationThread)
+            _pimpl->_compilationThread->SetProgress(progress);
+    }
+
+    CompilationThread* CompileAndAsyncManager::TryGetCompilationThread()
+    {
+        ScopedLock(_pimpl->_compilationThreadLock);
+        return _pimpl->_compilationThread.get();
+    }
+
 	const std::shared_ptr<IntermediateAssets::Store>&	CompileAndAsyncManager::GetIntermediateStore() 
     { 
 		return _pimpl->_intStore;
@@ -117,6 +183,7 @@ namespace Assets
         #endif
 
 		_pimpl = std::make_unique<Pimpl>();
+        _pimpl->_compilationProgress = std::make_shared<CompileProgressLog>();
 		_pimpl->_intStore = std::make_shared<IntermediateAssets::Store>("int", storeVersionString, storeConfigString);
 		_pimpl->_shadowingStore = std::make_shared<IntermediateAssets::Store>("int", storeVersionString, storeConfigString, true);
 
@@ -128,6 +195,9 @@ namespace Assets
             // note -- this order is important. The compiler set
             // can make use of the IntermediateAssets::Store during
             // it's destructor (eg, when flushing an archive cache to disk). 
+            // Compile operations can reference both the compilers and the
+            // stores, so the compilation workers must be shut down first.
+        _pimpl->_compilationThread.reset();
         _pimpl->_intMan.reset();
         _pimpl->_intStore.reset();
     }
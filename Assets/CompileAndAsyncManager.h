@@ -14,11 +14,14 @@
 #include <vector>
 #include <assert.h>
 
+namespace ConsoleRig { class IProgress; }
+
 namespace Assets
 {
     class DependencyValidation; class DependentFileState; 
     namespace IntermediateAssets { class Store; }
     class ArchiveCache;
+    class CompilationThread;
 
     class IPollingAsyncProcess
     {
@@ -73,6 +76,12 @@ namespace Assets
         void Add(const std::shared_ptr<IPollingAsyncProcess>& pollingProcess);
 
 		CompilerSet& GetIntermediateCompilers();
+        CompilationThread& GetCompilationThread();
+        CompilationThread* TryGetCompilationThread();     ///< returns nullptr if the compilation thread hasn't been created yet
+
+            /// <summary>Report progress of background compiles through the given interface</summary>
+            /// By default, progress is written to the log. Pass nullptr to disable reporting.
+        void SetCompilationProgress(const std::shared_ptr<ConsoleRig::IProgress>& progress);
 
         const std::shared_ptr<IntermediateAssets::Store>&	GetIntermediateStore();
 		const std::shared_ptr<IntermediateAssets::Store>&	GetShadowingStore();
@@ -117,7 +117,13 @@ namespace Assets
 			auto existingArtifact = marker->GetExistingAsset();
 			if (existingArtifact && existingArtifact->GetDependencyValidation() && existingArtifact->GetDependencyValidation()->GetValidationIndex()==0) {
 				bool doRecompile = false;
-				auto asset = AutoConstructAsset<AssetType>(existingArtifact->GetBlob(), existingArtifact->GetDependencyValidation(), existingArtifact->GetRequestParameters());
+				std::unique_ptr<AssetType> asset;
+				// Prefer constructing from a view of the artifact data, when the asset type supports it. Cached
+				// artifacts (eg, shaders in an archive) can be referenced in place, rather than copied into a blob
+				if constexpr (std::is_constructible<AssetType, const ArtifactDataView&, const DepValPtr&, StringSection<ResChar>>::value) {
+					asset = AutoConstructAsset<AssetType>(existingArtifact->GetDataView(), existingArtifact->GetDependencyValidation(), existingArtifact->GetRequestParameters());
+				} else
+					asset = AutoConstructAsset<AssetType>(existingArtifact->GetBlob(), existingArtifact->GetDependencyValidation(), existingArtifact->GetRequestParameters());
 				future.SetAsset(std::move(asset), {});
 				if (!doRecompile) return;
 			}
@@ -42,6 +42,12 @@ namespace Assets
 
 		CompilationThread& GetThread()
 		{
+				// Normally we share the compilation scheduler owned by the CompileAndAsyncManager,
+				// so that model compiles are ordered after the shader & material compiles they
+				// depend on. We only need our own when running without the asset services
+			if (Services::HasInstance())
+				return Services::GetAsyncMan().GetCompilationThread();
+
 			ScopedLock(_threadLock);
 			if (!_thread)
 				_thread = std::make_unique<CompilationThread>();
@@ -403,7 +409,8 @@ namespace Assets
 		auto typeCode = _typeCode;
 		std::weak_ptr<ExtensionAndDelegate> weakDelegate = _delegate;
 		std::weak_ptr<IntermediateAssets::Store> weakStore = c->_pimpl->_store;
-		c->_pimpl->GetThread().Push(
+		auto artifactHash = HashCombine(Hash64(requestName), typeCode);
+		return c->_pimpl->GetThread().Push(
 			backgroundOp,
 			[weakDelegate, weakStore, typeCode, requestName](ArtifactFuture& op) {
 			auto d = weakDelegate.lock();
@@ -414,9 +421,8 @@ namespace Assets
 			}
 
 			PerformCompile(*d, typeCode, MakeStringSection(requestName), op, s.get());
-		});
-        
-        return std::move(backgroundOp);
+		},
+		CompileStage::Model, artifactHash, c->_pimpl.get());
     }
 
     StringSection<ResChar> GeneralCompiler::Marker::Initializer() const
@@ -480,6 +486,16 @@ namespace Assets
 
     void GeneralCompiler::StallOnPendingOperations(bool cancelAll)
     {
+            // Our operations might be running on the shared scheduler; we must wait for
+            // those too, since the delegates might be unloaded after this. Only our own
+            // operations are affected, other compilers' operations are left to continue.
+            // (and if the shared scheduler was never created, there's nothing to wait for)
+        if (Services::HasInstance()) {
+            auto* sharedThread = Services::GetAsyncMan().TryGetCompilationThread();
+            if (sharedThread)
+                sharedThread->StallOnPendingOperations(cancelAll, _pimpl.get());
+        }
+
         {
             ScopedLock(_pimpl->_threadLock);
             if (!_pimpl->_thread) return;
@@ -11,10 +11,29 @@
 
 namespace Assets
 {
+	/// <summary>Read-only view of the data in an artifact</summary>
+	/// Holds a reference on whatever owns the data (eg, a blob or a memory mapped archive),
+	/// so the range stays valid for the lifetime of the view.
+	class ArtifactDataView
+	{
+	public:
+		IteratorRange<const void*> GetData() const { return _data; }
+		const std::shared_ptr<const void>& GetKeepAlive() const { return _keepAlive; }
+		explicit operator bool() const { return _keepAlive != nullptr; }
+
+		ArtifactDataView() {}
+		ArtifactDataView(std::shared_ptr<const void> keepAlive, IteratorRange<const void*> data)
+		: _keepAlive(std::move(keepAlive)), _data(data) {}
+	private:
+		std::shared_ptr<const void> _keepAlive;
+		IteratorRange<const void*> _data;
+	};
+
 	class IArtifact
 	{
 	public:
 		virtual Blob					GetBlob() const = 0;
+		virtual ArtifactDataView		GetDataView() const;		// avoids a copy when the artifact isn't already stored in a blob
 		virtual DepValPtr				GetDependencyValidation() const = 0;
 		virtual StringSection<ResChar>	GetRequestParameters() const = 0;		// these are parameters that should be passed through to the asset when it's actually loaded from the blob
 		virtual ~IArtifact();
@@ -402,6 +402,13 @@ namespace Assets { namespace IntermediateAssets
 
 namespace Assets
 {
+	ArtifactDataView IArtifact::GetDataView() const
+	{
+		auto blob = GetBlob();
+		if (!blob) return {};
+		return ArtifactDataView(blob, MakeIteratorRange(*blob));
+	}
+
 	IArtifact::~IArtifact() {}
 	IArtifactCompileMarker::~IArtifactCompileMarker() {}
 
@@ -6,6 +6,7 @@
 #include "../Utility/MemoryUtils.h"
 #include "../Utility/Threading/Mutex.h"
 #include "../Utility/Streams/PathUtils.h"
+#include <unordered_map>
 
 namespace Assets
 {
@@ -40,6 +41,50 @@ namespace Assets
 		bool				_hasAtLeastOneMount;
 		AbsolutePathMode    _absolutePathMode;
 
+			// Index of mount points, by the hash of the mount point path. Since the mount point hash
+			// is built by combining the hashes of each path section in turn, we can find all
+			// candidates for a filename by hashing it section by section, and looking up each
+			// partial hash as we go. Rebuilt whenever the mounts change.
+		std::unordered_map<HashValue, std::vector<unsigned>> _prefixIndex;
+		std::vector<unsigned> _rootMounts;
+		unsigned			_maxMountDepth = 0;
+
+		class CachedCandidate
+		{
+		public:
+			enum class State { Untested, Success, Invalid };
+			unsigned			_mountIdx;
+			uint32				_remainderOffset;	// in bytes, from the start of the request
+			State				_state;
+			IFileSystem::Marker	_marker;
+
+			CachedCandidate(unsigned mountIdx, uint32 remainderOffset)
+			: _mountIdx(mountIdx), _remainderOffset(remainderOffset), _state(State::Untested) {}
+		};
+
+		class CachedLookup
+		{
+		public:
+			std::vector<uint8>	_request;
+			unsigned			_encoding;
+			std::vector<CachedCandidate> _candidates;
+			uint64				_lastUsed;
+		};
+
+			// Cache of recent lookups, keyed on the hash of the exact request string. Cleared
+			// whenever the mounts change.
+		std::unordered_map<uint64, CachedLookup> _lookupCache;
+		uint64				_lookupCacheTick = 0;
+		static const unsigned s_lookupCacheSize = 4096;
+
+		void RebuildIndex();
+
+		template<typename CharType>
+			CachedLookup& GetCachedLookup(uint64 requestHash, const std::vector<uint8>& request, unsigned encoding);
+
+		template<typename CharType>
+			void FindCandidates(std::vector<CachedCandidate>& result, StringSection<CharType> request) const;
+
 		Pimpl(const FilenameRules &rules) : _rules(rules), _hasAtLeastOneMount(false),
 		                                    _absolutePathMode(AbsolutePathMode::RawOS) {}
 	};
@@ -78,6 +123,94 @@ namespace Assets
 			return std::find(section.begin(), section.end(), chr);
 		}
 
+	void MountingTree::Pimpl::RebuildIndex()
+	{
+		_prefixIndex.clear();
+		_rootMounts.clear();
+		_maxMountDepth = 0;
+		for (unsigned c=0; c<(unsigned)_mounts.size(); ++c) {
+			const auto& m = _mounts[c];
+			if (m._depth == 0) {
+				_rootMounts.push_back(c);
+			} else {
+				_prefixIndex[m._hash].push_back(c);		// (pushed in priority order)
+			}
+			_maxMountDepth = std::max(_maxMountDepth, m._depth);
+		}
+		_lookupCache.clear();
+	}
+
+	template<typename CharType>
+		void MountingTree::Pimpl::FindCandidates(std::vector<CachedCandidate>& result, StringSection<CharType> request) const
+	{
+		// Hash the request one section at a time, looking up the mounts at each depth in the
+		// prefix index. This is O(path depth), regardless of how many filesystems are mounted.
+		// Note that the last section of the request is never considered part of a mount point
+		// (we only consider sections that are followed by a separator)
+		for (auto m:_rootMounts)
+			result.emplace_back(m, 0);
+
+		HashValue hash = 0;
+		auto s = request;
+		for (unsigned d=1; d<=_maxMountDepth; ++d) {
+			auto sep = FindFirstSeparator(s);
+			if (sep == s.end()) break;
+
+			hash = HashCombine(hash, HashFilename(MakeStringSection(s.begin(), sep), _rules));
+			auto remainder = SkipSeparators(MakeStringSection(sep, s.end()));
+
+			auto i = _prefixIndex.find(hash);
+			if (i != _prefixIndex.end())
+				for (auto m:i->second)
+					if (_mounts[m]._depth == d)
+						result.emplace_back(m, (uint32)PtrDiff(remainder, request.begin()));
+
+			s = MakeStringSection(remainder, s.end());
+		}
+
+		if (result.size() > 1)
+			std::sort(
+				result.begin(), result.end(),
+				[](const CachedCandidate& lhs, const CachedCandidate& rhs) { return lhs._mountIdx < rhs._mountIdx; });
+	}
+
+	template<typename CharType>
+		auto MountingTree::Pimpl::GetCachedLookup(uint64 requestHash, const std::vector<uint8>& request, unsigned encoding) -> CachedLookup&
+	{
+		auto i = _lookupCache.find(requestHash);
+		if (i != _lookupCache.end()) {
+			if (i->second._encoding == encoding && i->second._request == request) {
+				i->second._lastUsed = ++_lookupCacheTick;
+				return i->second;
+			}
+			// hash collision; just replace the old lookup
+		} else {
+			if (_lookupCache.size() >= s_lookupCacheSize) {
+				// Evict the least recently used half of the cache
+				std::vector<uint64> ages;
+				ages.reserve(_lookupCache.size());
+				for (const auto& c:_lookupCache) ages.push_back(c.second._lastUsed);
+				auto median = ages.begin() + ages.size()/2;
+				std::nth_element(ages.begin(), median, ages.end());
+				auto cutoff = *median;
+				for (auto c=_lookupCache.begin(); c!=_lookupCache.end();)
+					if (c->second._lastUsed <= cutoff) c = _lookupCache.erase(c);
+					else ++c;
+			}
+			i = _lookupCache.emplace(requestHash, CachedLookup{}).first;
+		}
+
+		auto& result = i->second;
+		result._request = request;
+		result._encoding = encoding;
+		result._candidates.clear();
+		result._lastUsed = ++_lookupCacheTick;
+		FindCandidates(
+			result._candidates,
+			MakeStringSection((const CharType*)AsPointer(request.cbegin()), (const CharType*)AsPointer(request.cend())));
+		return result;
+	}
+
 	template<typename CharType>
 		auto MountingTree::EnumerableLookup::TryGetNext_Internal(CandidateObject& result) const -> Result
 	{
@@ -85,81 +218,45 @@ namespace Assets
 		if (!_pimpl || _pimpl->_changeId != _changeId)
 			return Result::Invalidated;
 
+		auto& lookup = _pimpl->GetCachedLookup<CharType>(_requestHash, _request, _encoding);
 		auto requestString = MakeStringSection(
-			(const CharType*)AsPointer(_request.cbegin()), 
-			(const CharType*)AsPointer(_request.cend()));
-
-		for (;;) {
-			if (_nextMountToTest >= (uint32)_pimpl->_mounts.size())
-				return Result::NoCandidates;
-
-			const auto& mt = _pimpl->_mounts[_nextMountToTest];
-			++_nextMountToTest;
-
-			// simple case for mount depth 0
-			if (mt._depth == 0) {
-				IFileSystem::Marker marker;
-				auto transResult = mt._fileSystem->TryTranslate(marker, requestString);
-				if (transResult == IFileSystem::TranslateResult::Success) {
-					result._fileSystem = mt._fileSystem;
-					result._marker = std::move(marker);
-					result._mountPoint = mt._mountPointBuffer;
-					return Result::Success;
-				}
-				continue;
-			}
-
-			// If the mount point is too deep, we can't match it.
-			// It's a limitation of the system, but helps us write a little optimisation.
-			if (mt._depth > dimof(_cachedRemainders)) continue;
-
-			if (_cachedRemainders[mt._depth-1] == ~0u) {
-				// build the cached value for this depth
-				for (auto d = 0u; d < mt._depth; ++d) {
-					if (_cachedRemainders[d] != ~0u) continue;
-					auto startingPt = (d == 0) ? 0 : _cachedRemainders[d - 1];
-					auto s = MakeStringSection(PtrAdd(requestString.begin(), startingPt), requestString.end());
-					auto sep = FindFirstSeparator(s);
-
-					if (sep == s.end()) {
-						// We didn't find a separator, or we started with an empty string. There are no
-						// further matches possible. We can just clear out the rest of the array
-						for (unsigned d2 = d; d2 < dimof(_cachedRemainders); ++d2) {
-							_cachedHashValues[d2] = 0x0;
-							_cachedRemainders[d2] = (uint32)(size_t(s.end()) - size_t(AsPointer(_request.begin())));
-						}
-						break;
-					}
-
-					auto newRemainder = SkipSeparators(MakeStringSection(sep, s.end()));
-					_cachedRemainders[d] = (uint32)PtrDiff(newRemainder, requestString.begin());
-
-					auto rootHash = (d == 0) ? 0 : _cachedHashValues[d - 1];
-					_cachedHashValues[d] = HashCombine(
-						rootHash, 
-						HashFilename(MakeStringSection(s.begin(), sep), _pimpl->_rules));
-				}
-			}
-
-			if (_cachedHashValues[mt._depth-1] == mt._hash) {
-				// We got a match. We have to pass this onto the filesystem to try to translate 
-				// it into a "Marker" which can later be used for file operations.
+			(const CharType*)AsPointer(lookup._request.cbegin()), 
+			(const CharType*)AsPointer(lookup._request.cend()));
+
+		using State = Pimpl::CachedCandidate::State;
+		while (_nextCandidate < (uint32)lookup._candidates.size()) {
+			auto& candidate = lookup._candidates[_nextCandidate];
+			++_nextCandidate;
+
+			const auto& mt = _pimpl->_mounts[candidate._mountIdx];
+			if (candidate._state == State::Untested) {
+				// We have to pass this onto the filesystem to try to translate it into a "Marker" 
+				// which can later be used for file operations.
 				// Note that if the filesystem is still mounting, we can get a "pending/mounting" state for
-				// some files that will later become available.
+				// some files that will later become available. We don't cache the result in that case.
 				auto remainderSection = MakeStringSection(
-					PtrAdd(requestString.begin(), _cachedRemainders[mt._depth-1]), 
+					PtrAdd(requestString.begin(), candidate._remainderOffset), 
 					requestString.end());
 
 				IFileSystem::Marker marker;
 				auto transResult = mt._fileSystem->TryTranslate(marker, remainderSection);
 				if (transResult == IFileSystem::TranslateResult::Success) {
-					result._fileSystem = mt._fileSystem;
-					result._marker = std::move(marker);
-					result._mountPoint = mt._mountPointBuffer;
-					return Result::Success;
+					candidate._state = State::Success;
+					candidate._marker = std::move(marker);
+				} else if (transResult == IFileSystem::TranslateResult::Invalid) {
+					candidate._state = State::Invalid;
 				}
 			}
+
+			if (candidate._state == State::Success) {
+				result._fileSystem = mt._fileSystem;
+				result._marker = candidate._marker;
+				result._mountPoint = mt._mountPointBuffer;
+				return Result::Success;
+			}
 		}
+
+		return Result::NoCandidates;
 	}
 
 	auto MountingTree::EnumerableLookup::TryGetNext(CandidateObject& result) const -> Result
@@ -179,9 +276,10 @@ namespace Assets
 		std::vector<uint8>&& request, Encoding encoding, MountingTree::Pimpl* pimpl)
 	: _request(std::move(request))
 	, _encoding(encoding)
-	, _nextMountToTest(0)
+	, _nextCandidate(0)
 	, _pimpl(pimpl)
 	{
+		_requestHash = Hash64(AsPointer(_request.cbegin()), AsPointer(_request.cend()), DefaultSeed64 + encoding);
 		// get the mounts lock to make sure we get the correct value from _changeId
 		ScopedLock(pimpl->_mountsLock);
 		_changeId = pimpl->_changeId;
@@ -189,9 +287,10 @@ namespace Assets
 
 	MountingTree::EnumerableLookup::EnumerableLookup()
 	: _encoding(Encoding::UTF8)
-	, _nextMountToTest(0)
+	, _nextCandidate(0)
 	, _changeId(0)
 	, _pimpl(nullptr)
+	, _requestHash(0)
 	{}
 
 	template<typename CharType>
@@ -226,20 +325,14 @@ namespace Assets
 		//
 		// We need to compare the "one" and "two" against the filesystem mounting point.
 		//
-		// There are couple of approaches...
-		// We maintain a linear list of filesystem, ordered by priority. In this case, we store a
-		// single hash value and a depth value for each filesystem.
-		// We must calculate a comparison hash value from "filename" that matches the correct depth.
-		// Then we just compare that with the filesystem hash value.
+		// We maintain a linear list of filesystem, ordered by priority, and store a single hash 
+		// value and a depth value for each filesystem. The hash values are indexed, so we can
+		// hash "filename" one section at a time, and look up the filesystems mounted at each
+		// depth as we go. After finding all candidates, we sort by priority order.
 		//
-		// Another possibility is to arrange the filesystems in a tree (like a directory tree). We walk
-		// through the tree, comparing the path section against the values in the tree.
-		// After finding all candidates, we have to sort by priority order.
-		//
-		// In most cases, we should have only a few filesystems (let's say, less than 10). Maybe for
-		// final production games we might only have 3 or 4.
-		// So, given this, it seems like maybe the linear list could be the ideal option? Anyway, it 
-		// gives the fastest resolution when the highest priority filesystem is the one selected.
+		// The candidates (and the results of translating the filename for each one) are cached,
+		// so the common case of looking up the same filename many times only requires hashing
+		// the full string once.
 
 		std::vector<uint8> request(filename.begin(), filename.end());
 		return EnumerableLookup 
@@ -284,6 +377,7 @@ namespace Assets
 		auto sectionCount = split.GetSectionCount();
 		_pimpl->_mounts.emplace_back(Pimpl::Mount{hash, sectionCount, std::move(system), id, std::move(split), std::move(mountPoint)});
 		_pimpl->_hasAtLeastOneMount = true;
+		_pimpl->RebuildIndex();
 		return id;
 	}
 
@@ -294,8 +388,11 @@ namespace Assets
 		auto i = std::find_if(
 			_pimpl->_mounts.begin(), _pimpl->_mounts.end(),
 			[mountId](const Pimpl::Mount& m) { return m._id == mountId; });
-		if (i != _pimpl->_mounts.end())
+		if (i != _pimpl->_mounts.end()) {
 			_pimpl->_mounts.erase(i);
+			++_pimpl->_changeId;		// (invalidates any EnumerableLookups that refer to mount indices)
+			_pimpl->RebuildIndex();
+		}
 
 		_pimpl->_hasAtLeastOneMount = !_pimpl->_mounts.empty();
 	}
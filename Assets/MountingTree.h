@@ -41,6 +41,10 @@ namespace Assets
 		EnumerableLookup	Lookup(StringSection<utf8> filename);
 		EnumerableLookup	Lookup(StringSection<utf16> filename);
 
+		// Note that lookups are cached (per exact filename string), including the results of
+		// IFileSystem::TryTranslate for each candidate. So repeated lookups of the same file only
+		// pay for hashing the filename. The cache is cleared whenever the mounts change.
+		//
 		// todo -- consider a "cached lookup" that should return the single most ideal candidate
 		// (perhaps at a higher level).
 		// We want avoid having to check for an existing free file before every archive access
@@ -99,11 +103,10 @@ namespace Assets
 		std::vector<uint8>		_request;
 		enum Encoding { UTF8, UTF16 };
 		Encoding				_encoding;
-		mutable uint32			_nextMountToTest;
+		mutable uint32			_nextCandidate;
 		uint32					_changeId;
 		MountingTree::Pimpl *	_pimpl;			// raw pointer; client must be careful
-		mutable uint64			_cachedHashValues[8] = { 0,0,0,0,0,0,0,0 };
-		mutable uint32			_cachedRemainders[8] = { ~0u,~0u,~0u,~0u,~0u,~0u,~0u,~0u };
+		uint64					_requestHash;
 
 		EnumerableLookup(std::vector<uint8>&& request, Encoding encoding, MountingTree::Pimpl* pimpl);
 		EnumerableLookup();
@@ -73,9 +73,9 @@ namespace BufferUploads
     template<typename Entry, int EntryCount>
         struct LockFreeQueue {
             #if defined(D3D_BUFFER_UPLOAD_USE_WAITABLE_QUEUES)
-                typedef LockFree::FixedSizeQueue_Waitable< Entry, EntryCount >  ResolvedType;
+                typedef LockFree::MPMCQueue_Waitable< Entry, EntryCount >   ResolvedType;
             #else
-                typedef LockFree::FixedSizeQueue< Entry, EntryCount >           ResolvedType;
+                typedef LockFree::MPMCQueue< Entry, EntryCount >            ResolvedType;
             #endif
         };
 
@@ -1849,7 +1849,7 @@ namespace BufferUploads
                 if (Process(queueSet, *step, stepMask, context, budgetUnderConstruction, true)) {
                     didSomething = true;
                 } else {
-                    _queueSet_Main._prepareSteps.push_overflow(std::move(*step));
+                    _queueSet_Main._prepareSteps.push(std::move(*step));
                 }
                 queueSet._prepareSteps.pop();
             }
@@ -1862,7 +1862,7 @@ namespace BufferUploads
                 if (Process(*resourceCreateStep, stepMask, context, budgetUnderConstruction)) {
                     didSomething = true;
                 } else {
-                    _queueSet_Main._resourceCreateSteps.push_overflow(std::move(*resourceCreateStep));
+                    _queueSet_Main._resourceCreateSteps.push(std::move(*resourceCreateStep));
                 }
                 queueSet._resourceCreateSteps.pop();
             }
@@ -1875,7 +1875,7 @@ namespace BufferUploads
                 if (Process_StagingBuffer(*resourceCreateStep, stepMask, context, budgetUnderConstruction)) {
                     didSomething = true;
                 } else {
-                    _queueSet_Main._stagingBufferCreateSteps.push_overflow(std::move(*resourceCreateStep));
+                    _queueSet_Main._stagingBufferCreateSteps.push(std::move(*resourceCreateStep));
                 }
                 queueSet._stagingBufferCreateSteps.pop();
             }
@@ -1888,7 +1888,7 @@ namespace BufferUploads
                 if (Process(*uploadStep, stepMask, context, budgetUnderConstruction)) {
                     didSomething = true;
                 } else {
-                    _queueSet_Main._uploadSteps.push_overflow(std::move(*uploadStep));
+                    _queueSet_Main._uploadSteps.push(std::move(*uploadStep));
                 }
                 queueSet._uploadSteps.pop();
             }
@@ -2168,16 +2168,6 @@ namespace BufferUploads
                 #endif
             }
 
-            _queueSet_Main._resourceCreateSteps.compress_overflow();
-            _queueSet_Main._stagingBufferCreateSteps.compress_overflow();
-            _queueSet_Main._uploadSteps.compress_overflow();
-            _queueSet_Main._prepareSteps.compress_overflow();
-            for (unsigned c=0; c<dimof(_queueSet_FramePriority); ++c) {
-                _queueSet_FramePriority[c]._resourceCreateSteps.compress_overflow();
-                _queueSet_FramePriority[c]._stagingBufferCreateSteps.compress_overflow();
-                _queueSet_FramePriority[c]._uploadSteps.compress_overflow();
-                _queueSet_FramePriority[c]._prepareSteps.compress_overflow();
-            }
         }
         result._transactionCount                 = _allocatedTransactionCount;
         #if defined(DEQUE_BASED_TRANSACTIONS)
@@ -2326,25 +2316,25 @@ namespace BufferUploads
     void AssemblyLine::PushStep(QueueSet& queueSet, Transaction& transaction, ResourceCreateStep&& step)
     {
         Interlocked::Increment(&transaction._referenceCount);
-        queueSet._resourceCreateSteps.push_overflow(std::move(step));
+        queueSet._resourceCreateSteps.push(std::move(step));
     }
 
     void AssemblyLine::PushStep_StagingBuffer(QueueSet& queueSet, Transaction& transaction, ResourceCreateStep&& step)
     {
         Interlocked::Increment(&transaction._referenceCount);
-        queueSet._stagingBufferCreateSteps.push_overflow(std::move(step));
+        queueSet._stagingBufferCreateSteps.push(std::move(step));
     }
 
     void AssemblyLine::PushStep(QueueSet& queueSet, Transaction& transaction, DataUploadStep&& step)
     {
         Interlocked::Increment(&transaction._referenceCount);
-        queueSet._uploadSteps.push_overflow(std::move(step));
+        queueSet._uploadSteps.push(std::move(step));
     }
 
     void AssemblyLine::PushStep(QueueSet& queueSet, Transaction& transaction, PrepareDataStep&& step)
     {
         Interlocked::Increment(&transaction._referenceCount);
-        queueSet._prepareSteps.push_overflow(std::move(step));
+        queueSet._prepareSteps.push(std::move(step));
     }
 
     unsigned AssemblyLine::FlipWritingQueueSet()
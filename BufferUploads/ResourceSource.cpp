@@ -1086,12 +1086,6 @@ namespace BufferUploads
         while (_delayedReleases.try_front(delayedRelease)) {
             _delayedReleases.pop();
         }
-
-        static unsigned callCount = 0;
-        if ((callCount%30)==0) {
-            _delayedReleases.compress_overflow();
-            ++callCount;
-        }
     }
 
     void ResourceSource::Tick(ThreadContext& threadContext, IManager::EventListID processedEventList, bool& deviceCreation)
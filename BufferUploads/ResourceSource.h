@@ -267,9 +267,9 @@ namespace BufferUploads
 		RenderCore::IDevice*                _underlyingDevice;
 
         #if defined(D3D_BUFFER_UPLOAD_USE_WAITABLE_QUEUES)
-            LockFree::FixedSizeQueue_Waitable<intrusive_ptr<ResourceLocator>,256> _delayedReleases;
+            LockFree::MPMCQueue_Waitable<intrusive_ptr<ResourceLocator>,256> _delayedReleases;
         #else
-            LockFree::FixedSizeQueue<intrusive_ptr<ResourceLocator>,256> _delayedReleases;
+            LockFree::MPMCQueue<intrusive_ptr<ResourceLocator>,256> _delayedReleases;
         #endif
 
         inline bool UsePooling(const BufferDesc& input)     { return (input._type == BufferDesc::Type::LinearBuffer) && (input._linearBufferDesc._sizeInBytes < (32*1024)) && (input._allocationRules & AllocationRules::Pooled); }
@@ -21,6 +21,12 @@
     #define HAS_SSE_INSTRUCTIONS
 #endif
 
+    // The batched AABB tests only need SSE2, so they can also be used with other compilers
+#if (COMPILER_ACTIVE == COMPILER_TYPE_MSVC) || defined(__SSE2__)
+    #include <emmintrin.h>
+    #define HAS_SSE2_INSTRUCTIONS
+#endif
+
 namespace XLEMath
 {
     static Float4x4 InvertWorldToProjection(const Float4x4& input, bool useAccurateInverse)
@@ -435,6 +441,151 @@ namespace XLEMath
 #endif
     }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+    AABBCullingFrustum::AABBCullingFrustum(const Float4x4& localToProjection, ClipSpaceType clipSpaceType)
+    {
+            //  Each clipping plane is a combination of rows of the projection matrix. For example,
+            //  "x >= -w" becomes dot(row0 + row3, p) >= 0. So we can find the planes in local space
+            //  without inverting anything. The only difference between the clip space types is
+            //  the near plane (the top/bottom flip in PositiveRightHanded doesn't matter here)
+        Float4 rows[4];
+        for (unsigned r=0; r<4; ++r)
+            rows[r] = Float4(localToProjection(r,0), localToProjection(r,1), localToProjection(r,2), localToProjection(r,3));
+
+        _planes[0] = rows[3] + rows[0];
+        _planes[1] = rows[3] - rows[0];
+        _planes[2] = rows[3] + rows[1];
+        _planes[3] = rows[3] - rows[1];
+        _planes[4] = rows[3] - rows[2];
+        if (clipSpaceType == ClipSpaceType::StraddlingZero) {
+            _planes[5] = rows[3] + rows[2];
+        } else {
+            _planes[5] = rows[2];
+        }
+
+        for (unsigned p=0; p<6; ++p)
+            for (unsigned c=0; c<4; ++c)
+                for (unsigned lane=0; lane<4; ++lane)
+                    _planeComponents[p][c][lane] = _planes[p][c];
+    }
+
+#if defined(HAS_SSE2_INSTRUCTIONS)
+
+    template<bool CalculateBoundary>
+        static inline void TestAABBx4_SSE(
+            const AABBCullingFrustum& frustum, const AABBx4& boxes,
+            int& culledMask, int& boundaryMask)
+    {
+            //  For each plane, the distance to the farthest corner is the sum of the larger of
+            //  (plane[c] * mins[c]) and (plane[c] * maxs[c]) for each axis (and the nearest
+            //  corner uses the smaller). This gives the same result as transforming all 8 corners
+            //  into clip space and comparing them to the frustum edges; but it's much less work.
+            //  The box is culled if the farthest corner is outside of any plane, and it's
+            //  entirely within the frustum if the nearest corner is inside of every plane.
+            //  (when the caller doesn't need the second part, we can skip about a third of the work)
+        auto minX = _mm_loadu_ps(boxes._mins[0]), minY = _mm_loadu_ps(boxes._mins[1]), minZ = _mm_loadu_ps(boxes._mins[2]);
+        auto maxX = _mm_loadu_ps(boxes._maxs[0]), maxY = _mm_loadu_ps(boxes._maxs[1]), maxZ = _mm_loadu_ps(boxes._maxs[2]);
+        auto zero = _mm_setzero_ps();
+        auto culled = _mm_setzero_ps();
+        auto boundary = _mm_setzero_ps();
+
+        for (unsigned p=0; p<6; ++p) {
+            __m128 plane[4] = {
+                _mm_loadu_ps(frustum._planeComponents[p][0]), _mm_loadu_ps(frustum._planeComponents[p][1]),
+                _mm_loadu_ps(frustum._planeComponents[p][2]), _mm_loadu_ps(frustum._planeComponents[p][3]) };
+            auto x0 = _mm_mul_ps(plane[0], minX), x1 = _mm_mul_ps(plane[0], maxX);
+            auto y0 = _mm_mul_ps(plane[1], minY), y1 = _mm_mul_ps(plane[1], maxY);
+            auto z0 = _mm_mul_ps(plane[2], minZ), z1 = _mm_mul_ps(plane[2], maxZ);
+
+            auto farthest = _mm_add_ps(_mm_add_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_add_ps(_mm_max_ps(z0, z1), plane[3]));
+            culled = _mm_or_ps(culled, _mm_cmplt_ps(farthest, zero));
+
+            if (constant_expression<CalculateBoundary>::result()) {
+                auto nearest = _mm_add_ps(_mm_add_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_add_ps(_mm_min_ps(z0, z1), plane[3]));
+                boundary = _mm_or_ps(boundary, _mm_cmplt_ps(nearest, zero));
+            }
+        }
+
+        culledMask = _mm_movemask_ps(culled);
+        boundaryMask = _mm_movemask_ps(boundary);
+    }
+
+#else
+
+    static inline void TestAABBx4_Basic(
+        const AABBCullingFrustum& frustum, const AABBx4& boxes,
+        int& culledMask, int& boundaryMask)
+    {
+            // (see TestAABBx4_SSE for a description of this test)
+        culledMask = boundaryMask = 0;
+        for (unsigned lane=0; lane<4; ++lane) {
+            for (unsigned p=0; p<6; ++p) {
+                const auto& plane = frustum._planes[p];
+                float farthest = plane[3], nearest = plane[3];
+                for (unsigned c=0; c<3; ++c) {
+                    float a = plane[c] * boxes._mins[c][lane], b = plane[c] * boxes._maxs[c][lane];
+                    farthest += std::max(a, b);
+                    nearest += std::min(a, b);
+                }
+                culledMask |= int(farthest < 0.f) << lane;
+                boundaryMask |= int(nearest < 0.f) << lane;
+            }
+        }
+    }
+
+#endif
+
+    unsigned TestAABBx4(
+        const AABBCullingFrustum& frustum,
+        const AABBx4& boxes,
+        unsigned* withinMask)
+    {
+        int culledMask, boundaryMask;
+        #if defined(HAS_SSE2_INSTRUCTIONS)
+            if (withinMask) TestAABBx4_SSE<true>(frustum, boxes, culledMask, boundaryMask);
+            else TestAABBx4_SSE<false>(frustum, boxes, culledMask, boundaryMask);
+        #else
+            TestAABBx4_Basic(frustum, boxes, culledMask, boundaryMask);
+        #endif
+        if (withinMask)
+            *withinMask = ~unsigned(boundaryMask) & 0xf;
+        return ~unsigned(culledMask) & 0xf;
+    }
+
+    unsigned CullAABBs(
+        const AABBCullingFrustum& frustum,
+        const AABBx4 boxes[], unsigned boxCount,
+        unsigned visibleIndices[], unsigned indexOffset)
+    {
+        unsigned visibleCount = 0;
+        for (unsigned b=0; b<boxCount; b+=4) {
+            int culledMask, boundaryMask;
+            #if defined(HAS_SSE2_INSTRUCTIONS)
+                TestAABBx4_SSE<false>(frustum, boxes[b/4], culledMask, boundaryMask);
+            #else
+                TestAABBx4_Basic(frustum, boxes[b/4], culledMask, boundaryMask);
+            #endif
+
+                // (lanes past the end of the final block are ignored)
+            unsigned visibleMask = ~unsigned(culledMask) & 0xf;
+            if ((b+4) > boxCount)
+                visibleMask &= (1u << (boxCount-b)) - 1u;
+            if (visibleMask == 0xf) {
+                visibleIndices[visibleCount+0] = indexOffset+b+0;
+                visibleIndices[visibleCount+1] = indexOffset+b+1;
+                visibleIndices[visibleCount+2] = indexOffset+b+2;
+                visibleIndices[visibleCount+3] = indexOffset+b+3;
+                visibleCount += 4;
+            } else {
+                for (unsigned lane=0; lane<4; ++lane)
+                    if (visibleMask & (1u<<lane))
+                        visibleIndices[visibleCount++] = indexOffset+b+lane;
+            }
+        }
+        return visibleCount;
+    }
+
     Float4 ExtractMinimalProjection(const Float4x4& projectionMatrix)
     {
         return Float4(projectionMatrix(0,0), projectionMatrix(1,1), projectionMatrix(2,2), projectionMatrix(2,3));
@@ -47,6 +47,59 @@ namespace XLEMath
             == AABBIntersection::Culled;
     }
 
+    /// <summary>4 axially aligned bounding boxes, in structure-of-arrays form</summary>
+    /// Used by the batched culling functions (TestAABBx4 & CullAABBs), which test all 4 boxes
+    /// with each SIMD instruction. Large sets of boxes should be stored as arrays of these
+    /// (rather than read through the stride of some larger object), so the culling loop only
+    /// touches the 24 bytes per box it needs.
+    ///
+    /// There are no alignment requirements, so this can be serialized as raw data. Unused
+    /// lanes in the final block of an array can have any value; the culling functions take
+    /// an explicit box count.
+    class AABBx4
+    {
+    public:
+        float _mins[3][4];
+        float _maxs[3][4];
+
+        void Set(unsigned lane, const Float3& mins, const Float3& maxs)
+        {
+            for (unsigned c=0; c<3; ++c) {
+                _mins[c][lane] = mins[c];
+                _maxs[c][lane] = maxs[c];
+            }
+        }
+    };
+
+    /// <summary>Frustum planes, prepared for the batched AABB tests</summary>
+    /// The planes are calculated in the same space as the boxes (ie, "local" space for the
+    /// given localToProjection matrix). So the boxes never need to be transformed; testing a box
+    /// against a plane just means finding the corners farthest and nearest to that plane.
+    /// Construct once per view (and per local space), and use for many tests.
+    class AABBCullingFrustum
+    {
+    public:
+        Float4 _planes[6];
+        float _planeComponents[6][4][4];        ///< each plane component repeated 4 times (for loading directly into SIMD registers)
+
+        AABBCullingFrustum(const Float4x4& localToProjection, ClipSpaceType clipSpaceType);
+    };
+
+    /// Returns a 4 bit mask of the boxes in "boxes" that are not culled. Boxes that are
+    /// entirely within the frustum are also set in "withinMask" (when it is not null).
+    unsigned TestAABBx4(
+        const AABBCullingFrustum& frustum,
+        const AABBx4& boxes,
+        unsigned* withinMask = nullptr);
+
+    /// Tests "boxCount" boxes (stored in (boxCount+3)/4 blocks), and writes the indices of the
+    /// boxes that are not culled (plus "indexOffset") into "visibleIndices". Returns the number
+    /// of indices written. There must be space for "boxCount" indices.
+    unsigned CullAABBs(
+        const AABBCullingFrustum& frustum,
+        const AABBx4 boxes[], unsigned boxCount,
+        unsigned visibleIndices[], unsigned indexOffset = 0);
+
     Float4 ExtractMinimalProjection(const Float4x4& projectionMatrix);
     bool IsOrthogonalProjection(const Float4x4& projectionMatrix);
     
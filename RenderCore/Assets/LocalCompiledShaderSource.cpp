@@ -274,6 +274,7 @@ namespace RenderCore { namespace Assets
 	{
 	public:
 		Blob	GetBlob() const;
+		::Assets::ArtifactDataView GetDataView() const;
 		Blob	GetErrors() const;
 		::Assets::DepValPtr GetDependencyValidation() const;
 		StringSection<Assets::ResChar> GetRequestParameters() const { return {}; }
@@ -294,6 +295,16 @@ namespace RenderCore { namespace Assets
 		return _archive->TryOpenFromCache(_fileID);
 	}
 
+	auto ArchivedFileArtifact::GetDataView() const -> ::Assets::ArtifactDataView
+	{
+			// Reference the archive data directly, rather than copying it into a blob
+		if (_blob) return ::Assets::ArtifactDataView(_blob, MakeIteratorRange(*_blob));
+		auto view = _archive->TryOpenView(_fileID);
+		if (!view) return {};
+		auto data = view.GetData();
+		return ::Assets::ArtifactDataView(std::make_shared<::Assets::ArchiveCache::BlockView>(std::move(view)), data);
+	}
+
 	auto ArchivedFileArtifact::GetErrors() const -> Blob { return _errors; }
 	::Assets::DepValPtr ArchivedFileArtifact::GetDependencyValidation() const { return _depVal; }
 
@@ -479,7 +490,13 @@ namespace RenderCore { namespace Assets
         };
 
         if (CompileInBackground) {
-            ::Assets::QueueCompileOperation(futureRes, std::move(operation));
+                // Identical requests (same shader, entry point & defines) share the same
+                // archive id, so they can be deduplicated while in flight
+            ::Assets::ResChar archiveName[MaxPath], depName[MaxPath];
+            auto archiveId = GetTarget(_res, _definesTable, archiveName, dimof(archiveName), depName, dimof(depName));
+            futureRes = ::Assets::QueueCompileOperation(
+                futureRes, std::move(operation),
+                ::Assets::CompileStage::Shader, HashCombine(archiveId, Hash64(archiveName)));
         } else {
             operation(*futureRes);
         }
@@ -613,7 +630,7 @@ namespace RenderCore { namespace Assets
         };
 
         if (CompileInBackground) {
-            ::Assets::QueueCompileOperation(futureRes, std::move(operation));
+            ::Assets::QueueCompileOperation(futureRes, std::move(operation), ::Assets::CompileStage::Shader);
         } else {
             operation(*futureRes);
         }
@@ -253,15 +253,14 @@ namespace RenderCore { namespace Assets
 		auto materialFilename = _materialFilename;
 		auto modelFilename = _modelFilename;
 		auto* store = _store;
-		QueueCompileOperation(
+		return QueueCompileOperation(
 			backgroundOp,
 			[materialFilename, modelFilename, destinationFile, store](::Assets::ArtifactFuture& op) {
 				CompileMaterialScaffold(
 					MakeStringSection(materialFilename), MakeStringSection(modelFilename), MakeStringSection(destinationFile),
 					op, *store);
-			});
-
-        return backgroundOp;
+			},
+			CompileStage::Material, Hash64(destinationFile));
     }
 
     StringSection<::Assets::ResChar> MatCompilerMarker::Initializer() const
@@ -265,6 +265,8 @@ namespace RenderCore { namespace Assets
         e._hash64 = Hash64(AsPointer(e._name.begin()), AsPointer(e._name.end()));
         e._type = input._type;
         e._conditions = input._conditions;
+        if (!e._conditions.empty())
+            e._compiledConditions = GetPreprocessorExpression(MakeStringSection(e._conditions));
         e._arrayElementCount = input._arrayElementCount;
         for (unsigned c=0; c<PredefinedCBLayout::AlignmentRules_Max; ++c)
             e._offsetsByLanguage[c] = CalculateElementOffset(cbIterator[c], e._arrayElementStride, e._type, e._arrayElementCount, (PredefinedCBLayout::AlignmentRules)c);
@@ -369,8 +371,8 @@ namespace RenderCore { namespace Assets
 
         result._elements.reserve(_elements.size());
         for (const auto& e:_elements) {
-            if (    e._conditions.empty()
-                ||  EvaluatePreprocessorExpression(e._conditions, definedTokens)) {
+            if (    !e._compiledConditions
+                ||  e._compiledConditions->Evaluate(definedTokens)) {
 
                 result._elements.push_back(e);
                 auto& newE = *(result._elements.end()-1);
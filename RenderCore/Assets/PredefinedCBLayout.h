@@ -11,8 +11,10 @@
 #include "../../Utility/StringUtils.h"
 #include <unordered_map>
 #include <string>
+#include <memory>
 
 namespace RenderCore { class SharedPkt; }
+namespace Utility { class PreprocessorExpression; }
 namespace RenderCore { namespace Assets
 {
     class PredefinedCBLayout
@@ -35,6 +37,7 @@ namespace RenderCore { namespace Assets
             unsigned _arrayElementStride = 0;
             std::string _name;
             std::string _conditions;
+            std::shared_ptr<const PreprocessorExpression> _compiledConditions;     // (null when there are no conditions)
 
             // Offsets according to the alignment rules for different shader languages
             unsigned _offsetsByLanguage[AlignmentRules_Max];
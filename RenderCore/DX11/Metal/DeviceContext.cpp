@@ -350,6 +350,35 @@ namespace RenderCore { namespace Metal_DX11
         return intrusive_ptr<CommandList>();
     }
 
+    void    DeviceContext::BeginSecondaryCommandList(DeviceContext& primary)
+    {
+        assert(!IsImmediate());
+
+        ID3D::RenderTargetView* rtvs[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT] = {};
+        ID3D::DepthStencilView* dsv = nullptr;
+        primary._underlying->OMGetRenderTargets(dimof(rtvs), rtvs, &dsv);
+        _underlying->OMSetRenderTargets(dimof(rtvs), rtvs, dsv);
+        for (auto* r:rtvs) if (r) r->Release();
+        if (dsv) dsv->Release();
+
+        D3D11_VIEWPORT viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+        UINT viewportCount = dimof(viewports);
+        primary._underlying->RSGetViewports(&viewportCount, viewports);
+        _underlying->RSSetViewports(viewportCount, viewports);
+
+        D3D11_RECT scissorRects[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+        UINT scissorRectCount = dimof(scissorRects);
+        primary._underlying->RSGetScissorRects(&scissorRectCount, scissorRects);
+        _underlying->RSSetScissorRects(scissorRectCount, scissorRects);
+
+        _inRenderPass = primary._inRenderPass;
+        _renderTargetWidth = primary._renderTargetWidth;
+        _renderTargetHeight = primary._renderTargetHeight;
+        _boundGraphicsPipeline = 0;
+        _boundStencilRefValue = 0;
+        InvalidateCachedState();
+    }
+
     bool    DeviceContext::IsImmediate() const
     {
         auto type = _underlying->GetType();
@@ -174,6 +174,11 @@ namespace RenderCore { namespace Metal_DX11
         auto        ResolveCommandList() -> CommandListPtr;
         void        ExecuteCommandList(CommandList& commandList, bool preserveRenderState);
 
+            //  Prepare a deferred context (see Fork()) to record commands that will be executed within
+            //  the current subpass of "primary". Copies the render target, viewport & scissor bindings
+            //  across. Must be called on the thread that owns "primary"
+        void        BeginSecondaryCommandList(DeviceContext& primary);
+
 		NumericUniformsInterface& GetNumericUniforms(ShaderStage stage);
 
         static std::shared_ptr<DeviceContext> Get(IThreadContext& threadContext);
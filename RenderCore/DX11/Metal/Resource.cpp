@@ -201,7 +201,9 @@ namespace RenderCore { namespace Metal_DX11
 		_map = {};
 		_mapSize = 0;
 
-		auto underlyingMapType = (mapMode == Mode::Read) ? D3D11_MAP_READ : D3D11_MAP_WRITE_DISCARD;
+		auto underlyingMapType = D3D11_MAP_WRITE_DISCARD;
+		if (mapMode == Mode::Read) underlyingMapType = D3D11_MAP_READ;
+		else if (mapMode == Mode::WriteNoOverwrite) underlyingMapType = D3D11_MAP_WRITE_NO_OVERWRITE;
 
 		D3D11_MAPPED_SUBRESOURCE result { nullptr, 0, 0 };
         _mapResultCode = _devContext->Map(_underlyingResource.get(), 0, underlyingMapType, 0, &result);
@@ -78,7 +78,7 @@ namespace RenderCore { namespace Metal_DX11
         IteratorRange<const void*>  GetData() const         { return { _map.pData, PtrAdd(_map.pData, _mapSize) }; }
 		TexturePitches				GetPitches() const      { return { _map.RowPitch, _map.DepthPitch }; }
 
-		enum class Mode { Read, WriteDiscardPrevious };
+		enum class Mode { Read, WriteDiscardPrevious, WriteNoOverwrite };
 
 		ResourceMap(
 			DeviceContext& context, const Resource& resource,
@@ -81,7 +81,7 @@ namespace RenderCore
 				future.SetState(newState);
 			};
 
-			::Assets::QueueCompileOperation(result, std::move(operation));
+			::Assets::QueueCompileOperation(result, std::move(operation), ::Assets::CompileStage::Shader);
 		}
 		return result;
     }
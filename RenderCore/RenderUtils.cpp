@@ -452,6 +452,11 @@ namespace RenderCore
         return pkt;
     }
     
+    SharedPkt MakeUnownedPkt(void* begin, size_t size)
+    {
+        return SharedPkt({begin, ~0u}, size);
+    }
+
     void SubFrameHeap_ConsumerFrameBarrier(unsigned producerBarrierId)
     {
         GetSubFrameHeap().OnConsumerFrameBarrier(producerBarrierId);
@@ -95,6 +95,7 @@ namespace RenderCore
         friend SharedPkt MakeSubFramePktSize(size_t size);
         friend SharedPkt MakeSubFramePktSizeAligned(size_t size, size_t alignment);
         friend SharedPkt MakeSubFramePkt(const void* begin, const void* end);
+        friend SharedPkt MakeUnownedPkt(void* begin, size_t size);
 
         void swap(SharedPkt& other) never_throws;
     private:
@@ -132,6 +133,11 @@ namespace RenderCore
         return MakeSubFramePkt(&input, PtrAdd(&input, sizeof(T)));
     }
 
+    /// <summary>Wrap memory owned by some other allocator in a packet</summary>
+    /// The packet isn't reference counted (like the subframe packets), so the caller
+    /// must ensure that the memory outlives every copy of the packet.
+    SharedPkt MakeUnownedPkt(void* begin, size_t size);
+
     void* SubFrameHeap_Allocate(size_t size);
     unsigned SubFrameHeap_ProducerFrameBarrier();
     void SubFrameHeap_ConsumerFrameBarrier(unsigned producerBarrierId);
@@ -6,6 +6,7 @@
 
 #include "ShaderService.h"
 #include "Types.h"	// For PS_DefShaderModel
+#include "../Assets/IArtifact.h"
 #include "../Utility/Streams/PathUtils.h"
 #include "../Utility/MemoryUtils.h"
 #include <assert.h>
@@ -31,19 +32,34 @@ namespace RenderCore
 
     ShaderStage ILowLevelCompiler::ResId::AsShaderStage() const { return RenderCore::AsShaderStage(_shaderModel); }
 
-	CompiledShaderByteCode::CompiledShaderByteCode(const ::Assets::Blob& shader, const ::Assets::DepValPtr& depVal, StringSection<Assets::ResChar>)
-	: _shader(shader)
-	, _depVal(depVal)
+	void CompiledShaderByteCode::ValidateHeader() const
 	{
-		if (_shader && !_shader->empty()) {
-			if (_shader->size() < sizeof(ShaderService::ShaderHeader))
+		if (!_shader.empty()) {
+			if (_shader.size() < sizeof(ShaderService::ShaderHeader))
 				Throw(::Exceptions::BasicLabel("Shader byte code is too small for shader header"));
-			const auto& hdr = *(const ShaderService::ShaderHeader*)_shader->data();
+			const auto& hdr = *(const ShaderService::ShaderHeader*)_shader.begin();
 			if (hdr._version != ShaderService::ShaderHeader::Version)
 				Throw(::Exceptions::BasicLabel("Unexpected version in shader header. Found (%i), expected (%i)", hdr._version, ShaderService::ShaderHeader::Version));
 		}
 	}
 
+	CompiledShaderByteCode::CompiledShaderByteCode(const ::Assets::Blob& shader, const ::Assets::DepValPtr& depVal, StringSection<Assets::ResChar>)
+	: _shaderStorage(shader)
+	, _depVal(depVal)
+	{
+		if (shader)
+			_shader = MakeIteratorRange(*shader);
+		ValidateHeader();
+	}
+
+	CompiledShaderByteCode::CompiledShaderByteCode(const ::Assets::ArtifactDataView& shader, const ::Assets::DepValPtr& depVal, StringSection<Assets::ResChar>)
+	: _shaderStorage(shader.GetKeepAlive())
+	, _shader(shader.GetData())
+	, _depVal(depVal)
+	{
+		ValidateHeader();
+	}
+
 	CompiledShaderByteCode::CompiledShaderByteCode()
 	{
 		_depVal = std::make_shared<::Assets::DependencyValidation>();
@@ -53,38 +69,38 @@ namespace RenderCore
 
 	IteratorRange<const void*> CompiledShaderByteCode::GetByteCode() const
 	{
-		if (!_shader || _shader->empty()) return {};
+		if (_shader.empty()) return {};
 		return MakeIteratorRange(
-			PtrAdd(AsPointer(_shader->begin()), sizeof(ShaderService::ShaderHeader)), 
-			AsPointer(_shader->end()));
+			PtrAdd(_shader.begin(), sizeof(ShaderService::ShaderHeader)), 
+			_shader.end());
 	}
 
     bool CompiledShaderByteCode::DynamicLinkingEnabled() const
     {
-        if (!_shader || _shader->empty()) return false;
+        if (_shader.empty()) return false;
 
-		assert(_shader->size() >= sizeof(ShaderService::ShaderHeader));
-        auto& hdr = *(const ShaderService::ShaderHeader*)AsPointer(_shader->begin());
+		assert(_shader.size() >= sizeof(ShaderService::ShaderHeader));
+        auto& hdr = *(const ShaderService::ShaderHeader*)_shader.begin();
         assert(hdr._version == ShaderService::ShaderHeader::Version);
         return hdr._dynamicLinkageEnabled != 0;
     }
 
 	ShaderStage		CompiledShaderByteCode::GetStage() const
 	{
-		if (!_shader || _shader->empty()) return ShaderStage::Null;
+		if (_shader.empty()) return ShaderStage::Null;
 
-		assert(_shader->size() >= sizeof(ShaderService::ShaderHeader));
-		auto& hdr = *(const ShaderService::ShaderHeader*)AsPointer(_shader->begin());
+		assert(_shader.size() >= sizeof(ShaderService::ShaderHeader));
+		auto& hdr = *(const ShaderService::ShaderHeader*)_shader.begin();
 		assert(hdr._version == ShaderService::ShaderHeader::Version);
 		return AsShaderStage(hdr._shaderModel);
 	}
 
     StringSection<>             CompiledShaderByteCode::GetIdentifier() const
     {
-        if (!_shader || _shader->empty()) return {};
+        if (_shader.empty()) return {};
 
-		assert(_shader->size() >= sizeof(ShaderService::ShaderHeader));
-		auto& hdr = *(const ShaderService::ShaderHeader*)AsPointer(_shader->begin());
+		assert(_shader.size() >= sizeof(ShaderService::ShaderHeader));
+		auto& hdr = *(const ShaderService::ShaderHeader*)_shader.begin();
 		assert(hdr._version == ShaderService::ShaderHeader::Version);
 		return MakeStringSection(hdr._identifier);
     }
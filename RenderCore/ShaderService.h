@@ -23,7 +23,7 @@ namespace Assets
 {
 	class DependencyValidation; class DependentFileState; 
 	class ArtifactFuture; class IArtifactCompileMarker; 
-	class IArtifact;
+	class IArtifact; class ArtifactDataView;
 }
 
 namespace RenderCore
@@ -191,6 +191,7 @@ namespace RenderCore
         bool            DynamicLinkingEnabled() const;
 
 		CompiledShaderByteCode(const ::Assets::Blob&, const ::Assets::DepValPtr&, StringSection<::Assets::ResChar>);
+		CompiledShaderByteCode(const ::Assets::ArtifactDataView&, const ::Assets::DepValPtr&, StringSection<::Assets::ResChar>);
 		CompiledShaderByteCode();
         ~CompiledShaderByteCode();
 
@@ -204,8 +205,11 @@ namespace RenderCore
         static const uint64 CompileProcessType;
 
     private:
-		::Assets::Blob			_shader;
+		std::shared_ptr<const void>	_shaderStorage;		// (either a blob, or a view into a shader archive)
+		IteratorRange<const void*>	_shader;
 		::Assets::DepValPtr		_depVal;
+
+		void ValidateHeader() const;
     };
 }
 
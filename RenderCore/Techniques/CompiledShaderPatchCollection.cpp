@@ -88,6 +88,7 @@ namespace RenderCore { namespace Techniques
 			if (relevanceDepVal)
 				::Assets::RegisterAssetDependency(_depVal, relevanceDepVal);
 		}
+		_interface._compiledSelectorRelevance = PreprocessorExpressionTable(_interface._selectorRelevance);
 
 		size_t size = 0;
 		for (const auto&i:inst._sourceFragments)
@@ -8,6 +8,7 @@
 #include "../../Assets/AssetsCore.h"
 #include "../../Assets/AssetUtils.h"
 #include "../../Utility/IteratorUtils.h"
+#include "../../Utility/Streams/PreprocessorInterpreter.h"
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -46,6 +47,7 @@ namespace RenderCore { namespace Techniques
 			IteratorRange<const Patch*> GetPatches() const { return MakeIteratorRange(_patches); }
 			const std::shared_ptr<RenderCore::Assets::PredefinedDescriptorSetLayout>& GetMaterialDescriptorSet() const { return _descriptorSet; }
 			const std::unordered_map<std::string, std::string>& GetSelectorRelevance() const { return _selectorRelevance; }
+			const PreprocessorExpressionTable& GetCompiledSelectorRelevance() const { return _compiledSelectorRelevance; }
 
 			bool HasPatchType(uint64_t implementing) const;
 
@@ -53,6 +55,7 @@ namespace RenderCore { namespace Techniques
 			std::vector<Patch> _patches;
 			std::shared_ptr<RenderCore::Assets::PredefinedDescriptorSetLayout> _descriptorSet;
 			std::unordered_map<std::string, std::string> _selectorRelevance;
+			PreprocessorExpressionTable _compiledSelectorRelevance;
 
 			friend class CompiledShaderPatchCollection;
 		};
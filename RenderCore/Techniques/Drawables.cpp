@@ -13,9 +13,11 @@
 #include "DescriptorSetAccelerator.h"
 #include "BasicDelegates.h"
 #include "CommonUtils.h"
+#include "FrameArena.h"
 #include "../UniformsStream.h"
 #include "../BufferView.h"
 #include "../IThreadContext.h"
+#include "../Metal/Metal.h"
 #include "../Metal/DeviceContext.h"
 #include "../Metal/InputLayout.h"
 #include "../Metal/State.h"
@@ -23,6 +25,10 @@
 #include "../Metal/Resource.h"
 #include "../Metal/TextureView.h"
 #include "../Assets/ShaderPatchCollection.h"
+#include "../../Utility/Threading/CompletionThreadPool.h"
+#include "../../Utility/Threading/ThreadingUtils.h"
+#include <algorithm>
+#include <atomic>
 
 namespace RenderCore { namespace Techniques
 {
@@ -35,32 +41,52 @@ namespace RenderCore { namespace Techniques
 		std::vector<ConstantBufferView>& sequencerCbvs,
 		unsigned& cbSlot);
 
-	static Metal::BoundUniforms* GetBoundUniforms(
-		const Metal::GraphicsPipeline& pipeline,
-        const Metal::PipelineLayoutConfig& pipelineLayout,
-        const UniformsStreamInterface& interface0 = {},
-        const UniformsStreamInterface& interface1 = {},
-        const UniformsStreamInterface& interface2 = {},
-		const UniformsStreamInterface& interface3 = {})
+	static const UniformsStreamInterface& GetEmptyUniformsStreamInterface()
 	{
-		uint64_t hash = pipeline.GetGUID();
-		hash = HashCombine(interface0.GetHash(), hash);
-		hash = HashCombine(interface1.GetHash(), hash);
-		hash = HashCombine(interface2.GetHash(), hash);
-		hash = HashCombine(interface3.GetHash(), hash);
-
-		static std::unordered_map<uint64_t, std::unique_ptr<Metal::BoundUniforms>> pipelines;
-		auto i = pipelines.find(hash);
-		if (i == pipelines.end())
-			i = pipelines.insert(
-				std::make_pair(
-					hash, 
-					std::make_unique<Metal::BoundUniforms>(pipeline, pipelineLayout, interface0, interface1, interface2, interface3))).first;
-			
-		return i->second.get();
+			// (hash is calculated up front, so it's never written while other threads read it)
+		static const UniformsStreamInterface s_empty = []() { UniformsStreamInterface result; result.GetHash(); return result; }();
+		return s_empty;
 	}
 
-	void Draw(
+	struct SortedDrawable
+	{
+		uint64_t						_pipelineGuid;
+		const Metal::GraphicsPipeline*	_pipeline;
+		const Drawable*					_drawable;
+		unsigned						_originalIndex;
+	};
+
+	struct CompareSortedDrawable
+	{
+		bool operator()(const SortedDrawable& lhs, const SortedDrawable& rhs) const
+		{
+			if (lhs._pipelineGuid != rhs._pipelineGuid) return lhs._pipelineGuid < rhs._pipelineGuid;
+			auto* lhsDescSet = lhs._drawable->_descriptorSet.get(), *rhsDescSet = rhs._drawable->_descriptorSet.get();
+			if (lhsDescSet != rhsDescSet) return std::less<const void*>()(lhsDescSet, rhsDescSet);
+			auto* lhsGeo = lhs._drawable->_geo.get(), *rhsGeo = rhs._drawable->_geo.get();
+			if (lhsGeo != rhsGeo) return std::less<const void*>()(lhsGeo, rhsGeo);
+			return lhs._originalIndex < rhs._originalIndex;
+		}
+	};
+
+	class PreparedDrawablesPacket
+	{
+	public:
+		UniformsStreamInterface _sequencerInterface;
+		std::vector<ConstantBufferView> _sequencerCbvs;
+		std::vector<Metal::ShaderResourceView> _sequencerSrvs;
+		std::vector<Metal::SamplerState> _sequencerSamplerStates;
+		IResource* _temporaryVB = nullptr;
+		IResource* _temporaryIB = nullptr;
+		unsigned _temporaryVBOffset = 0, _temporaryIBOffset = 0;
+		IResourcePtr _ownedTemporaryVB, _ownedTemporaryIB;
+		std::vector<SortedDrawable> _sortedDrawables;
+		unsigned _drawableCount = 0;
+		unsigned _skippedPendingPipelines = 0;
+	};
+
+	static void PrepareDrawablesPacket(
+		PreparedDrawablesPacket& result,
 		IThreadContext& context,
         Techniques::ParsingContext& parserContext,
 		const SequencerContext& sequencerTechnique,
@@ -68,12 +94,10 @@ namespace RenderCore { namespace Techniques
 	{
 		assert(sequencerTechnique._sequencerConfig);
 
-		auto& metalContext = *Metal::DeviceContext::Get(context);
-
-		UniformsStreamInterface sequencerInterface;
-		std::vector<ConstantBufferView> sequencerCbvs;
-		std::vector<Metal::ShaderResourceView> sequencerSrvs;
-		std::vector<Metal::SamplerState> sequencerSamplerStates;
+		auto& sequencerInterface = result._sequencerInterface;
+		auto& sequencerCbvs = result._sequencerCbvs;
+		auto& sequencerSrvs = result._sequencerSrvs;
+		auto& sequencerSamplerStates = result._sequencerSamplerStates;
 		{
 			unsigned cbSlot = 0, srvSlot = 0;
 			for (auto& d:sequencerTechnique._sequencerUniforms) {
@@ -99,60 +123,170 @@ namespace RenderCore { namespace Techniques
 			}
 		}
 
-		IResourcePtr temporaryVB, temporaryIB;
-		if (!drawablePkt.GetStorage(DrawablesPacket::Storage::VB).empty()) {
-			temporaryVB = CreateStaticVertexBuffer(*context.GetDevice(), drawablePkt.GetStorage(DrawablesPacket::Storage::VB));
+			//	Temporary vertex & index data goes into the frame arena's upload ring when we have one,
+			//	otherwise we fall back to creating new buffers every time. Both are uploaded together,
+			//	so that the upload of one can't wrap the ring and discard the other
+		auto vbStorage = drawablePkt.GetStorage(DrawablesPacket::Storage::VB);
+		auto ibStorage = drawablePkt.GetStorage(DrawablesPacket::Storage::IB);
+		FrameArena::UploadResult uploads[2];
+		if (parserContext._frameArena && (!vbStorage.empty() || !ibStorage.empty())) {
+			IteratorRange<const void*> storage[] = { vbStorage, ibStorage };
+			parserContext._frameArena->Upload(context, MakeIteratorRange(storage), MakeIteratorRange(uploads));
+		}
+
+		if (uploads[0]._resource) {
+			result._temporaryVB = uploads[0]._resource;
+			result._temporaryVBOffset = uploads[0]._offset;
+		} else if (!vbStorage.empty()) {
+			result._ownedTemporaryVB = CreateStaticVertexBuffer(*context.GetDevice(), vbStorage);
+			result._temporaryVB = result._ownedTemporaryVB.get();
 		}
-		if (!drawablePkt.GetStorage(DrawablesPacket::Storage::IB).empty()) {
-			temporaryIB = CreateStaticIndexBuffer(*context.GetDevice(), drawablePkt.GetStorage(DrawablesPacket::Storage::IB));
+		if (uploads[1]._resource) {
+			result._temporaryIB = uploads[1]._resource;
+			result._temporaryIBOffset = uploads[1]._offset;
+		} else if (!ibStorage.empty()) {
+			result._ownedTemporaryIB = CreateStaticIndexBuffer(*context.GetDevice(), ibStorage);
+			result._temporaryIB = result._ownedTemporaryIB.get();
 		}
 
-		for (auto d=drawablePkt._drawables.begin(); d!=drawablePkt._drawables.end(); ++d) {
+			//	Resolve pipelines up front, and (depending on the packet's sort mode) sort so that
+			//	drawables sharing a pipeline, descriptor set and geo are submitted together.
+			//	The original index is used as the final tie breaker, so the order is deterministic
+		auto& sortedDrawables = result._sortedDrawables;
+		sortedDrawables.reserve(drawablePkt._drawables.size());
+		unsigned originalIndex = 0;
+		for (auto d=drawablePkt._drawables.begin(); d!=drawablePkt._drawables.end(); ++d, ++originalIndex) {
 			const auto& drawable = *(Drawable*)d.get();
 			auto* pipeline = parserContext._pipelineAcceleratorPool->TryGetPipeline(
 				*drawable._pipeline,
 				*sequencerTechnique._sequencerConfig);
 
-			if (!pipeline || !drawable._descriptorSet)
+			if (!pipeline || !drawable._descriptorSet) {
+				if (!pipeline) ++result._skippedPendingPipelines;
 				continue;
+			}
+
+			sortedDrawables.push_back(SortedDrawable{pipeline->GetGUID(), pipeline, &drawable, originalIndex});
+		}
+		result._drawableCount = originalIndex;
+
+		if (drawablePkt._sortMode == DrawablesPacket::SortMode::MinimizeStateChanges)
+			std::sort(sortedDrawables.begin(), sortedDrawables.end(), CompareSortedDrawable());
+	}
+
+	static void RecordDrawables(
+		Metal::DeviceContext& metalContext,
+        Techniques::ParsingContext& parserContext,
+		const PreparedDrawablesPacket& prepared,
+		IteratorRange<const SortedDrawable*> drawables,
+		DrawablesPacket::Metrics& metrics)
+	{
+		const Metal::GraphicsPipeline* currentPipeline = nullptr;
+		const DrawableGeo* currentGeo = nullptr;
+		bool currentGeoBound = false;
+		const IResource* currentIB = nullptr;
+		Format currentIBFormat = Format(0);
+		unsigned currentIBOffset = 0;
+		const DescriptorSetAccelerator* currentDescriptorSet = nullptr;
+		const UniformsStreamInterface* currentDrawableInterface = nullptr;
+		Metal::BoundUniforms* boundUniforms = nullptr;
+		Metal::BoundUniforms* sequencerUniformsAppliedTo = nullptr;
+		Metal::BoundUniforms* descriptorSetAppliedTo = nullptr;
+		const DescriptorSetAccelerator* appliedDescriptorSet = nullptr;
+
+		for (const auto& sd:drawables) {
+			const auto& drawable = *sd._drawable;
+			auto* pipeline = sd._pipeline;
+			bool pipelineChanged = pipeline != currentPipeline;
+			if (pipelineChanged) {
+				currentPipeline = pipeline;
+				++metrics._pipelineChanges;
+			}
 
 			//////////////////////////////////////////////////////////////////////////////
 
-			VertexBufferView vbv[4];
-			if (drawable._geo) {
-				for (unsigned c=0; c<drawable._geo->_vertexStreamCount; ++c) {
-					auto& stream = drawable._geo->_vertexStreams[c];
-					vbv[c]._resource = stream._resource ? stream._resource.get() : temporaryVB.get();
-					vbv[c]._offset = stream._vbOffset;
+				//	Vertex buffer bindings depend on the pipeline's input layout, so they're only
+				//	skipped while both the pipeline and the geo are unchanged. The index buffer
+				//	binding is independent of the pipeline
+			auto* geo = drawable._geo.get();
+			if (geo) {
+				if (pipelineChanged || geo != currentGeo || !currentGeoBound) {
+					VertexBufferView vbv[4];
+					for (unsigned c=0; c<geo->_vertexStreamCount; ++c) {
+						auto& stream = geo->_vertexStreams[c];
+						if (stream._resource) {
+							vbv[c]._resource = stream._resource.get();
+							vbv[c]._offset = stream._vbOffset;
+						} else {
+							vbv[c]._resource = prepared._temporaryVB;
+							vbv[c]._offset = stream._vbOffset + prepared._temporaryVBOffset;
+						}
+					}
+
+					pipeline->ApplyVertexBuffers(metalContext, MakeIteratorRange(vbv));
+				} else {
+					++metrics._skippedVertexBufferBinds;
 				}
 
-				pipeline->ApplyVertexBuffers(metalContext, MakeIteratorRange(vbv));
-
-				if (drawable._geo->_ibFormat != Format(0)) {
-					auto* ib = drawable._geo->_ib ? drawable._geo->_ib.get() : temporaryIB.get();
-					metalContext.Bind(Metal::AsResource(*ib), drawable._geo->_ibFormat);
+				if (geo->_ibFormat != Format(0)) {
+					auto* ib = geo->_ib ? geo->_ib.get() : prepared._temporaryIB;
+					auto ibOffset = geo->_ib ? 0u : prepared._temporaryIBOffset;
+					if (ib != currentIB || geo->_ibFormat != currentIBFormat || ibOffset != currentIBOffset) {
+						metalContext.Bind(Metal::AsResource(*ib), geo->_ibFormat, ibOffset);
+						currentIB = ib;
+						currentIBFormat = geo->_ibFormat;
+						currentIBOffset = ibOffset;
+					} else {
+						++metrics._skippedIndexBufferBinds;
+					}
 				}
+				currentGeoBound = true;
 			} else {
-				metalContext.UnbindInputLayout();
+				if (currentGeoBound || pipelineChanged)
+					metalContext.UnbindInputLayout();
+				currentGeoBound = false;
 			}
+			currentGeo = geo;
 
 			//////////////////////////////////////////////////////////////////////////////
 
-			auto* boundUniforms = GetBoundUniforms(
-				*pipeline,
-				Metal::PipelineLayoutConfig{},
-				sequencerInterface,
-				drawable._descriptorSet->_usi,	// mat stream
-				UniformsStreamInterface{},		// geo stream
-				drawable._uniformsInterface ? *drawable._uniformsInterface : UniformsStreamInterface{});
-
-			boundUniforms->Apply(
-				metalContext, 0, 
-				UniformsStream {
-					MakeIteratorRange(sequencerCbvs),
-					UniformsStream::MakeResources(MakeIteratorRange(sequencerSrvs)),
-					UniformsStream::MakeResources(MakeIteratorRange(sequencerSamplerStates))});
-			drawable._descriptorSet->Apply(metalContext, *boundUniforms, 1);
+			auto* descriptorSet = drawable._descriptorSet.get();
+			auto* drawableInterface = drawable._uniformsInterface.get();
+			if (pipelineChanged || !boundUniforms || descriptorSet != currentDescriptorSet || drawableInterface != currentDrawableInterface) {
+				boundUniforms = &parserContext._pipelineAcceleratorPool->GetBoundUniforms(
+					*pipeline,
+					prepared._sequencerInterface,
+					descriptorSet->_usi,						// mat stream
+					GetEmptyUniformsStreamInterface(),			// geo stream
+					drawableInterface ? *drawableInterface : GetEmptyUniformsStreamInterface());
+				currentDescriptorSet = descriptorSet;
+				currentDrawableInterface = drawableInterface;
+			} else {
+				++metrics._skippedBoundUniformsLookups;
+			}
+
+				//	The sequencer uniforms are the same for every drawable in the packet, and bindings
+				//	made through a BoundUniforms persist until that same group is applied again;
+				//	so they only need to be reapplied when the BoundUniforms object changes
+			if (boundUniforms != sequencerUniformsAppliedTo) {
+				boundUniforms->Apply(
+					metalContext, 0, 
+					UniformsStream {
+						MakeIteratorRange(prepared._sequencerCbvs),
+						UniformsStream::MakeResources(MakeIteratorRange(prepared._sequencerSrvs)),
+						UniformsStream::MakeResources(MakeIteratorRange(prepared._sequencerSamplerStates))});
+				sequencerUniformsAppliedTo = boundUniforms;
+			} else {
+				++metrics._skippedSequencerUniformApplies;
+			}
+
+			if (boundUniforms != descriptorSetAppliedTo || descriptorSet != appliedDescriptorSet) {
+				descriptorSet->Apply(metalContext, *boundUniforms, 1);
+				descriptorSetAppliedTo = boundUniforms;
+				appliedDescriptorSet = descriptorSet;
+			} else {
+				++metrics._skippedDescriptorSetApplies;
+			}
 
 			//////////////////////////////////////////////////////////////////////////////
 
@@ -160,9 +294,85 @@ namespace RenderCore { namespace Techniques
 				parserContext, 
 				Drawable::DrawFunctionContext { &metalContext, pipeline, boundUniforms },
 				drawable);
+			++metrics._drawsSubmitted;
 		}
 	}
 
+#if GFXAPI_TARGET == GFXAPI_DX11
+	static void AccumulateMetrics(DrawablesPacket::Metrics& dst, const DrawablesPacket::Metrics& src)
+	{
+		dst._drawsSubmitted += src._drawsSubmitted;
+		dst._pipelineChanges += src._pipelineChanges;
+		dst._skippedVertexBufferBinds += src._skippedVertexBufferBinds;
+		dst._skippedIndexBufferBinds += src._skippedIndexBufferBinds;
+		dst._skippedBoundUniformsLookups += src._skippedBoundUniformsLookups;
+		dst._skippedSequencerUniformApplies += src._skippedSequencerUniformApplies;
+		dst._skippedDescriptorSetApplies += src._skippedDescriptorSetApplies;
+	}
+#endif
+
+	void Draw(
+		IThreadContext& context,
+        Techniques::ParsingContext& parserContext,
+		const SequencerContext& sequencerTechnique,
+		const DrawablesPacket& drawablePkt)
+	{
+		PreparedDrawablesPacket prepared;
+		PrepareDrawablesPacket(prepared, context, parserContext, sequencerTechnique, drawablePkt);
+
+		DrawablesPacket::Metrics metrics;
+		metrics._drawableCount = prepared._drawableCount;
+		metrics._skippedPendingPipelines = prepared._skippedPendingPipelines;
+		RecordDrawables(
+			*Metal::DeviceContext::Get(context), parserContext, prepared,
+			MakeIteratorRange(prepared._sortedDrawables), metrics);
+		drawablePkt._lastDrawMetrics = metrics;
+	}
+
+	void DrawParallel(
+		IThreadContext& context,
+        Techniques::ParsingContext& parserContext,
+		const SequencerContext& sequencerTechnique,
+		const DrawablesPacket& drawablePkt,
+		Utility::CompletionThreadPool& threadPool,
+		unsigned maxRanges,
+		unsigned minDrawablesPerRange)
+	{
+		#if GFXAPI_TARGET == GFXAPI_DX11
+			PreparedDrawablesPacket prepared;
+			PrepareDrawablesPacket(prepared, context, parserContext, sequencerTechnique, drawablePkt);
+
+			auto& metalContext = *Metal::DeviceContext::Get(context);
+			auto drawableCount = (unsigned)prepared._sortedDrawables.size();
+			auto rangeCount = std::min(maxRanges, drawableCount / std::max(minDrawablesPerRange, 1u));
+
+			std::vector<DrawablesPacket::Metrics> rangeMetrics(std::max(rangeCount, 1u));
+			if (rangeCount <= 1) {
+				RecordDrawables(metalContext, parserContext, prepared, MakeIteratorRange(prepared._sortedDrawables), rangeMetrics[0]);
+			} else {
+				Internal::RecordRangesParallel(
+					metalContext, threadPool, drawableCount, rangeCount,
+					[&](Metal::DeviceContext& rangeContext, unsigned rangeIndex, unsigned begin, unsigned end) {
+						auto range = MakeIteratorRange(
+							AsPointer(prepared._sortedDrawables.begin()+begin),
+							AsPointer(prepared._sortedDrawables.begin()+end));
+						RecordDrawables(rangeContext, parserContext, prepared, range, rangeMetrics[rangeIndex]);
+					});
+			}
+
+			DrawablesPacket::Metrics metrics;
+			metrics._drawableCount = prepared._drawableCount;
+			metrics._skippedPendingPipelines = prepared._skippedPendingPipelines;
+			for (const auto& m:rangeMetrics)
+				AccumulateMetrics(metrics, m);
+			drawablePkt._lastDrawMetrics = metrics;
+		#else
+				// No secondary command lists on this API, so everything is recorded on this thread
+			(void)threadPool; (void)maxRanges; (void)minDrawablesPerRange;
+			Draw(context, parserContext, sequencerTechnique, drawablePkt);
+		#endif
+	}
+
 	void SetupDefaultUniforms(
 		Techniques::ParsingContext& parserContext,
 		UniformsStreamInterface& sequencerInterface,
@@ -220,40 +430,115 @@ namespace RenderCore { namespace Techniques
 		_metalContext->DrawAuto(*_pipeline);
 	}
 
-	static DrawablesPacket::AllocateStorageResult AllocateFrom(std::vector<uint8_t>& vector, size_t size, unsigned alignment)
+	auto DrawablesPacket::TemporaryStorage::Allocate(FrameArena* frameArena, size_t size, unsigned alignment) -> AllocateStorageResult
 	{
 		unsigned preAlignmentBuffer = 0;
 		if (alignment != 0) {
-			preAlignmentBuffer = alignment - (vector.size() % alignment);
+			preAlignmentBuffer = alignment - (_size % alignment);
 			if (preAlignmentBuffer == alignment) preAlignmentBuffer = 0;
 		}
 
-		size_t startOffset = vector.size() + preAlignmentBuffer;
-		vector.resize(vector.size() + preAlignmentBuffer + size);
-		return {
-			MakeIteratorRange(AsPointer(vector.begin() + startOffset), AsPointer(vector.begin() + startOffset + size)),
-			(unsigned)startOffset
-		};
+		size_t startOffset = _size + preAlignmentBuffer;
+		size_t newSize = startOffset + size;
+		if (frameArena) {
+				//	Grow geometrically; the block that's replaced is just abandoned, and is
+				//	recycled along with the rest of the frame's pages
+			if (newSize > _arenaBlock.size()) {
+				auto newBlock = frameArena->Allocate(std::max(newSize, std::max(_arenaBlock.size()*2, size_t(4096))));
+				if (_size)
+					XlCopyMemory(newBlock.begin(), _arenaBlock.begin(), _size);
+				_arenaBlock = newBlock;
+			}
+		} else {
+			_heap.resize(newSize);
+		}
+		_size = newSize;
+		auto data = GetData();
+		return { MakeIteratorRange(PtrAdd(data.begin(), startOffset), data.end()), (unsigned)startOffset };
+	}
+
+	IteratorRange<void*> DrawablesPacket::TemporaryStorage::GetData() const
+	{
+		void* data = _arenaBlock.empty() ? (void*)AsPointer(_heap.begin()) : _arenaBlock.begin();
+		return MakeIteratorRange(data, PtrAdd(data, _size));
+	}
+
+	void DrawablesPacket::TemporaryStorage::Clear()
+	{
+		_arenaBlock = {};
+		_heap.clear();
+		_size = 0;
 	}
 
 	auto DrawablesPacket::AllocateStorage(Storage storageType, size_t size) -> AllocateStorageResult
 	{
 		if (storageType == Storage::IB) {
-			return AllocateFrom(_ibStorage, size, _storageAlignment);
+			return _ibStorage.Allocate(_frameArena, size, _storageAlignment);
 		} else {
 			assert(storageType == Storage::VB);
-			return AllocateFrom(_vbStorage, size, _storageAlignment);
+			return _vbStorage.Allocate(_frameArena, size, _storageAlignment);
 		}
 	}
 
-	IteratorRange<const void*> DrawablesPacket::GetStorage(Storage storageType) const
+	void DrawablesPacket::Reset()
 	{
-		if (storageType == Storage::IB) {
-			return MakeIteratorRange(_ibStorage);
-		} else {
-			assert(storageType == Storage::VB);
-			return MakeIteratorRange(_vbStorage);
+		_drawables.clear();
+		_vbStorage.Clear();
+		_ibStorage.Clear();
+	}
+
+	void DrawablesPacket::SetFrameArena(FrameArena* frameArena)
+	{
+		assert(!_vbStorage.GetSize() && !_ibStorage.GetSize());
+		_frameArena = frameArena;
+	}
+
+	void DrawablesPacket::Append(DrawablesPacket&& src)
+	{
+		assert(&src != this);
+		unsigned vbBase = 0, ibBase = 0;
+		if (src._vbStorage.GetSize()) {
+			auto space = _vbStorage.Allocate(_frameArena, src._vbStorage.GetSize(), _storageAlignment);
+			XlCopyMemory(space._data.begin(), src._vbStorage.GetData().begin(), src._vbStorage.GetSize());
+			vbBase = space._startOffset;
+		}
+		if (src._ibStorage.GetSize()) {
+			auto space = _ibStorage.Allocate(_frameArena, src._ibStorage.GetSize(), _storageAlignment);
+			XlCopyMemory(space._data.begin(), src._ibStorage.GetData().begin(), src._ibStorage.GetSize());
+			ibBase = space._startOffset;
 		}
+
+			//	Temporary geos can be shared by several drawables (eg, the draw calls of one instanced
+			//	model), so find the unique set before offsetting them
+		if (vbBase || ibBase) {
+			std::vector<DrawableGeo*> temporaryGeos;
+			for (auto d=src._drawables.begin(); d!=src._drawables.end(); ++d) {
+				auto* geo = ((const Drawable*)d.get())->_geo.get();
+				if (geo && (geo->_flags & DrawableGeo::Flags::Temporary))
+					temporaryGeos.push_back(geo);
+			}
+			std::sort(temporaryGeos.begin(), temporaryGeos.end());
+			temporaryGeos.erase(std::unique(temporaryGeos.begin(), temporaryGeos.end()), temporaryGeos.end());
+			for (auto* geo:temporaryGeos) {
+				for (unsigned c=0; c<geo->_vertexStreamCount; ++c)
+					if (!geo->_vertexStreams[c]._resource)
+						geo->_vertexStreams[c]._vbOffset += vbBase;
+				if (!geo->_ib && geo->_dynIBBegin != ~0u) {
+					geo->_dynIBBegin += ibBase;
+					geo->_dynIBEnd += ibBase;
+				}
+			}
+		}
+
+		_drawables.append(std::move(src._drawables));
+		src._vbStorage.Clear();
+		src._ibStorage.Clear();
+	}
+
+	IteratorRange<const void*> DrawablesPacket::GetStorage(Storage storageType) const
+	{
+		assert(storageType == Storage::IB || storageType == Storage::VB);
+		return (storageType == Storage::IB) ? _ibStorage.GetData() : _vbStorage.GetData();
 	}
 
 }}
@@ -12,13 +12,14 @@
 #include <memory>
 #include <string>
 
-namespace Utility { class ParameterBox; }
+namespace Utility { class ParameterBox; class CompletionThreadPool; }
 namespace RenderCore { class IThreadContext; class MiniInputElementDesc; class UniformsStreamInterface; class UniformsStream; }
 namespace RenderCore { namespace Assets { class MaterialScaffoldMaterial; class ShaderPatchCollection; } }
 
 namespace RenderCore { namespace Techniques
 {
 	class ParsingContext;
+	class FrameArena;
 	class IUniformBufferDelegate;
 	class IShaderResourceDelegate;
 	class PipelineAccelerator;
@@ -50,6 +51,9 @@ namespace RenderCore { namespace Techniques
         unsigned			_dynIBBegin = ~0u;
         unsigned			_dynIBEnd = 0u;
 
+            /// Temporary geos refer to the temporary storage of the DrawablesPacket they were built
+            /// for (via vertex streams without a resource, or the dynamic index range), and belong
+            /// to that packet. DrawablesPacket::Append() relocates them.
         struct Flags
         {
             enum Enum { Temporary       = 1 << 0 };
@@ -100,13 +104,70 @@ namespace RenderCore { namespace Techniques
 		struct AllocateStorageResult { IteratorRange<void*> _data; unsigned _startOffset; };
 		AllocateStorageResult AllocateStorage(Storage storageType, size_t size);
 
-		void Reset() { _drawables.clear(); _vbStorage.clear(); _ibStorage.clear(); }
+		/// <summary>Controls the submission order used by Techniques::Draw</summary>
+		/// Stable submits drawables in the order they were added (required whenever the order
+		/// matters, such as for blended geometry). MinimizeStateChanges sorts by pipeline,
+		/// descriptor set and geo before submission, so that runs of drawables sharing state
+		/// can skip redundant binds. Redundant binds are skipped in both modes.
+		enum class SortMode { Stable, MinimizeStateChanges };
+		SortMode _sortMode = SortMode::Stable;
+
+		struct Metrics
+		{
+			unsigned _drawableCount = 0;
+			unsigned _drawsSubmitted = 0;
+			unsigned _pipelineChanges = 0;
+			unsigned _skippedVertexBufferBinds = 0;
+			unsigned _skippedIndexBufferBinds = 0;
+			unsigned _skippedBoundUniformsLookups = 0;
+			unsigned _skippedSequencerUniformApplies = 0;
+			unsigned _skippedDescriptorSetApplies = 0;
+			unsigned _skippedPendingPipelines = 0;		///< drawables not drawn because their pipeline wasn't ready yet
+		};
+		/// <summary>Counters from the most recent Techniques::Draw of this packet</summary>
+		const Metrics& GetLastDrawMetrics() const { return _lastDrawMetrics; }
+
+		void Reset();
+
+		/// <summary>Allocate temporary vertex and index storage from the given arena</summary>
+		/// When set, AllocateStorage() takes space from the arena's CPU pages rather than the heap,
+		/// and so the storage is only valid until the frame is retired (packets are normally reset
+		/// every frame anyway). Can only be changed while there's no storage allocated; Reset()
+		/// keeps the arena.
+		void SetFrameArena(FrameArena* frameArena);
+		FrameArena* GetFrameArena() const { return _frameArena; }
+
+		/// <summary>Moves all of the drawables (and temporary storage) from "src" onto the end of this packet</summary>
+		/// Used to combine packets that were built separately (for example, on different threads).
+		/// The order of the drawables is preserved. Geos that refer to the temporary storage of
+		/// "src" must be marked with DrawableGeo::Flags::Temporary, so they can be relocated.
+		/// "src" is left empty, but keeps its allocations (so it can be reused).
+		void Append(DrawablesPacket&& src);
 
 		IteratorRange<const void*> GetStorage(Storage storageType) const;
+
+		DrawablesPacket(SortMode sortMode = SortMode::Stable) : _sortMode(sortMode) {}
 	private:
-		std::vector<uint8_t>	_vbStorage;
-		std::vector<uint8_t>	_ibStorage;
+		class TemporaryStorage
+		{
+		public:
+			AllocateStorageResult Allocate(FrameArena* frameArena, size_t size, unsigned alignment);
+			IteratorRange<void*> GetData() const;
+			size_t GetSize() const { return _size; }
+			void Clear();
+		private:
+			IteratorRange<void*>	_arenaBlock;		///< space allocated from the frame arena (only the start is in use)
+			std::vector<uint8_t>	_heap;				///< used when there is no frame arena
+			size_t					_size = 0;
+		};
+		TemporaryStorage		_vbStorage;
+		TemporaryStorage		_ibStorage;
 		unsigned				_storageAlignment = 0u;
+		FrameArena*				_frameArena = nullptr;
+
+		mutable Metrics			_lastDrawMetrics;
+		friend void Draw(IThreadContext&, ParsingContext&, const SequencerContext&, const DrawablesPacket&);
+		friend void DrawParallel(IThreadContext&, ParsingContext&, const SequencerContext&, const DrawablesPacket&, Utility::CompletionThreadPool&, unsigned, unsigned);
 	};
 
 	void Draw(
@@ -115,6 +176,64 @@ namespace RenderCore { namespace Techniques
 		const SequencerContext& sequencerTechnique,
 		const DrawablesPacket& drawablePkt);
 
+	/// <summary>Draw a packet, recording ranges of drawables on thread pool workers</summary>
+	/// The (sorted) drawables are split into contiguous ranges. The first range is recorded directly
+	/// on the given context, the others into secondary command lists on the thread pool; those
+	/// are then executed on the given context in order, so the final submission order is the same
+	/// as Draw(). Small packets are drawn with Draw() directly.
+	///
+	/// Only the DX11 device context can currently record into secondary command lists; on
+	/// other APIs this is the same as Draw().
+	///
+	/// Draw functions for drawables in the packet may be called from several threads at once,
+	/// and so must not modify the ParsingContext (allocating from its FrameArena is fine).
+	void DrawParallel(
+		IThreadContext& context,
+        Techniques::ParsingContext& parserContext,
+		const SequencerContext& sequencerTechnique,
+		const DrawablesPacket& drawablePkt,
+		Utility::CompletionThreadPool& threadPool,
+		unsigned maxRanges = 8,
+		unsigned minDrawablesPerRange = 256);
+
+	namespace Internal
+	{
+		/// <summary>Records [0, itemCount) in contiguous ranges, each range into its own command list</summary>
+		/// Range 0 is recorded directly on "primary". The others are recorded on the thread pool, on
+		/// contexts forked from "primary" (which inherit its render state before any recording starts).
+		/// Their command lists are then executed on "primary" in range order.
+		/// recordFn is called as recordFn(deviceContext, rangeIndex, begin, end).
+		/// This is used by DrawParallel(); it's a template so it can be used with any device context
+		/// that supports Fork() and BeginSecondaryCommandList().
+		template<typename DeviceContext, typename ThreadPool, typename RecordFn>
+			void RecordRangesParallel(DeviceContext& primary, ThreadPool& threadPool, unsigned itemCount, unsigned rangeCount, RecordFn&& recordFn)
+		{
+			std::vector<decltype(primary.Fork())> secondaryContexts(rangeCount ? rangeCount-1 : 0);
+			for (auto& c:secondaryContexts) {
+				c = primary.Fork();
+				c->BeginCommandList();
+				c->BeginSecondaryCommandList(primary);
+			}
+
+			std::vector<decltype(primary.ResolveCommandList())> commandLists(rangeCount);
+			ExecuteRangesParallel(
+				threadPool, itemCount, rangeCount,
+				[&](unsigned rangeIndex, unsigned begin, unsigned end) {
+					if (rangeIndex == 0) {
+						recordFn(primary, 0u, begin, end);
+					} else {
+						auto& secondary = *secondaryContexts[rangeIndex-1];
+						recordFn(secondary, rangeIndex, begin, end);
+						commandLists[rangeIndex] = secondary.ResolveCommandList();
+					}
+				});
+
+			for (unsigned c=1; c<rangeCount; ++c)
+				if (commandLists[c])
+					primary.ExecuteCommandList(*commandLists[c], true);
+		}
+	}
+
 	enum class BatchFilter
     {
         General,                // general rendering batch
@@ -0,0 +1,235 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#include "FrameArena.h"
+#include "../IDevice.h"
+#include "../IThreadContext.h"
+#include "../ResourceDesc.h"
+#include "../Metal/DeviceContext.h"
+#include "../Metal/Resource.h"
+#include "../../Utility/Threading/Mutex.h"
+#include "../../Utility/MemoryUtils.h"
+#include <vector>
+#include <algorithm>
+
+namespace RenderCore { namespace Techniques
+{
+		// (note that CeilToMultiplePow2 truncates the mask to 32 bits, so can't be used on addresses)
+	static size_t AlignUp(size_t value, size_t alignment) { return (value + alignment - 1) & ~(alignment - 1); }
+
+	class FrameArena::Pimpl
+	{
+	public:
+		class Page
+		{
+		public:
+			std::unique_ptr<uint8_t[]>	_data;
+			size_t		_size = 0;
+			size_t		_used = 0;
+			unsigned	_lastUsedFrame = 0;
+			bool		_inUse = false;
+		};
+
+		Threading::Mutex	_pagesLock;
+		std::vector<Page>	_pages;
+		unsigned			_currentPage = ~0u;
+		unsigned			_frameIndex = 0;
+		unsigned			_frameLatency;
+		size_t				_pageSize;
+		size_t				_cpuBytesAllocated = 0;
+		unsigned			_heapAllocations = 0;
+
+		Threading::Mutex	_uploadLock;
+		IResourcePtr		_uploadBuffer;
+		size_t				_uploadBufferSize;
+		size_t				_uploadHead = 0;
+		bool				_uploadNeedsDiscard = true;
+		unsigned			_uploadFrameIndex = 0;
+			// upload buffers that have been replaced by larger ones, and the frame they were last used in
+		std::vector<std::pair<unsigned, IResourcePtr>> _replacedUploadBuffers;
+		size_t				_gpuBytesUploaded = 0;
+		unsigned			_deviceAllocations = 0;
+		unsigned			_uploadRingWraps = 0;
+
+		unsigned AcquirePage(size_t minimumSize)
+		{
+				// Prefer a retired page; only create a new one when there are none big enough.
+				// Oversized pages are kept, so a steady state frame with large allocations also
+				// stops allocating eventually
+			for (unsigned c=0; c<_pages.size(); ++c)
+				if (!_pages[c]._inUse && _pages[c]._size >= minimumSize)
+					return c;
+
+			Page newPage;
+			newPage._size = std::max(_pageSize, minimumSize);
+			newPage._data = std::unique_ptr<uint8_t[]>(new uint8_t[newPage._size]);
+			_pages.emplace_back(std::move(newPage));
+			++_heapAllocations;
+			return unsigned(_pages.size()-1);
+		}
+	};
+
+	IteratorRange<void*> FrameArena::Allocate(size_t size, size_t alignment)
+	{
+		assert(alignment != 0 && (alignment & (alignment-1)) == 0);
+		ScopedLock(_pimpl->_pagesLock);
+		_pimpl->_cpuBytesAllocated += size;
+
+		if (_pimpl->_currentPage != ~0u) {
+			auto& page = _pimpl->_pages[_pimpl->_currentPage];
+			auto start = AlignUp(size_t(page._data.get()) + page._used, alignment) - size_t(page._data.get());
+			if (start + size <= page._size) {
+				page._used = start + size;
+				return MakeIteratorRange(PtrAdd(page._data.get(), start), PtrAdd(page._data.get(), start + size));
+			}
+		}
+
+		auto pageIdx = _pimpl->AcquirePage(size + alignment);
+		auto& page = _pimpl->_pages[pageIdx];
+		page._inUse = true;
+		page._lastUsedFrame = _pimpl->_frameIndex;
+		auto start = AlignUp(size_t(page._data.get()), alignment) - size_t(page._data.get());
+		page._used = start + size;
+		_pimpl->_currentPage = pageIdx;
+		return MakeIteratorRange(PtrAdd(page._data.get(), start), PtrAdd(page._data.get(), start + size));
+	}
+
+	SharedPkt FrameArena::AllocatePkt(size_t size)
+	{
+		auto space = Allocate(size, 16);
+		return MakeUnownedPkt(space.begin(), space.size());
+	}
+
+	SharedPkt FrameArena::MakePkt(const void* begin, const void* end)
+	{
+		auto size = size_t(ptrdiff_t(end) - ptrdiff_t(begin));
+		auto space = Allocate(size, 16);
+		XlCopyMemory(space.begin(), begin, size);
+		return MakeUnownedPkt(space.begin(), space.size());
+	}
+
+	auto FrameArena::Upload(IThreadContext& context, IteratorRange<const void*> data) -> UploadResult
+	{
+		UploadResult result;
+		Upload(context, MakeIteratorRange(&data, &data+1), MakeIteratorRange(&result, &result+1));
+		return result;
+	}
+
+	bool FrameArena::Upload(
+		IThreadContext& context,
+		IteratorRange<const IteratorRange<const void*>*> blocks,
+		IteratorRange<UploadResult*> results)
+	{
+		assert(results.size() == blocks.size());
+		for (auto& r:results) r = {};
+
+		size_t alignedSize = 0;
+		for (const auto& b:blocks) alignedSize += AlignUp(b.size(), 16);
+		if (!alignedSize) return true;
+
+		ScopedLock(_pimpl->_uploadLock);
+		if (!_pimpl->_uploadBuffer || alignedSize > _pimpl->_uploadBufferSize) {
+				// Draws recorded earlier this frame may still reference the old buffer, so it
+				// must stay alive until the frame is retired
+			if (_pimpl->_uploadBuffer)
+				_pimpl->_replacedUploadBuffers.emplace_back(_pimpl->_uploadFrameIndex, std::move(_pimpl->_uploadBuffer));
+			while (_pimpl->_uploadBufferSize < alignedSize)
+				_pimpl->_uploadBufferSize *= 2;
+			_pimpl->_uploadBuffer = context.GetDevice()->CreateResource(
+				CreateDesc(
+					BindFlag::VertexBuffer|BindFlag::IndexBuffer, CPUAccess::WriteDynamic, GPUAccess::Read,
+					LinearBufferDesc::Create(unsigned(_pimpl->_uploadBufferSize)),
+					"frame-arena-upload"));
+			_pimpl->_uploadHead = 0;
+			_pimpl->_uploadNeedsDiscard = true;
+			++_pimpl->_deviceAllocations;
+		}
+
+			//	Appending uses a no-overwrite map, so the GPU can continue to read earlier parts of
+			//	the buffer. When we wrap around, a discarding map gives us fresh memory while the
+			//	GPU finishes with the old contents
+		if (_pimpl->_uploadHead + alignedSize > _pimpl->_uploadBufferSize) {
+			_pimpl->_uploadHead = 0;
+			_pimpl->_uploadNeedsDiscard = true;
+			++_pimpl->_uploadRingWraps;
+		}
+
+		auto& metalContext = *Metal::DeviceContext::Get(context);
+		Metal::ResourceMap map(
+			metalContext, Metal::AsResource(*_pimpl->_uploadBuffer),
+			_pimpl->_uploadNeedsDiscard ? Metal::ResourceMap::Mode::WriteDiscardPrevious : Metal::ResourceMap::Mode::WriteNoOverwrite);
+		auto dst = map.GetData();
+		if (dst.size() < _pimpl->_uploadHead + alignedSize)
+			return false;		// (map failed; the caller should fall back to a temporary buffer)
+
+		for (size_t c=0; c<blocks.size(); ++c) {
+			const auto& data = blocks[c];
+			if (data.empty()) continue;
+			XlCopyMemory(PtrAdd(dst.begin(), _pimpl->_uploadHead), data.begin(), data.size());
+			results[c] = UploadResult { _pimpl->_uploadBuffer.get(), unsigned(_pimpl->_uploadHead) };
+			_pimpl->_uploadHead += AlignUp(data.size(), 16);
+			_pimpl->_gpuBytesUploaded += data.size();
+		}
+		_pimpl->_uploadNeedsDiscard = false;
+		return true;
+	}
+
+	void FrameArena::OnFrameBarrier()
+	{
+		{
+			ScopedLock(_pimpl->_pagesLock);
+			++_pimpl->_frameIndex;
+			_pimpl->_currentPage = ~0u;
+			for (auto& page:_pimpl->_pages)
+				if (page._inUse && (page._lastUsedFrame + _pimpl->_frameLatency) <= _pimpl->_frameIndex) {
+					page._inUse = false;
+					page._used = 0;
+				}
+			_pimpl->_cpuBytesAllocated = 0;
+		}
+		{
+			ScopedLock(_pimpl->_uploadLock);
+			++_pimpl->_uploadFrameIndex;
+			_pimpl->_replacedUploadBuffers.erase(
+				std::remove_if(
+					_pimpl->_replacedUploadBuffers.begin(), _pimpl->_replacedUploadBuffers.end(),
+					[this](const std::pair<unsigned, IResourcePtr>& b) { return (b.first + _pimpl->_frameLatency) <= _pimpl->_uploadFrameIndex; }),
+				_pimpl->_replacedUploadBuffers.end());
+			_pimpl->_gpuBytesUploaded = 0;
+		}
+	}
+
+	auto FrameArena::GetMetrics() const -> Metrics
+	{
+		Metrics result;
+		{
+			ScopedLock(_pimpl->_pagesLock);
+			result._frameIndex = _pimpl->_frameIndex;
+			result._cpuBytesAllocated = _pimpl->_cpuBytesAllocated;
+			result._cpuPageCount = unsigned(_pimpl->_pages.size());
+			result._cpuPagesInUse = unsigned(std::count_if(_pimpl->_pages.begin(), _pimpl->_pages.end(), [](const Pimpl::Page& p) { return p._inUse; }));
+			result._heapAllocations = _pimpl->_heapAllocations;
+		}
+		{
+			ScopedLock(_pimpl->_uploadLock);
+			result._gpuBytesUploaded = _pimpl->_gpuBytesUploaded;
+			result._uploadBufferSize = _pimpl->_uploadBuffer ? _pimpl->_uploadBufferSize : 0;
+			result._deviceAllocations = _pimpl->_deviceAllocations;
+			result._uploadRingWraps = _pimpl->_uploadRingWraps;
+		}
+		return result;
+	}
+
+	FrameArena::FrameArena(unsigned frameLatency, size_t pageSize, size_t uploadBufferSize)
+	{
+		_pimpl = std::make_unique<Pimpl>();
+		_pimpl->_frameLatency = std::max(frameLatency, 1u);
+		_pimpl->_pageSize = pageSize;
+		_pimpl->_uploadBufferSize = std::max(uploadBufferSize, size_t(256));
+	}
+
+	FrameArena::~FrameArena() {}
+}}
@@ -0,0 +1,94 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#pragma once
+
+#include "../RenderUtils.h"
+#include "../../Utility/IteratorUtils.h"
+#include <memory>
+#include <type_traits>
+
+namespace RenderCore { class IThreadContext; class IResource; }
+
+namespace RenderCore { namespace Techniques
+{
+	/// <summary>Linear, frame fenced allocator for transient draw data</summary>
+	/// Serves two kinds of transient allocations:
+	///   <list>
+	///     <item>CPU side memory (such as per-drawable constants), allocated linearly from
+	///			pages that are recycled once the frame that used them has been retired</item>
+	///     <item>GPU upload space, allocated linearly from a single dynamic vertex/index buffer
+	///			that is used as a ring</item>
+	///   </list>
+	///
+	/// Memory allocated during a frame remains valid until OnFrameBarrier() has been called
+	/// "frameLatency" times. After the first few frames (once enough pages and a large enough
+	/// upload buffer exist) there are no heap or device allocations at all.
+	///
+	/// The arena is owned by the client (since a ParsingContext only lives for a single frame)
+	/// and is exposed to the render steps via ParsingContext::_frameArena. Allocation is thread
+	/// safe, so it can be used from draw functions while recording in parallel.
+	class FrameArena
+	{
+	public:
+		IteratorRange<void*> Allocate(size_t size, size_t alignment = 16);
+
+		/// <summary>Allocate a constant buffer packet from the arena</summary>
+		/// The packet isn't reference counted, and is only valid until the frame is retired.
+		SharedPkt AllocatePkt(size_t size);
+		SharedPkt MakePkt(const void* begin, const void* end);
+		template<typename Type, typename std::enable_if<!std::is_integral<Type>::value>::type* = nullptr>
+			SharedPkt MakePkt(const Type& input) { return MakePkt(&input, PtrAdd(&input, sizeof(Type))); }
+
+		struct UploadResult
+		{
+			IResource*			_resource = nullptr;
+			unsigned			_offset = 0;
+		};
+
+		/// <summary>Copy data into the upload ring, for use as vertex or index data</summary>
+		/// Must be called from the thread that owns the given context. The contents are only
+		/// guaranteed until the next call to Upload(), since that may wrap around the ring and
+		/// discard them; so draw calls that use the data must be recorded before then. The
+		/// resource itself stays alive until the frame has been retired, even if it is replaced
+		/// by a larger one.
+		UploadResult Upload(IThreadContext& context, IteratorRange<const void*> data);
+
+		/// <summary>Copy several blocks into the upload ring at once</summary>
+		/// Space for all of the blocks is reserved together, so they're valid at the same time
+		/// (eg, the vertex and index data for a packet). Empty blocks get an empty result.
+		/// Returns false if the upload buffer couldn't be mapped (and all results will be empty).
+		bool Upload(
+			IThreadContext& context,
+			IteratorRange<const IteratorRange<const void*>*> blocks,
+			IteratorRange<UploadResult*> results);
+
+		void OnFrameBarrier();
+
+		struct Metrics
+		{
+			unsigned	_frameIndex = 0;
+			size_t		_cpuBytesAllocated = 0;			///< in the current frame
+			size_t		_gpuBytesUploaded = 0;			///< in the current frame
+			unsigned	_cpuPageCount = 0;
+			unsigned	_cpuPagesInUse = 0;
+			size_t		_uploadBufferSize = 0;
+			unsigned	_heapAllocations = 0;			///< total pages ever created
+			unsigned	_deviceAllocations = 0;			///< total upload buffers ever created
+			unsigned	_uploadRingWraps = 0;
+		};
+		Metrics GetMetrics() const;
+
+		FrameArena(unsigned frameLatency = 2, size_t pageSize = 256*1024, size_t uploadBufferSize = 4*1024*1024);
+		~FrameArena();
+
+		FrameArena(const FrameArena&) = delete;
+		FrameArena& operator=(const FrameArena&) = delete;
+	private:
+		class Pimpl;
+		std::unique_ptr<Pimpl> _pimpl;
+	};
+}}
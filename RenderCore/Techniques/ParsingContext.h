@@ -27,6 +27,7 @@ namespace RenderCore { namespace Techniques
     class AttachmentPool;
 	class FrameBufferPool;
 	class IPipelineAcceleratorPool;
+	class FrameArena;
     
     /// <summary>Manages critical shader state</summary>
     /// Certain system variables are bound to the shaders, and managed by higher
@@ -52,6 +53,7 @@ namespace RenderCore { namespace Techniques
 		UniformsStream			GetGlobalUniformsStream() const;
         
 		RenderCore::Techniques::IPipelineAcceleratorPool* _pipelineAcceleratorPool = nullptr;
+		RenderCore::Techniques::FrameArena* _frameArena = nullptr;		///< transient per-frame storage (optional; owned by the client, since the ParsingContext only lives for a frame)
 
 		void AddUniformDelegate(uint64_t binding, const std::shared_ptr<IUniformBufferDelegate>&);
 		void RemoveUniformDelegate(uint64_t binding);
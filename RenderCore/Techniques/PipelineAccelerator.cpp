@@ -7,13 +7,26 @@
 #include "../Metal/DeviceContext.h"
 #include "../Metal/InputLayout.h"
 #include "../Assets/MaterialScaffold.h"
+#include "../UniformsStream.h"
 #include "../../Assets/AssetFuture.h"
+#include "../../Assets/IntermediateAssets.h"
+#include "../../Assets/IFileSystem.h"
+#include "../../ConsoleRig/GlobalServices.h"
+#include "../../ConsoleRig/Log.h"
+#include "../../Utility/Threading/Mutex.h"
+#include "../../Utility/Threading/CompletionThreadPool.h"
+#include "../../Utility/Streams/FileUtils.h"
+#include "../../Utility/Streams/PathUtils.h"
 #include "../../Utility/MemoryUtils.h"
 #include "../../Utility/StringFormat.h"
+#include <unordered_map>
+#include <atomic>
+#include <algorithm>
 #include <cctype>
 
 #include "Techniques.h"
 #include "TechniqueDelegates.h"
+#include "CompiledShaderPatchCollection.h"
 
 namespace RenderCore { namespace Techniques
 {
@@ -29,6 +42,8 @@ namespace RenderCore { namespace Techniques
 
 		FrameBufferDesc _fbDesc;
 		uint64_t _fbRelevanceValue = 0;
+
+		uint64_t _persistentHash = 0;		// (excludes the delegate, so it's stable from run to run)
 	};
 
 	class PipelineAccelerator : public std::enable_shared_from_this<PipelineAccelerator>
@@ -46,6 +61,8 @@ namespace RenderCore { namespace Techniques
 		struct Pipeline
 		{
 			::Assets::FuturePtr<Metal::GraphicsPipeline> _future;
+			::Assets::FuturePtr<Metal::ShaderProgram> _shaderFuture;
+			bool _precompileQueued = false;
 		};
 		std::vector<Pipeline> _finalPipelines;
 
@@ -65,6 +82,7 @@ namespace RenderCore { namespace Techniques
 		RenderCore::Assets::RenderStateSet _stateSet;
 
 		unsigned _ownerPoolId;
+		uint64_t _persistentHash = 0;
 
 		std::shared_ptr<Metal::GraphicsPipeline> InternalCreatePipeline(
 			const Metal::ShaderProgram& shader,
@@ -114,6 +132,7 @@ namespace RenderCore { namespace Techniques
 			_shaderPatches,
 			MakeIteratorRange(paramBoxes),
 			_stateSet);
+		result._shaderFuture = shader._shaderProgram;
 		
 		auto state = shader._shaderProgram->GetAssetState();
 		if (state == ::Assets::AssetState::Invalid) {
@@ -255,6 +274,13 @@ namespace RenderCore { namespace Techniques
 		const ::Assets::FuturePtr<Metal::GraphicsPipeline>& GetPipeline(PipelineAccelerator& pipelineAccelerator, const SequencerConfig& sequencerConfig) const;
 		const Metal::GraphicsPipeline* TryGetPipeline(PipelineAccelerator& pipelineAccelerator, const SequencerConfig& sequencerConfig) const;
 
+		Metal::BoundUniforms& GetBoundUniforms(
+			const Metal::GraphicsPipeline& pipeline,
+			const UniformsStreamInterface& group0,
+			const UniformsStreamInterface& group1,
+			const UniformsStreamInterface& group2,
+			const UniformsStreamInterface& group3) const;
+
 		void			SetGlobalSelector(StringSection<> name, IteratorRange<const void*> data, const ImpliedTyping::TypeDesc& type);
 		T1(Type) void   SetGlobalSelector(StringSection<> name, Type value);
 		void			RemoveGlobalSelector(StringSection<> name);
@@ -262,6 +288,11 @@ namespace RenderCore { namespace Techniques
 		void			SetFrameBufferProperties(const FrameBufferProperties& fbProps);
 		void			RebuildAllOutOfDatePipelines();
 
+		unsigned		PrecompilePipelines();
+		void			SavePipelineCache(const ::Assets::IntermediateAssets::Store& store) const;
+		void			LoadPipelineCache(const ::Assets::IntermediateAssets::Store& store);
+		Metrics			GetMetrics() const;
+
 		PipelineAcceleratorPool();
 		~PipelineAcceleratorPool();
 		PipelineAcceleratorPool(const PipelineAcceleratorPool&) = delete;
@@ -282,8 +313,88 @@ namespace RenderCore { namespace Techniques
 
 		void RebuildAllPipelines(unsigned poolGuid);
 		void RebuildAllPipelines(unsigned poolGuid, PipelineAccelerator& pipeline);
+
+		PipelineAccelerator::Pipeline CreatePipeline(PipelineAccelerator& accelerator, const SequencerConfig& cfg);
+
+			// Background completion of pipelines. The counters are shared with the queued tasks,
+			// since they can outlive the pool
+		std::vector<uint64_t> _cachedPipelineKeys;		// (sorted)
+		mutable std::atomic<unsigned> _pendingPipelineLookups;
+		unsigned _precompilesQueued = 0;
+		unsigned _cachedPipelineHits = 0;
+		std::shared_ptr<std::atomic<unsigned>> _precompilesCompleted;
+
+		void QueuePrecompile(PipelineAccelerator::Pipeline& pipeline);
+
+			// BoundUniforms are shared between all drawables using the same pipeline and interfaces.
+			// Lookups take a shared lock, so many threads can record drawables at the same time; we
+			// only need exclusive access when creating a new entry or evicting old ones
+		struct BoundUniformsEntry
+		{
+			uint64_t _pipelineGuid = 0;
+			std::unique_ptr<Metal::BoundUniforms> _boundUniforms;
+			mutable std::atomic<unsigned> _lastUsedFrame;
+			BoundUniformsEntry() : _lastUsedFrame(0) {}
+		};
+		mutable Threading::ReadWriteMutex _boundUniformsLock;
+		mutable std::unordered_map<uint64_t, BoundUniformsEntry> _boundUniforms;
+		std::atomic<unsigned> _boundUniformsFrame;
+
+		void EvictBoundUniforms(IteratorRange<const uint64_t*> rebuiltPipelineGuids);
 	};
 
+	static const unsigned s_boundUniformsMaxUnusedFrames = 256;
+
+	Metal::BoundUniforms& PipelineAcceleratorPool::GetBoundUniforms(
+		const Metal::GraphicsPipeline& pipeline,
+		const UniformsStreamInterface& group0,
+		const UniformsStreamInterface& group1,
+		const UniformsStreamInterface& group2,
+		const UniformsStreamInterface& group3) const
+	{
+			// (UniformsStreamInterface updates its hash as bindings are added, so GetHash() is just a read)
+		uint64_t hash = pipeline.GetGUID();
+		hash = HashCombine(group0.GetHash(), hash);
+		hash = HashCombine(group1.GetHash(), hash);
+		hash = HashCombine(group2.GetHash(), hash);
+		hash = HashCombine(group3.GetHash(), hash);
+
+		auto currentFrame = _boundUniformsFrame.load(std::memory_order_relaxed);
+		{
+			std::shared_lock<Threading::ReadWriteMutex> readLock(_boundUniformsLock);
+			auto i = _boundUniforms.find(hash);
+			if (i != _boundUniforms.end()) {
+				i->second._lastUsedFrame.store(currentFrame, std::memory_order_relaxed);
+				return *i->second._boundUniforms;
+			}
+		}
+
+		ScopedModifyLock(_boundUniformsLock);
+		auto& entry = _boundUniforms[hash];		// (another thread may have created it while we were unlocked)
+		if (!entry._boundUniforms) {
+			entry._pipelineGuid = pipeline.GetGUID();
+			entry._boundUniforms = std::make_unique<Metal::BoundUniforms>(
+				pipeline, Metal::PipelineLayoutConfig{},
+				group0, group1, group2, group3);
+		}
+		entry._lastUsedFrame.store(currentFrame, std::memory_order_relaxed);
+		return *entry._boundUniforms;
+	}
+
+	void PipelineAcceleratorPool::EvictBoundUniforms(IteratorRange<const uint64_t*> rebuiltPipelineGuids)
+	{
+		auto currentFrame = ++_boundUniformsFrame;
+		ScopedModifyLock(_boundUniformsLock);
+		for (auto i=_boundUniforms.begin(); i!=_boundUniforms.end();) {
+			bool evict = (currentFrame - i->second._lastUsedFrame.load(std::memory_order_relaxed)) > s_boundUniformsMaxUnusedFrames
+				|| std::find(rebuiltPipelineGuids.begin(), rebuiltPipelineGuids.end(), i->second._pipelineGuid) != rebuiltPipelineGuids.end();
+			if (evict) {
+				i = _boundUniforms.erase(i);
+			} else
+				++i;
+		}
+	}
+
 	const ::Assets::FuturePtr<Metal::GraphicsPipeline>& PipelineAcceleratorPool::GetPipeline(
 		PipelineAccelerator& pipelineAccelerator, 
 		const SequencerConfig& sequencerConfig) const
@@ -313,7 +424,10 @@ namespace RenderCore { namespace Techniques
 				Throw(std::runtime_error("Bad sequencer config id"));
 		#endif
 		
-		return pipelineAccelerator._finalPipelines[sequencerIdx]._future->TryActualize().get();
+		auto* result = pipelineAccelerator._finalPipelines[sequencerIdx]._future->TryActualize().get();
+		if (!result)
+			_pendingPipelineLookups.fetch_add(1, std::memory_order_relaxed);
+		return result;
 	}
 
 	SequencerConfig PipelineAcceleratorPool::MakeSequencerConfig(
@@ -339,6 +453,7 @@ namespace RenderCore { namespace Techniques
 
 		hash = HashCombine(sequencerSelectors.GetHash(), sequencerSelectors.GetParameterNamesHash());
 		hash = HashCombine(cfg._fbRelevanceValue, hash);
+		cfg._persistentHash = hash;
 
 		// todo -- we must take into account the delegate itself; it must impact the hash
 		hash = HashCombine(uint64_t(delegate.get()), hash);
@@ -398,6 +513,7 @@ namespace RenderCore { namespace Techniques
 			shaderPatches, materialSelectors,
 			inputAssembly, topology,
 			stateSet);
+		newAccelerator->_persistentHash = HashCombine(shaderPatches ? shaderPatches->GetGUID() : 0, hash);
 
 		if (i != _pipelineAccelerators.end() && i->first == hash) {
 			i->second = newAccelerator;		// (we replaced one that expired)
@@ -444,7 +560,7 @@ namespace RenderCore { namespace Techniques
 					if (a) {
 						auto& pipeline = a->PipelineForCfgId(cfgId);
 						if (!pipeline._future)
-							pipeline = a->CreatePipelineForSequencerState(*result, _fbProps, _globalSelectors);
+							pipeline = CreatePipeline(*a, *result);
 					}
 				}
 				
@@ -462,7 +578,7 @@ namespace RenderCore { namespace Techniques
 		for (auto& accelerator:_pipelineAccelerators) {
 			auto a = accelerator.second.lock();
 			if (a)
-				a->PipelineForCfgId(cfgId) = a->CreatePipelineForSequencerState(*result, _fbProps, _globalSelectors);
+				a->PipelineForCfgId(cfgId) = CreatePipeline(*a, *result);
 		}
 
 		return result;
@@ -474,7 +590,7 @@ namespace RenderCore { namespace Techniques
 			auto cfgId = SequencerConfigId(c) | (SequencerConfigId(poolGuid) << 32ull);
 			auto l = _sequencerConfigById[c].second.lock();
 			if (l) 
-				pipeline.PipelineForCfgId(cfgId) = pipeline.CreatePipelineForSequencerState(*l, _fbProps, _globalSelectors);
+				pipeline.PipelineForCfgId(cfgId) = CreatePipeline(pipeline, *l);
 		}
 	}
 
@@ -498,6 +614,8 @@ namespace RenderCore { namespace Techniques
 			auto l = _sequencerConfigById[c].second.lock();
 			lockedSequencerConfigs.emplace_back(std::move(l));
 		}
+
+		std::vector<uint64_t> rebuiltPipelineGuids;
 					
 		for (auto& accelerator:_pipelineAccelerators) {
 			auto a = accelerator.second.lock();
@@ -509,11 +627,169 @@ namespace RenderCore { namespace Techniques
 					auto& p = a->_finalPipelines[c];
 					if (p._future->GetAssetState() != ::Assets::AssetState::Pending && p._future->GetDependencyValidation()->GetValidationIndex() != 0) {
 						// It's out of date -- let's rebuild and reassign it
-						p = a->CreatePipelineForSequencerState(*lockedSequencerConfigs[c], _fbProps, _globalSelectors);
+						auto* oldPipeline = p._future->TryActualize().get();
+						if (oldPipeline)
+							rebuiltPipelineGuids.push_back(oldPipeline->GetGUID());
+						p = CreatePipeline(*a, *lockedSequencerConfigs[c]);
 					}
 				}
 			}
 		}
+
+		EvictBoundUniforms(MakeIteratorRange(rebuiltPipelineGuids));
+	}
+
+	static uint64_t MakePipelineCacheKey(const PipelineAccelerator& accelerator, const SequencerConfig& cfg)
+	{
+		return HashCombine(accelerator._persistentHash, cfg._persistentHash);
+	}
+
+	PipelineAccelerator::Pipeline PipelineAcceleratorPool::CreatePipeline(PipelineAccelerator& accelerator, const SequencerConfig& cfg)
+	{
+		auto result = accelerator.CreatePipelineForSequencerState(cfg, _fbProps, _globalSelectors);
+		if (!_cachedPipelineKeys.empty() && std::binary_search(_cachedPipelineKeys.begin(), _cachedPipelineKeys.end(), MakePipelineCacheKey(accelerator, cfg))) {
+			++_cachedPipelineHits;
+			QueuePrecompile(result);
+		}
+		return result;
+	}
+
+		// GL objects can only be created on a thread with the right context bound, so on that API
+		// background precompilation only waits for shaders
+	#if GFXAPI_TARGET == GFXAPI_OPENGLES
+		static const bool s_backgroundPipelineCreation = false;
+	#else
+		static const bool s_backgroundPipelineCreation = true;
+	#endif
+
+	void PipelineAcceleratorPool::QueuePrecompile(PipelineAccelerator::Pipeline& pipeline)
+	{
+		if (pipeline._precompileQueued || !pipeline._future || pipeline._future->GetAssetState() != ::Assets::AssetState::Pending)
+			return;
+
+		pipeline._precompileQueued = true;
+		++_precompilesQueued;
+		auto pipelineFuture = pipeline._future;
+		auto shaderFuture = pipeline._shaderFuture;
+		auto completed = _precompilesCompleted;
+		ConsoleRig::GlobalServices::GetInstance().GetLongTaskThreadPool().Enqueue(
+			[pipelineFuture, shaderFuture, completed]() {
+					// Shader compilation is the slow part. Once the shader is ready, polling the pipeline
+					// future constructs the pipeline object here. The result is swapped into the foreground
+					// at the next frame barrier, as normal
+				if (shaderFuture)
+					shaderFuture->StallWhilePending();
+				if (constant_expression<s_backgroundPipelineCreation>::result()) {
+					::Assets::AssetPtr<Metal::GraphicsPipeline> actualized;
+					::Assets::DepValPtr depVal;
+					::Assets::Blob actualizationLog;
+					while (pipelineFuture->CheckStatusBkgrnd(actualized, depVal, actualizationLog) == ::Assets::AssetState::Pending)
+						YieldToPool();
+				}
+				completed->fetch_add(1, std::memory_order_relaxed);
+			});
+	}
+
+	unsigned PipelineAcceleratorPool::PrecompilePipelines()
+	{
+		unsigned pendingCount = 0;
+		for (auto& accelerator:_pipelineAccelerators) {
+			auto a = accelerator.second.lock();
+			if (!a) continue;
+			for (unsigned c=0; c<std::min(_sequencerConfigById.size(), a->_finalPipelines.size()); ++c) {
+				auto& p = a->_finalPipelines[c];
+				if (!p._future || _sequencerConfigById[c].second.expired() || p._future->GetAssetState() != ::Assets::AssetState::Pending)
+					continue;
+				QueuePrecompile(p);
+				++pendingCount;
+			}
+		}
+		return pendingCount;
+	}
+
+	static const uint32_t s_pipelineCacheMagic = 0x48435050;		// 'PPCH'
+	static const uint32_t s_pipelineCacheVersion = 1;
+	static const char s_pipelineCacheName[] = "pipelines/pipelineaccelerators.cache";
+
+	void PipelineAcceleratorPool::SavePipelineCache(const ::Assets::IntermediateAssets::Store& store) const
+	{
+			// Record every combination that completed successfully, along with anything loaded from a
+			// previous cache (so pipelines that just weren't used in this session aren't forgotten)
+		std::vector<uint64_t> keys = _cachedPipelineKeys;
+		for (const auto& accelerator:_pipelineAccelerators) {
+			auto a = accelerator.second.lock();
+			if (!a) continue;
+			for (unsigned c=0; c<std::min(_sequencerConfigById.size(), a->_finalPipelines.size()); ++c) {
+				auto cfg = _sequencerConfigById[c].second.lock();
+				const auto& p = a->_finalPipelines[c];
+				if (cfg && p._future && p._future->GetAssetState() == ::Assets::AssetState::Ready)
+					keys.push_back(MakePipelineCacheKey(*a, *cfg));
+			}
+		}
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+		::Assets::ResChar filename[MaxPath];
+		store.MakeIntermediateName(filename, dimof(filename), s_pipelineCacheName);
+		::Assets::ResChar dirName[MaxPath];
+		XlDirname(dirName, dimof(dirName), filename);
+		RawFS::CreateDirectoryRecursive(dirName);
+
+		BasicFile file;
+		if (::Assets::MainFileSystem::TryOpen(file, filename, "wb") != ::Assets::IFileSystem::IOReason::Success) {
+			Log(Warning) << "Could not open pipeline cache file (" << filename << ") for writing" << std::endl;
+			return;
+		}
+		uint32_t header[] = { s_pipelineCacheMagic, s_pipelineCacheVersion, (uint32_t)keys.size() };
+		file.Write(header, sizeof(header), 1);
+		if (!keys.empty())
+			file.Write(keys.data(), sizeof(uint64_t), keys.size());
+	}
+
+	void PipelineAcceleratorPool::LoadPipelineCache(const ::Assets::IntermediateAssets::Store& store)
+	{
+		::Assets::ResChar filename[MaxPath];
+		store.MakeIntermediateName(filename, dimof(filename), s_pipelineCacheName);
+		size_t fileSize = 0;
+		auto fileData = ::Assets::TryLoadFileAsMemoryBlock(filename, &fileSize);
+		if (!fileData || fileSize < sizeof(uint32_t)*3) return;
+
+		auto* header = (const uint32_t*)fileData.get();
+		if (header[0] != s_pipelineCacheMagic || header[1] != s_pipelineCacheVersion
+			|| fileSize < sizeof(uint32_t)*3 + header[2]*sizeof(uint64_t)) {
+			Log(Warning) << "Ignoring invalid or out of date pipeline cache file (" << filename << ")" << std::endl;
+			return;
+		}
+
+		auto* keys = (const uint64_t*)PtrAdd(fileData.get(), sizeof(uint32_t)*3);
+		_cachedPipelineKeys.insert(_cachedPipelineKeys.end(), keys, keys + header[2]);
+		std::sort(_cachedPipelineKeys.begin(), _cachedPipelineKeys.end());
+		_cachedPipelineKeys.erase(std::unique(_cachedPipelineKeys.begin(), _cachedPipelineKeys.end()), _cachedPipelineKeys.end());
+
+			// Queue anything that already exists
+		for (auto& accelerator:_pipelineAccelerators) {
+			auto a = accelerator.second.lock();
+			if (!a) continue;
+			for (unsigned c=0; c<std::min(_sequencerConfigById.size(), a->_finalPipelines.size()); ++c) {
+				auto cfg = _sequencerConfigById[c].second.lock();
+				auto& p = a->_finalPipelines[c];
+				if (cfg && !p._precompileQueued && std::binary_search(_cachedPipelineKeys.begin(), _cachedPipelineKeys.end(), MakePipelineCacheKey(*a, *cfg))) {
+					++_cachedPipelineHits;
+					QueuePrecompile(p);
+				}
+			}
+		}
+	}
+
+	auto PipelineAcceleratorPool::GetMetrics() const -> Metrics
+	{
+		Metrics result;
+		result._pendingPipelineLookups = _pendingPipelineLookups.load(std::memory_order_relaxed);
+		result._precompilesQueued = _precompilesQueued;
+		result._precompilesCompleted = _precompilesCompleted->load(std::memory_order_relaxed);
+		result._cachedPipelineKeys = (unsigned)_cachedPipelineKeys.size();
+		result._cachedPipelineHits = _cachedPipelineHits;
+		return result;
 	}
 
 	void PipelineAcceleratorPool::SetGlobalSelector(StringSection<> name, IteratorRange<const void*> data, const ImpliedTyping::TypeDesc& type)
@@ -539,7 +815,10 @@ namespace RenderCore { namespace Techniques
 	static unsigned s_nextPipelineAcceleratorPoolGUID = 1;
 
 	PipelineAcceleratorPool::PipelineAcceleratorPool()
+	: _boundUniformsFrame(0)
+	, _pendingPipelineLookups(0)
 	{
+		_precompilesCompleted = std::make_shared<std::atomic<unsigned>>(0);
 		_guid = s_nextPipelineAcceleratorPoolGUID++;
 	}
 
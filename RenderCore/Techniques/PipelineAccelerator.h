@@ -17,9 +17,11 @@ namespace RenderCore
 	class FrameBufferDesc;
 	class FrameBufferProperties;
 	class InputElementDesc;
+	class UniformsStreamInterface;
 }
 
 namespace RenderCore { namespace Assets { class RenderStateSet; } }
+namespace Assets { namespace IntermediateAssets { class Store; } }
 
 namespace RenderCore { namespace Techniques
 {
@@ -52,6 +54,18 @@ namespace RenderCore { namespace Techniques
 		virtual const ::Assets::FuturePtr<Metal::GraphicsPipeline>& GetPipeline(PipelineAccelerator& pipelineAccelerator, const SequencerConfig& sequencerConfig) const = 0;
 		virtual const Metal::GraphicsPipeline* TryGetPipeline(PipelineAccelerator& pipelineAccelerator, const SequencerConfig& sequencerConfig) const = 0;
 
+		/// <summary>Find or create the BoundUniforms for a pipeline and set of uniform stream interfaces</summary>
+		/// Results are cached in the pool, keyed on the pipeline and the interface hashes. Safe to call
+		/// from multiple threads at once. The result remains valid until the next call to
+		/// RebuildAllOutOfDatePipelines() (which evicts entries for rebuilt pipelines, and
+		/// entries that haven't been used recently)
+		virtual Metal::BoundUniforms& GetBoundUniforms(
+			const Metal::GraphicsPipeline& pipeline,
+			const UniformsStreamInterface& group0,
+			const UniformsStreamInterface& group1,
+			const UniformsStreamInterface& group2,
+			const UniformsStreamInterface& group3) const = 0;
+
 		virtual void	SetGlobalSelector(StringSection<> name, IteratorRange<const void*> data, const ImpliedTyping::TypeDesc& type) = 0;
 		T1(Type) void   SetGlobalSelector(StringSection<> name, Type value);
 		virtual void	RemoveGlobalSelector(StringSection<> name) = 0;
@@ -59,6 +73,30 @@ namespace RenderCore { namespace Techniques
 		virtual void	SetFrameBufferProperties(const FrameBufferProperties& fbProps) = 0;
 		virtual void	RebuildAllOutOfDatePipelines() = 0;
 
+		/// <summary>Complete all known pipelines on background threads</summary>
+		/// Every combination of live pipeline accelerator and sequencer config that isn't finished yet is
+		/// queued on the long task thread pool. There it waits for its shader to compile, and (where the
+		/// graphics API allows it) constructs the pipeline object, so the first draw doesn't have to.
+		/// Intended to be called once per frame during a loading screen. Returns the number of pipelines
+		/// that are still pending (completed pipelines become visible at the next frame barrier).
+		virtual unsigned PrecompilePipelines() = 0;
+
+		/// <summary>Persist the combinations of pipeline accelerator and sequencer config that were completed</summary>
+		/// After LoadPipelineCache(), any combination recorded in the cache is queued for background
+		/// completion as soon as it's created, rather than waiting until it's first drawn.
+		virtual void	SavePipelineCache(const ::Assets::IntermediateAssets::Store& store) const = 0;
+		virtual void	LoadPipelineCache(const ::Assets::IntermediateAssets::Store& store) = 0;
+
+		struct Metrics
+		{
+			unsigned _pendingPipelineLookups = 0;		///< TryGetPipeline() calls that failed because the pipeline was pending (ie, skipped draws)
+			unsigned _precompilesQueued = 0;
+			unsigned _precompilesCompleted = 0;
+			unsigned _cachedPipelineKeys = 0;			///< loaded by LoadPipelineCache()
+			unsigned _cachedPipelineHits = 0;			///< pipelines queued because they were found in the pipeline cache
+		};
+		virtual Metrics GetMetrics() const = 0;
+
 		virtual ~IPipelineAcceleratorPool();
 
 		unsigned GetGUID() const { return _guid; }
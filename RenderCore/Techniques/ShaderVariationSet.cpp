@@ -16,6 +16,8 @@
 #include "../../Assets/Assets.h"
 #include "../../Assets/AssetFutureContinuation.h"
 #include "../../Utility/Streams/PreprocessorInterpreter.h"
+#include "../../Utility/Threading/Mutex.h"
+#include <atomic>
 
 namespace RenderCore { namespace Techniques
 {
@@ -41,7 +43,7 @@ namespace RenderCore { namespace Techniques
 	std::string MakeFilteredDefinesTable(
 		IteratorRange<const ParameterBox**> selectors,
 		const ShaderSelectorFiltering& techniqueFiltering,
-		const SelectorRelevanceMap& relevance)
+		const PreprocessorExpressionTable& relevance)
 	{
 		// Selectors are considered relevant only if they appear in the 
 		// baseTechniqueSelectors, or the condition in the relevance map succeeds
@@ -72,20 +74,17 @@ namespace RenderCore { namespace Techniques
 					passesTechniqueRelevanceMap = true;		// considered relevant, unless we explicitly fail in the condition just below
 				}
 
-				auto relevanceI = techniqueFiltering._relevanceMap.find(sourceIterator->Name().Cast<char>().AsString());
-				if (relevanceI != techniqueFiltering._relevanceMap.end()) {
+				auto* techniqueRelevance = techniqueFiltering.GetCompiledRelevanceMap().Find(sourceIterator->HashName());
+				if (techniqueRelevance) {
 					// Set a key called "value" to the new value we want to set
 					pBoxValue.SetParameter(u("value"), sourceIterator->RawValue(), sourceIterator->Type());
-					passesTechniqueRelevanceMap = EvaluatePreprocessorExpression(
-						relevanceI->second,
-						MakeIteratorRange(selectorsWithBaseTechnique));
+					passesTechniqueRelevanceMap = techniqueRelevance->Evaluate(MakeIteratorRange(selectorsWithBaseTechnique));
 				}
 
 				// see if we can pass the relevance check
-				relevanceI = relevance.find(sourceIterator->Name().Cast<char>().AsString());
-				if (relevanceI != relevance.end()) {
-					passesRelevanceMap = EvaluatePreprocessorExpression(
-						relevanceI->second,
+				auto* patchRelevance = relevance.Find(sourceIterator->HashName());
+				if (patchRelevance) {
+					passesRelevanceMap = patchRelevance->Evaluate(
 						MakeIteratorRange(AsPointer(selectorsWithBaseTechnique.begin()+1), AsPointer(selectorsWithBaseTechnique.end())));
 				}
 
@@ -101,43 +100,173 @@ namespace RenderCore { namespace Techniques
 		return BuildFlatStringTable(filteredBox);
 	}
 
+	namespace Internal
+	{
+		/// <summary>Insert-only hash table with lock-free lookups</summary>
+		/// Entries are never moved or destroyed before the table itself, so references to them can be
+		/// handed out freely. When the table grows a new slot array is published, but the old arrays
+		/// are kept alive, because readers may still be probing them.
+		/// Insert() must be called with _writeLock held.
+		template<typename Entry, uint64_t Entry::*KeyMember>
+			class InsertOnlyHashTable
+		{
+		public:
+			const Entry* Find(uint64_t key) const
+			{
+				auto* slots = _slots.load(std::memory_order_acquire);
+				for (auto i=unsigned(key)&slots->_mask;; i=(i+1)&slots->_mask) {
+					auto* e = slots->_entries[i].load(std::memory_order_acquire);
+					if (!e) return nullptr;
+					if ((e->*KeyMember) == key) return e;
+				}
+			}
+
+			/// Replaces any existing entry with the same key (but the old entry remains valid)
+			const Entry* Insert(std::unique_ptr<Entry>&& entry)
+			{
+				auto* slots = _slots.load(std::memory_order_relaxed);
+				if ((_count+1)*2 > slots->_mask+1)
+					slots = Grow();
+				auto* result = entry.get();
+				if (!Publish(*slots, result))
+					++_count;
+				_storage.push_back(std::move(entry));
+				return result;
+			}
+
+			unsigned GetCount() const { return _count; }
+
+			Threading::Mutex _writeLock;
+
+			InsertOnlyHashTable()
+			{
+				_allSlots.push_back(std::make_unique<Slots>(64));
+				_slots.store(_allSlots.back().get(), std::memory_order_release);
+			}
+		private:
+			struct Slots
+			{
+				std::unique_ptr<std::atomic<const Entry*>[]> _entries;
+				unsigned _mask;
+
+				Slots(unsigned count) : _entries(new std::atomic<const Entry*>[count]), _mask(count-1)
+				{
+					for (unsigned c=0; c<count; ++c)
+						_entries[c].store(nullptr, std::memory_order_relaxed);
+				}
+			};
+			std::atomic<Slots*> _slots;
+			std::vector<std::unique_ptr<Slots>> _allSlots;
+			std::vector<std::unique_ptr<Entry>> _storage;
+			unsigned _count = 0;
+
+			static bool Publish(Slots& slots, const Entry* entry)
+			{
+				auto key = entry->*KeyMember;
+				for (auto i=unsigned(key)&slots._mask;; i=(i+1)&slots._mask) {
+					auto* e = slots._entries[i].load(std::memory_order_relaxed);
+					if (!e || (e->*KeyMember) == key) {
+						slots._entries[i].store(entry, std::memory_order_release);
+						return e != nullptr;
+					}
+				}
+			}
+
+			Slots* Grow()
+			{
+				auto* oldSlots = _slots.load(std::memory_order_relaxed);
+				auto newSlots = std::make_unique<Slots>((oldSlots->_mask+1)*2);
+				for (unsigned c=0; c<=oldSlots->_mask; ++c)
+					if (auto* e = oldSlots->_entries[c].load(std::memory_order_relaxed))
+						Publish(*newSlots, e);
+				auto* result = newSlots.get();
+				_allSlots.push_back(std::move(newSlots));
+				_slots.store(result, std::memory_order_release);
+				return result;
+			}
+		};
+	}
+
+	class UniqueShaderVariationSet::Pimpl
+	{
+	public:
+		struct FilteredSelectors
+		{
+			uint64_t _inputHash;
+			uint64_t _filteredHashValue;
+			std::string _filteredSelectors;
+		};
+		Internal::InsertOnlyHashTable<FilteredSelectors, &FilteredSelectors::_inputHash> _globalToFiltered;
+		Internal::InsertOnlyHashTable<Variation, &Variation::_variationHash> _filteredToResolved;
+
+		std::atomic<unsigned> _filterHits { 0 }, _filterMisses { 0 };
+		std::atomic<unsigned> _variationHits { 0 }, _variationMisses { 0 };
+		std::atomic<unsigned> _invalidatedVariations { 0 };
+
+		static bool IsInvalidated(const Variation& v)
+		{
+			const auto& depVal = v._shaderFuture->GetDependencyValidation();
+			return depVal && depVal->GetValidationIndex() != 0;
+		}
+	};
+
 	auto UniqueShaderVariationSet::FindVariation(
 		IteratorRange<const ParameterBox**> selectors,
 		const ShaderSelectorFiltering& techniqueFiltering,
-		const SelectorRelevanceMap& relevance,
+		const PreprocessorExpressionTable& relevance,
 		IShaderVariationFactory& factory) const -> const Variation&
 	{
 		auto inputHash = Hash(selectors);
 		inputHash = HashCombine(techniqueFiltering.GetHash(), inputHash);
-		// todo -- we must include the relevance map in the hash
-
-		std::string filteredDefinesTable;
-		uint64_t filteredHashValue;
-
-        auto i = LowerBound(_globalToFiltered, inputHash);
-        if (i!=_globalToFiltered.cend() && i->first == inputHash) {
-            filteredHashValue = i->second._filteredHashValue;
-			filteredDefinesTable = i->second._filteredSelectors;
-        } else {
-			filteredDefinesTable = MakeFilteredDefinesTable(selectors, techniqueFiltering, relevance);
-			filteredHashValue = Hash64(filteredDefinesTable);
-			_globalToFiltered.insert(i, {inputHash, FilteredDefines{filteredHashValue, filteredDefinesTable}});
+		if (!relevance.IsEmpty())
+			inputHash = HashCombine(relevance.GetHash(), inputHash);
+
+		auto& pimpl = *_pimpl;
+		auto* filtered = pimpl._globalToFiltered.Find(inputHash);
+		if (filtered) {
+			pimpl._filterHits.fetch_add(1, std::memory_order_relaxed);
+		} else {
+				// Filtering is done outside of the lock. If 2 threads race to filter the same input,
+				// the first one to insert wins
+			auto newFiltered = std::make_unique<Pimpl::FilteredSelectors>();
+			newFiltered->_inputHash = inputHash;
+			newFiltered->_filteredSelectors = MakeFilteredDefinesTable(selectors, techniqueFiltering, relevance);
+			newFiltered->_filteredHashValue = Hash64(newFiltered->_filteredSelectors);
+
+			ScopedLock(pimpl._globalToFiltered._writeLock);
+			filtered = pimpl._globalToFiltered.Find(inputHash);
+			if (!filtered) {
+				filtered = pimpl._globalToFiltered.Insert(std::move(newFiltered));
+				pimpl._filterMisses.fetch_add(1, std::memory_order_relaxed);
+			} else
+				pimpl._filterHits.fetch_add(1, std::memory_order_relaxed);
 		}
 
-		filteredHashValue = HashCombine(filteredHashValue, factory._factoryGuid);
-
-		auto i3 = std::lower_bound(
-			_filteredToResolved.begin(), _filteredToResolved.end(), filteredHashValue,
-			[](const Variation& v, uint64_t h) { return v._variationHash < h; });
-        if (i3!=_filteredToResolved.cend() && i3->_variationHash == filteredHashValue) {
-			if (i3->_shaderFuture->GetDependencyValidation() && i3->_shaderFuture->GetDependencyValidation()->GetValidationIndex()!=0)
-				i3->_shaderFuture = factory.MakeShaderVariation(MakeStringSection(filteredDefinesTable));
-        } else {
-			auto newVariation = factory.MakeShaderVariation(MakeStringSection(filteredDefinesTable));
-			i3 = _filteredToResolved.insert(i3, {filteredHashValue, newVariation});
+		auto variationHash = HashCombine(filtered->_filteredHashValue, factory._factoryGuid);
+		auto* variation = pimpl._filteredToResolved.Find(variationHash);
+		if (variation && !Pimpl::IsInvalidated(*variation)) {
+			pimpl._variationHits.fetch_add(1, std::memory_order_relaxed);
+			return *variation;
 		}
 
-		return *i3;
+			// Shader construction is done within the lock, so we never build the same variation twice.
+			// An invalidated variation is replaced with a new entry, rather than modified in place,
+			// because other threads may be reading it
+		ScopedLock(pimpl._filteredToResolved._writeLock);
+		variation = pimpl._filteredToResolved.Find(variationHash);
+		if (variation) {
+			if (!Pimpl::IsInvalidated(*variation)) {
+				pimpl._variationHits.fetch_add(1, std::memory_order_relaxed);
+				return *variation;
+			}
+			pimpl._invalidatedVariations.fetch_add(1, std::memory_order_relaxed);
+		} else
+			pimpl._variationMisses.fetch_add(1, std::memory_order_relaxed);
+
+		auto newVariation = std::make_unique<Variation>();
+		newVariation->_variationHash = variationHash;
+		newVariation->_shaderFuture = factory.MakeShaderVariation(MakeStringSection(filtered->_filteredSelectors));
+		return *pimpl._filteredToResolved.Insert(std::move(newVariation));
 	}
 
 	auto UniqueShaderVariationSet::FindVariation(
@@ -148,11 +277,34 @@ namespace RenderCore { namespace Techniques
 		return FindVariation(
 			MakeIteratorRange(shaderSelectors, shaderSelectors + ShaderSelectorFiltering::Source::Max),
 			techniqueFiltering, 
-			{},
+			PreprocessorExpressionTable{},
 			factory);
 	}
 
-	UniqueShaderVariationSet::UniqueShaderVariationSet()  {}
+	auto UniqueShaderVariationSet::GetMetrics() const -> Metrics
+	{
+		Metrics result;
+		result._filterHits = _pimpl->_filterHits.load();
+		result._filterMisses = _pimpl->_filterMisses.load();
+		result._variationHits = _pimpl->_variationHits.load();
+		result._variationMisses = _pimpl->_variationMisses.load();
+		result._invalidatedVariations = _pimpl->_invalidatedVariations.load();
+		{
+			ScopedLock(_pimpl->_globalToFiltered._writeLock);
+			result._uniqueFilteredSelectors = _pimpl->_globalToFiltered.GetCount();
+		}
+		{
+			ScopedLock(_pimpl->_filteredToResolved._writeLock);
+			result._uniqueVariations = _pimpl->_filteredToResolved.GetCount();
+		}
+		return result;
+	}
+
+	UniqueShaderVariationSet::UniqueShaderVariationSet()
+	{
+		_pimpl = std::make_unique<Pimpl>();
+	}
+
 	UniqueShaderVariationSet::~UniqueShaderVariationSet() {}
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -8,6 +8,7 @@
 #include "../Metal/Forward.h"
 #include <unordered_map>
 #include <string>
+#include <memory>
 
 namespace RenderCore { namespace Techniques 
 {
@@ -29,10 +30,12 @@ namespace RenderCore { namespace Techniques
 
 	using SelectorRelevanceMap = std::unordered_map<std::string, std::string>;
 
+	/// The relevance conditions are compiled ahead of time (see CompiledShaderPatchCollection::Interface::GetCompiledSelectorRelevance()
+	/// and ShaderSelectorFiltering::GetCompiledRelevanceMap()), so evaluating them doesn't take any locks
 	std::string MakeFilteredDefinesTable(
 		IteratorRange<const ParameterBox**> selectors,
 		const ShaderSelectorFiltering& techniqueFiltering,
-		const SelectorRelevanceMap& relevance);
+		const PreprocessorExpressionTable& relevance);
 
 	/// <summary>Filters shader variation construction parameters to avoid construction of duplicate shaders</summary>
 	///
@@ -41,6 +44,10 @@ namespace RenderCore { namespace Techniques
 	/// to attempt to identify though which will result in duplicates.
 	///
 	/// UniqueShaderVariationSet maintains a list of previously generated shaders, which can be reused as appropriate.
+	///
+	/// FindVariation is thread safe. Lookups that hit previously seen construction parameters don't take
+	/// any locks or allocate; only the first lookup for a new set of parameters does.
+	/// The returned reference remains valid for the lifetime of the UniqueShaderVariationSet.
 	class UniqueShaderVariationSet
 	{
 	public:
@@ -58,20 +65,23 @@ namespace RenderCore { namespace Techniques
 		const Variation& FindVariation(
 			IteratorRange<const ParameterBox**> selectors,
 			const ShaderSelectorFiltering& techniqueFiltering,
-			const SelectorRelevanceMap& relevance,
+			const PreprocessorExpressionTable& relevance,
 			IShaderVariationFactory& factory) const;
 
+		struct Metrics
+		{
+			unsigned	_filterHits = 0, _filterMisses = 0;				///< lookups of the filtered selectors for a set of input selectors
+			unsigned	_variationHits = 0, _variationMisses = 0;		///< lookups of the shader for a set of filtered selectors
+			unsigned	_invalidatedVariations = 0;						///< shaders rebuilt after their dependencies changed
+			unsigned	_uniqueFilteredSelectors = 0, _uniqueVariations = 0;
+		};
+		Metrics GetMetrics() const;
+
 		UniqueShaderVariationSet();
 		~UniqueShaderVariationSet();
 	protected:
-		mutable std::vector<Variation>							_filteredToResolved;
-
-		struct FilteredDefines
-		{
-			uint64_t _filteredHashValue;
-			std::string _filteredSelectors;
-		};
-		mutable std::vector<std::pair<uint64_t, FilteredDefines>>		_globalToFiltered;
+		class Pimpl;
+		std::unique_ptr<Pimpl> _pimpl;
 	};
 
 	/// <summary>Provides convenient management of shader variations generated from a technique file</summary>
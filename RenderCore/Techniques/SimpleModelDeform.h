@@ -10,8 +10,10 @@
 #include "../../Utility/StringUtils.h"
 #include <vector>
 #include <functional>
+#include <memory>
 
 namespace RenderCore { namespace Assets { class ModelScaffold; }}
+namespace Utility { class CompletionThreadPool; }
 
 namespace RenderCore { namespace Techniques 
 {
@@ -70,5 +72,44 @@ namespace RenderCore { namespace Techniques
 		unsigned _nextDeformId;
 	};
 
-}}
+	namespace Internal
+	{
+		/// <summary>A deform operation, bound to the parts of the deform buffers it reads and writes</summary>
+		struct DeformOp
+		{
+			std::shared_ptr<IDeformOperation> _deformOp;
+
+			struct Element { Format _format = Format(0); unsigned _offset = 0; unsigned _stride = 0; unsigned _vbIdx = ~0u; };
+			std::vector<Element> _inputElements;
+			std::vector<Element> _outputElements;
+			unsigned _vertexCount = 0;
+		};
 
+		static const unsigned VB_StaticData = 0;			///< input data loaded from the model (read only)
+		static const unsigned VB_TemporaryDeform = 1;		///< intermediate data passed between deform operations
+		static const unsigned VB_PostDeform = 2;			///< final output, which goes into the dynamic vertex buffer
+
+		/// <summary>Returns true if "later" must wait for "earlier" to complete</summary>
+		/// This is the case when they access the same bytes of the temporary or post deform buffers,
+		/// and either of them writes (read-after-write, write-after-read or write-after-write).
+		bool HasDeformHazard(const DeformOp& earlier, const DeformOp& later);
+
+		/// <summary>Groups deform operations into waves that can be executed one after another</summary>
+		/// Operations within a wave don't depend on each other, and so can be run concurrently. Each
+		/// operation goes into the first wave after all of the earlier operations it depends on.
+		/// "schedule" receives operation indices in execution order, and "waveBounds" the index
+		/// into "schedule" where each wave begins (with the end of the schedule as the last entry).
+		void ScheduleDeformOps(
+			std::vector<unsigned>& schedule, std::vector<unsigned>& waveBounds,
+			IteratorRange<const DeformOp*> deformOps);
+
+		/// <summary>Executes deform operations according to a schedule from ScheduleDeformOps()</summary>
+		/// When there's a thread pool, the operations within each wave are split across it.
+		void ExecuteDeformOpWaves(
+			IteratorRange<const DeformOp*> deformOps,
+			IteratorRange<const unsigned*> schedule, IteratorRange<const unsigned*> waveBounds,
+			IteratorRange<void*> staticData, IteratorRange<void*> temporaryData, IteratorRange<void*> postDeformOutput,
+			Utility::CompletionThreadPool* threadPool);
+	}
+
+}}
@@ -7,6 +7,7 @@
 #include "Drawables.h"
 #include "TechniqueUtils.h"
 #include "ParsingContext.h"
+#include "FrameArena.h"
 #include "CommonBindings.h"
 #include "CommonUtils.h"
 #include "PipelineAccelerator.h"
@@ -33,8 +34,11 @@
 #include "../../Assets/AssetFuture.h"
 #include "../../Assets/IFileSystem.h"
 #include "../../Assets/AssetFutureContinuation.h"
+#include "../../Utility/Threading/CompletionThreadPool.h"
+#include "../../ConsoleRig/Log.h"
 #include <utility>
 #include <map>
+#include <thread>
 
 namespace RenderCore { namespace Techniques 
 {
@@ -55,8 +59,58 @@ namespace RenderCore { namespace Techniques
 		uint64_t _materialGuid;
 		unsigned _drawCallIdx;
 		std::vector<std::shared_ptr<IUniformBufferDelegate>> _extraUniformBufferDelegates;
+		std::shared_ptr<SimpleModelRenderer::DeformOutput> _deformOutput;		///< (only for models with deform operations)
 	};
 
+	class SimpleModelRenderer::DeformOutput
+	{
+	public:
+		std::shared_ptr<IResource> _dynVB;
+		unsigned _dynVBSize = 0;
+
+			// double buffered output from ExecuteDeformOps()
+		std::vector<uint8_t> _buffers[2];
+		unsigned _nextBuffer = 0;
+		std::atomic<unsigned> _readyBuffer;		///< index+1 of the buffer waiting to be uploaded, or 0
+		std::atomic<bool> _pending;				///< set while ExecuteDeformOps() is running in the background
+		Threading::Mutex _uploadLock;
+
+		void WaitForPending()
+		{
+				// (yields to the pool, so this is safe even if it's called from a pool thread)
+			while (_pending.load())
+				YieldToPool();
+		}
+
+		void Upload(Metal::DeviceContext& metalContext)
+		{
+				// (check _pending first; the output is marked as ready before _pending is cleared)
+			if (!_pending.load() && !_readyBuffer.load()) return;
+
+			WaitForPending();
+			ScopedLock(_uploadLock);
+			auto readyBuffer = _readyBuffer.exchange(0);
+			if (!readyBuffer) return;		// (someone else got here first)
+
+			auto* res = (Metal::Resource*)_dynVB->QueryInterface(typeid(Metal::Resource).hash_code());
+			assert(res);
+			Metal::ResourceMap map(metalContext, *res, Metal::ResourceMap::Mode::WriteDiscardPrevious);
+			const auto& buffer = _buffers[readyBuffer-1];
+			assert(map.GetData().size() >= buffer.size());
+			XlCopyMemory(map.GetData().begin(), buffer.data(), buffer.size());
+		}
+
+		DeformOutput() : _readyBuffer(0), _pending(false) {}
+	};
+
+	static void UploadDeformOutput(
+		const Techniques::Drawable::DrawFunctionContext& drawFnContext,
+		const SimpleModelDrawable& drawable)
+	{
+		if (drawable._deformOutput)
+			drawable._deformOutput->Upload(*drawFnContext._metalContext);
+	}
+
 	struct DrawCallProperties
 	{
 		uint64_t _materialGuid;
@@ -64,26 +118,37 @@ namespace RenderCore { namespace Techniques
 		unsigned _dummy;
 	};
 
-	static void DrawFn_SimpleModelStatic(
+	static void ApplySimpleModelUniforms(
 		Techniques::ParsingContext& parserContext,
 		const Techniques::Drawable::DrawFunctionContext& drawFnContext,
         const SimpleModelDrawable& drawable)
 	{
 		ConstantBufferView cbvs[6];
 		auto bindingField = drawFnContext.UniformBindingBitField();
-		cbvs[0] = {
-			Techniques::MakeLocalTransformPacket(
-				drawable._objectToWorld, 
-				ExtractTranslation(parserContext.GetProjectionDesc()._cameraToWorld))};
+			// (per-drawable constants come from the frame arena when there is one, so they don't touch the heap)
+		auto* frameArena = parserContext._frameArena;
+		auto localTransform = Techniques::MakeLocalTransform(
+			drawable._objectToWorld, 
+			ExtractTranslation(parserContext.GetProjectionDesc()._cameraToWorld));
+		cbvs[0] = frameArena ? frameArena->MakePkt(localTransform) : MakeSharedPkt(localTransform);
 		if (bindingField & (1<<1)) {
-			cbvs[1] = MakeSharedPkt(DrawCallProperties{drawable._materialGuid, drawable._drawCallIdx});
+			DrawCallProperties drawCallProperties{drawable._materialGuid, drawable._drawCallIdx};
+			cbvs[1] = frameArena ? frameArena->MakePkt(drawCallProperties) : MakeSharedPkt(drawCallProperties);
 		}
 		assert(dimof(cbvs) >= 2 + drawable._extraUniformBufferDelegates.size());
 		for (unsigned c=0; c<drawable._extraUniformBufferDelegates.size(); ++c)
 			if (bindingField & ((c+2)<<1))
 				cbvs[c+2] = drawable._extraUniformBufferDelegates[c]->WriteBuffer(parserContext, nullptr);
 		drawFnContext.ApplyUniforms(UniformsStream{MakeIteratorRange(cbvs)});
+	}
 
+	static void DrawFn_SimpleModelStatic(
+		Techniques::ParsingContext& parserContext,
+		const Techniques::Drawable::DrawFunctionContext& drawFnContext,
+        const SimpleModelDrawable& drawable)
+	{
+		UploadDeformOutput(drawFnContext, drawable);
+		ApplySimpleModelUniforms(parserContext, drawFnContext, drawable);
         drawFnContext.DrawIndexed(
 			drawable._drawCall._indexCount, drawable._drawCall._firstIndex, drawable._drawCall._firstVertex);
 	}
@@ -129,6 +194,7 @@ namespace RenderCore { namespace Techniques
 				drawable._materialGuid = geoCall._materialGuids[drawCall._subMaterialIndex];
 				drawable._drawCallIdx = drawCallCounter;
 				drawable._extraUniformBufferDelegates = _extraUniformBufferDelegates;
+				drawable._deformOutput = _deformOutput;
                 drawable._objectToWorld = Combine(rawGeo._geoSpaceToNodeSpace, geoCallToWorld);
 
 				++drawCallCounter;
@@ -165,6 +231,7 @@ namespace RenderCore { namespace Techniques
 				drawable._materialGuid = geoCall._materialGuids[drawCall._subMaterialIndex];
 				drawable._drawCallIdx = drawCallCounter;
 				drawable._extraUniformBufferDelegates = _extraUniformBufferDelegates;
+				drawable._deformOutput = _deformOutput;
 				drawable._objectToWorld = Combine(rawGeo._geoSpaceToNodeSpace, geoCallToWorld);
 
 				++drawCallCounter;
@@ -174,6 +241,158 @@ namespace RenderCore { namespace Techniques
         }
 	}
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	class SimpleModelDrawable_Instanced : public SimpleModelDrawable
+	{
+	public:
+		unsigned _instanceCount;
+	};
+
+	static void DrawFn_SimpleModelInstanced(
+		Techniques::ParsingContext& parserContext,
+		const Techniques::Drawable::DrawFunctionContext& drawFnContext,
+        const SimpleModelDrawable_Instanced& drawable)
+	{
+			// (_objectToWorld is the transform into the space of the instance here; the shader
+			// combines it with the per-instance transform from the instance stream)
+		UploadDeformOutput(drawFnContext, drawable);
+		ApplySimpleModelUniforms(parserContext, drawFnContext, drawable);
+		drawFnContext.DrawIndexedInstances(
+			drawable._drawCall._indexCount, drawable._instanceCount, drawable._drawCall._firstIndex, drawable._drawCall._firstVertex);
+	}
+
+	bool Internal::UseInstancedDrawables(size_t instanceCount, unsigned skinCallCount)
+	{
+		return instanceCount >= SimpleModelRenderer::s_minInstancedBatch && skinCallCount == 0;
+	}
+
+	unsigned Internal::WriteInstanceTransforms(DrawablesPacket& pkt, IteratorRange<const Float4x4*> instanceLocalToWorld)
+	{
+		auto storage = pkt.AllocateStorage(DrawablesPacket::Storage::VB, instanceLocalToWorld.size() * 12 * sizeof(float));
+		auto* dst = (float*)storage._data.begin();
+		for (const auto& localToWorld:instanceLocalToWorld)
+			for (unsigned r=0; r<3; ++r)
+				for (unsigned q=0; q<4; ++q)
+					*dst++ = localToWorld(r, q);
+		return storage._startOffset;
+	}
+
+	std::shared_ptr<DrawableGeo> Internal::MakeInstancedGeo(const DrawableGeo& geo, unsigned instanceDataOffset)
+	{
+		assert(geo._vertexStreamCount < dimof(geo._vertexStreams));
+		auto result = std::make_shared<DrawableGeo>(geo);
+		result->_vertexStreams[result->_vertexStreamCount] = DrawableGeo::VertexStream{nullptr, instanceDataOffset};
+		++result->_vertexStreamCount;
+		result->_flags |= DrawableGeo::Flags::Temporary;
+		return result;
+	}
+
+	bool SimpleModelRenderer::BuildInstancedDrawables(
+		IteratorRange<Techniques::DrawablesPacket** const> pkts,
+		IteratorRange<const Float4x4*> instanceLocalToWorld) const
+	{
+		const auto& cmdStream = _modelScaffold->CommandStream();
+		if (!Internal::UseInstancedDrawables(instanceLocalToWorld.size(), cmdStream.GetSkinCallCount())) {
+			for (const auto& localToWorld:instanceLocalToWorld)
+				BuildDrawables(pkts, localToWorld);
+			return false;
+		}
+
+		if (!_instancedPipelinesBuilt.load(std::memory_order_acquire))
+			BuildInstancedPipelines();
+
+			//	Write the instance transforms into the vertex storage of each packet we're going
+			//	to draw into. All of the draw calls in the model share the same instance data
+		const unsigned instanceCount = (unsigned)instanceLocalToWorld.size();
+		SimpleModelDrawable_Instanced* drawables[dimof(_drawablesCount)];
+		unsigned instanceDataOffset[dimof(_drawablesCount)];
+		for (unsigned c=0; c<dimof(_drawablesCount); ++c) {
+			if (!_drawablesCount[c]) {
+				drawables[c] = nullptr;
+				continue;
+			}
+			if (!pkts[c])
+				Throw(::Exceptions::BasicLabel("Drawables packet not provided for batch filter %i", c));
+			drawables[c] = pkts[c]->_drawables.Allocate<SimpleModelDrawable_Instanced>(_drawablesCount[c]);
+			instanceDataOffset[c] = Internal::WriteInstanceTransforms(*pkts[c], instanceLocalToWorld);
+		}
+
+		unsigned drawCallCounter = 0;
+        const auto& immData = _modelScaffold->ImmutableData();
+		auto geoCallIterator = _geoCalls.begin();
+        for (unsigned c = 0; c < cmdStream.GetGeoCallCount(); ++c) {
+            const auto& geoCall = cmdStream.GetGeoCall(c);
+            auto& rawGeo = immData._geos[geoCall._geoId];
+
+			auto machineOutput = _skeletonBinding.ModelJointToMachineOutput(geoCall._transformMarker);
+            assert(machineOutput < _baseTransformCount);
+			auto geoToInstance = Combine(rawGeo._geoSpaceToNodeSpace, _baseTransforms[machineOutput]);
+
+				// The instanced geo is the normal geo, with the instance stream appended. Draw calls
+				// for the same geo normally share a batch filter, so this is usually built once
+			std::shared_ptr<DrawableGeo> instancedGeos[dimof(_drawablesCount)];
+
+            for (unsigned d = 0; d < unsigned(rawGeo._drawCalls.size()); ++d) {
+                const auto& drawCall = rawGeo._drawCalls[d];
+				const auto& compiledGeoCall = geoCallIterator[drawCall._subMaterialIndex];
+				auto batchFilter = compiledGeoCall._batchFilter;
+
+				auto& instancedGeo = instancedGeos[batchFilter];
+				if (!instancedGeo) {
+					assert(compiledGeoCall._instanceStreamIdx == _geos[geoCall._geoId]->_vertexStreamCount);
+					instancedGeo = Internal::MakeInstancedGeo(*_geos[geoCall._geoId], instanceDataOffset[batchFilter]);
+				}
+
+				auto& drawable = *drawables[batchFilter]++;
+				drawable._geo = instancedGeo;
+				drawable._pipeline = compiledGeoCall._instancedPipelineAccelerator;
+				drawable._descriptorSet = compiledGeoCall._compiledDescriptorSet->TryActualize();
+				drawable._drawFn = (Techniques::Drawable::ExecuteDrawFn*)&DrawFn_SimpleModelInstanced;
+				drawable._drawCall = drawCall;
+				drawable._uniformsInterface = _usi;
+				drawable._materialGuid = geoCall._materialGuids[drawCall._subMaterialIndex];
+				drawable._drawCallIdx = drawCallCounter;
+				drawable._extraUniformBufferDelegates = _extraUniformBufferDelegates;
+				drawable._deformOutput = _deformOutput;
+				drawable._objectToWorld = geoToInstance;
+				drawable._instanceCount = instanceCount;
+
+				++drawCallCounter;
+            }
+
+			geoCallIterator += geoCall._materialCount;
+        }
+		return true;
+	}
+
+	struct SimpleModelRenderer::InstancedPipelineDesc
+	{
+		std::shared_ptr<CompiledShaderPatchCollection> _patchCollection;
+		ParameterBox _materialSelectors;
+		std::vector<InputElementDesc> _inputElements;
+		Topology _topology;
+		RenderCore::Assets::RenderStateSet _stateSet;
+	};
+
+	void SimpleModelRenderer::BuildInstancedPipelines() const
+	{
+		ScopedLock(_instancedPipelinesLock);
+		if (_instancedPipelinesBuilt.load()) return;
+		for (const auto& geoCall:_geoCalls) {
+			if (!geoCall._instancedPipelineDesc) continue;
+			const auto& desc = *geoCall._instancedPipelineDesc;
+			geoCall._instancedPipelineAccelerator =
+				_pipelineAcceleratorPool->CreatePipelineAccelerator(
+					desc._patchCollection,
+					desc._materialSelectors,
+					MakeIteratorRange(desc._inputElements),
+					desc._topology,
+					desc._stateSet);
+		}
+		_instancedPipelinesBuilt.store(true, std::memory_order_release);
+	}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 	class SimpleModelDrawable_Delegate : public SimpleModelDrawable
@@ -239,6 +458,7 @@ namespace RenderCore { namespace Techniques
 				drawable._materialGuid = geoCall._materialGuids[drawCall._subMaterialIndex];
 				drawable._drawCallIdx = drawCallCounter;
 				drawable._delegate = delegate;
+				drawable._deformOutput = _deformOutput;
                 drawable._objectToWorld = Combine(rawGeo._geoSpaceToNodeSpace, geoCallToWorld);
 
 				++drawCallCounter;
@@ -275,6 +495,7 @@ namespace RenderCore { namespace Techniques
 				drawable._materialGuid = geoCall._materialGuids[drawCall._subMaterialIndex];
 				drawable._drawCallIdx = drawCallCounter;
 				drawable._delegate = delegate;
+				drawable._deformOutput = _deformOutput;
 				drawable._objectToWorld = Combine(rawGeo._geoSpaceToNodeSpace, geoCallToWorld);
 
 				++drawCallCounter;
@@ -286,74 +507,197 @@ namespace RenderCore { namespace Techniques
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	struct SimpleModelRenderer::DeformOp
+	using Internal::VB_StaticData;
+	using Internal::VB_TemporaryDeform;
+	using Internal::VB_PostDeform;
+
+	static void ExecuteDeformOp(
+		const SimpleModelRenderer::DeformOp& d,
+		IteratorRange<void*> staticDataPartRange,
+		IteratorRange<void*> temporaryDeformRange,
+		IteratorRange<void*> outputPartRange)
 	{
-		std::shared_ptr<IDeformOperation> _deformOp;
+		IDeformOperation::VertexElementRange inputElementRanges[16];
+		assert(d._inputElements.size() <= dimof(inputElementRanges));
+		for (unsigned c=0; c<d._inputElements.size(); ++c) {
+			if (d._inputElements[c]._vbIdx == VB_StaticData) {
+				inputElementRanges[c] = MakeVertexIteratorRangeConst(
+					MakeIteratorRange(PtrAdd(staticDataPartRange.begin(), d._inputElements[c]._offset), staticDataPartRange.end()),
+					d._inputElements[c]._stride, d._inputElements[c]._format);
+			} else {
+				assert(d._inputElements[c]._vbIdx == VB_TemporaryDeform);
+				inputElementRanges[c] = MakeVertexIteratorRangeConst(
+					MakeIteratorRange(PtrAdd(temporaryDeformRange.begin(), d._inputElements[c]._offset), temporaryDeformRange.end()),
+					d._inputElements[c]._stride, d._inputElements[c]._format);
+			}
+		}
 
-		struct Element { Format _format = Format(0); unsigned _offset = 0; unsigned _stride = 0; unsigned _vbIdx = ~0u; };
-		std::vector<Element> _inputElements;
-		std::vector<Element> _outputElements;
-	};
+		assert(outputPartRange.begin() < outputPartRange.end());
+
+		IDeformOperation::VertexElementRange outputElementRanges[16];
+		assert(d._outputElements.size() <= dimof(outputElementRanges));
+		for (unsigned c=0; c<d._outputElements.size(); ++c) {
+			if (d._outputElements[c]._vbIdx == VB_PostDeform) {
+				outputElementRanges[c] = MakeVertexIteratorRangeConst(
+					MakeIteratorRange(PtrAdd(outputPartRange.begin(), d._outputElements[c]._offset), outputPartRange.end()),
+					d._outputElements[c]._stride, d._outputElements[c]._format);
+			} else {
+				assert(d._outputElements[c]._vbIdx == VB_TemporaryDeform);
+				outputElementRanges[c] = MakeVertexIteratorRangeConst(
+					MakeIteratorRange(PtrAdd(temporaryDeformRange.begin(), d._outputElements[c]._offset), temporaryDeformRange.end()),
+					d._outputElements[c]._stride, d._outputElements[c]._format);
+			}
+		}
+
+		// Execute the actual deform op
+		d._deformOp->Execute(
+			MakeIteratorRange(inputElementRanges, &inputElementRanges[d._inputElements.size()]),
+			MakeIteratorRange(outputElementRanges, &outputElementRanges[d._outputElements.size()]));
+	}
+
+	namespace Internal
+	{
+		static std::pair<size_t, size_t> ElementByteRange(const DeformOp::Element& e, unsigned vertexCount)
+		{
+			// Interleaved elements are treated as covering the whole span between their first and
+			// last vertex; so neighbours in the same vertex are considered to overlap
+			if (!vertexCount) return {e._offset, e._offset};
+			return {e._offset, e._offset + size_t(e._stride) * (vertexCount-1) + BitsPerPixel(e._format) / 8};
+		}
+
+		static bool Overlaps(
+			const DeformOp::Element& lhs, unsigned lhsVertexCount,
+			const DeformOp::Element& rhs, unsigned rhsVertexCount)
+		{
+			if (lhs._vbIdx != rhs._vbIdx || lhs._vbIdx == VB_StaticData || lhs._vbIdx == ~0u) return false;
+			auto l = ElementByteRange(lhs, lhsVertexCount), r = ElementByteRange(rhs, rhsVertexCount);
+			return l.first < r.second && r.first < l.second;
+		}
+
+		bool HasDeformHazard(const DeformOp& earlier, const DeformOp& later)
+		{
+			for (const auto& w:earlier._outputElements) {
+				for (const auto& r:later._inputElements)
+					if (Overlaps(w, earlier._vertexCount, r, later._vertexCount)) return true;		// read after write
+				for (const auto& w2:later._outputElements)
+					if (Overlaps(w, earlier._vertexCount, w2, later._vertexCount)) return true;		// write after write
+			}
+			for (const auto& r:earlier._inputElements)
+				for (const auto& w:later._outputElements)
+					if (Overlaps(r, earlier._vertexCount, w, later._vertexCount)) return true;		// write after read
+			return false;
+		}
 
-	static unsigned VB_StaticData = 0;
-	static unsigned VB_TemporaryDeform = 1;
-	static unsigned VB_PostDeform = 2;
+		void ScheduleDeformOps(
+			std::vector<unsigned>& schedule, std::vector<unsigned>& waveBounds,
+			IteratorRange<const DeformOp*> deformOps)
+		{
+			std::vector<std::pair<unsigned, unsigned>> waveAndOp;
+			waveAndOp.reserve(deformOps.size());
+			for (unsigned op=0; op<deformOps.size(); ++op) {
+				unsigned wave = 0;
+				for (unsigned earlierOp=0; earlierOp<op; ++earlierOp)
+					if (HasDeformHazard(deformOps[earlierOp], deformOps[op]))
+						wave = std::max(wave, waveAndOp[earlierOp].first+1);
+				waveAndOp.push_back({wave, op});
+			}
+
+			std::sort(waveAndOp.begin(), waveAndOp.end());
+			schedule.clear();
+			waveBounds.clear();
+			schedule.reserve(waveAndOp.size());
+			for (unsigned c=0; c<waveAndOp.size(); ++c) {
+				if (c == 0 || waveAndOp[c].first != waveAndOp[c-1].first)
+					waveBounds.push_back(c);
+				schedule.push_back(waveAndOp[c].second);
+			}
+			waveBounds.push_back((unsigned)schedule.size());
+		}
 
-	void SimpleModelRenderer::GenerateDeformBuffer(IThreadContext& context)
+		void ExecuteDeformOpWaves(
+			IteratorRange<const DeformOp*> deformOps,
+			IteratorRange<const unsigned*> schedule, IteratorRange<const unsigned*> waveBounds,
+			IteratorRange<void*> staticData, IteratorRange<void*> temporaryData, IteratorRange<void*> postDeformOutput,
+			Utility::CompletionThreadPool* threadPool)
+		{
+			for (unsigned w=0; w+1<waveBounds.size(); ++w) {
+				auto waveBegin = waveBounds[w], waveEnd = waveBounds[w+1];
+				auto executeRange = [&, waveBegin](unsigned, unsigned begin, unsigned end) {
+					for (unsigned c=waveBegin+begin; c<waveBegin+end; ++c)
+						ExecuteDeformOp(deformOps[schedule[c]], staticData, temporaryData, postDeformOutput);
+				};
+
+				auto opCount = waveEnd - waveBegin;
+				if (threadPool && threadPool->IsGood() && opCount > 1) {
+					ExecuteRangesParallel(*threadPool, opCount, std::min(opCount, std::max(1u, std::thread::hardware_concurrency())), executeRange);
+				} else
+					executeRange(0, 0, opCount);
+			}
+		}
+	}
+
+	void SimpleModelRenderer::RunDeformOps(IteratorRange<void*> postDeformOutput, Utility::CompletionThreadPool* threadPool)
 	{
-		if (!_dynVB) return;
+		Internal::ExecuteDeformOpWaves(
+			MakeIteratorRange(_deformOps), MakeIteratorRange(_deformOpSchedule), MakeIteratorRange(_deformWaveBounds),
+			MakeIteratorRange(_deformStaticDataInput), MakeIteratorRange(_deformTemporaryBuffer), postDeformOutput,
+			threadPool);
+	}
+
+	void SimpleModelRenderer::GenerateDeformBuffer(IThreadContext& context, Utility::CompletionThreadPool* threadPool)
+	{
+		if (!_deformOutput) return;
 
 		auto& metalContext = *RenderCore::Metal::DeviceContext::Get(context);
+		if (_deferredDeformOutput.load()) {
+				// The deform ops have been started by ExecuteDeformOps(); we only need to upload the result.
+				// If there's nothing new, the buffer retains what was uploaded last time
+			_deformOutput->Upload(metalContext);
+			return;
+		}
 
-		auto* res = (Metal::Resource*)_dynVB->QueryInterface(typeid(Metal::Resource).hash_code());
+		auto* res = (Metal::Resource*)_deformOutput->_dynVB->QueryInterface(typeid(Metal::Resource).hash_code());
 		assert(res);
 
 		Metal::ResourceMap map(metalContext, *res, Metal::ResourceMap::Mode::WriteDiscardPrevious);
 		auto dst = map.GetData();
+		assert(dst.size() >= _deformOutput->_dynVBSize);
+		RunDeformOps(dst, threadPool);
+	}
 
-		auto staticDataPartRange = MakeIteratorRange(_deformStaticDataInput);
-		auto temporaryDeformRange = MakeIteratorRange(_deformTemporaryBuffer);
-
-		for (const auto&d:_deformOps) {
+	void SimpleModelRenderer::ExecuteDeformOps(Utility::CompletionThreadPool* threadPool)
+	{
+		if (!_deformOutput) return;
 
-			IDeformOperation::VertexElementRange inputElementRanges[16];
-			assert(d._inputElements.size() <= dimof(inputElementRanges));
-			for (unsigned c=0; c<d._inputElements.size(); ++c) {
-				if (d._inputElements[c]._vbIdx == VB_StaticData) {
-					inputElementRanges[c] = MakeVertexIteratorRangeConst(
-						MakeIteratorRange(PtrAdd(staticDataPartRange.begin(), d._inputElements[c]._offset), staticDataPartRange.end()),
-						d._inputElements[c]._stride, d._inputElements[c]._format);
-				} else {
-					assert(d._inputElements[c]._vbIdx == VB_TemporaryDeform);
-					inputElementRanges[c] = MakeVertexIteratorRangeConst(
-						MakeIteratorRange(PtrAdd(temporaryDeformRange.begin(), d._inputElements[c]._offset), temporaryDeformRange.end()),
-						d._inputElements[c]._stride, d._inputElements[c]._format);
-				}
-			}
+		auto& deformOutput = *_deformOutput;
+		deformOutput.WaitForPending();
+		_deferredDeformOutput.store(true);
 
-			auto outputPartRange = dst;
-			assert(outputPartRange.begin() < outputPartRange.end() && PtrDiff(outputPartRange.end(), dst.begin()) <= ptrdiff_t(dst.size()));
+		auto bufferIdx = deformOutput._nextBuffer;
+		deformOutput._nextBuffer ^= 1;
+		auto& buffer = deformOutput._buffers[bufferIdx];
+		buffer.resize(deformOutput._dynVBSize);
 
-			IDeformOperation::VertexElementRange outputElementRanges[16];
-			assert(d._outputElements.size() <= dimof(outputElementRanges));
-			for (unsigned c=0; c<d._outputElements.size(); ++c) {
-				if (d._outputElements[c]._vbIdx == VB_PostDeform) {
-					outputElementRanges[c] = MakeVertexIteratorRangeConst(
-						MakeIteratorRange(PtrAdd(outputPartRange.begin(), d._outputElements[c]._offset), outputPartRange.end()),
-						d._outputElements[c]._stride, d._outputElements[c]._format);
-				} else {
-					assert(d._outputElements[c]._vbIdx == VB_TemporaryDeform);
-					outputElementRanges[c] = MakeVertexIteratorRangeConst(
-						MakeIteratorRange(PtrAdd(temporaryDeformRange.begin(), d._outputElements[c]._offset), temporaryDeformRange.end()),
-						d._outputElements[c]._stride, d._outputElements[c]._format);
-				}
-			}
-
-			// Execute the actual deform op
-			d._deformOp->Execute(
-				MakeIteratorRange(inputElementRanges, &inputElementRanges[d._inputElements.size()]),
-				MakeIteratorRange(outputElementRanges, &outputElementRanges[d._outputElements.size()]));
+		if (!threadPool || !threadPool->IsGood()) {
+			RunDeformOps(MakeIteratorRange(buffer), nullptr);
+			deformOutput._readyBuffer.store(bufferIdx+1);
+			return;
 		}
+
+			// Run in the background. The drawables that use the output wait for this to finish when
+			// they're drawn (or GenerateDeformBuffer() does, if it's called first)
+		deformOutput._pending.store(true);
+		threadPool->EnqueueBasic(
+			[this, bufferIdx, threadPool]() {
+				auto& deformOutput = *_deformOutput;
+				TRY {
+					RunDeformOps(MakeIteratorRange(deformOutput._buffers[bufferIdx]), threadPool);
+					deformOutput._readyBuffer.store(bufferIdx+1);
+				} CATCH(const std::exception& e) {
+					Log(Warning) << "Deform operations failed for model (" << _modelScaffoldName << "): " << e.what() << std::endl;
+				} CATCH_END
+				deformOutput._pending.store(false);
+			});
 	}
 
 	unsigned SimpleModelRenderer::DeformOperationCount() const { return (unsigned)_deformOps.size(); }
@@ -579,6 +923,7 @@ namespace RenderCore { namespace Techniques
 					}
 				}
 				finalDeformOp._deformOp = wdo._deformOp;
+				finalDeformOp._vertexCount = vertexCount;
 				result._deformOps.emplace_back(std::move(finalDeformOp));
 			}
 
@@ -674,7 +1019,7 @@ namespace RenderCore { namespace Techniques
 						auto vbData = std::make_unique<uint8_t[]>(geo._vb._size);
 						largeBlocks->Seek(base + geo._vb._offset);
 						largeBlocks->Read(vbData.get(), geo._vb._size);
-						ReadStaticData(MakeIteratorRange(result), MakeIteratorRange(vbData.get(), PtrAdd(vbData.get(), geo._vb._size)), r, *sourceEle, geo._animatedVertexElements._ia._vertexStride);
+						ReadStaticData(MakeIteratorRange(result), MakeIteratorRange(vbData.get(), PtrAdd(vbData.get(), geo._vb._size)), r, *sourceEle, geo._vb._ia._vertexStride);
 						initializedElement = true;
 					} else {
 						sourceEle = FindElement(MakeIteratorRange(geo._animatedVertexElements._ia._elements), r._sourceStream);
@@ -784,7 +1129,8 @@ namespace RenderCore { namespace Techniques
 			GeoCall MakeGeoCall(
 				uint64_t materialGuid,
 				const RawGeoType& rawGeo,
-				const Internal::NascentDeformStream& deformStream)
+				const Internal::NascentDeformStream& deformStream,
+				bool buildInstancedPipeline = false)
 		{
 			GeoCall resultGeoCall;
 			const auto* mat = _materialScaffold->GetMaterial(materialGuid);
@@ -848,6 +1194,25 @@ namespace RenderCore { namespace Techniques
 					topology,
 					mat->_stateSet);
 
+			if (buildInstancedPipeline) {
+				// The instanced variant reads a 3x4 transform for each instance from an extra vertex
+				// stream, bound after the geo's own streams. Most models are never drawn instanced,
+				// so we only record what's needed here, and create the pipeline on demand
+				unsigned instanceSlot = 0;
+				for (const auto& e:inputElements)
+					instanceSlot = std::max(instanceSlot, e._inputSlot+1);
+				auto desc = std::make_shared<InstancedPipelineDesc>();
+				desc->_patchCollection = i->second._compiledPatchCollection;
+				desc->_materialSelectors = matSelectors;
+				desc->_inputElements = inputElements;
+				for (unsigned r=0; r<3; ++r)
+					desc->_inputElements.push_back(InputElementDesc{"INSTANCE_TRANSFORM", r, Format::R32G32B32A32_FLOAT, instanceSlot, r*16, InputDataRate::PerInstance, 1});
+				desc->_topology = topology;
+				desc->_stateSet = mat->_stateSet;
+				resultGeoCall._instancedPipelineDesc = std::move(desc);
+				resultGeoCall._instanceStreamIdx = instanceSlot;
+			}
+
 			resultGeoCall._batchFilter = (unsigned)BatchFilter::General;
 			if (mat->_stateSet._forwardBlendOp == BlendOp::NoBlending) {
                 resultGeoCall._batchFilter = (unsigned)BatchFilter::General;
@@ -877,6 +1242,7 @@ namespace RenderCore { namespace Techniques
 		const std::string& materialScaffoldName)
 	: _modelScaffold(modelScaffold)
 	, _materialScaffold(materialScaffold)
+	, _pipelineAcceleratorPool(pipelineAcceleratorPool)
 	, _modelScaffoldName(modelScaffoldName)
 	, _materialScaffoldName(materialScaffoldName)
 	{
@@ -978,7 +1344,7 @@ namespace RenderCore { namespace Techniques
 			// here (since many draw calls will share the same materials, etc). We should avoid unnecessary
 			// duplication of objects and construction work
             for (unsigned d = 0; d < unsigned(geoCall._materialCount); ++d) {
-				_geoCalls.emplace_back(geoCallBuilder.MakeGeoCall(geoCall._materialGuids[d], rawGeo, deform));
+				_geoCalls.emplace_back(geoCallBuilder.MakeGeoCall(geoCall._materialGuids[d], rawGeo, deform, true));
 			}
 		}
 
@@ -996,22 +1362,24 @@ namespace RenderCore { namespace Techniques
 
 		// Create the dynamic VB and assign it to all of the slots it needs to go to
 		if (postDeformVBIterator) {
-			_dynVB = Services::GetDevice().CreateResource(
+			_deformOutput = std::make_shared<DeformOutput>();
+			auto dynVB = _deformOutput->_dynVB = Services::GetDevice().CreateResource(
 				CreateDesc(
 					BindFlag::VertexBuffer,
 					CPUAccess::WriteDynamic, GPUAccess::Read,
 					LinearBufferDesc::Create(postDeformVBIterator),
 					"ModelRendererDynVB"));
+			_deformOutput->_dynVBSize = postDeformVBIterator;
 
 			for (auto&g:_geos)
 				for (unsigned s=0; s<g->_vertexStreamCount; ++s)
 					if (!g->_vertexStreams[s]._resource)
-						g->_vertexStreams[s]._resource = _dynVB;
+						g->_vertexStreams[s]._resource = dynVB;
 
 			for (auto&g:_boundSkinnedControllers)
 				for (unsigned s=0; s<g->_vertexStreamCount; ++s)
 					if (!g->_vertexStreams[s]._resource)
-						g->_vertexStreams[s]._resource = _dynVB;
+						g->_vertexStreams[s]._resource = dynVB;
 		}
 
 		if (preDeformStaticDataVBIterator) {
@@ -1025,6 +1393,10 @@ namespace RenderCore { namespace Techniques
 			_deformTemporaryBuffer.resize(deformTemporaryVBIterator, 0);
 		}
 
+		Internal::ScheduleDeformOps(_deformOpSchedule, _deformWaveBounds, MakeIteratorRange(_deformOps));
+		_deferredDeformOutput.store(false);
+		_instancedPipelinesBuilt.store(false);
+
 		_usi = std::make_shared<UniformsStreamInterface>();
 		_usi->BindConstantBuffer(0, {Techniques::ObjectCB::LocalTransform});
 		_usi->BindConstantBuffer(1, {Techniques::ObjectCB::DrawCallProperties});
@@ -1079,7 +1451,12 @@ namespace RenderCore { namespace Techniques
 			::Assets::RegisterAssetDependency(_depVal, depVal);
 	}
 
-	SimpleModelRenderer::~SimpleModelRenderer() {}
+	SimpleModelRenderer::~SimpleModelRenderer()
+	{
+			// (a background ExecuteDeformOps() refers to this object)
+		if (_deformOutput)
+			_deformOutput->WaitForPending();
+	}
 
 	struct DeformConstructionFuture
 	{
@@ -10,8 +10,10 @@
 #include "../../Math/Matrix.h"
 #include "../../Assets/AssetsCore.h"
 #include "../../Utility/StringUtils.h"
+#include "../../Utility/Threading/Mutex.h"
 #include <vector>
 #include <memory>
+#include <atomic>
 
 namespace RenderCore { namespace Assets 
 { 
@@ -20,7 +22,7 @@ namespace RenderCore { namespace Assets
 	class SkeletonScaffold;
 }}
 namespace RenderCore { class IThreadContext; class IResource; class UniformsStreamInterface; }
-namespace Utility { class VariantArray; }
+namespace Utility { class VariantArray; class CompletionThreadPool; }
 
 namespace RenderCore { namespace Techniques 
 {
@@ -32,6 +34,7 @@ namespace RenderCore { namespace Techniques
 	class DescriptorSetAccelerator;
 	class DeformOperationInstantiation;
 	class IDeformOperation;
+	namespace Internal { struct DeformOp; }
 	class IUniformBufferDelegate;
 
 	class IPreDrawDelegate
@@ -56,7 +59,35 @@ namespace RenderCore { namespace Techniques
 			const Float4x4& localToWorld,
 			const std::shared_ptr<IPreDrawDelegate>& delegate) const;
 
-		void GenerateDeformBuffer(IThreadContext& context);
+		/// <summary>Build drawables for many copies of this model, using instanced draw calls</summary>
+		/// Each draw call in the model becomes a single drawable that draws all of the instances.
+		/// The instance transforms are written into the packets' temporary vertex storage and
+		/// read by the vertex shader (via the GEO_HAS_INSTANCE_TRANSFORM input).
+		/// Models with skinned geometry (and batches of fewer than s_minInstancedBatch instances)
+		/// fall back to BuildDrawables() for each instance. The instanced pipelines are created
+		/// the first time a batch is actually drawn with instancing.
+		/// Returns true if instanced draw calls were used.
+		bool BuildInstancedDrawables(
+			IteratorRange<DrawablesPacket** const> pkts,
+			IteratorRange<const Float4x4*> instanceLocalToWorld) const;
+
+		static const unsigned s_minInstancedBatch = 4;
+
+		/// <summary>Update the dynamic vertex buffer with the output of the deform operations</summary>
+		/// If ExecuteDeformOps() has been used, this just uploads any output that hasn't been uploaded
+		/// yet (waiting for it, if necessary). Otherwise the deform operations are executed here, writing
+		/// directly into the mapped buffer. Must be called on the thread that owns the given context.
+		void GenerateDeformBuffer(IThreadContext& context, Utility::CompletionThreadPool* threadPool = nullptr);
+
+		/// <summary>Start executing the deform operations on the CPU, ahead of drawing</summary>
+		/// When a thread pool is given, this returns immediately and the deform operations run in the
+		/// background (with operations that don't depend on each other running concurrently). So it
+		/// should be called as early in the frame as possible; before the scene is prepared.
+		/// The output goes into one of two CPU side buffers, and is uploaded into the dynamic vertex
+		/// buffer when the first of this renderer's drawables is drawn (or by GenerateDeformBuffer()).
+		/// It must not be called concurrently for the same renderer, and at most once per upload.
+		void ExecuteDeformOps(Utility::CompletionThreadPool* threadPool = nullptr);
+
 		unsigned DeformOperationCount() const;
 		IDeformOperation& DeformOperation(unsigned idx);
 		const ::Assets::DepValPtr& GetDependencyValidation() const;
@@ -104,7 +135,8 @@ namespace RenderCore { namespace Techniques
 			const std::shared_ptr<IPipelineAcceleratorPool>& pipelineAcceleratorPool,
 			StringSection<> modelScaffoldName);
 
-		struct DeformOp;
+		using DeformOp = Internal::DeformOp;
+		class DeformOutput;
 	private:
 		std::shared_ptr<RenderCore::Assets::ModelScaffold> _modelScaffold;
 		std::shared_ptr<RenderCore::Assets::MaterialScaffold> _materialScaffold;
@@ -115,17 +147,26 @@ namespace RenderCore { namespace Techniques
 		std::vector<std::shared_ptr<DrawableGeo>> _geos;
 		std::vector<std::shared_ptr<DrawableGeo>> _boundSkinnedControllers;
 
+		struct InstancedPipelineDesc;
 		struct GeoCall
 		{
 			std::shared_ptr<PipelineAccelerator> _pipelineAccelerator;
+			mutable std::shared_ptr<PipelineAccelerator> _instancedPipelineAccelerator;		///< (only for static geo, created on demand)
+			std::shared_ptr<InstancedPipelineDesc> _instancedPipelineDesc;
 			::Assets::FuturePtr<DescriptorSetAccelerator> _compiledDescriptorSet;
 			unsigned _batchFilter;
+			unsigned _instanceStreamIdx = ~0u;
 		};
 
 		std::vector<GeoCall> _geoCalls;
 		std::vector<GeoCall> _boundSkinnedControllerGeoCalls;
 		unsigned _drawablesCount[4];
 
+		std::shared_ptr<IPipelineAcceleratorPool> _pipelineAcceleratorPool;
+		mutable std::atomic<bool> _instancedPipelinesBuilt;
+		mutable Threading::Mutex _instancedPipelinesLock;
+		void BuildInstancedPipelines() const;
+
 		RenderCore::Assets::SkeletonBinding _skeletonBinding;
 
 		std::shared_ptr<UniformsStreamInterface> _usi;
@@ -134,7 +175,15 @@ namespace RenderCore { namespace Techniques
 		std::vector<uint8_t> _deformStaticDataInput;
 		std::vector<uint8_t> _deformTemporaryBuffer;
 
-		std::shared_ptr<IResource> _dynVB;
+			// Deform ops in execution order, grouped into waves. Ops within a wave don't touch
+			// the same bytes of the temporary or output buffers, and so can run concurrently
+		std::vector<unsigned> _deformOpSchedule;
+		std::vector<unsigned> _deformWaveBounds;
+
+		std::shared_ptr<DeformOutput> _deformOutput;		///< dynamic vertex buffer, and the CPU side output waiting to go into it
+		std::atomic<bool> _deferredDeformOutput;
+
+		void RunDeformOps(IteratorRange<void*> postDeformOutput, Utility::CompletionThreadPool* threadPool);
 
 		std::vector<std::shared_ptr<IUniformBufferDelegate>> _extraUniformBufferDelegates;
 
@@ -146,6 +195,22 @@ namespace RenderCore { namespace Techniques
 		class GeoCallBuilder;
 	};
 
+	namespace Internal
+	{
+		/// <summary>Returns true if a batch should be drawn with instanced draw calls</summary>
+		/// Otherwise BuildInstancedDrawables() falls back to drawing each instance separately
+		bool UseInstancedDrawables(size_t instanceCount, unsigned skinCallCount);
+
+		/// <summary>Writes the instance transforms into the packet's temporary vertex storage</summary>
+		/// Transforms are written as 3x4 row major matrices. Returns the offset of the first one.
+		unsigned WriteInstanceTransforms(DrawablesPacket& pkt, IteratorRange<const Float4x4*> instanceLocalToWorld);
+
+		/// <summary>Copy of "geo" with the instance stream appended</summary>
+		/// The instance stream refers to the temporary vertex storage of the packet, at
+		/// "instanceDataOffset", so the result is marked as Temporary.
+		std::shared_ptr<DrawableGeo> MakeInstancedGeo(const DrawableGeo& geo, unsigned instanceDataOffset);
+	}
+
 	class RendererSkeletonInterface : public IUniformBufferDelegate
 	{
 	public:
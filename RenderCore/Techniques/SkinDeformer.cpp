@@ -8,10 +8,205 @@
 #include "../Assets/ModelImmutableData.h"
 #include "../../Assets/IFileSystem.h"
 #include "../../Assets/AssetTraits.h"
+#include "../../ConsoleRig/GlobalServices.h"
+#include "../../Math/Transformations.h"
+#include "../../Utility/Threading/CompletionThreadPool.h"
+#include "../../Core/SelectConfiguration.h"
+#include <thread>
 #include <assert.h>
 
+#if COMPILER_ACTIVE == COMPILER_TYPE_MSVC
+	#include <intrin.h>
+	#define HAS_SSE_INSTRUCTIONS
+#elif defined(__SSE2__)
+	#include <emmintrin.h>
+	#define HAS_SSE_INSTRUCTIONS
+#endif
+
 namespace RenderCore { namespace Techniques
 {
+	namespace Internal
+	{
+		static Float3 LoadFloat3(const SkinningStream& stream, unsigned v) { auto* f = (const float*)PtrAdd(stream._src, v*stream._srcStride); return Float3{f[0], f[1], f[2]}; }
+		static void StoreFloat3(const SkinningStream& stream, unsigned v, Float3 value) { auto* f = (float*)PtrAdd(stream._dst, v*stream._dstStride); f[0] = value[0]; f[1] = value[1]; f[2] = value[2]; }
+
+		static Float3 SafeNormalize(Float3 input)
+		{
+			Float3 result;
+			return Normalize_Checked(&result, input) ? result : input;
+		}
+
+		static void SkinVertex_Scalar(
+			const SkinningStreams& streams, unsigned v,
+			unsigned influenceCount, const float* weights, const unsigned* jointIndices,
+			IteratorRange<const Float3x4*> jointTransforms)
+		{
+			assert(influenceCount != 0);
+			assert(jointIndices[0] < jointTransforms.size());
+			Float3x4 blended = weights[0] * jointTransforms[jointIndices[0]];
+			for (unsigned b=1; b<influenceCount; ++b) {
+				assert(jointIndices[b] < jointTransforms.size());
+				blended += weights[b] * jointTransforms[jointIndices[b]];
+			}
+
+			StoreFloat3(streams._positions, v, TransformPoint(blended, LoadFloat3(streams._positions, v)));
+			if (streams._normals._src)
+				StoreFloat3(streams._normals, v, SafeNormalize(TransformDirectionVector(blended, LoadFloat3(streams._normals, v))));
+			if (streams._tangents._src) {
+				StoreFloat3(streams._tangents, v, SafeNormalize(TransformDirectionVector(blended, LoadFloat3(streams._tangents, v))));
+				((float*)PtrAdd(streams._tangents._dst, v*streams._tangents._dstStride))[3] = ((const float*)PtrAdd(streams._tangents._src, v*streams._tangents._srcStride))[3];
+			}
+		}
+
+	#if defined(HAS_SSE_INSTRUCTIONS)
+
+			// Transforms one vector for each of 4 vertices, returning the results as x, y & z
+			// vectors (ie, one component of all 4 vertices in each)
+		static inline void TransformBlock4_SSE(
+			__m128& x, __m128& y, __m128& z,
+			const __m128 rows[4][3], const __m128 input[4])
+		{
+			__m128 t0 = _mm_mul_ps(rows[0][0], input[0]), t1 = _mm_mul_ps(rows[1][0], input[1]), t2 = _mm_mul_ps(rows[2][0], input[2]), t3 = _mm_mul_ps(rows[3][0], input[3]);
+			_MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+			x = _mm_add_ps(_mm_add_ps(t0, t1), _mm_add_ps(t2, t3));
+
+			t0 = _mm_mul_ps(rows[0][1], input[0]); t1 = _mm_mul_ps(rows[1][1], input[1]); t2 = _mm_mul_ps(rows[2][1], input[2]); t3 = _mm_mul_ps(rows[3][1], input[3]);
+			_MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+			y = _mm_add_ps(_mm_add_ps(t0, t1), _mm_add_ps(t2, t3));
+
+			t0 = _mm_mul_ps(rows[0][2], input[0]); t1 = _mm_mul_ps(rows[1][2], input[1]); t2 = _mm_mul_ps(rows[2][2], input[2]); t3 = _mm_mul_ps(rows[3][2], input[3]);
+			_MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+			z = _mm_add_ps(_mm_add_ps(t0, t1), _mm_add_ps(t2, t3));
+		}
+
+		static inline void Normalize4_SSE(__m128& x, __m128& y, __m128& z)
+		{
+			__m128 magSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+			__m128 invMag = _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(_mm_max_ps(magSq, _mm_set1_ps(1e-20f))));
+			x = _mm_mul_ps(x, invMag); y = _mm_mul_ps(y, invMag); z = _mm_mul_ps(z, invMag);
+		}
+
+		static inline void LoadBlock4_SSE(__m128 result[4], const SkinningStream& stream, unsigned v, float w)
+		{
+				// (we can't load 4 floats directly, because the last vertex may be at the very end of the buffer)
+			for (unsigned q=0; q<4; ++q) {
+				auto* f = (const float*)PtrAdd(stream._src, (v+q)*stream._srcStride);
+				result[q] = _mm_setr_ps(f[0], f[1], f[2], w);
+			}
+		}
+
+		static inline void StoreBlock4_SSE(const SkinningStream& stream, unsigned v, __m128 x, __m128 y, __m128 z)
+		{
+			__m128 w = _mm_setzero_ps();
+			_MM_TRANSPOSE4_PS(x, y, z, w);
+			__m128 vertices[4] = { x, y, z, w };
+			for (unsigned q=0; q<4; ++q) {
+				auto* f = (float*)PtrAdd(stream._dst, (v+q)*stream._dstStride);
+				_mm_storel_pi((__m64*)f, vertices[q]);
+				_mm_store_ss(f+2, _mm_movehl_ps(vertices[q], vertices[q]));
+			}
+		}
+
+		template<unsigned InfluenceCount>
+			static void SkinBlock4_SSE(
+				const SkinningStreams& streams, unsigned v,
+				unsigned influenceStride, const float* weights, const unsigned* jointIndices,
+				IteratorRange<const Float3x4*> jointTransforms)
+		{
+				// Blend the joint transforms for each vertex. Note that this relies on cml's (default) row major
+				// storage for the joint transforms
+			__m128 rows[4][3];
+			for (unsigned q=0; q<4; ++q) {
+				auto* w = weights + q*influenceStride;
+				auto* j = jointIndices + q*influenceStride;
+				assert(j[0] < jointTransforms.size());
+				const float* m = &jointTransforms[j[0]](0,0);
+				__m128 weight = _mm_set1_ps(w[0]);
+				rows[q][0] = _mm_mul_ps(weight, _mm_loadu_ps(m));
+				rows[q][1] = _mm_mul_ps(weight, _mm_loadu_ps(m+4));
+				rows[q][2] = _mm_mul_ps(weight, _mm_loadu_ps(m+8));
+				for (unsigned b=1; b<InfluenceCount; ++b) {
+					assert(j[b] < jointTransforms.size());
+					m = &jointTransforms[j[b]](0,0);
+					weight = _mm_set1_ps(w[b]);
+					rows[q][0] = _mm_add_ps(rows[q][0], _mm_mul_ps(weight, _mm_loadu_ps(m)));
+					rows[q][1] = _mm_add_ps(rows[q][1], _mm_mul_ps(weight, _mm_loadu_ps(m+4)));
+					rows[q][2] = _mm_add_ps(rows[q][2], _mm_mul_ps(weight, _mm_loadu_ps(m+8)));
+				}
+			}
+
+			__m128 input[4], x, y, z;
+			LoadBlock4_SSE(input, streams._positions, v, 1.f);
+			TransformBlock4_SSE(x, y, z, rows, input);
+			StoreBlock4_SSE(streams._positions, v, x, y, z);
+
+			if (streams._normals._src) {
+				LoadBlock4_SSE(input, streams._normals, v, 0.f);
+				TransformBlock4_SSE(x, y, z, rows, input);
+				Normalize4_SSE(x, y, z);
+				StoreBlock4_SSE(streams._normals, v, x, y, z);
+			}
+
+			if (streams._tangents._src) {
+				LoadBlock4_SSE(input, streams._tangents, v, 0.f);
+				TransformBlock4_SSE(x, y, z, rows, input);
+				Normalize4_SSE(x, y, z);
+				StoreBlock4_SSE(streams._tangents, v, x, y, z);
+				for (unsigned q=0; q<4; ++q)
+					((float*)PtrAdd(streams._tangents._dst, (v+q)*streams._tangents._dstStride))[3] = ((const float*)PtrAdd(streams._tangents._src, (v+q)*streams._tangents._srcStride))[3];
+			}
+		}
+
+	#endif
+
+		template<unsigned InfluenceCount>
+			static void SkinVertices_Fixed(
+				const SkinningStreams& streams,
+				unsigned firstVertex, unsigned vertexCount,
+				unsigned influenceStride, const float* weights, const unsigned* jointIndices,
+				IteratorRange<const Float3x4*> jointTransforms)
+		{
+			unsigned v = firstVertex, end = firstVertex + vertexCount;
+			#if defined(HAS_SSE_INSTRUCTIONS)
+				for (; (v+4)<=end; v+=4)
+					SkinBlock4_SSE<InfluenceCount>(streams, v, influenceStride, weights + v*influenceStride, jointIndices + v*influenceStride, jointTransforms);
+			#endif
+			for (; v<end; ++v)
+				SkinVertex_Scalar(streams, v, InfluenceCount, weights + v*influenceStride, jointIndices + v*influenceStride, jointTransforms);
+		}
+
+		static void CopyStream(const SkinningStream& stream, unsigned firstVertex, unsigned vertexCount, size_t elementSize)
+		{
+			for (unsigned v=firstVertex; v<firstVertex+vertexCount; ++v)
+				XlCopyMemory(PtrAdd(stream._dst, v*stream._dstStride), PtrAdd(stream._src, v*stream._srcStride), elementSize);
+		}
+
+		void SkinVertices(
+			const SkinningStreams& streams,
+			unsigned firstVertex, unsigned vertexCount,
+			unsigned influenceCount, unsigned influenceStride,
+			const float* weights, const unsigned* jointIndices,
+			IteratorRange<const Float3x4*> jointTransforms)
+		{
+			switch (influenceCount) {
+			case 0:
+					// no influences; the vertices are just copied
+				CopyStream(streams._positions, firstVertex, vertexCount, 3*sizeof(float));
+				if (streams._normals._src) CopyStream(streams._normals, firstVertex, vertexCount, 3*sizeof(float));
+				if (streams._tangents._src) CopyStream(streams._tangents, firstVertex, vertexCount, 4*sizeof(float));
+				break;
+			case 1: SkinVertices_Fixed<1>(streams, firstVertex, vertexCount, influenceStride, weights, jointIndices, jointTransforms); break;
+			case 2: SkinVertices_Fixed<2>(streams, firstVertex, vertexCount, influenceStride, weights, jointIndices, jointTransforms); break;
+			case 4: SkinVertices_Fixed<4>(streams, firstVertex, vertexCount, influenceStride, weights, jointIndices, jointTransforms); break;
+			default:
+				assert(influenceCount <= influenceStride);
+				for (unsigned v=firstVertex; v<firstVertex+vertexCount; ++v)
+					SkinVertex_Scalar(streams, v, influenceCount, weights + v*influenceStride, jointIndices + v*influenceStride, jointTransforms);
+				break;
+			}
+		}
+	}
+
 	void SkinDeformer::WriteJointTransforms(
 		const Section& section,
 		IteratorRange<Float3x4*>		destination,
@@ -45,55 +240,92 @@ namespace RenderCore { namespace Techniques
 		_skeletonBinding = RenderCore::Assets::SkeletonBinding{skeletonMachineOutputInterface, _jointInputInterface};
 	}
 
+	static Internal::SkinningStream MakeSkinningStream(
+		const IDeformOperation::VertexElementRange& src,
+		const IDeformOperation::VertexElementRange& dst,
+		Format expectedFormat)
+	{
+		assert(src.begin().Format() == expectedFormat && dst.begin().Format() == expectedFormat);
+		assert(dst.size() <= src.size());
+		(void)expectedFormat;
+		return Internal::SkinningStream { src.begin()._data.begin(), dst.begin()._data.begin(), src.begin()._stride, dst.begin()._stride };
+	}
+
 	void SkinDeformer::Execute(
 		IteratorRange<const VertexElementRange*> sourceElements,
 		IteratorRange<const VertexElementRange*> destinationElements) const
 	{
-		assert(destinationElements.size() == 1);
-
-		auto& inputPosElement = sourceElements[0];
-		auto& outputPosElement = destinationElements[0];
-		assert(inputPosElement.begin().Format() == Format::R32G32B32_FLOAT);
-		assert(outputPosElement.begin().Format() == Format::R32G32B32_FLOAT);
-		assert(outputPosElement.size() <= inputPosElement.size());
-
+		assert(destinationElements.size() == 1 + unsigned(_skinNormals) + unsigned(_skinTangents));
+		assert(sourceElements.size() == destinationElements.size());
+
+		Internal::SkinningStreams streams;
+		unsigned elementIdx = 0;
+		streams._positions = MakeSkinningStream(sourceElements[elementIdx], destinationElements[elementIdx], Format::R32G32B32_FLOAT);
+		++elementIdx;
+		if (_skinNormals) {
+			streams._normals = MakeSkinningStream(sourceElements[elementIdx], destinationElements[elementIdx], Format::R32G32B32_FLOAT);
+			++elementIdx;
+		}
+		if (_skinTangents) {
+			streams._tangents = MakeSkinningStream(sourceElements[elementIdx], destinationElements[elementIdx], Format::R32G32B32A32_FLOAT);
+			++elementIdx;
+		}
+		auto outputVertexCount = destinationElements[0].size();
+		(void)outputVertexCount;
+
+			// Calculate the joint transforms for all sections up front, and split the draw calls
+			// into jobs of a limited size, so large sections can be spread across threads
+		static const unsigned verticesPerJob = 2048;
+		_jointTransformsScratch.clear();
+		_jobsScratch.clear();
+		unsigned totalVertexCount = 0;
 		for (const auto&section:_sections) {
-			std::vector<Float3x4> jointTransform(section._jointMatrices.size());
+			auto jointTransformsOffset = (unsigned)_jointTransformsScratch.size();
+			auto jointTransformsCount = (unsigned)section._jointMatrices.size();
+			_jointTransformsScratch.resize(jointTransformsOffset + jointTransformsCount);
 			WriteJointTransforms(
 				section,
-				MakeIteratorRange(jointTransform),
+				MakeIteratorRange(AsPointer(_jointTransformsScratch.begin() + jointTransformsOffset), AsPointer(_jointTransformsScratch.end())),
 				MakeIteratorRange(_skeletonMachineOutput));
 
 			for (const auto&drawCall:section._preskinningDrawCalls) {
-				assert((drawCall._firstVertex + drawCall._indexCount) <= outputPosElement.size());
-
-				auto srcPosition = inputPosElement.begin() + drawCall._firstVertex;
-
+				assert((drawCall._firstVertex + drawCall._indexCount) <= outputVertexCount);
 				// drawCall._subMaterialIndex is 0, 1, 2 or 4 depending on the number of weights we have to proces
-				if (drawCall._subMaterialIndex == 0) {
-					// in this case, we just copy
-					for (auto p=outputPosElement.begin() + drawCall._firstVertex; p < (outputPosElement.begin() + drawCall._firstVertex + drawCall._indexCount); ++p, ++srcPosition)
-						*p = (*srcPosition).As<Float3>();
-					continue;
-				}
-
-				auto srcJointWeight = _jointWeights.begin() + drawCall._firstVertex * _influencesPerVertex;
-				auto srcJointIndex = _jointIndices.begin() + drawCall._firstVertex * _influencesPerVertex;
-
-				for (auto p=outputPosElement.begin() + drawCall._firstVertex; 
-					p < (outputPosElement.begin() + drawCall._firstVertex + drawCall._indexCount); 
-					++p, ++srcPosition, srcJointWeight+=_influencesPerVertex, srcJointIndex+=_influencesPerVertex) {
-				
-					Float3 deformedPosition { 0.f, 0.f, 0.f };
-					for (unsigned b=0; b<drawCall._subMaterialIndex; ++b) {
-						assert(srcJointIndex[b] < jointTransform.size());
-						deformedPosition += srcJointWeight[b] * TransformPoint(jointTransform[srcJointIndex[b]], (*srcPosition).As<Float3>());
-					}
+				for (unsigned v=0; v<drawCall._indexCount; v+=verticesPerJob)
+					_jobsScratch.push_back(Job{
+						drawCall._firstVertex + v, std::min(verticesPerJob, drawCall._indexCount - v),
+						drawCall._subMaterialIndex,
+						jointTransformsOffset, jointTransformsCount});
+				totalVertexCount += drawCall._indexCount;
+			}
+		}
 
-					*p = deformedPosition;
-				}
+		auto executeJobs = [this, &streams](unsigned, unsigned jobBegin, unsigned jobEnd) {
+			for (unsigned j=jobBegin; j<jobEnd; ++j) {
+				const auto& job = _jobsScratch[j];
+				Internal::SkinVertices(
+					streams, job._firstVertex, job._vertexCount,
+					job._influenceCount, (unsigned)_influencesPerVertex,
+					_jointWeights.data(), _jointIndices.data(),
+					MakeIteratorRange(
+						AsPointer(_jointTransformsScratch.begin() + job._jointTransformsOffset),
+						AsPointer(_jointTransformsScratch.begin() + job._jointTransformsOffset + job._jointTransformsCount)));
+			}
+		};
+
+			// Only large meshes are worth the overhead of going wide
+		static const unsigned parallelVertexThreshold = 16*1024;
+		auto jobCount = (unsigned)_jobsScratch.size();
+		if (totalVertexCount >= parallelVertexThreshold && jobCount > 1) {
+			auto& threadPool = ConsoleRig::GlobalServices::GetInstance().GetShortTaskThreadPool();
+			if (threadPool.IsGood()) {
+				auto rangeCount = std::min(jobCount, std::max(1u, std::thread::hardware_concurrency()));
+				ExecuteRangesParallel(threadPool, jobCount, rangeCount, executeJobs);
+				return;
 			}
 		}
+
+		executeJobs(0, 0, jobCount);
 	}
 
 	static IteratorRange<VertexElementIterator> AsVertexElementIteratorRange(
@@ -190,6 +422,14 @@ namespace RenderCore { namespace Techniques
 		}
 
 		_jointInputInterface = modelScaffold.CommandStream().GetInputInterface();
+
+			// Normals and tangents are skinned along with the positions, when the geometry has them
+		auto hasElement = [&skinnedController](StringSection<> semantic) {
+			return FindElement(MakeIteratorRange(skinnedController._vb._ia._elements), semantic)
+				|| FindElement(MakeIteratorRange(skinnedController._animatedVertexElements._ia._elements), semantic);
+		};
+		_skinNormals = hasElement("NORMAL");
+		_skinTangents = hasElement("TEXTANGENT");
 	}
 
 	SkinDeformer::~SkinDeformer()
@@ -214,12 +454,17 @@ namespace RenderCore { namespace Techniques
 			//			StringSection<>(initializer.begin(), sep),
 			//			StringSection<>(sep+1, initializer.end()
 
+			auto deformer = std::make_shared<SkinDeformer>(*modelScaffold, c);
+			std::vector<DeformOperationInstantiation::NameAndFormat> elements;
+			elements.push_back({positionEleName, 0, Format::R32G32B32_FLOAT});
+			if (deformer->_skinNormals) elements.push_back({"NORMAL", 0, Format::R32G32B32_FLOAT});
+			if (deformer->_skinTangents) elements.push_back({"TEXTANGENT", 0, Format::R32G32B32A32_FLOAT});
+
 			result.emplace_back(
 				DeformOperationInstantiation {
-					std::make_shared<SkinDeformer>(*modelScaffold, c),
+					std::move(deformer),
 					unsigned(immData._geoCount) + c,
-					{DeformOperationInstantiation::NameAndFormat{positionEleName, 0, Format::R32G32B32_FLOAT}},
-					{DeformOperationInstantiation::NameAndFormat{positionEleName, 0, Format::R32G32B32_FLOAT}},
+					elements, elements,
 					{weightsEle, jointIndicesEle}
 				});
 		}
@@ -16,6 +16,38 @@ namespace RenderCore { class VertexElementIterator; }
 
 namespace RenderCore { namespace Techniques
 {
+	namespace Internal
+	{
+		struct SkinningStream
+		{
+			const void*		_src = nullptr;
+			void*			_dst = nullptr;
+			size_t			_srcStride = 0;
+			size_t			_dstStride = 0;
+		};
+
+		/// <summary>Vertex streams processed by SkinVertices()</summary>
+		/// Positions and normals are 3 component floats, tangents are 4 component floats (with the
+		/// handedness in w). Normals and tangents are optional; they're skipped when the source is null
+		struct SkinningStreams
+		{
+			SkinningStream	_positions;
+			SkinningStream	_normals;
+			SkinningStream	_tangents;
+		};
+
+		/// <summary>CPU skinning kernel</summary>
+		/// Skins vertices [firstVertex, firstVertex+vertexCount), blending "influenceCount" joint transforms
+		/// per vertex. Weights and joint indices are stored with "influenceStride" entries per vertex, starting
+		/// from vertex 0. 1, 2 and 4 influences have specialized (SSE, 4 vertices at a time) implementations.
+		void SkinVertices(
+			const SkinningStreams& streams,
+			unsigned firstVertex, unsigned vertexCount,
+			unsigned influenceCount, unsigned influenceStride,
+			const float* weights, const unsigned* jointIndices,
+			IteratorRange<const Float3x4*> jointTransforms);
+	}
+
 	class SkinDeformer : public IDeformOperation
 	{
 	public:
@@ -39,6 +71,8 @@ namespace RenderCore { namespace Techniques
 		std::vector<float>		_jointWeights;
 		std::vector<unsigned>	_jointIndices;
 		size_t					_influencesPerVertex;
+		bool					_skinNormals = false;
+		bool					_skinTangents = false;
 
 		RenderCore::Assets::ModelCommandStream::InputInterface _jointInputInterface;
 
@@ -54,6 +88,16 @@ namespace RenderCore { namespace Techniques
 		std::vector<Float4x4> _skeletonMachineOutput;
 		RenderCore::Assets::SkeletonBinding _skeletonBinding;
 
+		struct Job
+		{
+			unsigned _firstVertex, _vertexCount;
+			unsigned _influenceCount;
+			unsigned _jointTransformsOffset, _jointTransformsCount;
+		};
+			// (scratch space reused by every Execute(), to avoid per frame allocations)
+		mutable std::vector<Float3x4>	_jointTransformsScratch;
+		mutable std::vector<Job>		_jobsScratch;
+
 		void WriteJointTransforms(
 			const Section& section,
 			IteratorRange<Float3x4*>		destination,
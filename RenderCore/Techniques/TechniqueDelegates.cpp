@@ -437,7 +437,7 @@ namespace RenderCore { namespace Techniques
 			const auto& variation = _sharedResources->_mainVariationSet.FindVariation(
 				selectors,
 				techEntry._selectorFiltering,
-				shaderPatches->GetInterface().GetSelectorRelevance(),
+				shaderPatches->GetInterface().GetCompiledSelectorRelevance(),
 				factory);
 			return variation._shaderFuture;
 		}
@@ -90,7 +90,7 @@ namespace RenderCore { namespace Techniques
     {
         for (;;) {
             auto next = source.PeekNext();
-            if (next == Formatter::Blob::EndElement) return;
+            if (next == Formatter::Blob::EndElement) break;
 
 			if (next == Formatter::Blob::BeginElement) {
 				Formatter::InteriorSection selectorName;
@@ -301,6 +301,7 @@ namespace RenderCore { namespace Techniques
 		_hash = HashCombine(_setValues.GetHash(), _setValues.GetParameterNamesHash());
 		for (const auto&r:_relevanceMap)
 			_hash = HashCombine(HashCombine(Hash64(r.first), Hash64(r.second)), _hash);
+		_compiledRelevanceMap = PreprocessorExpressionTable(_relevanceMap);
 	}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
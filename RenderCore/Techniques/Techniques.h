@@ -10,6 +10,7 @@
 #include "../Assets/PredefinedCBLayout.h"
 #include "../Init.h"
 #include "../../Utility/ParameterBox.h"
+#include "../../Utility/Streams/PreprocessorInterpreter.h"
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -29,9 +30,12 @@ namespace RenderCore { namespace Techniques
 		std::unordered_map<std::string, std::string> _relevanceMap;
 
 		uint64_t GetHash() const { return _hash; }
+		const PreprocessorExpressionTable& GetCompiledRelevanceMap() const { return _compiledRelevanceMap; }
 
+		/// Call after changing _setValues or _relevanceMap; this also compiles the relevance conditions
 		void GenerateHash();
 		uint64_t _hash = 0ull;
+		PreprocessorExpressionTable _compiledRelevanceMap;
     };
 
         //////////////////////////////////////////////////////////////////
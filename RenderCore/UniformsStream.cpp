@@ -20,7 +20,7 @@ namespace RenderCore
             binding._hashName,
             std::vector<ConstantBufferElementDesc>(binding._elements.begin(), binding._elements.end())
         };
-        _hash = 0;
+        _hash = CalculateHash();
     }
 
     void UniformsStreamInterface::BindShaderResource(unsigned slot, uint64_t hashName)
@@ -28,25 +28,22 @@ namespace RenderCore
         if (_srvBindings.size() <= slot)
             _srvBindings.resize(slot+1);
         _srvBindings[slot] = hashName;
-        _hash = 0;
+        _hash = CalculateHash();
     }
 
-    uint64_t UniformsStreamInterface::GetHash() const
+    uint64_t UniformsStreamInterface::CalculateHash() const
     {
-        if (expect_evaluation(_hash==0, false)) {
-            _hash = DefaultSeed64;
-            // to prevent some oddities when the same hash value could be in either a CB or SRV
-            // we need to include the count of the first array we look through in the hash
-            _hash = HashCombine((uint64_t)_cbBindings.size(), _hash);
-            for (const auto& c:_cbBindings)
-                _hash = HashCombine(c._hashName, _hash);
-            _hash = HashCombine(Hash64(AsPointer(_srvBindings.begin()), AsPointer(_srvBindings.end())), _hash);
-        }
-
-        return _hash;
+        uint64_t hash = DefaultSeed64;
+        // to prevent some oddities when the same hash value could be in either a CB or SRV
+        // we need to include the count of the first array we look through in the hash
+        hash = HashCombine((uint64_t)_cbBindings.size(), hash);
+        for (const auto& c:_cbBindings)
+            hash = HashCombine(c._hashName, hash);
+        hash = HashCombine(Hash64(AsPointer(_srvBindings.begin()), AsPointer(_srvBindings.end())), hash);
+        return hash;
     }
 
-    UniformsStreamInterface::UniformsStreamInterface() : _hash(0) {}
+    UniformsStreamInterface::UniformsStreamInterface() { _hash = CalculateHash(); }
     UniformsStreamInterface::~UniformsStreamInterface() {}
 
 }
@@ -50,7 +50,9 @@ namespace RenderCore
         void BindConstantBuffer(unsigned slot, const CBBinding& binding);
         void BindShaderResource(unsigned slot, uint64_t hashName);
 
-        uint64_t GetHash() const;
+            // The hash is recalculated as bindings are added, so GetHash() is just a read, and
+            // is safe to call from multiple threads once the interface has been built
+        uint64_t GetHash() const { return _hash; }
 
         UniformsStreamInterface();
         ~UniformsStreamInterface();
@@ -66,7 +68,8 @@ namespace RenderCore
         std::vector<uint64_t> _srvBindings;
 
     private:
-        mutable uint64_t _hash;
+        uint64_t _hash;
+        uint64_t CalculateHash() const;
     };
     
 }
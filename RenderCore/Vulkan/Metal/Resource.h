@@ -105,7 +105,7 @@ namespace RenderCore { namespace Metal_Vulkan
         IteratorRange<const void*>  GetData() const         { return { _data, PtrAdd(_data, _dataSize) }; }
         TexturePitches				GetPitches() const      { return _pitches; }
 
-		enum class Mode { Read, WriteDiscardPrevious };
+		enum class Mode { Read, WriteDiscardPrevious, WriteNoOverwrite };
 
 		ResourceMap(
 			VkDevice dev, VkDeviceMemory memory,
@@ -0,0 +1,100 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#include "Assets/ArchiveFileSystem.h"
+#include "Assets/IFileSystem.h"
+#include "Assets/AssetServices.h"
+#include "ConsoleRig/GlobalServices.h"
+#include "ConsoleRig/Log.h"
+#include "ConsoleRig/AttachablePtr.h"
+#include "Utility/Streams/StreamFormatter.h"
+#include "Utility/Streams/StreamDOM.h"
+#include "Utility/Streams/FileUtils.h"
+#include "Utility/Streams/PathUtils.h"
+#include "Utility/StringUtils.h"
+#include <iostream>
+
+namespace ArchivePacker
+{
+    int Execute(StringSection<char> cmdLine)
+    {
+        // Packs every file under the input directory into a single archive, for mounting
+        // with ::Assets::CreateFileSystem_Archive. Usage:
+        //      ArchivePacker i=<input directory> o=<output archive> [compress=0]
+        MemoryMappedInputStream stream(cmdLine.begin(), cmdLine.end());
+        InputStreamFormatter<char> formatter(stream);
+        Document<InputStreamFormatter<char>> doc(formatter);
+
+        auto inputDirectory = doc.Attribute("i").Value().AsString();
+        auto outputFile = doc.Attribute("o").Value().AsString();
+        auto compress = doc("compress", 1u) != 0;
+
+        if (inputDirectory.empty() || outputFile.empty()) {
+            Log(Error) << "Expecting input directory and output archive on the command line (with the syntax i=<directory> o=<archive>)" << std::endl;
+            Log(Error) << "Cmdline: " << cmdLine.AsString().c_str() << std::endl;
+            return -1;
+        }
+
+        while (!inputDirectory.empty() && (inputDirectory.back() == '/' || inputDirectory.back() == '\\'))
+            inputDirectory.pop_back();
+
+        auto files = RawFS::FindFilesHierarchical(inputDirectory, "*", RawFS::FindFilesFilter::File);
+        std::vector<::Assets::ArchiveFileSystemEntry> entries;
+        entries.reserve(files.size());
+        size_t totalSize = 0;
+        for (const auto& f:files) {
+            ::Assets::ArchiveFileSystemEntry entry;
+                // FindFilesHierarchical returns filenames that start with the search directory
+            assert(f.size() > inputDirectory.size() && XlEqStringI(MakeStringSection(f.c_str(), f.c_str() + inputDirectory.size()), MakeStringSection(inputDirectory)));
+            entry._name = (const utf8*)&f[inputDirectory.size()+1];
+            auto attrib = RawFS::TryGetFileAttributes((const utf8*)f.c_str());
+            if (attrib) entry._modificationTime = attrib->_lastWriteTime;
+                // TryLoadFileAsBlob returns null for empty files, so they're stored as an empty blob instead
+            if (attrib && attrib->_size == 0) {
+                entry._data = std::make_shared<std::vector<uint8_t>>();
+            } else
+                entry._data = ::Assets::TryLoadFileAsBlob(MakeStringSection(f));
+            if (!entry._data) {
+                Log(Error) << "Could not load file (" << f << ")" << std::endl;
+                return -1;
+            }
+            totalSize += entry._data->size();
+            entries.emplace_back(std::move(entry));
+        }
+
+        ::Assets::WriteFileSystemArchive(
+            MakeStringSection((const utf8*)outputFile.c_str()),
+            MakeIteratorRange(entries),
+            compress ? ::Assets::ArchiveCompression::Deflate : ::Assets::ArchiveCompression::None);
+
+        auto archiveAttrib = RawFS::TryGetFileAttributes((const utf8*)outputFile.c_str());
+        Log(Verbose) << "Packed " << entries.size() << " files (" << totalSize << " bytes) into archive (" << outputFile << ") of " << (archiveAttrib ? archiveAttrib->_size : 0) << " bytes" << std::endl;
+        return 0;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    ConsoleRig::StartupConfig cfg("archivepacker");
+    cfg._setWorkingDir = false;
+    cfg._redirectCout = false;
+    auto services = ConsoleRig::MakeAttachablePtr<ConsoleRig::GlobalServices>(cfg);
+    auto assetServices = ConsoleRig::MakeAttachablePtr<::Assets::Services>();
+
+    std::string cmdLine;
+    for (int c=1; c<argc; ++c) {
+        if (c != 1) cmdLine += " ";
+        cmdLine += argv[c];
+    }
+
+    TRY {
+        return ArchivePacker::Execute(MakeStringSection(cmdLine));
+    } CATCH (const std::exception& e) {
+        Log(Error) << "Hit top level exception. Aborting program!" << std::endl;
+        Log(Error) << e.what() << std::endl;
+        return -1;
+    } CATCH_END
+}
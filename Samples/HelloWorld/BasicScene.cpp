@@ -27,6 +27,7 @@
 #include "../../Math/Geometry.h"
 #include "../../PlatformRig/PlatformRigUtil.h"
 #include "../../ConsoleRig/Console.h"
+#include "../../ConsoleRig/GlobalServices.h"
 #include "../../Math/Transformations.h"
 #include "../../Utility/Streams/PathUtils.h"
 
@@ -49,6 +50,8 @@ namespace Sample
 			RenderCore::IThreadContext& context, 
             SceneEngine::SceneExecuteContext& executeContext);
 
+		void UpdateAnimation(float deltaTime);
+
         Model(const std::shared_ptr<RenderCore::Techniques::IPipelineAcceleratorPool>& pipelineAcceleratorPool);
         ~Model();
     protected:
@@ -56,6 +59,9 @@ namespace Sample
         mutable std::unique_ptr<FixedFunctionModel::ModelRenderer> _modelRenderer;
 
 		::Assets::FuturePtr<RenderCore::Techniques::SimpleModelRenderer> _simpleModelRenderer;
+		std::shared_ptr<RenderCore::Techniques::IPipelineAcceleratorPool> _pipelineAcceleratorPool;
+		bool _pipelinesPrecompiled = false;
+		float _animationTime = 0.f;
     };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -67,6 +73,11 @@ namespace Sample
         _model->RenderOpaque_SimpleModelRenderer(context, executeContext);
     }
 
+	void BasicSceneParser::Update(float deltaTime)
+	{
+		_model->UpdateAnimation(deltaTime);
+	}
+
 	BasicSceneParser::BasicSceneParser(const std::shared_ptr<RenderCore::Techniques::IPipelineAcceleratorPool>& pipelineAcceleratorPool)
 	{
 		_model = std::make_unique<Model>(pipelineAcceleratorPool);
@@ -78,6 +89,7 @@ namespace Sample
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
     BasicSceneParser::Model::Model(const std::shared_ptr<RenderCore::Techniques::IPipelineAcceleratorPool>& pipelineAcceleratorPool)
+	: _pipelineAcceleratorPool(pipelineAcceleratorPool)
     {
         _sharedStateSet = std::make_unique<FixedFunctionModel::SharedStateSet>(
             RenderCore::Assets::Services::GetTechniqueConfigDirs());
@@ -213,52 +225,65 @@ namespace Sample
 		return result;
 	}
 
-	void BasicSceneParser::Model::RenderOpaque_SimpleModelRenderer(
-		RenderCore::IThreadContext& context, 
-        SceneEngine::SceneExecuteContext& executeContext)
-    {
+	void BasicSceneParser::Model::UpdateAnimation(float deltaTime)
+	{
 		auto renderer = _simpleModelRenderer->TryActualize();
 		if (!renderer) return;
 
-		{
-			auto& skeletonScaffold = ::Assets::GetAsset<RenderCore::Assets::SkeletonScaffold>(
-				"game/model/character/skin.dae");
-			auto& skeletonMachine = skeletonScaffold.GetTransformationMachine();
+		auto& skeletonScaffold = ::Assets::GetAsset<RenderCore::Assets::SkeletonScaffold>(
+			"game/model/character/skin.dae");
+		auto& skeletonMachine = skeletonScaffold.GetTransformationMachine();
 
-			auto& animScaffold = ::Assets::GetAsset<RenderCore::Assets::AnimationSetScaffold>(
-				"game/model/character/animations/alldae");
-			auto& animData = animScaffold.ImmutableData();
+		auto& animScaffold = ::Assets::GetAsset<RenderCore::Assets::AnimationSetScaffold>(
+			"game/model/character/animations/alldae");
+		auto& animData = animScaffold.ImmutableData();
 
-			RenderCore::Assets::AnimationSetBinding animSetToSkeletonBinding(
-				animData._animationSet.GetOutputInterface(), 
-				skeletonMachine.GetInputInterface());
+		RenderCore::Assets::AnimationSetBinding animSetToSkeletonBinding(
+			animData._animationSet.GetOutputInterface(), 
+			skeletonMachine.GetInputInterface());
 
-			auto animation = Hash64("run");
-			auto foundAnimation = animData._animationSet.FindAnimation(animation);
+		auto animation = Hash64("run");
+		auto foundAnimation = animData._animationSet.FindAnimation(animation);
 
-			static float time = 0.f;
-			time += 1.0f / 60.f;
+		_animationTime += deltaTime;
 
-			RenderCore::Assets::AnimationState animState{
-				std::fmod(time, foundAnimation._endTime), animation};
-			auto params = animData._animationSet.BuildTransformationParameterSet(
-				animState,
-				skeletonMachine, animSetToSkeletonBinding,
-				MakeIteratorRange(animData._curves));
+		RenderCore::Assets::AnimationState animState{
+			std::fmod(_animationTime, foundAnimation._endTime), animation};
+		auto params = animData._animationSet.BuildTransformationParameterSet(
+			animState,
+			skeletonMachine, animSetToSkeletonBinding,
+			MakeIteratorRange(animData._curves));
 
-			std::vector<Float4x4> skeletonMachineOutput(skeletonMachine.GetOutputMatrixCount());
-			skeletonMachine.GenerateOutputTransforms(
+		std::vector<Float4x4> skeletonMachineOutput(skeletonMachine.GetOutputMatrixCount());
+		skeletonMachine.GenerateOutputTransforms(
+			MakeIteratorRange(skeletonMachineOutput),
+			&params);
+
+		for (unsigned c=0; c<renderer->DeformOperationCount(); ++c) {
+			auto* skinDeformOp = dynamic_cast<RenderCore::Techniques::SkinDeformer*>(&renderer->DeformOperation(c));
+			if (!skinDeformOp) continue;
+			skinDeformOp->FeedInSkeletonMachineResults(
 				MakeIteratorRange(skeletonMachineOutput),
-				&params);
-
-			for (unsigned c=0; c<renderer->DeformOperationCount(); ++c) {
-				auto* skinDeformOp = dynamic_cast<RenderCore::Techniques::SkinDeformer*>(&renderer->DeformOperation(c));
-				if (!skinDeformOp) continue;
-				skinDeformOp->FeedInSkeletonMachineResults(
-					MakeIteratorRange(skeletonMachineOutput),
-					skeletonMachine.GetOutputInterface());
-			}
-			renderer->GenerateDeformBuffer(context);
+				skeletonMachine.GetOutputInterface());
+		}
+
+			// The skinning runs in the background while the scene is prepared; the output is
+			// uploaded when the model is first drawn
+		renderer->ExecuteDeformOps(&ConsoleRig::GlobalServices::GetInstance().GetShortTaskThreadPool());
+	}
+
+	void BasicSceneParser::Model::RenderOpaque_SimpleModelRenderer(
+		RenderCore::IThreadContext& context, 
+        SceneEngine::SceneExecuteContext& executeContext)
+    {
+		auto renderer = _simpleModelRenderer->TryActualize();
+		if (!renderer) return;
+
+		if (!_pipelinesPrecompiled) {
+				// The model has just finished loading; start building its pipelines in the background
+				// now, rather than as each one is first drawn
+			_pipelineAcceleratorPool->PrecompilePipelines();
+			_pipelinesPrecompiled = true;
 		}
 
 		for (unsigned v=0; v<executeContext.GetViews().size(); ++v) {
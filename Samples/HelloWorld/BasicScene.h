@@ -22,6 +22,9 @@ namespace Sample
             RenderCore::IThreadContext& context, 
             SceneEngine::SceneExecuteContext& executeContext) const;
 
+		/// Advances the animation, and starts the skinning for the next frame
+		void Update(float deltaTime);
+
 		BasicSceneParser(const std::shared_ptr<RenderCore::Techniques::IPipelineAcceleratorPool>&);
 		~BasicSceneParser();
 	protected:
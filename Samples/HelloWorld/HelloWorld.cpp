@@ -12,6 +12,9 @@
 #include "../../RenderOverlays/DebuggingDisplay.h"
 #include "../../SceneEngine/LightingParserContext.h"
 #include "../../ConsoleRig/Console.h"
+#include "../../Assets/AssetServices.h"
+#include "../../Assets/CompileAndAsyncManager.h"
+#include "../../Assets/IntermediateAssets.h"
 #include <optional>
 
 namespace Sample
@@ -91,15 +94,26 @@ namespace Sample
 	void HelloWorldOverlay::OnUpdate(float deltaTime)
 	{
 		_lightingDelegate->Update(deltaTime);
+		if (_scene)
+			_scene->Update(deltaTime);
 	}
 
 	void HelloWorldOverlay::OnStartup(const SampleGlobals& globals)
 	{
 		_pipelineAcceleratorPool = RenderCore::Techniques::CreatePipelineAcceleratorPool();
+		if (auto& store = ::Assets::Services::GetAsyncMan().GetIntermediateStore())
+			_pipelineAcceleratorPool->LoadPipelineCache(*store);
 		_scene = std::make_shared<BasicSceneParser>(_pipelineAcceleratorPool);
 		_lightingDelegate = std::make_shared<SampleLightingDelegate>();
 		_inputListener = std::make_shared<InputListener>();
 	}
+
+	HelloWorldOverlay::~HelloWorldOverlay()
+	{
+		if (_pipelineAcceleratorPool)
+			if (auto& store = ::Assets::Services::GetAsyncMan().GetIntermediateStore())
+				_pipelineAcceleratorPool->SavePipelineCache(*store);
+	}
     
 }
 
@@ -6,12 +6,12 @@
 
 #include "../Shared/SampleRig.h"
 
-namespace SceneEngine { class IScene; }
 namespace RenderCore { namespace Techniques { class IPipelineAcceleratorPool; } }
 
 namespace Sample
 {
 	class SampleLightingDelegate;
+	class BasicSceneParser;
 
 	class HelloWorldOverlay : public ISampleOverlay
 	{
@@ -25,8 +25,10 @@ namespace Sample
 		virtual void OnStartup(const SampleGlobals& globals) override;
 
 		virtual std::shared_ptr<PlatformRig::IInputListener> GetInputListener();
+
+		~HelloWorldOverlay();
 	private:
-		std::shared_ptr<SceneEngine::IScene> _scene;
+		std::shared_ptr<BasicSceneParser> _scene;
 		std::shared_ptr<SampleLightingDelegate> _lightingDelegate;
 		std::shared_ptr<RenderCore::Techniques::IPipelineAcceleratorPool> _pipelineAcceleratorPool;
 
@@ -22,6 +22,7 @@
 #include "../../RenderCore/Techniques/RenderPass.h"
 #include "../../RenderCore/Techniques/RenderPassUtils.h"
 #include "../../RenderCore/Techniques/ParsingContext.h"
+#include "../../RenderCore/Techniques/FrameArena.h"
 #include "../../RenderCore/Techniques/Services.h"
 
 #include "../../RenderOverlays/Font.h"
@@ -136,12 +137,15 @@ namespace Sample
 			sampleOverlay->OnStartup(sampleGlobals);
 
                 //  Finally, we execute the frame loop
+            RenderCore::Techniques::FrameArena frameArena;
             while (PlatformRig::OverlappedWindow::DoMsgPump() != PlatformRig::OverlappedWindow::PumpResult::Terminate) {
                     // ------- Render ----------------------------------------
                 RenderCore::Techniques::ParsingContext parserContext(*sampleGlobals._techniqueContext, attachmentPool.get(), frameBufferPool.get());
+                parserContext._frameArena = &frameArena;
                 auto frameResult = frameRig.ExecuteFrame(
                     *threadContext.get(), sampleGlobals._presentationChain.get(), 
 					parserContext, &cpuProfiler);
+                frameArena.OnFrameBarrier();
 
                     // ------- Update ----------------------------------------
                 RenderCore::Techniques::Services::GetBufferUploads().Update(*threadContext, false);
@@ -30,6 +30,7 @@ namespace SceneEngine
             unsigned        _payloadID;
             unsigned        _treeDepth;
             unsigned        _children[4];
+            AABBx4          _childBoundaries;       // (lanes for missing children are never tested)
 
 			static const bool SerializeRaw = true;
         };
@@ -38,15 +39,19 @@ namespace SceneEngine
         {
         public:
 			SerializableVector<unsigned>	_objects;
+			unsigned						_firstBoundaryBlock;	// index into _payloadBoundaries
 
 			void SerializeMethod(::Serialization::NascentBlockSerializer& serializer) const
 			{
 				Serialize(serializer, _objects);
+				Serialize(serializer, _firstBoundaryBlock);
 			}
         };
 
 		SerializableVector<Node>		_nodes;
 		SerializableVector<Payload>		_payloads;
+		SerializableVector<AABBx4>		_payloadBoundaries;		// object bounding boxes, in payload order
+		AABBx4							_rootBoundary;
         unsigned						_maxCullResults;
 
         class WorkingObject
@@ -59,6 +64,7 @@ namespace SceneEngine
         void PushNode(  unsigned parentNode, unsigned childIndex,
                         const std::vector<WorkingObject>& workingObjects,
 						unsigned leafThreshold, Orientation orientation);
+        void BuildCullingBoundaries(const BoundingBox objCellSpaceBoundingBoxes[], size_t objStride);
 
         unsigned CalculateMaxResults()
         {
@@ -114,6 +120,8 @@ namespace SceneEngine
 		{
 			Serialize(serializer, _nodes);
 			Serialize(serializer, _payloads);
+			Serialize(serializer, _payloadBoundaries);
+			serializer.SerializeRaw(_rootBoundary);
 			Serialize(serializer, _maxCullResults);
 		}
     };
@@ -395,6 +403,36 @@ namespace SceneEngine
         }
     }
 
+    void GenericQuadTree::Pimpl::BuildCullingBoundaries(const BoundingBox objCellSpaceBoundingBoxes[], size_t objStride)
+    {
+            //  Copy the bounding boxes into structure-of-arrays blocks for the batched
+            //  culling tests. Each payload gets its own run of blocks, and each node
+            //  records the boundaries of its children, so they can be tested together.
+        assert(_payloadBoundaries.empty());
+        for (auto& p:_payloads) {
+            p._firstBoundaryBlock = unsigned(_payloadBoundaries.size());
+            for (unsigned c=0; c<p._objects.size(); c+=4) {
+                AABBx4 block = {};
+                for (unsigned q=0; q<4 && (c+q)<p._objects.size(); ++q) {
+                    const auto& boundary = *PtrAdd(objCellSpaceBoundingBoxes, p._objects[c+q] * objStride);
+                    block.Set(q, boundary.first, boundary.second);
+                }
+                _payloadBoundaries.push_back(block);
+            }
+        }
+
+        for (auto& n:_nodes) {
+            n._childBoundaries = AABBx4{};
+            for (unsigned c=0; c<4; ++c)
+                if (n._children[c] < _nodes.size())
+                    n._childBoundaries.Set(c, _nodes[n._children[c]]._boundary.first, _nodes[n._children[c]]._boundary.second);
+        }
+
+        _rootBoundary = AABBx4{};
+        if (!_nodes.empty())
+            _rootBoundary.Set(0, _nodes[0]._boundary.first, _nodes[0]._boundary.second);
+    }
+
 	const GenericQuadTree::Pimpl& GenericQuadTree::GetPimpl() const
 	{
 		return *(const GenericQuadTree::Pimpl*)Serialization::Block_GetFirstObject(_dataBlock.get());
@@ -402,81 +440,90 @@ namespace SceneEngine
 
     bool GenericQuadTree::CalculateVisibleObjects(
         const Float4x4& cellToClipAligned, ClipSpaceType clipSpaceType,
-        const BoundingBox objCellSpaceBoundingBoxes[], size_t objStride,
+        bool testPayloadObjects,
         unsigned visObjs[], unsigned& visObjsCount, unsigned visObjMaxCount,
         Metrics* metrics) const
     {
         visObjsCount = 0;
-        assert((size_t(AsFloatArray(cellToClipAligned)) & 0xf) == 0);
-
-        unsigned nodeAabbTestCount = 0, payloadAabbTestCount = 0;
 
 		const auto& pimpl = GetPimpl();
+        if (pimpl._nodes.empty()) return true;
+
+        unsigned nodeAabbTestCount = 0, payloadAabbTestCount = 0;
+        AABBCullingFrustum frustum(cellToClipAligned, clipSpaceType);
 
             //  Traverse through the quad tree, and find do bounding box level 
-            //  culling on each object
+            //  culling on each object. Nodes on the working stack are known to straddle
+            //  the edge of the frustum; the children of each are tested together
         static std::stack<unsigned> workingStack;
         static std::stack<unsigned> entirelyVisibleStack;
         assert(workingStack.empty() && entirelyVisibleStack.empty());
-        workingStack.push(0);
+
+        unsigned withinMask = 0;
+        ++nodeAabbTestCount;
+        if (!(TestAABBx4(frustum, pimpl._rootBoundary, &withinMask) & 1))
+            return true;
+        if (withinMask & 1) entirelyVisibleStack.push(0);
+        else workingStack.push(0);
+
         while (!workingStack.empty()) {
             auto nodeIndex = workingStack.top();
             workingStack.pop();
             
             auto& node = pimpl._nodes[nodeIndex];
-            auto test = TestAABB_Aligned(cellToClipAligned, node._boundary.first, node._boundary.second, clipSpaceType);
-            ++nodeAabbTestCount;
-            if (test == AABBIntersection::Culled) {
-                continue;
-            }
-
-            if (test == AABBIntersection::Within) {
-
-                    //  this node and all children are "visible" without
-                    //  any further culling tests
-                entirelyVisibleStack.push(nodeIndex);
-
-            } else {
+            unsigned childMask = 0;
+            for (unsigned c=0; c<4; ++c)
+                if (node._children[c] < pimpl._nodes.size()) {
+                    childMask |= 1u<<c;
+                    ++nodeAabbTestCount;
+                }
 
+            if (childMask) {
+                auto visibleMask = TestAABBx4(frustum, node._childBoundaries, &withinMask) & childMask;
                 for (unsigned c=0; c<4; ++c) {
-                    if (node._children[c] < pimpl._nodes.size()) {
+                    if (!(visibleMask & (1u<<c))) continue;
+
+                        //  children entirely within the frustum are "visible" without
+                        //  any further culling tests (including all of their children)
+                    if (withinMask & (1u<<c)) {
+                        entirelyVisibleStack.push(node._children[c]);
+                    } else {
                         workingStack.push(node._children[c]);
                     }
                 }
+            }
 
-                if (node._payloadID < pimpl._payloads.size()) {
-                    auto& payload = pimpl._payloads[node._payloadID];
-					if (objCellSpaceBoundingBoxes) {
-						for (auto i=payload._objects.cbegin(); i!=payload._objects.cend(); ++i) {
-
-								//  Test the "cell" space bounding box of the object itself
-								//  This must be done inside of this function, we can't
-								//  drop the responsibility to the caller. Because:
-								//      * sometimes we can skip it entirely, when quad tree
-								//          node bounding boxes are considered entirely within the frustum
-								//      * it's best to reduce the result arrays to as small as
-								//          possible (because the caller may need to sort them)
-
-							const auto& boundary = *PtrAdd(objCellSpaceBoundingBoxes, (*i) * objStride);
-							++payloadAabbTestCount;
-							if (!CullAABB_Aligned(cellToClipAligned, boundary.first, boundary.second, clipSpaceType)) {
-								if ((visObjsCount+1) > visObjMaxCount) {
-									return false;
-								}
-								visObjs[visObjsCount++] = *i; 
-							}
-						}
-					} else {
-						if ((visObjsCount + payload._objects.size()) > visObjMaxCount) {
-							return false;
-						}
-
-						for (auto i=payload._objects.cbegin(); i!=payload._objects.cend(); ++i) {
-							visObjs[visObjsCount++] = *i; 
-						}
-					}
+            if (node._payloadID < pimpl._payloads.size()) {
+                auto& payload = pimpl._payloads[node._payloadID];
+                auto objectCount = (unsigned)payload._objects.size();
+                if ((visObjsCount + objectCount) > visObjMaxCount) {
+                    return false;
                 }
 
+				if (testPayloadObjects) {
+
+						//  Test the "cell" space bounding box of the object itself
+						//  This must be done inside of this function, we can't
+						//  drop the responsibility to the caller. Because:
+						//      * sometimes we can skip it entirely, when quad tree
+						//          node bounding boxes are considered entirely within the frustum
+						//      * it's best to reduce the result arrays to as small as
+						//          possible (because the caller may need to sort them)
+						//  The batched test writes indices within the payload; these are
+						//  converted into object indices in place
+					auto* dst = &visObjs[visObjsCount];
+					auto visibleCount = CullAABBs(
+						frustum, &pimpl._payloadBoundaries[payload._firstBoundaryBlock], objectCount,
+						dst);
+					for (unsigned c=0; c<visibleCount; ++c)
+						dst[c] = payload._objects[dst[c]];
+					visObjsCount += visibleCount;
+					payloadAabbTestCount += objectCount;
+				} else {
+					for (auto i=payload._objects.cbegin(); i!=payload._objects.cend(); ++i) {
+						visObjs[visObjsCount++] = *i; 
+					}
+				}
             }
         }
 
@@ -565,8 +612,10 @@ namespace SceneEngine
             //  node based on the objects assigned to it.
 
         auto pimpl = std::make_unique<Pimpl>();
-        pimpl->PushNode(~unsigned(0x0), 0, workingObjects, leafThreshold, orientation);
+        if (!workingObjects.empty())
+            pimpl->PushNode(~unsigned(0x0), 0, workingObjects, leafThreshold, orientation);
         pimpl->_maxCullResults = pimpl->CalculateMaxResults();
+        pimpl->BuildCullingBoundaries(objCellSpaceBoundingBoxes, objStride);
 
         ::Serialization::NascentBlockSerializer serializer;
 		Serialize(serializer, *pimpl);
@@ -576,7 +625,7 @@ namespace SceneEngine
     }
 
 	static const uint64 ChunkType_QuadTree = ConstHash64<'Quad', 'Tree'>::Value;
-	static const unsigned QuadTreeDataVersion = 0;
+	static const unsigned QuadTreeDataVersion = 1;
 
 	static const ::Assets::AssetChunkRequest QuadTreeChunkRequests[]
     {
@@ -29,6 +29,11 @@ namespace SceneEngine
     /// multiply. If the world space bounding box straddles the edge of the
     /// frustum, the caller may wish to perform a local space bounding
     /// box test to further improve the result.
+    ///
+    /// The object bounding boxes are copied into the tree when it's built
+    /// (stored in structure-of-arrays form, grouped by leaf). When
+    /// "testPayloadObjects" is false, CalculateVisibleObjects only tests the
+    /// nodes, and returns all objects in the visible nodes.
     class GenericQuadTree
     {
     public:
@@ -45,7 +50,7 @@ namespace SceneEngine
 
         bool CalculateVisibleObjects(
             const Float4x4& cellToClipAligned, ClipSpaceType clipSpaceType,
-            const BoundingBox objCellSpaceBoundingBoxes[], size_t objStride,
+            bool testPayloadObjects,
             unsigned visObjs[], unsigned& visObjsCount, unsigned visObjMaxCount,
             Metrics* metrics = nullptr) const;
         unsigned GetMaxResults() const;
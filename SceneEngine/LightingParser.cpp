@@ -318,6 +318,16 @@ namespace SceneEngine
 		const CompiledSceneTechnique& technique,
         unsigned samplingPassIndex = 0, unsigned samplingPassCount = 1);
 
+	static void SetDrawablesFrameArena(SceneExecuteContext& executeContext, Techniques::FrameArena* frameArena)
+	{
+			// Temporary vertex & index data written into the packets while executing the scene
+			// comes from the frame arena, rather than from heap allocations in each packet
+		for (const auto& viewDelegate:executeContext.GetViewDelegates())
+			for (unsigned b=0; b<(unsigned)Techniques::BatchFilter::Max; ++b)
+				if (auto* pkt = viewDelegate->GetDrawablesPacket(Techniques::BatchFilter(b)))
+					pkt->SetFrameArena(frameArena);
+	}
+
 	LightingParserContext LightingParser_ExecuteScene(
         RenderCore::IThreadContext& threadContext, 
 		const RenderCore::IResourcePtr& renderTarget,
@@ -351,6 +361,8 @@ namespace SceneEngine
 			shadowViewDelegates.push_back(std::move(viewDelegate));
 		}
 
+		SetDrawablesFrameArena(executeContext, parsingContext._frameArena);
+
 		// No, go ahead and execute the scene, which should generate a lot of Drawables (and potentially other scene preparation elements)
         CATCH_ASSETS_BEGIN
 			scene.ExecuteScene(threadContext, executeContext);
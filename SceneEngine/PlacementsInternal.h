@@ -0,0 +1,329 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#pragma once
+
+#include "PlacementsManager.h"
+#include "PlacementsQuadTree.h"
+#include "../Assets/AssetsCore.h"
+#include "../Utility/Streams/FileUtils.h"
+#include "../Utility/MemoryUtils.h"
+#include "../Utility/IteratorUtils.h"
+#include "../Utility/StringUtils.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+
+namespace Assets { class AssetChunkRequest; class AssetChunkResult; }
+namespace RenderCore { namespace Techniques { class SimpleModelRenderer; } }
+
+namespace SceneEngine
+{
+    using SupplementRange = IteratorRange<const uint64_t*>;
+
+        // Object index & mask of the views that can see it (bit N is the N-th view of the
+        // group of views that was culled together)
+    using VisiblePlacement = std::pair<unsigned, uint64_t>;
+
+        // Note that "placements" that interface methods in Placements are actually
+        // very rarely called. So it should be fine to make those methods into virtual
+        // methods, and use an abstract base class.
+    class Placements
+    {
+    public:
+        typedef std::pair<Float3, Float3> BoundingBox;
+
+        class ObjectReference
+        {
+        public:
+            Float3x4    _localToCell;
+            BoundingBox _cellSpaceBoundary;
+            unsigned    _modelFilenameOffset;       // note -- hash values should be stored with the filenames
+            unsigned    _materialFilenameOffset;
+            unsigned    _supplementsOffset;
+            uint64_t      _guid;
+        };
+        
+        virtual const ObjectReference*  GetObjectReferences() const;
+        virtual unsigned                GetObjectReferenceCount() const;
+        virtual const void*             GetFilenamesBuffer() const;
+        virtual const uint64_t*         GetSupplementsBuffer() const;
+        virtual unsigned                GetFilenamesBufferSize() const;
+        virtual unsigned                GetSupplementsBufferCount() const;
+
+        void Write(const Assets::ResChar destinationFile[]) const;
+        void WriteStreaming(const Assets::ResChar destinationFile[]) const;
+        void LogDetails(const char title[]) const;
+
+		const ::Assets::DepValPtr& GetDependencyValidation() const	{ return _dependencyValidation; }
+		static const ::Assets::AssetChunkRequest ChunkRequests[1];
+
+        Placements(IteratorRange<::Assets::AssetChunkResult*> chunks, const ::Assets::DepValPtr& depVal);
+        Placements();
+        virtual ~Placements();
+    protected:
+        std::vector<ObjectReference>    _objects;
+        std::vector<uint8>              _filenamesBuffer;
+        std::vector<uint64_t>             _supplementsBuffer;
+
+		::Assets::DepValPtr				_dependencyValidation;
+        void ReplaceString(const char oldString[], const char newString[]);
+    };
+
+    class DynamicPlacements : public Placements
+    {
+    public:
+        uint64_t AddPlacement(
+            const Float3x4& objectToCell, 
+            const std::pair<Float3, Float3>& cellSpaceBoundary,
+            StringSection<::Assets::ResChar> modelFilename, StringSection<::Assets::ResChar> materialFilename,
+            SupplementRange supplements,
+            uint64_t objectGuid);
+
+        std::vector<ObjectReference>& GetObjects() { return _objects; }
+        bool HasObject(uint64_t guid);
+
+        unsigned AddString(StringSection<::Assets::ResChar> str);
+        unsigned AddSupplements(SupplementRange supplements);
+
+        DynamicPlacements(const Placements& copyFrom);
+        DynamicPlacements();
+    };
+
+        //  Placements in the streaming format, used in place. The data is either a memory
+        //  mapped file, or a heap block (for cells that were converted from the original
+        //  format as they were loaded)
+    class StreamingPlacements : public Placements
+    {
+    public:
+        const ObjectReference*  GetObjectReferences() const override        { return _streamingObjects; }
+        unsigned                GetObjectReferenceCount() const override    { return _streamingObjectCount; }
+        const void*             GetFilenamesBuffer() const override         { return _streamingFilenames; }
+        const uint64_t*         GetSupplementsBuffer() const override       { return _streamingSupplements; }
+        unsigned                GetFilenamesBufferSize() const override     { return _streamingFilenamesSize; }
+        unsigned                GetSupplementsBufferCount() const override  { return _streamingSupplementsCount; }
+
+        const PlacementsQuadTree& GetQuadTree() const   { return *_quadTree; }
+        size_t GetResidentSize() const                  { return _chunk.size(); }
+
+        StreamingPlacements(Utility::MemoryMappedFile&& file, IteratorRange<const void*> chunk, const ::Assets::DepValPtr& depVal);
+        StreamingPlacements(IteratorRange<const void*> chunk, const ::Assets::DepValPtr& depVal);
+        ~StreamingPlacements();
+    private:
+        Utility::MemoryMappedFile                       _file;
+        std::unique_ptr<uint8[], PODAlignedDeletor>     _block;
+        IteratorRange<const void*>                      _chunk;
+
+        const ObjectReference*      _streamingObjects = nullptr;
+        const void*                 _streamingFilenames = nullptr;
+        const uint64_t*             _streamingSupplements = nullptr;
+        unsigned                    _streamingObjectCount = 0;
+        unsigned                    _streamingFilenamesSize = 0;
+        unsigned                    _streamingSupplementsCount = 0;
+        std::unique_ptr<PlacementsQuadTree> _quadTree;
+
+        void BindChunk();
+    };
+
+        //
+        //      Streaming format for placements cells
+        //      This is designed to be used in place, directly from a memory mapped 
+        //      file, without any parsing or copying:
+        //          * every array starts on a 16 byte boundary (and the chunk itself
+        //              starts on a 16 byte boundary within the file)
+        //          * each filename hash is 8 byte aligned
+        //          * the quad tree is prebuilt (see PlacementsQuadTree::Serialize),
+        //              so the structure-of-arrays bounding box blocks for culling are
+        //              ready to go
+        //          * objects are sorted by model & material (so they come out of the
+        //              quad tree in the order they are drawn)
+        //      Offsets in the header are relative to the start of the chunk.
+        //      Version 1 chunks have the same layout, but the objects aren't sorted; they
+        //      are rebuilt as they are loaded.
+        //
+    static const uint64_t ChunkType_StreamingPlacements = ConstHash64<'Stre','amPl','acem','ents'>::Value;
+    static const unsigned StreamingPlacementsVersion = 2;
+    static const unsigned StreamingPlacementsVersion_Unsorted = 1;
+
+    class StreamingPlacementsHeader
+    {
+    public:
+        unsigned _objectRefCount;
+        unsigned _objectRefSize;
+        unsigned _objectsOffset;
+        unsigned _filenamesOffset, _filenamesSize;
+        unsigned _supplementsOffset, _supplementsCount;
+        unsigned _quadTreeOffset, _quadTreeSize;
+    };
+
+        //  Builds a cell in the streaming format (see PlacementsResidencyManager). The
+        //  result is the contents of the chunk, without the chunk file header
+    std::vector<uint8_t> BuildStreamingPlacementsChunk(const Placements& placements);
+
+    class PlacementCell
+    {
+    public:
+        uint64_t      _filenameHash;
+        Float3x4    _cellToWorld;
+        Float3      _aabbMin, _aabbMax;
+        Float2      _captureMins, _captureMaxs;
+        ::Assets::ResChar _filename[256];
+    };
+
+    class PlacementsCache
+    {
+    public:
+        class Item
+        {
+        public:
+            ::Assets::rstring _filename;
+            std::unique_ptr<Placements> _placements;
+
+            void Reload();
+
+            Item() {}
+            Item(Item&& moveFrom) : _filename(std::move(moveFrom._filename)), _placements(std::move(moveFrom._placements)) {}
+            Item& operator=(Item&& moveFrom) 
+            {
+                _filename = std::move(moveFrom._filename);
+                _placements = std::move(moveFrom._placements);
+                return *this;
+            }
+
+            Item& operator=(const Item&) = delete;
+            Item(const Item&) = delete;
+        };
+        Item* Get(uint64_t filenameHash, const ::Assets::ResChar filename[] = nullptr);
+
+        PlacementsCache();
+        ~PlacementsCache();
+    protected:
+        std::vector<std::pair<uint64_t, std::unique_ptr<Item>>> _items;
+    };
+
+    class PlacementCellSet::Pimpl
+    {
+    public:
+        std::vector<PlacementCell> _cells;
+        std::vector<std::pair<uint64_t, std::shared_ptr<Placements>>> _cellOverrides;
+
+        void SetOverride(uint64_t guid, std::shared_ptr<Placements> placements);
+        Placements* GetOverride(uint64_t guid);
+    };
+
+        //  Model/material pairs used by placements, interned into dense handles. Each cell is
+        //  resolved into handles once, when it's first drawn; so while drawing, checking for a
+        //  change of model is just an integer compare, and there is no string or hash work.
+        //  Interning (and refreshing the renderers) happens while the cell jobs are prepared;
+        //  the worker threads only read from the table.
+    class PlacementsModelTable
+    {
+    public:
+        class Entry
+        {
+        public:
+            ::Assets::rstring _modelName, _materialName;
+            ::Assets::FuturePtr<RenderCore::Techniques::SimpleModelRenderer> _renderer;
+            unsigned _lastUsedBuild = 0;
+        };
+
+            // The handles for the objects in a single cell
+        class CellHandles
+        {
+        public:
+            std::vector<unsigned>   _objectHandles;     // in draw order
+            std::vector<unsigned>   _drawOrder;         // draw index -> object index (empty when the objects are already in draw order)
+            std::vector<unsigned>   _uniqueHandles;
+            unsigned                _tableId = 0;
+
+            unsigned GetObjectIndex(unsigned drawIndex) const { return _drawOrder.empty() ? drawIndex : _drawOrder[drawIndex]; }
+        };
+
+        void BuildCellHandles(CellHandles& dst, const Placements& placements, bool sortByHandle);
+        using RendererFactory = std::function<
+            ::Assets::FuturePtr<RenderCore::Techniques::SimpleModelRenderer>(StringSection<::Assets::ResChar>, StringSection<::Assets::ResChar>)>;
+        void UpdateRenderers(const CellHandles& handles, const RendererFactory& factory);
+        void UpdateRenderers(const CellHandles& handles, PlacementsModelCache& cache);
+        void BeginBuild();
+
+        const Entry& GetEntry(unsigned handle) const { return _entries[handle]; }
+        unsigned GetTableId() const { return _tableId; }
+
+            // renderers unused for more than this many builds are released
+        static const unsigned s_releaseBuilds = 256;
+
+        PlacementsModelTable();
+        ~PlacementsModelTable();
+    private:
+        std::vector<Entry> _entries;
+        std::vector<std::pair<uint64_t, unsigned>> _lookup;
+        unsigned _buildIndex = 1;
+        unsigned _tableId;
+
+        unsigned Intern(const void* filenamesBuffer, const Placements::ObjectReference& obj);
+    };
+
+        //  Removes the visible objects whose GUIDs aren't in the filter (which must be sorted).
+        //  The visible objects are draw indices, so they aren't in GUID order; each one is
+        //  searched for in the filter. The order of the remaining objects is unchanged
+    void FilterVisiblePlacements(
+        std::vector<VisiblePlacement>& visiblePlacements,
+        const Placements& placements,
+        const PlacementsModelTable::CellHandles& modelHandles,
+        IteratorRange<const uint64_t*> filter);
+
+    class PlacementsResidencyManager::Pimpl
+    {
+    public:
+        class PendingLoad
+        {
+        public:
+            std::atomic<bool>                       _complete;
+            std::unique_ptr<StreamingPlacements>    _result;        // written by the loading thread before _complete is set
+            PendingLoad() : _complete(false) {}
+        };
+
+        class Cell
+        {
+        public:
+            ::Assets::rstring                       _filename;
+            std::unique_ptr<StreamingPlacements>    _placements;
+            std::shared_ptr<PendingLoad>            _pendingLoad;
+            PlacementsModelTable::CellHandles _modelHandles;    // (resolved by the renderer, the first time the cell is drawn)
+            size_t          _lastResidentSize = 0;      // (estimate used for loading the cell again)
+            float           _distanceSq = 0.f;
+            unsigned        _lastSeenFrame = 0;
+            bool            _failed = false;
+        };
+
+        std::vector<std::pair<uint64_t, Cell>> _cells;
+        Config          _config;
+        unsigned        _frameIndex = 0;
+        size_t          _residentBytes = 0;
+        Metrics         _totals;
+
+        Cell* GetResidentCell(uint64_t filenameHash)
+        {
+            auto i = LowerBound(_cells, filenameHash);
+            if (i != _cells.end() && i->first == filenameHash && i->second._placements)
+                return &i->second;
+            return nullptr;
+        }
+
+        void Release(Cell& cell)
+        {
+            assert(cell._placements);
+            cell._lastResidentSize = cell._placements->GetResidentSize();
+            _residentBytes -= cell._lastResidentSize;
+            cell._placements.reset();
+            cell._modelHandles = PlacementsModelTable::CellHandles();
+            ++_totals._releases;
+        }
+
+        static void LoadCell(PendingLoad& load, const ::Assets::rstring& filename);
+    };
+}
@@ -5,6 +5,7 @@
 // http://www.opensource.org/licenses/mit-license.php)
 
 #include "PlacementsManager.h"
+#include "PlacementsInternal.h"
 #include "PlacementsQuadTree.h"
 #include "DynamicImposters.h"
 #include "SceneParser.h"
@@ -15,6 +16,7 @@
 #include "../RenderCore/Assets/MaterialScaffold.h"
 #include "../RenderCore/Techniques/ParsingContext.h"
 #include "../RenderCore/Techniques/RenderStateResolver.h"
+#include "../RenderCore/Techniques/Drawables.h"
 
 #include "../Assets/IFileSystem.h"
 #include "../Assets/AssetTraits.h"
@@ -40,9 +42,13 @@
 #include "../Utility/Streams/StreamFormatter.h"
 #include "../Utility/Streams/StreamDOM.h"
 #include "../Utility/Conversion.h"
+#include "../Utility/Threading/CompletionThreadPool.h"
 #include "../Core/Types.h"
 
 #include <random>
+#include <thread>
+#include <atomic>
+#include <tuple>
 
 namespace SceneEngine
 {
@@ -51,56 +57,14 @@ namespace SceneEngine
     using RenderCore::Assets::ModelScaffold;
     using RenderCore::Assets::MaterialScaffold;
 
-    using SupplementRange = IteratorRange<const uint64_t*>;
-
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-        // Note that "placements" that interface methods in Placements are actually
-        // very rarely called. So it should be fine to make those methods into virtual
-        // methods, and use an abstract base class.
-    class Placements
-    {
-    public:
-        typedef std::pair<Float3, Float3> BoundingBox;
-
-        class ObjectReference
-        {
-        public:
-            Float3x4    _localToCell;
-            BoundingBox _cellSpaceBoundary;
-            unsigned    _modelFilenameOffset;       // note -- hash values should be stored with the filenames
-            unsigned    _materialFilenameOffset;
-            unsigned    _supplementsOffset;
-            uint64_t      _guid;
-        };
-        
-        const ObjectReference*  GetObjectReferences() const;
-        unsigned                GetObjectReferenceCount() const;
-        const void*             GetFilenamesBuffer() const;
-        const uint64_t*           GetSupplementsBuffer() const;
-
-        void Write(const Assets::ResChar destinationFile[]) const;
-        void LogDetails(const char title[]) const;
-
-		const ::Assets::DepValPtr& GetDependencyValidation() const	{ return _dependencyValidation; }
-		static const ::Assets::AssetChunkRequest ChunkRequests[1];
-
-        Placements(IteratorRange<::Assets::AssetChunkResult*> chunks, const ::Assets::DepValPtr& depVal);
-        Placements();
-        ~Placements();
-    protected:
-        std::vector<ObjectReference>    _objects;
-        std::vector<uint8>              _filenamesBuffer;
-        std::vector<uint64_t>             _supplementsBuffer;
-
-		::Assets::DepValPtr				_dependencyValidation;
-        void ReplaceString(const char oldString[], const char newString[]);
-    };
-
     auto            Placements::GetObjectReferences() const -> const ObjectReference*   { return AsPointer(_objects.begin()); }
     unsigned        Placements::GetObjectReferenceCount() const                         { return unsigned(_objects.size()); }
     const void*     Placements::GetFilenamesBuffer() const                              { return AsPointer(_filenamesBuffer.begin()); }
     const uint64_t*   Placements::GetSupplementsBuffer() const                            { return AsPointer(_supplementsBuffer.begin()); }
+    unsigned        Placements::GetFilenamesBufferSize() const                          { return unsigned(_filenamesBuffer.size()); }
+    unsigned        Placements::GetSupplementsBufferCount() const                       { return unsigned(_supplementsBuffer.size()); }
 
     static const uint64_t ChunkType_Placements = ConstHash64<'Plac','emen','ts'>::Value;
 
@@ -295,48 +259,195 @@ namespace SceneEngine
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    class PlacementCell
+    static size_t AlignTo16(size_t offset) { return (offset + 15) & ~size_t(15); }
+
+    std::vector<uint8_t> BuildStreamingPlacementsChunk(const Placements& placements)
     {
-    public:
-        uint64_t      _filenameHash;
-        Float3x4    _cellToWorld;
-        Float3      _aabbMin, _aabbMax;
-        Float2      _captureMins, _captureMaxs;
-        ResChar     _filename[256];
-    };
+        auto objectCount = placements.GetObjectReferenceCount();
+        std::vector<Placements::ObjectReference> objects(
+            placements.GetObjectReferences(), placements.GetObjectReferences() + objectCount);
 
-    class PlacementsQuadTree;
+            //  Rebuild the string table, so that each entry starts on an 8 byte boundary.
+            //  Only the entries that the objects refer to are copied (so this works for any
+            //  source table, including one that already has padding between entries). The
+            //  object references must be updated to match
+        std::vector<uint8_t> filenames;
+        std::vector<std::pair<unsigned, unsigned>> offsetRemapping;
+        offsetRemapping.reserve(objects.size()*2);
+        for (const auto& o:objects) {
+            offsetRemapping.emplace_back(o._modelFilenameOffset, 0);
+            offsetRemapping.emplace_back(o._materialFilenameOffset, 0);
+        }
+        std::sort(offsetRemapping.begin(), offsetRemapping.end());
+        offsetRemapping.erase(
+            std::unique(
+                offsetRemapping.begin(), offsetRemapping.end(),
+                [](const std::pair<unsigned, unsigned>& lhs, const std::pair<unsigned, unsigned>& rhs) { return lhs.first == rhs.first; }),
+            offsetRemapping.end());
+        {
+            const auto* start = (const uint8_t*)placements.GetFilenamesBuffer();
+            size_t size = placements.GetFilenamesBufferSize();
+            for (auto& r:offsetRemapping) {
+                if (size_t(r.first) + sizeof(uint64_t) > size)
+                    Throw(::Exceptions::BasicLabel("Bad filename offset in placements"));
+                auto stringEnd = std::find(start + r.first + sizeof(uint64_t), start + size, uint8_t(0));
+                auto entrySize = size_t(stringEnd - (start + r.first));         // (not including the terminator)
+                auto newOffset = (filenames.size() + 7) & ~size_t(7);
+                filenames.resize(newOffset + entrySize + 1, 0);
+                XlCopyMemory(&filenames[newOffset], start + r.first, entrySize);
+                r.second = unsigned(newOffset);
+            }
+        }
+
+        auto remapOffset = [&offsetRemapping](unsigned oldOffset) { return LowerBound(offsetRemapping, oldOffset)->second; };
+        for (auto& o:objects) {
+            o._modelFilenameOffset = remapOffset(o._modelFilenameOffset);
+            o._materialFilenameOffset = remapOffset(o._materialFilenameOffset);
+        }
+
+            //  Objects are grouped by model & material, so the prebuilt quad tree is already
+            //  in the order the renderer wants to draw them (see PlacementsModelTable)
+        auto drawOrderKey = [&filenames](const Placements::ObjectReference& o) {
+            return std::make_tuple(
+                *(const uint64_t*)&filenames[o._modelFilenameOffset],
+                *(const uint64_t*)&filenames[o._materialFilenameOffset],
+                o._guid);
+        };
+        std::sort(
+            objects.begin(), objects.end(),
+            [&drawOrderKey](const Placements::ObjectReference& lhs, const Placements::ObjectReference& rhs) { return drawOrderKey(lhs) < drawOrderKey(rhs); });
+
+        PlacementsQuadTree quadTree(
+            objectCount ? &objects[0]._cellSpaceBoundary : nullptr,
+            sizeof(Placements::ObjectReference), objectCount);
+        auto quadTreeData = quadTree.Serialize();
+
+        StreamingPlacementsHeader hdr;
+        hdr._objectRefCount = objectCount;
+        hdr._objectRefSize = unsigned(sizeof(Placements::ObjectReference));
+        hdr._objectsOffset = unsigned(AlignTo16(sizeof(StreamingPlacementsHeader)));
+        hdr._filenamesOffset = unsigned(AlignTo16(hdr._objectsOffset + objectCount * sizeof(Placements::ObjectReference)));
+        hdr._filenamesSize = unsigned(filenames.size());
+        hdr._supplementsOffset = unsigned(AlignTo16(hdr._filenamesOffset + hdr._filenamesSize));
+        hdr._supplementsCount = placements.GetSupplementsBufferCount();
+        hdr._quadTreeOffset = unsigned(AlignTo16(hdr._supplementsOffset + hdr._supplementsCount * sizeof(uint64_t)));
+        hdr._quadTreeSize = unsigned(quadTreeData.size());
+
+        std::vector<uint8_t> result(hdr._quadTreeOffset + hdr._quadTreeSize, 0);
+        XlCopyMemory(AsPointer(result.begin()), &hdr, sizeof(hdr));
+        XlCopyMemory(&result[hdr._objectsOffset], AsPointer(objects.begin()), objectCount * sizeof(Placements::ObjectReference));
+        XlCopyMemory(&result[hdr._filenamesOffset], AsPointer(filenames.begin()), filenames.size());
+        XlCopyMemory(&result[hdr._supplementsOffset], placements.GetSupplementsBuffer(), hdr._supplementsCount * sizeof(uint64_t));
+        XlCopyMemory(&result[hdr._quadTreeOffset], AsPointer(quadTreeData.begin()), quadTreeData.size());
+        return result;
+    }
 
-    class PlacementsCache
+    void Placements::WriteStreaming(const Assets::ResChar destinationFile[]) const
     {
-    public:
-        class Item
-        {
-        public:
-            ::Assets::rstring _filename;
-            std::unique_ptr<Placements> _placements;
+        auto chunk = BuildStreamingPlacementsChunk(*this);
 
-            void Reload();
+        using namespace Serialization::ChunkFile;
+		auto libVersion = ConsoleRig::GetLibVersionDesc();
+        SimpleChunkFileWriter fileWriter(
+			::Assets::MainFileSystem::OpenBasicFile(destinationFile, "wb", 0),
+            1, libVersion._versionString, libVersion._buildDateString);
 
-            Item() {}
-            Item(Item&& moveFrom) : _filename(std::move(moveFrom._filename)), _placements(std::move(moveFrom._placements)) {}
-            Item& operator=(Item&& moveFrom) 
-            {
-                _filename = std::move(moveFrom._filename);
-                _placements = std::move(moveFrom._placements);
-                return *this;
-            }
+            //  The chunk must begin on a 16 byte boundary within the file (so the arrays
+            //  inside of it are aligned when the file is memory mapped)
+        const uint8_t padding[16] = {};
+        auto paddingSize = AlignTo16(fileWriter.TellP()) - fileWriter.TellP();
+        auto writeResult0 = paddingSize ? fileWriter.Write(padding, 1, paddingSize) : 0;
+        fileWriter.BeginChunk(ChunkType_StreamingPlacements, StreamingPlacementsVersion, "Placements");
+        auto writeResult1 = fileWriter.Write(AsPointer(chunk.begin()), 1, chunk.size());
+
+        if (writeResult0 != paddingSize || writeResult1 != chunk.size())
+            Throw(::Exceptions::BasicLabel("Failure in file write while saving streaming placements"));
+    }
+
+    void StreamingPlacements::BindChunk()
+    {
+            //  The renderer trusts the offsets in the object references; so everything is
+            //  checked here, once, on the loading thread. For memory mapped files, this also
+            //  means the pages for the object references are faulted in on this thread, 
+            //  rather than while rendering
+        if ((size_t(_chunk.begin()) & 15) != 0 || _chunk.size() < sizeof(StreamingPlacementsHeader))
+            Throw(::Exceptions::BasicLabel("Streaming placements chunk is misaligned or truncated"));
+        const auto& hdr = *(const StreamingPlacementsHeader*)_chunk.begin();
+        if (hdr._objectRefSize != sizeof(ObjectReference))
+            Throw(::Exceptions::BasicLabel("Streaming placements object reference size mismatch"));
+        auto sectionBad = [this](size_t offset, size_t size) { return (offset & 15) != 0 || offset + size > _chunk.size(); };
+        if (    sectionBad(hdr._objectsOffset, size_t(hdr._objectRefCount) * sizeof(ObjectReference))
+            ||  sectionBad(hdr._filenamesOffset, hdr._filenamesSize)
+            ||  sectionBad(hdr._supplementsOffset, size_t(hdr._supplementsCount) * sizeof(uint64_t))
+            ||  sectionBad(hdr._quadTreeOffset, hdr._quadTreeSize))
+            Throw(::Exceptions::BasicLabel("Bad section in streaming placements chunk"));
+
+        _streamingObjects = (const ObjectReference*)PtrAdd(_chunk.begin(), hdr._objectsOffset);
+        _streamingObjectCount = hdr._objectRefCount;
+        _streamingFilenames = PtrAdd(_chunk.begin(), hdr._filenamesOffset);
+        _streamingFilenamesSize = hdr._filenamesSize;
+        _streamingSupplements = (const uint64_t*)PtrAdd(_chunk.begin(), hdr._supplementsOffset);
+        _streamingSupplementsCount = hdr._supplementsCount;
+
+        const auto* filenames = (const uint8_t*)_streamingFilenames;
+        if (_streamingFilenamesSize && filenames[_streamingFilenamesSize-1] != 0)
+            Throw(::Exceptions::BasicLabel("Bad string table in streaming placements chunk"));
+            //  (the supplements entry is a count followed by that many values; the range is
+            //  checked by subtraction, so a huge count can't wrap around)
+        for (unsigned c=0; c<_streamingObjectCount; ++c) {
+            const auto& o = _streamingObjects[c];
+            if (    (o._modelFilenameOffset & 7) || o._modelFilenameOffset + sizeof(uint64_t) >= _streamingFilenamesSize
+                ||  (o._materialFilenameOffset & 7) || o._materialFilenameOffset + sizeof(uint64_t) >= _streamingFilenamesSize
+                ||  (o._supplementsOffset && (o._supplementsOffset >= _streamingSupplementsCount || _streamingSupplements[o._supplementsOffset] >= uint64_t(_streamingSupplementsCount) - uint64_t(o._supplementsOffset))))
+                Throw(::Exceptions::BasicLabel("Bad object reference in streaming placements chunk"));
+        }
 
-            Item& operator=(const Item&) = delete;
-            Item(const Item&) = delete;
-        };
-        Item* Get(uint64_t filenameHash, const ResChar filename[] = nullptr);
+        _quadTree = std::make_unique<PlacementsQuadTree>(
+            MakeIteratorRange(PtrAdd(_chunk.begin(), hdr._quadTreeOffset), PtrAdd(_chunk.begin(), hdr._quadTreeOffset + hdr._quadTreeSize)),
+            _streamingObjectCount);
+        if (_quadTree->GetMaxResults() != _streamingObjectCount)
+            Throw(::Exceptions::BasicLabel("Quad tree doesn't match objects in streaming placements chunk"));
+    }
 
-        PlacementsCache();
-        ~PlacementsCache();
-    protected:
-        std::vector<std::pair<uint64_t, std::unique_ptr<Item>>> _items;
-    };
+    StreamingPlacements::StreamingPlacements(Utility::MemoryMappedFile&& file, IteratorRange<const void*> chunk, const ::Assets::DepValPtr& depVal)
+    : _file(std::move(file)), _chunk(chunk)
+    {
+        _dependencyValidation = depVal;
+        BindChunk();
+    }
+
+    StreamingPlacements::StreamingPlacements(IteratorRange<const void*> chunk, const ::Assets::DepValPtr& depVal)
+    {
+        _block.reset((uint8*)XlMemAlign(chunk.size(), 16));
+        XlCopyMemory(_block.get(), chunk.begin(), chunk.size());
+        _chunk = MakeIteratorRange((const void*)_block.get(), PtrAdd((const void*)_block.get(), chunk.size()));
+        _dependencyValidation = depVal;
+        BindChunk();
+    }
+
+    StreamingPlacements::~StreamingPlacements() {}
+
+    static IteratorRange<const void*> FindChunkInMemory(IteratorRange<const void*> file, uint64_t chunkType, unsigned& chunkVersion)
+    {
+        using namespace Serialization::ChunkFile;
+        if (file.size() < sizeof(ChunkFileHeader)) return {};
+        const auto& fileHeader = *(const ChunkFileHeader*)file.begin();
+        if (    fileHeader._magic != MagicHeader || fileHeader._fileVersionNumber != ChunkFileVersion
+            ||  sizeof(ChunkFileHeader) + size_t(fileHeader._chunkCount) * sizeof(ChunkHeader) > file.size())
+            return {};
+
+        const auto* chunks = (const ChunkHeader*)PtrAdd(file.begin(), sizeof(ChunkFileHeader));
+        for (unsigned c=0; c<fileHeader._chunkCount; ++c) {
+            if (chunks[c]._type != chunkType) continue;
+            if (size_t(chunks[c]._fileOffset) + size_t(chunks[c]._size) > file.size())
+                Throw(::Exceptions::BasicLabel("Chunk extends beyond the end of the file"));
+            chunkVersion = chunks[c]._chunkVersion;
+            return MakeIteratorRange(PtrAdd(file.begin(), chunks[c]._fileOffset), PtrAdd(file.begin(), chunks[c]._fileOffset + chunks[c]._size));
+        }
+        return {};
+    }
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
     auto PlacementsCache::Get(uint64_t filenameHash, const ResChar filename[]) -> Item*
     {
@@ -388,30 +499,160 @@ namespace SceneEngine
 		return ::Assets::AssetState::Ready;
     }
 
+    unsigned PlacementsModelTable::Intern(const void* filenamesBuffer, const Placements::ObjectReference& obj)
+    {
+            // (this is the same key that the model cache uses for its renderers)
+        auto modelHash = *(const uint64_t*)PtrAdd(filenamesBuffer, obj._modelFilenameOffset);
+        auto materialHash = *(const uint64_t*)PtrAdd(filenamesBuffer, obj._materialFilenameOffset);
+        auto key = HashCombine(materialHash, modelHash);
+        auto i = LowerBound(_lookup, key);
+        if (i != _lookup.end() && i->first == key)
+            return i->second;
+
+        Entry newEntry;
+        newEntry._modelName = (const ResChar*)PtrAdd(filenamesBuffer, obj._modelFilenameOffset + sizeof(uint64_t));
+        newEntry._materialName = (const ResChar*)PtrAdd(filenamesBuffer, obj._materialFilenameOffset + sizeof(uint64_t));
+        auto handle = unsigned(_entries.size());
+        _entries.emplace_back(std::move(newEntry));
+        _lookup.insert(i, std::make_pair(key, handle));
+        return handle;
+    }
+
+    void PlacementsModelTable::BuildCellHandles(CellHandles& dst, const Placements& placements, bool sortByHandle)
+    {
+        auto count = placements.GetObjectReferenceCount();
+        const auto* objRef = placements.GetObjectReferences();
+        const auto* filenamesBuffer = placements.GetFilenamesBuffer();
+        dst._objectHandles.resize(count);
+        for (unsigned c=0; c<count; ++c)
+            dst._objectHandles[c] = Intern(filenamesBuffer, objRef[c]);
+
+        dst._drawOrder.clear();
+        if (sortByHandle) {
+            dst._drawOrder.resize(count);
+            for (unsigned c=0; c<count; ++c) dst._drawOrder[c] = c;
+            std::stable_sort(
+                dst._drawOrder.begin(), dst._drawOrder.end(),
+                [&dst](unsigned lhs, unsigned rhs) { return dst._objectHandles[lhs] < dst._objectHandles[rhs]; });
+
+            std::vector<unsigned> sortedHandles(count);
+            for (unsigned c=0; c<count; ++c)
+                sortedHandles[c] = dst._objectHandles[dst._drawOrder[c]];
+            dst._objectHandles = std::move(sortedHandles);
+        }
+
+        dst._uniqueHandles = dst._objectHandles;
+        std::sort(dst._uniqueHandles.begin(), dst._uniqueHandles.end());
+        dst._uniqueHandles.erase(std::unique(dst._uniqueHandles.begin(), dst._uniqueHandles.end()), dst._uniqueHandles.end());
+        dst._tableId = _tableId;
+    }
+
+    void PlacementsModelTable::UpdateRenderers(const CellHandles& handles, PlacementsModelCache& cache)
+    {
+        UpdateRenderers(
+            handles,
+            [&cache](StringSection<ResChar> modelName, StringSection<ResChar> materialName) { return cache.GetModelRenderer(modelName, materialName); });
+    }
+
+    void PlacementsModelTable::UpdateRenderers(const CellHandles& handles, const RendererFactory& factory)
+    {
+            //  Each model is checked once per build, by the first cell that uses it. Renderers
+            //  that have been invalidated are replaced here, rather than while drawing
+        assert(handles._tableId == _tableId);
+        for (auto h:handles._uniqueHandles) {
+            auto& entry = _entries[h];
+            if (entry._lastUsedBuild == _buildIndex) continue;
+            entry._lastUsedBuild = _buildIndex;
+            if (!entry._renderer || ::Assets::IsInvalidated(*entry._renderer))
+                entry._renderer = factory(MakeStringSection(entry._modelName), MakeStringSection(entry._materialName));
+        }
+    }
+
+    void PlacementsModelTable::BeginBuild()
+    {
+            //  Renderers that haven't been used for a while are released, so that the
+            //  model cache is free to evict them
+        ++_buildIndex;
+        for (auto& e:_entries)
+            if (e._renderer && (_buildIndex - e._lastUsedBuild) > s_releaseBuilds)
+                e._renderer.reset();
+    }
+
+    PlacementsModelTable::PlacementsModelTable()
+    {
+            // (ids are unique for every table, so handles can be stored with cells owned by other objects)
+        static std::atomic<unsigned> s_nextTableId(1);
+        _tableId = s_nextTableId++;
+    }
+
+    PlacementsModelTable::~PlacementsModelTable() {}
+
     class PlacementsRenderer::Pimpl
     {
     public:
-        Placements* CullCell(
-            std::vector<unsigned>& visiblePlacements,
+            // A cell that is ready to be culled & drawn (all of the lookups that modify the
+            // renderer are done before the cells are processed on worker threads)
+        class CellJob
+        {
+        public:
+            const Placements*           _placements;
+            const PlacementsQuadTree*   _quadTree;
+            const PlacementsModelTable::CellHandles* _modelHandles;
+            Float3x4                    _cellToWorld;
+            const uint64_t*             _filterStart;
+            const uint64_t*             _filterEnd;
+        };
+
+            // Working state for a single thread. Every thread but the first writes into its own
+            // packets, which are appended to the real packets once all of the threads are done
+        class Worker
+        {
+        public:
+            std::vector<VisiblePlacement> _visibleObjects;
+            std::vector<AABBCullingFrustum> _cullFrustums;
+            std::vector<RenderCore::Techniques::DrawablesPacket> _localPkts;
+            std::vector<RenderCore::Techniques::DrawablesPacket*> _pkts;     // [view * BatchFilter::Max + batchFilter]
+        };
+
+        bool PrepareCellJob(
+            CellJob& job,
+            const PlacementCellSet& cellSet, const PlacementCell& cell,
+            const uint64_t* filterStart = nullptr, const uint64_t* filterEnd = nullptr);
+
+        void ExecuteCellJobs(
             SceneExecuteContext& executeContext,
-            const PlacementCell& cell);
+            IteratorRange<const CellJob*> jobs);
+
+        void CullAndBuildDrawables(
+            Worker& worker,
+            const CellJob& job,
+            IteratorRange<const SceneView*> views,
+            const Float3& cameraPosition);
+
+        Placements* GetCellPlacements(
+            const PlacementCell& cell,
+            const PlacementsQuadTree*& quadTree,
+            const PlacementsModelTable::CellHandles*& modelHandles);
 
-        void CullCell(
-            std::vector<unsigned>& visiblePlacements,
-            const Float4x4& cellToCullSpace,
+        static void CullCell(
+            std::vector<VisiblePlacement>& visiblePlacements,
+            IteratorRange<const AABBCullingFrustum*> cellToCullSpace,
             const Placements& placements,
             const PlacementsQuadTree* quadTree,
-			unsigned viewIdx = 0);
+            const PlacementsModelTable::CellHandles& modelHandles);
 
         void BuildDrawables(
-            SceneExecuteContext& executeContext,
+            IteratorRange<RenderCore::Techniques::DrawablesPacket**> pkts,
             const Placements& placements,
-            IteratorRange<unsigned*> objects,
+            const PlacementsModelTable::CellHandles& modelHandles,
+            IteratorRange<const VisiblePlacement*> objects,
+            unsigned viewCount,
             const Float3x4& cellToWorld,
-            const uint64_t* filterStart = nullptr, const uint64_t* filterEnd = nullptr);
+            const Float3& cameraPosition);
 
         auto GetCachedQuadTree(uint64_t cellFilenameHash) const -> const PlacementsQuadTree*;
         PlacementsModelCache& GetModelCache() { return *_cache; }
+        void BeginBuild();
 
         Pimpl(
             std::shared_ptr<PlacementsCache> placementsCache, 
@@ -423,11 +664,13 @@ namespace SceneEngine
         public:
             PlacementsCache::Item* _placements;
             std::unique_ptr<PlacementsQuadTree> _quadTree;
+            PlacementsModelTable::CellHandles _modelHandles;
 
             CellRenderInfo() {}
             CellRenderInfo(CellRenderInfo&& moveFrom) never_throws
             : _placements(moveFrom._placements)
             , _quadTree(std::move(moveFrom._quadTree))
+            , _modelHandles(std::move(moveFrom._modelHandles))
             {
                 moveFrom._placements = nullptr;
             }
@@ -437,6 +680,7 @@ namespace SceneEngine
                 _placements = moveFrom._placements;
                 moveFrom._placements = nullptr;
                 _quadTree = std::move(moveFrom._quadTree);
+                _modelHandles = std::move(moveFrom._modelHandles);
                 return *this;
             }
 
@@ -450,6 +694,15 @@ namespace SceneEngine
         std::shared_ptr<PlacementsModelCache> _cache;
 
         std::shared_ptr<DynamicImposters> _imposters;
+        std::shared_ptr<PlacementsResidencyManager> _residency;
+
+        PlacementsModelTable _modelTable;
+        std::vector<std::unique_ptr<PlacementsModelTable::CellHandles>> _overrideHandles;
+        unsigned _overrideHandlesUsed = 0;
+
+        std::vector<Worker> _workers;
+        std::vector<CellJob> _cellJobs;
+        std::vector<RenderCore::Techniques::DrawablesPacket*> _destinationPkts;
     };
 
     class PlacementsManager::Pimpl
@@ -461,16 +714,6 @@ namespace SceneEngine
         std::shared_ptr<PlacementsIntersections> _intersections;
     };
 
-    class PlacementCellSet::Pimpl
-    {
-    public:
-        std::vector<PlacementCell> _cells;
-        std::vector<std::pair<uint64_t, std::shared_ptr<Placements>>> _cellOverrides;
-
-        void SetOverride(uint64_t guid, std::shared_ptr<Placements> placements);
-        Placements* GetOverride(uint64_t guid);
-    };
-
     Placements* PlacementCellSet::Pimpl::GetOverride(uint64_t guid)
     {
         auto i = LowerBound(_cellOverrides, guid);
@@ -490,10 +733,145 @@ namespace SceneEngine
         return nullptr;
     }
 
-    Placements* PlacementsRenderer::Pimpl::CullCell(
-        std::vector<unsigned>& visibleObjects,
+    bool PlacementsRenderer::Pimpl::PrepareCellJob(
+        CellJob& job,
+        const PlacementCellSet& cellSet, const PlacementCell& cell,
+        const uint64_t* filterStart, const uint64_t* filterEnd)
+    {
+            //  We need to look in the "_cellOverride" list first.
+            //  The overridden cells are actually designed for tools. When authoring 
+            //  placements, we need a way to render them before they are flushed to disk.
+        job._quadTree = nullptr;
+        job._modelHandles = nullptr;
+        job._placements = cellSet._pimpl->GetOverride(cell._filenameHash);
+        if (job._placements) {
+                // (overrides can change at any time, so their handles are resolved every time)
+            if (_overrideHandlesUsed == _overrideHandles.size())
+                _overrideHandles.emplace_back(std::make_unique<PlacementsModelTable::CellHandles>());
+            auto& handles = *_overrideHandles[_overrideHandlesUsed++];
+            _modelTable.BuildCellHandles(handles, *job._placements, true);
+            job._modelHandles = &handles;
+        } else if (_residency) {
+                // (cells that aren't resident yet are just skipped)
+            auto* resident = _residency->_pimpl->GetResidentCell(cell._filenameHash);
+            if (!resident) return false;
+            if (resident->_modelHandles._tableId != _modelTable.GetTableId())
+                _modelTable.BuildCellHandles(resident->_modelHandles, *resident->_placements, false);   // (streaming cells are sorted by model when they are written)
+            job._placements = resident->_placements.get();
+            job._quadTree = &resident->_placements->GetQuadTree();
+            job._modelHandles = &resident->_modelHandles;
+        } else {
+            job._placements = GetCellPlacements(cell, job._quadTree, job._modelHandles);
+            if (!job._placements) return false;
+        }
+        _modelTable.UpdateRenderers(*job._modelHandles, *_cache);
+        job._cellToWorld = cell._cellToWorld;
+        job._filterStart = filterStart;
+        job._filterEnd = filterEnd;
+        return true;
+    }
+
+    void PlacementsRenderer::Pimpl::ExecuteCellJobs(
         SceneExecuteContext& executeContext,
-        const PlacementCell& cell)
+        IteratorRange<const CellJob*> jobs)
+    {
+        auto views = executeContext.GetViews();
+        if (jobs.empty() || views.empty()) return;
+
+        const unsigned filterCount = unsigned(RenderCore::Techniques::BatchFilter::Max);
+        _destinationPkts.resize(views.size() * filterCount);
+        for (unsigned v=0; v<views.size(); ++v)
+            for (unsigned c=0; c<filterCount; ++c)
+                _destinationPkts[v*filterCount+c] = executeContext.GetDrawablesPacket(v, RenderCore::Techniques::BatchFilter(c));
+
+        auto cameraPosition = ExtractTranslation(views[0]._projection._cameraToWorld);
+
+            //  Cells are split into contiguous ranges, one per thread. The first range writes
+            //  directly into the real packets, and the others into their own; those are appended
+            //  in range order afterwards. So the final order of the drawables is the same as
+            //  if every cell were processed in turn on this thread
+        auto jobCount = unsigned(jobs.size());
+        unsigned rangeCount = 1;
+        auto& threadPool = ConsoleRig::GlobalServices::GetInstance().GetShortTaskThreadPool();
+        if (jobCount > 1 && threadPool.IsGood())
+            rangeCount = std::min(jobCount, std::max(1u, std::thread::hardware_concurrency()));
+
+        if (_workers.size() < rangeCount)
+            _workers.resize(rangeCount);
+        _workers[0]._pkts = _destinationPkts;
+        for (unsigned r=1; r<rangeCount; ++r) {
+            auto& worker = _workers[r];
+            worker._localPkts.resize(_destinationPkts.size());
+            worker._pkts.resize(_destinationPkts.size());
+            for (unsigned c=0; c<_destinationPkts.size(); ++c) {
+                worker._localPkts[c].Reset();       // (in case an exception interrupted the last merge)
+                worker._localPkts[c].SetFrameArena(_destinationPkts[c] ? _destinationPkts[c]->GetFrameArena() : nullptr);
+                worker._pkts[c] = _destinationPkts[c] ? &worker._localPkts[c] : nullptr;
+            }
+        }
+
+        auto executeRange = [this, jobs, views, &cameraPosition](unsigned rangeIndex, unsigned begin, unsigned end) {
+            auto& worker = _workers[rangeIndex];
+            for (unsigned j=begin; j<end; ++j)
+                CullAndBuildDrawables(worker, jobs[j], views, cameraPosition);
+        };
+
+        if (rangeCount > 1) {
+            ExecuteRangesParallel(threadPool, jobCount, rangeCount, executeRange);
+            for (unsigned r=1; r<rangeCount; ++r)
+                for (unsigned c=0; c<_destinationPkts.size(); ++c)
+                    if (_destinationPkts[c])
+                        _destinationPkts[c]->Append(std::move(_workers[r]._localPkts[c]));
+        } else {
+            executeRange(0, 0, jobCount);
+        }
+    }
+
+    void PlacementsRenderer::Pimpl::CullAndBuildDrawables(
+        Worker& worker,
+        const CellJob& job,
+        IteratorRange<const SceneView*> views,
+        const Float3& cameraPosition)
+    {
+            //  All of the views are culled in a single pass over the cell (in groups of up to 64,
+            //  so there's no limit on the number of views). Each visible object comes back with
+            //  a mask of the views that can see it
+        const unsigned filterCount = unsigned(RenderCore::Techniques::BatchFilter::Max);
+        auto clipSpaceType = RenderCore::Techniques::GetDefaultClipSpaceType();
+        for (unsigned firstView=0; firstView<views.size(); firstView+=PlacementsQuadTree::MaxViewsPerQuery) {
+            auto viewCount = std::min(unsigned(views.size()) - firstView, PlacementsQuadTree::MaxViewsPerQuery);
+            worker._cullFrustums.clear();
+            for (unsigned v=0; v<viewCount; ++v)
+                worker._cullFrustums.emplace_back(
+                    Combine(job._cellToWorld, views[firstView+v]._projection._worldToProjection),
+                    clipSpaceType);
+
+            worker._visibleObjects.clear();
+            CullCell(worker._visibleObjects, MakeIteratorRange(worker._cullFrustums), *job._placements, job._quadTree, *job._modelHandles);
+
+                // Filtering is required in some cases (for example, if we want to render only
+                // a single object in highlighted state). Rendering only part of a cell isn't
+                // ideal for this architecture. Mostly the cell is intended to work as a 
+                // immutable atomic object. However, we really need filtering for some things.
+            if (job._filterStart != job._filterEnd)
+                FilterVisiblePlacements(
+                    worker._visibleObjects, *job._placements, *job._modelHandles,
+                    MakeIteratorRange(job._filterStart, job._filterEnd));
+
+            if (!worker._visibleObjects.empty())
+                BuildDrawables(
+                    MakeIteratorRange(
+                        AsPointer(worker._pkts.begin() + firstView*filterCount), 
+                        AsPointer(worker._pkts.begin() + (firstView+viewCount)*filterCount)),
+                    *job._placements, *job._modelHandles, MakeIteratorRange(worker._visibleObjects),
+                    viewCount, job._cellToWorld, cameraPosition);
+        }
+    }
+
+    Placements* PlacementsRenderer::Pimpl::GetCellPlacements(
+        const PlacementCell& cell,
+        const PlacementsQuadTree*& quadTree,
+        const PlacementsModelTable::CellHandles*& modelHandles)
     {
         // Look for a "RenderInfo" for this cell.. and create it if it doesn't exist
         // Note that there's a bit of extra overhead here:
@@ -526,23 +904,22 @@ namespace SceneEngine
         }
 
         if (!i2->second._quadTree) {
+            const auto& placements = *i2->second._placements->_placements;
+            auto& handles = i2->second._modelHandles;
+            _modelTable.BuildCellHandles(handles, placements, true);
+
+                //  The quad tree is built with the objects in draw order, so the culling
+                //  results come out grouped by model
+            std::vector<Placements::BoundingBox> boundaries;
+            boundaries.reserve(placements.GetObjectReferenceCount());
+            for (auto o:handles._drawOrder)
+                boundaries.push_back(placements.GetObjectReferences()[o]._cellSpaceBoundary);
             i2->second._quadTree = std::make_unique<PlacementsQuadTree>(
-                &i2->second._placements->_placements->GetObjectReferences()->_cellSpaceBoundary,
-                sizeof(Placements::ObjectReference), 
-                i2->second._placements->_placements->GetObjectReferenceCount());
+                AsPointer(boundaries.cbegin()), sizeof(Placements::BoundingBox), boundaries.size());
         }
 
-		for (unsigned viewIdx=0; viewIdx<executeContext.GetViews().size(); ++viewIdx) {
-			const auto& view = executeContext.GetViews()[viewIdx];
-			__declspec(align(16)) auto cellToCullSpace = Combine(cell._cellToWorld, view._projection._worldToProjection);
-
-			CullCell(
-				visibleObjects, cellToCullSpace, 
-				*i2->second._placements->_placements, 
-				i2->second._quadTree.get(),
-				viewIdx);
-		}
-
+        quadTree = i2->second._quadTree.get();
+        modelHandles = &i2->second._modelHandles;
         return i2->second._placements->_placements.get();
     }
 
@@ -562,25 +939,29 @@ namespace SceneEngine
             template<bool UseImposters = true>
                 void Render(
 					IteratorRange<RenderCore::Techniques::DrawablesPacket** const> pkts,
-                    PlacementsModelCache& cache,
-                    const void* filenamesBuffer,
-                    const uint64_t* supplementsBuffer,
+                    const PlacementsModelTable& modelTable,
+                    unsigned modelHandle,
                     const Placements::ObjectReference& obj,
                     const Float3x4& cellToWorld,
                     const Float3& cameraPosition);
 
+                /// Build drawables for any instances still queued for the current model
+            void FlushInstances();
+
             class Metrics
             {
             public:
                 unsigned _instancesPrepared;
                 unsigned _uniqueModelsPrepared;
                 unsigned _impostersQueued;
+                unsigned _instancedBatches;
 
                 Metrics()
                 {
                     _instancesPrepared = 0;
                     _uniqueModelsPrepared = 0;
                     _impostersQueued = 0;
+                    _instancedBatches = 0;
                 }
             };
 
@@ -588,8 +969,8 @@ namespace SceneEngine
 
             RendererHelper(DynamicImposters* imposters)
             {
-                _currentModel = _currentMaterial = 0ull;
-                _currentSupplements = 0u;
+                _currentModelHandle = ~0u;
+                _current = nullptr;
 
                 auto maxDistance = 1000.f;
                 if (imposters && imposters->IsEnabled())
@@ -600,20 +981,35 @@ namespace SceneEngine
                 _currentModelRendered = false;
             }
         protected:
-            uint64_t _currentModel, _currentMaterial;
-            unsigned _currentSupplements;
-            ::Assets::FuturePtr<RenderCore::Techniques::SimpleModelRenderer> _current;
+            unsigned _currentModelHandle;
+            ::Assets::AssetFuture<RenderCore::Techniques::SimpleModelRenderer>* _current;     // (kept alive by the model table)
             float _maxDistanceSq;
             bool _currentModelRendered;
             DynamicImposters* _imposters;
+
+                // Consecutive placements of the same model (into the same packets) are queued up
+                // here, and drawn with instanced draw calls when there are enough of them
+            std::vector<Float4x4> _pendingInstances;
+            IteratorRange<RenderCore::Techniques::DrawablesPacket**> _pendingPkts;
+            std::shared_ptr<RenderCore::Techniques::SimpleModelRenderer> _pendingRenderer;
         };
 
+        void RendererHelper::FlushInstances()
+        {
+            if (_pendingInstances.empty()) return;
+            assert(_pendingRenderer);
+                // (small batches and skinned models fall back to separate drawables per instance)
+            if (_pendingRenderer->BuildInstancedDrawables(_pendingPkts, MakeIteratorRange(_pendingInstances)))
+                ++_metrics._instancedBatches;
+            _pendingInstances.clear();
+            _pendingRenderer.reset();
+        }
+
         template<bool UseImposters>
             void RendererHelper::Render(
                 IteratorRange<RenderCore::Techniques::DrawablesPacket** const> pkts,
-				PlacementsModelCache& cache,
-                const void* filenamesBuffer,
-                const uint64_t* supplementsBuffer,
+				const PlacementsModelTable& modelTable,
+                unsigned modelHandle,
                 const Placements::ObjectReference& obj,
                 const Float3x4& cellToWorld,
                 const Float3& cameraPosition)
@@ -627,14 +1023,10 @@ namespace SceneEngine
             if (constant_expression<!UseImposters>::result() && distanceSq > _maxDistanceSq)
                 return; 
 
-                //  Objects should be sorted by model & material. This is important for
-                //  reducing the work load in "_cache". Typically cells will only refer
-                //  to a limited number of different types of objects, but the same object
-                //  may be repeated many times. In these cases, we want to minimize the
-                //  workload for every repeat.
-            auto modelHash = *(uint64_t*)PtrAdd(filenamesBuffer, obj._modelFilenameOffset);
-            auto materialHash = *(uint64_t*)PtrAdd(filenamesBuffer, obj._materialFilenameOffset);
-            materialHash = HashCombine(materialHash, modelHash);
+                //  Objects arrive sorted by model & material handle. Typically cells will
+                //  only refer to a limited number of different types of objects, but the same
+                //  object may be repeated many times. In these cases, we want to minimize the
+                //  workload for every repeat (and consecutive repeats can be instanced).
 
                 // Simple LOD calculation based on distanceSq from camera...
                 //      Currently all models have only the single LOD. But this
@@ -651,16 +1043,9 @@ namespace SceneEngine
             // to add a more formal "prepare" step. So it will have to wait for now.
             // auto LOD = unsigned(distanceSq / (75.f*75.f));
 
-            if (    modelHash != _currentModel 
-                ||  materialHash != _currentMaterial 
-                ||  obj._supplementsOffset != _currentSupplements) {
-
-                _current = cache.GetModelRenderer(
-                    (const ResChar*)PtrAdd(filenamesBuffer, obj._modelFilenameOffset + sizeof(uint64_t)),
-                    (const ResChar*)PtrAdd(filenamesBuffer, obj._materialFilenameOffset + sizeof(uint64_t)));
-                _currentModel = modelHash;
-                _currentMaterial = materialHash;
-                _currentSupplements = obj._supplementsOffset;
+            if (modelHandle != _currentModelHandle) {
+                _current = modelTable.GetEntry(modelHandle)._renderer.get();
+                _currentModelHandle = modelHandle;
                 _currentModelRendered = false;
             }
 
@@ -679,7 +1064,12 @@ namespace SceneEngine
                 //  if we have internal transforms, we must use them.
                 //  But some models don't have any internal transforms -- in these
                 //  cases, the _defaultTransformCount will be zero
-            current->BuildDrawables(pkts, AsFloat4x4(localToWorld));
+            if (current != _pendingRenderer || pkts.begin() != _pendingPkts.begin()) {
+                FlushInstances();
+                _pendingRenderer = current;
+                _pendingPkts = MakeIteratorRange(pkts.begin(), pkts.end());
+            }
+            _pendingInstances.push_back(AsFloat4x4(localToWorld));
 
             ++_metrics._instancesPrepared;
             _metrics._uniqueModelsPrepared += !_currentModelRendered;
@@ -693,15 +1083,18 @@ namespace SceneEngine
     }*/
 
     void PlacementsRenderer::Pimpl::CullCell(
-        std::vector<unsigned>& visiblePlacements,
-        const Float4x4& cellToCullSpace,
+        std::vector<VisiblePlacement>& visiblePlacements,
+        IteratorRange<const AABBCullingFrustum*> cellToCullSpace,
         const Placements& placements,
         const PlacementsQuadTree* quadTree,
-		unsigned viewIdx)
+        const PlacementsModelTable::CellHandles& modelHandles)
     {
+            //  The results are draw indices (see PlacementsModelTable::CellHandles), in
+            //  increasing order. The quad tree is always built in draw order
         auto placementCount = placements.GetObjectReferenceCount();
-        if (!placementCount)
+        if (!placementCount || cellToCullSpace.empty())
             return;
+        assert(cellToCullSpace.size() <= PlacementsQuadTree::MaxViewsPerQuery);
         
         const auto* objRef = placements.GetObjectReferences();
         
@@ -709,37 +1102,75 @@ namespace SceneEngine
             auto cullResults = quadTree->GetMaxResults();
             visiblePlacements.resize(cullResults);
             PlacementsQuadTree::Metrics metrics;
-			assert(viewIdx < 16);
-			assert(placementCount < (1<<28));
             quadTree->CalculateVisibleObjects(
-                cellToCullSpace, &objRef->_cellSpaceBoundary,
-                sizeof(Placements::ObjectReference),
+                cellToCullSpace,
                 AsPointer(visiblePlacements.begin()), cullResults, cullResults,
-				viewIdx << 28,
                 &metrics);
             visiblePlacements.resize(cullResults);
 
             // QuickMetrics(parserContext) << "Cull placements cell... AABB test: (" << metrics._nodeAabbTestCount << ") nodes + (" << metrics._payloadAabbTestCount << ") payloads\n";
 
                 // we have to sort to return to our expected order
-            std::sort(visiblePlacements.begin(), visiblePlacements.end());
+            std::sort(
+                visiblePlacements.begin(), visiblePlacements.end(),
+                [](const VisiblePlacement& lhs, const VisiblePlacement& rhs) { return lhs.first < rhs.first; });
         } else {
+                //  Without a quad tree (ie, for dynamic placements that change frequently) we
+                //  don't have a prepared copy of the bounding boxes. But we can still gather
+                //  them into small batches, and test each batch against every view
+                //  (they are gathered in draw order)
+            const unsigned batchSize = 128;
+            AABBx4 batch[batchSize/4] = {};
+            uint64_t batchViewMasks[batchSize];
             visiblePlacements.reserve(placementCount);
-            for (unsigned c=0; c<placementCount; ++c) {
-                auto& obj = objRef[c];
-                if (CullAABB_Aligned(cellToCullSpace, obj._cellSpaceBoundary.first, obj._cellSpaceBoundary.second, RenderCore::Techniques::GetDefaultClipSpaceType()))
-                    continue;
-                visiblePlacements.push_back(c);
+            for (unsigned c=0; c<placementCount; c+=batchSize) {
+                auto count = std::min(placementCount-c, batchSize);
+                for (unsigned q=0; q<count; ++q) {
+                    const auto& boundary = objRef[modelHandles.GetObjectIndex(c+q)]._cellSpaceBoundary;
+                    batch[q/4].Set(q%4, boundary.first, boundary.second);
+                }
+
+                std::fill(batchViewMasks, &batchViewMasks[count], 0ull);
+                for (unsigned v=0; v<cellToCullSpace.size(); ++v) {
+                    for (unsigned q=0; q<count; q+=4) {
+                        auto visibleMask = TestAABBx4(cellToCullSpace[v], batch[q/4]);
+                        for (unsigned lane=0; lane<std::min(4u, count-q); ++lane)
+                            if (visibleMask & (1u<<lane))
+                                batchViewMasks[q+lane] |= 1ull << uint64_t(v);
+                    }
+                }
+
+                for (unsigned q=0; q<count; ++q)
+                    if (batchViewMasks[q])
+                        visiblePlacements.push_back(std::make_pair(c+q, batchViewMasks[q]));
             }
         }
     }
 
+    void FilterVisiblePlacements(
+        std::vector<VisiblePlacement>& visiblePlacements,
+        const Placements& placements,
+        const PlacementsModelTable::CellHandles& modelHandles,
+        IteratorRange<const uint64_t*> filter)
+    {
+        const auto* objRef = placements.GetObjectReferences();
+        visiblePlacements.erase(
+            std::remove_if(
+                visiblePlacements.begin(), visiblePlacements.end(),
+                [objRef, &modelHandles, filter](const VisiblePlacement& o) {
+                    return !std::binary_search(filter.begin(), filter.end(), objRef[modelHandles.GetObjectIndex(o.first)]._guid);
+                }),
+            visiblePlacements.end());
+    }
+
     void PlacementsRenderer::Pimpl::BuildDrawables(
-        SceneExecuteContext& executeContext,
+        IteratorRange<RenderCore::Techniques::DrawablesPacket**> pkts,
         const Placements& placements,
-        IteratorRange<unsigned*> objects,
+        const PlacementsModelTable::CellHandles& modelHandles,
+        IteratorRange<const VisiblePlacement*> objects,
+        unsigned viewCount,
         const Float3x4& cellToWorld,
-        const uint64_t* filterStart, const uint64_t* filterEnd)
+        const Float3& cameraPosition)
     {
             //
             //  Here we render all of the placements defined by the placement
@@ -771,64 +1202,42 @@ namespace SceneEngine
             //  for rendering.
             //  
 
-        const uint64_t* filterIterator = filterStart;
-        const bool doFilter = filterStart != filterEnd;
         Internal::RendererHelper helper(_imposters.get());
 
-        auto cameraPositionCell = Zero<Float3>();
-		if (!executeContext.GetViews().empty())
-			cameraPositionCell = ExtractTranslation(executeContext.GetViews()[0]._projection._cameraToWorld);
-        cameraPositionCell = TransformPointByOrthonormalInverse(cellToWorld, cameraPositionCell);
+        auto cameraPositionCell = TransformPointByOrthonormalInverse(cellToWorld, cameraPosition);
         
-        const auto* filenamesBuffer = placements.GetFilenamesBuffer();
-        const auto* supplementsBuffer = placements.GetSupplementsBuffer();
         const auto* objRef = placements.GetObjectReferences();
-
-            // Filtering is required in some cases (for example, if we want to render only
-            // a single object in highlighted state). Rendering only part of a cell isn't
-            // ideal for this architecture. Mostly the cell is intended to work as a 
-            // immutable atomic object. However, we really need filtering for some things.
-
-		const unsigned objectIndexBitField = (1<<28)-1;
-
-		RenderCore::Techniques::DrawablesPacket* pkts[16][unsigned(RenderCore::Techniques::BatchFilter::Max)];
-		for (unsigned v=0; v<executeContext.GetViews().size(); ++v)
-			for (unsigned c=0; c<unsigned(RenderCore::Techniques::BatchFilter::Max); ++c)
-				pkts[c][v] = executeContext.GetDrawablesPacket(v, RenderCore::Techniques::BatchFilter(c));
-
-        if (_imposters && _imposters->IsEnabled()) { //////////////////////////////////////////////////////////////////
-            if (doFilter) {
-                for (auto o:objects) {
-                    auto& obj = objRef[o&objectIndexBitField];
-                    while (filterIterator != filterEnd && *filterIterator < obj._guid) { ++filterIterator; }
-                    if (filterIterator == filterEnd || *filterIterator != obj._guid) { continue; }
+        const auto* objHandles = AsPointer(modelHandles._objectHandles.cbegin());
+
+            // Each view is handled in turn (rather than each object), so consecutive
+            // objects with the same model still go into the same packets, and can be
+            // instanced together
+        const unsigned filterCount = unsigned(RenderCore::Techniques::BatchFilter::Max);
+        assert(pkts.size() == viewCount * filterCount);
+        for (unsigned v=0; v<viewCount; ++v) {
+            auto viewPkts = MakeIteratorRange(&pkts[v*filterCount], &pkts[(v+1)*filterCount]);
+
+            const auto viewBit = 1ull << uint64_t(v);
+            if (_imposters && _imposters->IsEnabled()) { //////////////////////////////////////////////////////////////
+                for (const auto& o:objects) {
+                    if (!(o.second & viewBit)) continue;
+                    auto& obj = objRef[modelHandles.GetObjectIndex(o.first)];
                     helper.Render<true>(
-                        MakeIteratorRange(pkts[o>>28]), *_cache,
-                        filenamesBuffer, supplementsBuffer, obj, cellToWorld, cameraPositionCell);
+                        viewPkts, _modelTable,
+                        objHandles[o.first], obj, cellToWorld, cameraPositionCell);
                 }
-            } else {
-                for (auto o:objects)
-                    helper.Render<true>(
-                        MakeIteratorRange(pkts[o>>28]), *_cache,
-                        filenamesBuffer, supplementsBuffer, objRef[o&objectIndexBitField], cellToWorld, cameraPositionCell);
-            }
-        } else { //////////////////////////////////////////////////////////////////////////////////////////////////////
-            if (doFilter) {
-                for (auto o:objects) {
-                    auto& obj = objRef[o&objectIndexBitField];
-                    while (filterIterator != filterEnd && *filterIterator < obj._guid) { ++filterIterator; }
-                    if (filterIterator == filterEnd || *filterIterator != obj._guid) { continue; }
+            } else { //////////////////////////////////////////////////////////////////////////////////////////////////
+                for (const auto& o:objects) {
+                    if (!(o.second & viewBit)) continue;
+                    auto& obj = objRef[modelHandles.GetObjectIndex(o.first)];
                     helper.Render<false>(
-                        MakeIteratorRange(pkts[o>>28]), *_cache,
-                        filenamesBuffer, supplementsBuffer, obj, cellToWorld, cameraPositionCell);
+                        viewPkts, _modelTable,
+                        objHandles[o.first], obj, cellToWorld, cameraPositionCell);
                 }
-            } else {
-                for (auto o:objects)
-                    helper.Render<false>(
-                        MakeIteratorRange(pkts[o>>28]), *_cache,
-                        filenamesBuffer, supplementsBuffer, objRef[o&objectIndexBitField], cellToWorld, cameraPositionCell);
-            }
-        } /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+            } /////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+            helper.FlushInstances();
+        }
 
         // QuickMetrics(parserContext) << "Placements cell: (" << helper._metrics._instancesPrepared << ") instances from (" << helper._metrics._uniqueModelsPrepared << ") models. Imposters: (" << helper._metrics._impostersQueued << ")\n";
     }
@@ -842,6 +1251,12 @@ namespace SceneEngine
 
     PlacementsRenderer::Pimpl::~Pimpl() {}
 
+    void PlacementsRenderer::Pimpl::BeginBuild()
+    {
+        _modelTable.BeginBuild();
+        _overrideHandlesUsed = 0;
+    }
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
     void PlacementsRenderer::SetImposters(std::shared_ptr<DynamicImposters> imposters)
@@ -849,6 +1264,11 @@ namespace SceneEngine
         _pimpl->_imposters = std::move(imposters);
     }
 
+    void PlacementsRenderer::SetResidencyManager(std::shared_ptr<PlacementsResidencyManager> residency)
+    {
+        _pimpl->_residency = std::move(residency);
+    }
+
     PlacementsRenderer::PlacementsRenderer(
         std::shared_ptr<PlacementsCache> placementsCache, 
         std::shared_ptr<PlacementsModelCache> modelCache)
@@ -884,39 +1304,19 @@ namespace SceneEngine
 		if (executeContext.GetViews().empty())
 			return;
 
-        static std::vector<unsigned> visibleObjects;
-
             // Render every registered cell
             // We catch exceptions on a cell based level (so pending cells won't cause other cells to flicker)
             // non-asset exceptions will throw back to the caller and bypass EndRender()
+        auto& jobs = _pimpl->_cellJobs;
+        jobs.clear();
+        _pimpl->BeginBuild();
         auto& cells = cellSet._pimpl->_cells;
         for (auto i=cells.begin(); i!=cells.end(); ++i) {
-
-			uint64_t viewBitField = 0;
-			for (unsigned c=0; c<executeContext.GetViews().size(); ++c) {
-				if (CullAABB_Aligned(executeContext.GetViews()[c]._projection._worldToProjection, i->_aabbMin, i->_aabbMax, RenderCore::Techniques::GetDefaultClipSpaceType()))
-					viewBitField |= 1ull<<uint64_t(c);
-			}
-
-                //  We need to look in the "_cellOverride" list first.
-                //  The overridden cells are actually designed for tools. When authoring 
-                //  placements, we need a way to render them before they are flushed to disk.
-            visibleObjects.clear();
-			auto ovr = LowerBound(cellSet._pimpl->_cellOverrides, i->_filenameHash);
-
-			if (ovr != cellSet._pimpl->_cellOverrides.end() && ovr->first == i->_filenameHash) {
-				for (unsigned viewIdx=0; viewIdx<executeContext.GetViews().size(); ++viewIdx) {
-					const auto& view = executeContext.GetViews()[viewIdx];
-					__declspec(align(16)) auto cellToCullSpace = Combine(i->_cellToWorld, view._projection._worldToProjection);
-					_pimpl->CullCell(visibleObjects, cellToCullSpace, *ovr->second.get(), nullptr, viewIdx);
-				}
-				_pimpl->BuildDrawables(executeContext, *ovr->second.get(), MakeIteratorRange(visibleObjects), i->_cellToWorld);
-			} else {
-				auto* plc = _pimpl->CullCell(visibleObjects, executeContext, *i);
-				if (plc)
-					_pimpl->BuildDrawables(executeContext, *plc, MakeIteratorRange(visibleObjects), i->_cellToWorld);
-			}
+            Pimpl::CellJob job;
+            if (_pimpl->PrepareCellJob(job, cellSet, *i))
+                jobs.push_back(job);
         }
+        _pimpl->ExecuteCellJobs(executeContext, MakeIteratorRange(jobs));
     }
 
     void PlacementsRenderer::BuildDrawables(
@@ -928,12 +1328,16 @@ namespace SceneEngine
 		if (executeContext.GetViews().empty())
 			return;
 
-        static std::vector<unsigned> visibleObjects;
+        auto& jobs = _pimpl->_cellJobs;
+        jobs.clear();
+        _pimpl->BeginBuild();
 
             //  We need to take a copy, so we don't overwrite
             //  and reorder the caller's version.
+            //  (the jobs refer to the filters in this copy, so it must outlive ExecuteCellJobs)
+        std::vector<PlacementGUID> copy;
         if (begin || end) {
-            std::vector<PlacementGUID> copy(begin, end);
+            copy.insert(copy.end(), begin, end);
             std::sort(copy.begin(), copy.end());
 
             auto ci = cellSet._pimpl->_cells.begin();
@@ -948,21 +1352,9 @@ namespace SceneEngine
                     uint64_t* t = tStart;
                     while (i < i2) { *t++ = i->second; i++; }
 
-                    visibleObjects.clear();
-
-					auto ovr = LowerBound(cellSet._pimpl->_cellOverrides, ci->_filenameHash);
-					if (ovr != cellSet._pimpl->_cellOverrides.end() && ovr->first == ci->_filenameHash) {
-						for (unsigned viewIdx=0; viewIdx<executeContext.GetViews().size(); ++viewIdx) {
-							const auto& view = executeContext.GetViews()[viewIdx];
-							__declspec(align(16)) auto cellToCullSpace = Combine(ci->_cellToWorld, view._projection._worldToProjection);
-							_pimpl->CullCell(visibleObjects, cellToCullSpace, *ovr->second.get(), nullptr, viewIdx);
-						}
-						_pimpl->BuildDrawables(executeContext, *ovr->second, MakeIteratorRange(visibleObjects), ci->_cellToWorld, tStart, t);
-					} else {
-						auto* plcmnts = _pimpl->CullCell(visibleObjects, executeContext, *ci);
-						if (plcmnts)
-							_pimpl->BuildDrawables(executeContext, *plcmnts, MakeIteratorRange(visibleObjects), ci->_cellToWorld, tStart, t);
-					}
+                    Pimpl::CellJob job;
+                    if (_pimpl->PrepareCellJob(job, cellSet, *ci, tStart, t))
+                        jobs.push_back(job);
 
                 } else {
                     i = i2;
@@ -971,24 +1363,13 @@ namespace SceneEngine
         } else {
                 // in this case we're not filtering by object GUID (though we may apply a predicate on the prepared draw calls)
             for (auto i=cellSet._pimpl->_cells.begin(); i!=cellSet._pimpl->_cells.end(); ++i) {
-                visibleObjects.clear();
-
-				auto ovr = LowerBound(cellSet._pimpl->_cellOverrides, i->_filenameHash);
-				if (ovr != cellSet._pimpl->_cellOverrides.end() && ovr->first == i->_filenameHash) {
-					for (unsigned viewIdx=0; viewIdx<executeContext.GetViews().size(); ++viewIdx) {
-						const auto& view = executeContext.GetViews()[viewIdx];
-						__declspec(align(16)) auto cellToCullSpace = Combine(i->_cellToWorld, view._projection._worldToProjection);
-					
-						_pimpl->CullCell(visibleObjects, cellToCullSpace, *ovr->second.get(), nullptr, viewIdx);
-					}
-					_pimpl->BuildDrawables(executeContext, *ovr->second, MakeIteratorRange(visibleObjects), i->_cellToWorld);
-				} else {
-					auto* plcmnts = _pimpl->CullCell(visibleObjects, executeContext, *i);
-					if (plcmnts)
-						_pimpl->BuildDrawables(executeContext, *plcmnts, MakeIteratorRange(visibleObjects), i->_cellToWorld);
-				}
+                Pimpl::CellJob job;
+                if (_pimpl->PrepareCellJob(job, cellSet, *i))
+                    jobs.push_back(job);
             }
         }
+
+        _pimpl->ExecuteCellJobs(executeContext, MakeIteratorRange(jobs));
     }
 
     auto PlacementsRenderer::GetVisibleQuadTrees(const PlacementCellSet& cellSet, const Float4x4& worldToClip) const
@@ -1097,25 +1478,173 @@ namespace SceneEngine
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-    class DynamicPlacements : public Placements
+    void PlacementsResidencyManager::Pimpl::LoadCell(PendingLoad& load, const ::Assets::rstring& filename)
+    {
+        TRY {
+            Utility::MemoryMappedFile file;
+            if (::Assets::MainFileSystem::TryOpen(file, MakeStringSection(filename), 0, "r") == ::Assets::IFileSystem::IOReason::Success) {
+                unsigned chunkVersion = 0;
+                auto chunk = FindChunkInMemory(file.GetData(), ChunkType_StreamingPlacements, chunkVersion);
+                if (!chunk.empty()) {
+                    auto depVal = std::make_shared<::Assets::DependencyValidation>();
+                    ::Assets::RegisterFileDependency(depVal, MakeStringSection(filename));
+                    if (chunkVersion == StreamingPlacementsVersion) {
+                        load._result = std::make_unique<StreamingPlacements>(std::move(file), chunk, depVal);
+                        return;
+                    }
+
+                    if (chunkVersion == StreamingPlacementsVersion_Unsorted) {
+                            //  Same layout, but the objects aren't in draw order. Rebuilding the chunk
+                            //  sorts them (and rebuilds the quad tree to match)
+                        StreamingPlacements unsorted(std::move(file), chunk, depVal);
+                        auto rebuilt = BuildStreamingPlacementsChunk(unsorted);
+                        load._result = std::make_unique<StreamingPlacements>(
+                            MakeIteratorRange(AsPointer(rebuilt.cbegin()), AsPointer(rebuilt.cend())), depVal);
+                        return;
+                    }
+
+                    Log(Verbose) << "Unexpected version number for streaming placements (" << chunkVersion << ") in (" << filename << "). Falling back to conversion." << std::endl;
+                }
+            }
+
+                //  Not in the streaming format (or in a version we can't use directly). Load it normally,
+                //  and convert it into the streaming layout here (so the render thread only ever sees
+                //  the one layout)
+            auto placements = ::Assets::AutoConstructAsset<Placements>(MakeStringSection(filename));
+            auto chunk = BuildStreamingPlacementsChunk(*placements);
+            load._result = std::make_unique<StreamingPlacements>(
+                MakeIteratorRange(AsPointer(chunk.cbegin()), AsPointer(chunk.cend())),
+                placements->GetDependencyValidation());
+        } CATCH (const std::exception& e) {
+            Log(Warning) << "Failed while streaming placements cell (" << filename << "). Error: (" << e.what() << ")." << std::endl;
+        } CATCH_END
+    }
+
+    void PlacementsResidencyManager::Update(const PlacementCellSet& cellSet, const Float3& cameraPosition)
+    {
+        auto& pimpl = *_pimpl;
+        ++pimpl._frameIndex;
+
+            //  Pick up the loads that have finished on background threads
+        for (auto& c:pimpl._cells) {
+            auto& cell = c.second;
+            if (!cell._pendingLoad || !cell._pendingLoad->_complete.load(std::memory_order_acquire)) continue;
+            cell._placements = std::move(cell._pendingLoad->_result);
+            cell._pendingLoad.reset();
+            if (cell._placements) {
+                pimpl._residentBytes += cell._placements->GetResidentSize();
+                ++pimpl._totals._loadsCompleted;
+            } else {
+                cell._failed = true;        // (not attempted again until the cell goes out of range)
+                ++pimpl._totals._loadsFailed;
+            }
+        }
+
+            //  Find the distance to each cell. This is only in XY; the cells are arranged
+            //  on a 2D grid, and their vertical extents are often very conservative
+        auto loadDistanceSq = pimpl._config._loadDistance * pimpl._config._loadDistance;
+        auto releaseDistance = std::max(pimpl._config._releaseDistance, pimpl._config._loadDistance);
+        auto releaseDistanceSq = releaseDistance * releaseDistance;
+        for (const auto& c:cellSet._pimpl->_cells) {
+            if (c._filename[0] == '[') continue;    // (cells from the editor use overrides)
+            float dx = std::max(std::max(c._aabbMin[0] - cameraPosition[0], 0.f), cameraPosition[0] - c._aabbMax[0]);
+            float dy = std::max(std::max(c._aabbMin[1] - cameraPosition[1], 0.f), cameraPosition[1] - c._aabbMax[1]);
+            float distanceSq = dx*dx + dy*dy;
+
+            auto i = LowerBound(pimpl._cells, c._filenameHash);
+            if (i == pimpl._cells.end() || i->first != c._filenameHash) {
+                if (distanceSq > loadDistanceSq) continue;
+                i = pimpl._cells.insert(i, std::make_pair(c._filenameHash, Pimpl::Cell{}));
+                i->second._filename = c._filename;
+            }
+            i->second._distanceSq = distanceSq;
+            i->second._lastSeenFrame = pimpl._frameIndex;
+        }
+
+            //  Release cells that are out of range (or no longer in the cell set), and cells whose
+            //  files have changed (they will be loaded again, below)
+        for (auto& c:pimpl._cells) {
+            auto& cell = c.second;
+            bool inRange = cell._lastSeenFrame == pimpl._frameIndex && cell._distanceSq <= releaseDistanceSq;
+            if (cell._placements && (!inRange || cell._placements->GetDependencyValidation()->GetValidationIndex() != 0))
+                pimpl.Release(cell);
+            if (!inRange) cell._failed = false;
+        }
+        pimpl._cells.erase(
+            std::remove_if(
+                pimpl._cells.begin(), pimpl._cells.end(),
+                [&pimpl, releaseDistanceSq](const std::pair<uint64_t, Pimpl::Cell>& c) {
+                    return !c.second._placements && !c.second._pendingLoad
+                        && (c.second._lastSeenFrame != pimpl._frameIndex || c.second._distanceSq > releaseDistanceSq);
+                }),
+            pimpl._cells.end());
+
+            //  Release the furthest cells until we're within the budget
+        std::vector<Pimpl::Cell*> resident;
+        for (auto& c:pimpl._cells)
+            if (c.second._placements)
+                resident.push_back(&c.second);
+        std::sort(resident.begin(), resident.end(), [](const Pimpl::Cell* lhs, const Pimpl::Cell* rhs) { return lhs->_distanceSq > rhs->_distanceSq; });
+        auto furthestResident = resident.begin();
+        while (pimpl._residentBytes > pimpl._config._memoryBudget && furthestResident != resident.end())
+            pimpl.Release(**furthestResident++);
+
+            //  Start loading the closest cells that aren't resident. The size of a cell isn't known
+            //  until it's loaded, so we can only guarantee room for cells that have been loaded
+            //  before. Anything that goes over the budget is released on the next update.
+            //  Cells are only released to make room for closer cells
+        std::vector<Pimpl::Cell*> candidates;
+        unsigned pendingCount = 0;
+        for (auto& c:pimpl._cells) {
+            auto& cell = c.second;
+            pendingCount += !!cell._pendingLoad;
+            if (!cell._placements && !cell._pendingLoad && !cell._failed && cell._lastSeenFrame == pimpl._frameIndex && cell._distanceSq <= loadDistanceSq)
+                candidates.push_back(&cell);
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const Pimpl::Cell* lhs, const Pimpl::Cell* rhs) { return lhs->_distanceSq < rhs->_distanceSq; });
+
+        for (auto* cell:candidates) {
+            if (pendingCount >= pimpl._config._maxPendingLoads) break;
+            while (pimpl._residentBytes + cell->_lastResidentSize > pimpl._config._memoryBudget
+                && furthestResident != resident.end() && (*furthestResident)->_distanceSq > cell->_distanceSq) {
+                if ((*furthestResident)->_placements)
+                    pimpl.Release(**furthestResident);
+                ++furthestResident;
+            }
+            if (pimpl._residentBytes + cell->_lastResidentSize > pimpl._config._memoryBudget) break;
+
+            auto load = std::make_shared<Pimpl::PendingLoad>();
+            auto filename = cell->_filename;
+            cell->_pendingLoad = load;
+            ++pendingCount;
+            ConsoleRig::GlobalServices::GetInstance().GetLongTaskThreadPool().Enqueue(
+                [load, filename]() {
+                    Pimpl::LoadCell(*load, filename);
+                    load->_complete.store(true, std::memory_order_release);
+                });
+        }
+    }
+
+    auto PlacementsResidencyManager::GetMetrics() const -> Metrics
     {
-    public:
-        uint64_t AddPlacement(
-            const Float3x4& objectToCell, 
-            const std::pair<Float3, Float3>& cellSpaceBoundary,
-            StringSection<ResChar> modelFilename, StringSection<ResChar> materialFilename,
-            SupplementRange supplements,
-            uint64_t objectGuid);
+        auto result = _pimpl->_totals;
+        result._residentBytes = _pimpl->_residentBytes;
+        for (const auto& c:_pimpl->_cells) {
+            result._residentCells += !!c.second._placements;
+            result._pendingLoads += !!c.second._pendingLoad;
+        }
+        return result;
+    }
 
-        std::vector<ObjectReference>& GetObjects() { return _objects; }
-        bool HasObject(uint64_t guid);
+    PlacementsResidencyManager::PlacementsResidencyManager(const Config& config)
+    {
+        _pimpl = std::make_unique<Pimpl>();
+        _pimpl->_config = config;
+    }
 
-        unsigned AddString(StringSection<ResChar> str);
-        unsigned AddSupplements(SupplementRange supplements);
+    PlacementsResidencyManager::~PlacementsResidencyManager() {}
 
-        DynamicPlacements(const Placements& copyFrom);
-        DynamicPlacements();
-    };
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
     static uint32 BuildGuid32()
     {
@@ -2325,6 +2854,28 @@ namespace SceneEngine
                 uint32(cellId>>32), uint32(cellId)));
     }
 
+    void PlacementsEditor::WriteStreamingCell(uint64_t cellId, const Assets::ResChar destinationFile[]) const
+    {
+            // Save a single placement cell in the streaming format (see PlacementsResidencyManager)
+            // Cells that haven't been opened for editing are converted from the cached copy
+        for (auto i=_pimpl->_dynPlacements.begin(); i!=_pimpl->_dynPlacements.end(); ++i) {
+            if (i->first != cellId)
+                continue;
+
+            i->second->WriteStreaming(destinationFile);
+            return;
+        }
+
+        auto* cell = _pimpl->GetCell(cellId);
+        auto* placements = cell ? GetPlacements(*cell, *_pimpl->_cellSet, *_pimpl->_placementsCache) : nullptr;
+        if (!placements)
+            Throw(
+                ::Exceptions::BasicLabel("Could not find cell with given id (0x%08x%08x). Saving cancelled",
+                    uint32(cellId>>32), uint32(cellId)));
+
+        placements->WriteStreaming(destinationFile);
+    }
+
     std::string PlacementsEditor::GetMetricsString(uint64_t cellId) const
     {
         auto* cell = _pimpl->GetCell(cellId);
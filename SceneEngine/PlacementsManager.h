@@ -84,6 +84,48 @@ namespace SceneEngine
         friend class PlacementsEditor;
     };
     
+    /// <summary>Streams placement cells in and out of memory, based on distance from the camera</summary>
+    /// Cells near the camera are loaded on background threads, and cells far from it are
+    /// released, keeping the total size of the resident cells within a memory budget.
+    ///
+    /// Cells written in the streaming format (see PlacementsEditor::WriteStreamingCell) are
+    /// memory mapped and used in place. Cells in the original format are converted into the
+    /// same layout on the loading thread.
+    ///
+    /// Call Update() once per frame, from the thread that builds drawables. A renderer with a
+    /// residency manager (see PlacementsRenderer::SetResidencyManager) only draws the cells
+    /// that are resident, and never loads cells itself.
+    class PlacementsResidencyManager
+    {
+    public:
+        struct Config
+        {
+            size_t      _memoryBudget = 256*1024*1024;
+            float       _loadDistance = 1000.f;         ///< cells closer than this (in XY) are loaded
+            float       _releaseDistance = 1250.f;      ///< resident cells further than this are released
+            unsigned    _maxPendingLoads = 4;
+        };
+
+        void Update(const PlacementCellSet& cellSet, const Float3& cameraPosition);
+
+        struct Metrics
+        {
+            unsigned    _residentCells = 0;
+            unsigned    _pendingLoads = 0;
+            size_t      _residentBytes = 0;
+            unsigned    _loadsCompleted = 0;
+            unsigned    _loadsFailed = 0;
+            unsigned    _releases = 0;
+        };
+        Metrics GetMetrics() const;
+
+        PlacementsResidencyManager(const Config& config);
+        ~PlacementsResidencyManager();
+
+        class Pimpl;
+        std::unique_ptr<Pimpl> _pimpl;
+    };
+
     class PlacementCell;
     class PlacementsCache;
     class PreparedScene;
@@ -114,6 +156,7 @@ namespace SceneEngine
             -> std::vector<std::pair<Float3x4, ObjectBoundingBoxes>>;
 
         void SetImposters(std::shared_ptr<DynamicImposters> imposters);
+        void SetResidencyManager(std::shared_ptr<PlacementsResidencyManager> residency);
 
         PlacementsRenderer(
             std::shared_ptr<PlacementsCache> placementsCache, 
@@ -223,6 +266,7 @@ namespace SceneEngine
         std::string GetMetricsString(uint64_t cellId) const;
         void WriteAllCells();
         void WriteCell(uint64_t cellId, const Assets::ResChar destinationFile[]) const;
+        void WriteStreamingCell(uint64_t cellId, const Assets::ResChar destinationFile[]) const;
 
         std::pair<Float3, Float3> GetModelBoundingBox(const Assets::ResChar modelName[]) const;
 
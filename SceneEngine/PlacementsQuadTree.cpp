@@ -7,8 +7,12 @@
 #include "PlacementsQuadTree.h"
 #include "../Math/ProjectionMath.h"
 #include "../Utility/PtrUtils.h"
+#include "../Utility/ArithmeticUtils.h"
+#include "../Utility/MemoryUtils.h"
 #include "../Core/Prefix.h"
+#include "../Core/Exceptions.h"
 #include <stack>
+#include <algorithm>
 
 #include "PlacementsQuadTreeDebugger.h"
 #include "PlacementsManager.h"
@@ -32,17 +36,64 @@ namespace SceneEngine
             unsigned        _payloadID;
             unsigned        _treeDepth;
             unsigned        _children[4];
+            AABBx4          _childBoundaries;       // (lanes for missing children are never tested)
         };
 
         class Payload
         {
         public:
-            std::vector<unsigned> _objects;
+            unsigned        _firstObject;           // index into _payloadObjects
+            unsigned        _objectCount;
+            unsigned        _firstBoundaryBlock;    // index into _payloadBoundaries
         };
 
-        std::vector<Node>       _nodes;
-        std::vector<Payload>    _payloads;
+            //  The culling functions read the tree through these ranges. They point into the
+            //  storage vectors below when the tree was built here, or directly into the
+            //  serialized data otherwise
+        IteratorRange<const Node*>      _nodes;
+        IteratorRange<const Payload*>   _payloads;
+        IteratorRange<const unsigned*>  _payloadObjects;
+        IteratorRange<const AABBx4*>    _payloadBoundaries;     // object bounding boxes, in payload order
+        AABBx4                  _rootBoundary;
         unsigned                _maxCullResults;
+        unsigned                _maxTreeDepth;
+
+        std::vector<Node>       _nodeStorage;
+        std::vector<Payload>    _payloadStorage;
+        std::vector<unsigned>   _payloadObjectStorage;
+        std::vector<AABBx4>     _payloadBoundaryStorage;
+
+        class SerializedHeader
+        {
+        public:
+            unsigned _version;
+            unsigned _nodeCount, _payloadCount, _payloadObjectCount, _payloadBoundaryBlockCount;
+            unsigned _maxCullResults, _maxTreeDepth;
+            unsigned _dummy;
+        };
+        static const unsigned SerializedVersion = 1;
+
+        struct SerializedLayout { size_t _payloadBoundaries, _nodes, _payloads, _payloadObjects, _end; };
+        static SerializedLayout CalculateSerializedLayout(const SerializedHeader& hdr)
+        {
+                // (arrays with 16 byte elements first, so they don't need padding)
+            auto align16 = [](size_t offset) { return (offset + 15) & ~size_t(15); };
+            SerializedLayout result;
+            result._payloadBoundaries = align16(sizeof(SerializedHeader));
+            result._nodes = align16(result._payloadBoundaries + hdr._payloadBoundaryBlockCount * sizeof(AABBx4));
+            result._payloads = align16(result._nodes + hdr._nodeCount * sizeof(Node));
+            result._payloadObjects = align16(result._payloads + hdr._payloadCount * sizeof(Payload));
+            result._end = result._payloadObjects + hdr._payloadObjectCount * sizeof(unsigned);
+            return result;
+        }
+
+        void BindStorage()
+        {
+            _nodes = MakeIteratorRange(_nodeStorage);
+            _payloads = MakeIteratorRange(_payloadStorage);
+            _payloadObjects = MakeIteratorRange(_payloadObjectStorage);
+            _payloadBoundaries = MakeIteratorRange(_payloadBoundaryStorage);
+        }
 
         class WorkingObject
         {
@@ -53,19 +104,20 @@ namespace SceneEngine
 
         void PushNode(  unsigned parentNode, unsigned childIndex,
                         const std::vector<WorkingObject>& workingObjects);
+        void BuildCullingBoundaries(const BoundingBox objCellSpaceBoundingBoxes[], size_t objStride);
 
         unsigned CalculateMaxResults()
         {
-            unsigned result = 0;
-            for (auto&i:_payloads)
-                result += (unsigned)i._objects.size();
-            return result;
+            return unsigned(_payloadObjectStorage.size());
         }
 
-        static void InitPayload(Payload& p, const std::vector<WorkingObject>& workingObjects)
+        void InitPayload(Payload& p, const std::vector<WorkingObject>& workingObjects)
         {
+            p._firstObject = unsigned(_payloadObjectStorage.size());
+            p._objectCount = unsigned(workingObjects.size());
+            p._firstBoundaryBlock = 0;
             for (auto i=workingObjects.cbegin(); i!=workingObjects.cend(); ++i) {
-                p._objects.push_back(i->_id);
+                _payloadObjectStorage.push_back(i->_id);
             }
         }
 
@@ -125,8 +177,8 @@ namespace SceneEngine
         newNode._children[0] = newNode._children[1] = newNode._children[2] = newNode._children[3] = ~unsigned(0x0);
 
         Node* parent = nullptr;
-        if (parentNodeIndex < _nodes.size())
-            parent = &_nodes[parentNodeIndex];
+        if (parentNodeIndex < _nodeStorage.size())
+            parent = &_nodeStorage[parentNodeIndex];
 
         newNode._treeDepth = parent ? (parent->_treeDepth+1) : 0;
         for (unsigned c=0; c<4; ++c) newNode._children[c] = ~unsigned(0x0);
@@ -138,13 +190,13 @@ namespace SceneEngine
         if (workingObjects.size() <= leafThreshold) {
             Payload payload;
             InitPayload(payload, workingObjects);
-            _payloads.push_back(std::move(payload));
-            newNode._payloadID = unsigned(_payloads.size()-1);
+            _payloadStorage.push_back(std::move(payload));
+            newNode._payloadID = unsigned(_payloadStorage.size()-1);
 
             if (parent) {
-                parent->_children[childIndex] = unsigned(_nodes.size());
+                parent->_children[childIndex] = unsigned(_nodeStorage.size());
             }
-            _nodes.push_back(newNode);
+            _nodeStorage.push_back(newNode);
             return;
         }
 
@@ -348,17 +400,17 @@ namespace SceneEngine
         if (!dividedObjects[4].empty()) {
             Payload payload;
             InitPayload(payload, dividedObjects[4]);
-            _payloads.push_back(std::move(payload));
-            newNode._payloadID = unsigned(_payloads.size()-1);
+            _payloadStorage.push_back(std::move(payload));
+            newNode._payloadID = unsigned(_payloadStorage.size()-1);
         }
 
         assert(dividedObjects[0].size() + dividedObjects[1].size() + dividedObjects[2].size() + dividedObjects[3].size() + dividedObjects[4].size() == workingObjects.size());
 
-        auto newNodeId = unsigned(_nodes.size());
+        auto newNodeId = unsigned(_nodeStorage.size());
         if (parent) {
             parent->_children[childIndex] = newNodeId;
         }
-        _nodes.push_back(newNode);
+        _nodeStorage.push_back(newNode);
 
             // now just push in the children
         for (unsigned c=0; c<4; ++c) {
@@ -368,72 +420,114 @@ namespace SceneEngine
         }
     }
 
+    void PlacementsQuadTree::Pimpl::BuildCullingBoundaries(const BoundingBox objCellSpaceBoundingBoxes[], size_t objStride)
+    {
+            //  Copy the bounding boxes into structure-of-arrays blocks for the batched
+            //  culling tests. Each payload gets its own run of blocks, so the objects in a
+            //  payload are contiguous in memory; and each node records the boundaries
+            //  of its children, so they can be tested together.
+        _payloadBoundaryStorage.clear();
+        for (auto& p:_payloadStorage) {
+            p._firstBoundaryBlock = unsigned(_payloadBoundaryStorage.size());
+            _payloadBoundaryStorage.resize(_payloadBoundaryStorage.size() + (p._objectCount+3)/4, AABBx4{});
+            for (unsigned c=0; c<p._objectCount; ++c) {
+                const auto& boundary = *PtrAdd(objCellSpaceBoundingBoxes, _payloadObjectStorage[p._firstObject + c] * objStride);
+                _payloadBoundaryStorage[p._firstBoundaryBlock + c/4].Set(c%4, boundary.first, boundary.second);
+            }
+        }
+
+        _maxTreeDepth = 0;
+        for (auto& n:_nodeStorage) {
+            _maxTreeDepth = std::max(_maxTreeDepth, n._treeDepth);
+            n._childBoundaries = AABBx4{};
+            for (unsigned c=0; c<4; ++c)
+                if (n._children[c] < _nodeStorage.size())
+                    n._childBoundaries.Set(c, _nodeStorage[n._children[c]]._boundary.first, _nodeStorage[n._children[c]]._boundary.second);
+        }
+
+        _rootBoundary = AABBx4{};
+        if (!_nodeStorage.empty())
+            _rootBoundary.Set(0, _nodeStorage[0]._boundary.first, _nodeStorage[0]._boundary.second);
+    }
+
     bool PlacementsQuadTree::CalculateVisibleObjects(
         const Float4x4& cellToClipAligned, 
-        const BoundingBox objCellSpaceBoundingBoxes[], size_t objStride,
         unsigned visObjs[], unsigned& visObjsCount, unsigned visObjMaxCount,
 		unsigned outputIdxOffset,
         Metrics* metrics) const
     {
         visObjsCount = 0;
-        assert((size_t(AsFloatArray(cellToClipAligned)) & 0xf) == 0);
+        if (_pimpl->_nodes.empty()) return true;
 
         unsigned nodeAabbTestCount = 0, payloadAabbTestCount = 0;
+        AABBCullingFrustum frustum(cellToClipAligned, RenderCore::Techniques::GetDefaultClipSpaceType());
 
             //  Traverse through the quad tree, and find do bounding box level 
-            //  culling on each object
+            //  culling on each object. Nodes on the working stack are known to straddle
+            //  the edge of the frustum; the children of each are tested together
         static std::stack<unsigned> workingStack;
         static std::stack<unsigned> entirelyVisibleStack;
         assert(workingStack.empty() && entirelyVisibleStack.empty());
-        workingStack.push(0);
+
+        unsigned withinMask = 0;
+        ++nodeAabbTestCount;
+        if (!(TestAABBx4(frustum, _pimpl->_rootBoundary, &withinMask) & 1))
+            return true;
+        if (withinMask & 1) entirelyVisibleStack.push(0);
+        else workingStack.push(0);
+
         while (!workingStack.empty()) {
             auto nodeIndex = workingStack.top();
             workingStack.pop();
             
             auto& node = _pimpl->_nodes[nodeIndex];
-            auto test = TestAABB_Aligned(cellToClipAligned, node._boundary.first, node._boundary.second, RenderCore::Techniques::GetDefaultClipSpaceType());
-            ++nodeAabbTestCount;
-            if (test == AABBIntersection::Culled) {
-                continue;
-            }
-
-            if (test == AABBIntersection::Within) {
-
-                    //  this node and all children are "visible" without
-                    //  any further culling tests
-                entirelyVisibleStack.push(nodeIndex);
-
-            } else {
+            unsigned childMask = 0;
+            for (unsigned c=0; c<4; ++c)
+                if (node._children[c] < _pimpl->_nodes.size()) {
+                    childMask |= 1u<<c;
+                    ++nodeAabbTestCount;
+                }
 
+            if (childMask) {
+                auto visibleMask = TestAABBx4(frustum, node._childBoundaries, &withinMask) & childMask;
                 for (unsigned c=0; c<4; ++c) {
-                    if (node._children[c] < _pimpl->_nodes.size()) {
+                    if (!(visibleMask & (1u<<c))) continue;
+
+                        //  children entirely within the frustum are "visible" without
+                        //  any further culling tests (including all of their children)
+                    if (withinMask & (1u<<c)) {
+                        entirelyVisibleStack.push(node._children[c]);
+                    } else {
                         workingStack.push(node._children[c]);
                     }
                 }
+            }
 
-                if (node._payloadID < _pimpl->_payloads.size()) {
-                    auto& payload = _pimpl->_payloads[node._payloadID];
-                    for (auto i=payload._objects.cbegin(); i!=payload._objects.cend(); ++i) {
-
-                            //  Test the "cell" space bounding box of the object itself
-                            //  This must be done inside of this function, we can't
-                            //  drop the responsibility to the caller. Because:
-                            //      * sometimes we can skip it entirely, when quad tree
-                            //          node bounding boxes are considered entirely within the frustum
-                            //      * it's best to reduce the result arrays to as small as
-                            //          possible (because the caller may need to sort them)
-
-                        const auto& boundary = *PtrAdd(objCellSpaceBoundingBoxes, (*i) * objStride);
-                        ++payloadAabbTestCount;
-                        if (!CullAABB_Aligned(cellToClipAligned, boundary.first, boundary.second, RenderCore::Techniques::GetDefaultClipSpaceType())) {
-                            if ((visObjsCount+1) > visObjMaxCount) {
-                                return false;
-                            }
-                            visObjs[visObjsCount++] = *i + outputIdxOffset; 
-                        }
-                    }
+            if (node._payloadID < _pimpl->_payloads.size()) {
+                auto& payload = _pimpl->_payloads[node._payloadID];
+                auto objectCount = payload._objectCount;
+
+                    //  Test the "cell" space bounding box of the object itself
+                    //  This must be done inside of this function, we can't
+                    //  drop the responsibility to the caller. Because:
+                    //      * sometimes we can skip it entirely, when quad tree
+                    //          node bounding boxes are considered entirely within the frustum
+                    //      * it's best to reduce the result arrays to as small as
+                    //          possible (because the caller may need to sort them)
+                if ((visObjsCount + objectCount) > visObjMaxCount) {
+                    return false;
                 }
 
+                    //  The batched test writes indices within the payload; these are
+                    //  converted into object indices in place
+                auto* dst = &visObjs[visObjsCount];
+                auto visibleCount = CullAABBs(
+                    frustum, &_pimpl->_payloadBoundaries[payload._firstBoundaryBlock], objectCount,
+                    dst);
+                for (unsigned c=0; c<visibleCount; ++c)
+                    dst[c] = _pimpl->_payloadObjects[payload._firstObject + dst[c]] + outputIdxOffset;
+                visObjsCount += visibleCount;
+                payloadAabbTestCount += objectCount;
             }
         }
 
@@ -454,12 +548,131 @@ namespace SceneEngine
             if (node._payloadID < _pimpl->_payloads.size()) {
                 auto& payload = _pimpl->_payloads[node._payloadID];
 
-                if ((visObjsCount + payload._objects.size()) > visObjMaxCount) {
+                if ((visObjsCount + payload._objectCount) > visObjMaxCount) {
+                    return false;
+                }
+
+                const auto* objects = &_pimpl->_payloadObjects[payload._firstObject];
+                for (unsigned c=0; c<payload._objectCount; ++c) {
+                    visObjs[visObjsCount++] = objects[c] + outputIdxOffset; 
+                }
+            }
+        }
+
+        assert(visObjsCount <= visObjMaxCount);
+        if (metrics) {
+            metrics->_nodeAabbTestCount = nodeAabbTestCount; 
+            metrics->_payloadAabbTestCount = payloadAabbTestCount;
+        }
+
+        return true;
+    }
+
+    bool PlacementsQuadTree::CalculateVisibleObjects(
+        IteratorRange<const AABBCullingFrustum*> cellToClipFrustums,
+        std::pair<unsigned, uint64_t> visObjs[], unsigned& visObjsCount, unsigned visObjMaxCount,
+        Metrics* metrics) const
+    {
+        assert(cellToClipFrustums.size() <= MaxViewsPerQuery);
+        visObjsCount = 0;
+        if (_pimpl->_nodes.empty() || cellToClipFrustums.empty()) return true;
+
+        unsigned nodeAabbTestCount = 0, payloadAabbTestCount = 0;
+        const auto* frustums = cellToClipFrustums.begin();
+
+            //  Each pending node carries 2 view masks: views for which the node straddles
+            //  the edge of the frustum (so its children & objects must be tested), and views
+            //  for which the node is entirely within the frustum (so everything under it is
+            //  visible without further tests). Views that have culled the node are dropped.
+            //  The stack can't be deeper than 3 siblings for each level of the tree (plus the 4
+            //  children of the deepest node); so usually the local array is enough
+        struct PendingNode { unsigned _node; uint64_t _boundaryViews, _withinViews; };
+        PendingNode localStack[64];
+        std::vector<PendingNode> heapStack;
+        PendingNode* workingStack = localStack;
+        auto maxStackSize = 3 * _pimpl->_maxTreeDepth + 4;
+        if (maxStackSize > dimof(localStack)) {
+            heapStack.resize(maxStackSize);
+            workingStack = AsPointer(heapStack.begin());
+        }
+        unsigned workingStackSize = 0;
+
+        PendingNode root { 0, 0, 0 };
+        for (unsigned v=0; v<cellToClipFrustums.size(); ++v) {
+            unsigned withinMask = 0;
+            if (TestAABBx4(frustums[v], _pimpl->_rootBoundary, &withinMask) & 1)
+                ((withinMask & 1) ? root._withinViews : root._boundaryViews) |= 1ull << uint64_t(v);
+        }
+        nodeAabbTestCount += unsigned(cellToClipFrustums.size());
+        if (!(root._boundaryViews | root._withinViews))
+            return true;
+        workingStack[workingStackSize++] = root;
+
+        while (workingStackSize) {
+            auto pending = workingStack[--workingStackSize];
+            auto& node = _pimpl->_nodes[pending._node];
+
+            unsigned childMask = 0;
+            for (unsigned c=0; c<4; ++c)
+                if (node._children[c] < _pimpl->_nodes.size())
+                    childMask |= 1u<<c;
+
+            if (childMask) {
+                    //  Test the 4 children together, once for each view that needs it
+                uint64_t childBoundaryViews[4] = { 0, 0, 0, 0 };
+                uint64_t childWithinViews[4] = { pending._withinViews, pending._withinViews, pending._withinViews, pending._withinViews };
+                for (auto views=pending._boundaryViews; views; views&=views-1) {
+                    auto v = xl_ctz8(views);
+                    unsigned withinMask = 0;
+                    auto visibleMask = TestAABBx4(frustums[v], node._childBoundaries, &withinMask) & childMask;
+                    for (unsigned c=0; c<4; ++c) {
+                        if (!(visibleMask & (1u<<c))) continue;
+                        ((withinMask & (1u<<c)) ? childWithinViews[c] : childBoundaryViews[c]) |= 1ull << uint64_t(v);
+                    }
+                    nodeAabbTestCount += popcount(childMask);
+                }
+
+                for (unsigned c=0; c<4; ++c) {
+                    if (!(childMask & (1u<<c)) || !(childBoundaryViews[c] | childWithinViews[c])) continue;
+                    assert(workingStackSize < maxStackSize);
+                    workingStack[workingStackSize++] = PendingNode { node._children[c], childBoundaryViews[c], childWithinViews[c] };
+                }
+            }
+
+            if (node._payloadID < _pimpl->_payloads.size()) {
+                auto& payload = _pimpl->_payloads[node._payloadID];
+                auto objectCount = payload._objectCount;
+                if ((visObjsCount + objectCount) > visObjMaxCount) {
                     return false;
                 }
 
-                for (auto i=payload._objects.cbegin(); i!=payload._objects.cend(); ++i) {
-                    visObjs[visObjsCount++] = *i + outputIdxOffset; 
+                    //  Every object starts with the views that see the entire node, and then
+                    //  gets a bit for every other view that doesn't cull it. Objects that aren't
+                    //  seen by any view are removed afterwards
+                auto* dst = &visObjs[visObjsCount];
+                const auto* objects = &_pimpl->_payloadObjects[payload._firstObject];
+                for (unsigned c=0; c<objectCount; ++c)
+                    dst[c] = std::make_pair(objects[c], pending._withinViews);
+
+                const auto* blocks = &_pimpl->_payloadBoundaries[payload._firstBoundaryBlock];
+                for (auto views=pending._boundaryViews; views; views&=views-1) {
+                    auto v = xl_ctz8(views);
+                    auto viewBit = 1ull << uint64_t(v);
+                    for (unsigned b=0; b<objectCount; b+=4) {
+                        auto visibleMask = TestAABBx4(frustums[v], blocks[b/4]);
+                        for (unsigned lane=0; lane<std::min(4u, objectCount-b); ++lane)
+                            if (visibleMask & (1u<<lane))
+                                dst[b+lane].second |= viewBit;
+                    }
+                    payloadAabbTestCount += objectCount;
+                }
+
+                if (pending._boundaryViews) {
+                    visObjsCount += unsigned(std::remove_if(
+                        dst, &dst[objectCount], 
+                        [](const std::pair<unsigned, uint64_t>& o) { return o.second == 0; }) - dst);
+                } else {
+                    visObjsCount += objectCount;
                 }
             }
         }
@@ -513,12 +726,87 @@ namespace SceneEngine
             //  node based on the objects assigned to it.
 
         auto pimpl = std::make_unique<Pimpl>();
-        pimpl->PushNode(~unsigned(0x0), 0, workingObjects);
+        if (!workingObjects.empty())
+            pimpl->PushNode(~unsigned(0x0), 0, workingObjects);
         pimpl->_maxCullResults = pimpl->CalculateMaxResults();
+        pimpl->BuildCullingBoundaries(objCellSpaceBoundingBoxes, objStride);
+        pimpl->BindStorage();
+
+        _pimpl = std::move(pimpl);
+    }
+
+    PlacementsQuadTree::PlacementsQuadTree(IteratorRange<const void*> serializedData, unsigned objectCount)
+    {
+        using SerializedHeader = Pimpl::SerializedHeader;
+        if (serializedData.size() < sizeof(SerializedHeader))
+            Throw(::Exceptions::BasicLabel("Serialized quad tree data is truncated"));
+        const auto& hdr = *(const SerializedHeader*)serializedData.begin();
+        if (hdr._version != Pimpl::SerializedVersion)
+            Throw(::Exceptions::BasicLabel("Unexpected version number for serialized quad tree (%i)", hdr._version));
+        auto layout = Pimpl::CalculateSerializedLayout(hdr);
+        if (serializedData.size() < layout._end)
+            Throw(::Exceptions::BasicLabel("Serialized quad tree data is truncated"));
+
+        auto pimpl = std::make_unique<Pimpl>();
+        auto* base = serializedData.begin();
+        pimpl->_payloadBoundaries = MakeIteratorRange((const AABBx4*)PtrAdd(base, layout._payloadBoundaries), (const AABBx4*)PtrAdd(base, layout._payloadBoundaries) + hdr._payloadBoundaryBlockCount);
+        pimpl->_nodes = MakeIteratorRange((const Pimpl::Node*)PtrAdd(base, layout._nodes), (const Pimpl::Node*)PtrAdd(base, layout._nodes) + hdr._nodeCount);
+        pimpl->_payloads = MakeIteratorRange((const Pimpl::Payload*)PtrAdd(base, layout._payloads), (const Pimpl::Payload*)PtrAdd(base, layout._payloads) + hdr._payloadCount);
+        pimpl->_payloadObjects = MakeIteratorRange((const unsigned*)PtrAdd(base, layout._payloadObjects), (const unsigned*)PtrAdd(base, layout._payloadObjects) + hdr._payloadObjectCount);
+        pimpl->_maxCullResults = hdr._maxCullResults;
+        pimpl->_maxTreeDepth = hdr._maxTreeDepth;
+
+            //  The culling functions trust the payload ranges, object indices and tree depths
+            //  (the multi-view traversal sizes its stack from _maxTreeDepth), so check them once
+            //  here. The ranges are checked in 64 bit, so large values can't wrap around
+        for (const auto& p:pimpl->_payloads)
+            if (    uint64_t(p._firstObject) + uint64_t(p._objectCount) > uint64_t(hdr._payloadObjectCount)
+                ||  uint64_t(p._firstBoundaryBlock) + (uint64_t(p._objectCount)+3)/4 > uint64_t(hdr._payloadBoundaryBlockCount))
+                Throw(::Exceptions::BasicLabel("Bad payload in serialized quad tree"));
+        for (auto o:pimpl->_payloadObjects)
+            if (o >= objectCount)
+                Throw(::Exceptions::BasicLabel("Bad object index in serialized quad tree"));
+        for (unsigned n=0; n<hdr._nodeCount; ++n) {
+            const auto& node = pimpl->_nodes[n];
+            if (n == 0 && node._treeDepth != 0)
+                Throw(::Exceptions::BasicLabel("Bad node in serialized quad tree"));
+            for (unsigned c=0; c<4; ++c) {
+                if (node._children[c] >= hdr._nodeCount) continue;
+                const auto& child = pimpl->_nodes[node._children[c]];
+                if (child._treeDepth != node._treeDepth+1 || child._treeDepth > hdr._maxTreeDepth)
+                    Throw(::Exceptions::BasicLabel("Bad node in serialized quad tree"));
+            }
+        }
+
+        pimpl->_rootBoundary = AABBx4{};
+        if (!pimpl->_nodes.empty())
+            pimpl->_rootBoundary.Set(0, pimpl->_nodes[0]._boundary.first, pimpl->_nodes[0]._boundary.second);
 
         _pimpl = std::move(pimpl);
     }
 
+    std::vector<uint8_t> PlacementsQuadTree::Serialize() const
+    {
+        Pimpl::SerializedHeader hdr;
+        hdr._version = Pimpl::SerializedVersion;
+        hdr._nodeCount = unsigned(_pimpl->_nodes.size());
+        hdr._payloadCount = unsigned(_pimpl->_payloads.size());
+        hdr._payloadObjectCount = unsigned(_pimpl->_payloadObjects.size());
+        hdr._payloadBoundaryBlockCount = unsigned(_pimpl->_payloadBoundaries.size());
+        hdr._maxCullResults = _pimpl->_maxCullResults;
+        hdr._maxTreeDepth = _pimpl->_maxTreeDepth;
+        hdr._dummy = 0;
+        auto layout = Pimpl::CalculateSerializedLayout(hdr);
+
+        std::vector<uint8_t> result(layout._end, 0);
+        XlCopyMemory(AsPointer(result.begin()), &hdr, sizeof(hdr));
+        XlCopyMemory(&result[layout._payloadBoundaries], _pimpl->_payloadBoundaries.begin(), _pimpl->_payloadBoundaries.size() * sizeof(AABBx4));
+        XlCopyMemory(&result[layout._nodes], _pimpl->_nodes.begin(), _pimpl->_nodes.size() * sizeof(Pimpl::Node));
+        XlCopyMemory(&result[layout._payloads], _pimpl->_payloads.begin(), _pimpl->_payloads.size() * sizeof(Pimpl::Payload));
+        XlCopyMemory(&result[layout._payloadObjects], _pimpl->_payloadObjects.begin(), _pimpl->_payloadObjects.size() * sizeof(unsigned));
+        return result;
+    }
+
     PlacementsQuadTree::~PlacementsQuadTree() {}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -8,9 +8,12 @@
 
 #include "../Math/Vector.h"
 #include "../Math/Matrix.h"
+#include "../Utility/IteratorUtils.h"
 #include <utility>
 #include <memory>
+#include <vector>
 
+namespace XLEMath { class AABBCullingFrustum; }
 
 namespace SceneEngine
 {
@@ -28,6 +31,10 @@ namespace SceneEngine
     /// multiply. If the world space bounding box straddles the edge of the
     /// frustum, the caller may wish to perform a local space bounding
     /// box test to further improve the result.
+    ///
+    /// The object bounding boxes are copied into the tree when it's built
+    /// (stored in structure-of-arrays form, grouped by leaf), so culling
+    /// doesn't need to read through the source objects.
     class PlacementsQuadTree
     {
     public:
@@ -44,16 +51,42 @@ namespace SceneEngine
 
         bool CalculateVisibleObjects(
             const Float4x4& cellToClipAligned,
-            const BoundingBox objCellSpaceBoundingBoxes[], size_t objStride,
             unsigned visObjs[], unsigned& visObjsCount, unsigned visObjMaxCount,
 			unsigned outputIdxOffset,
             Metrics* metrics = nullptr) const;
 
+        /// <summary>Cull against many views in a single pass</summary>
+        /// The tree is walked once, and each node is tested against every view that might
+        /// see some part of it (views that have culled a node, or see all of it, don't test
+        /// its children). Each visible object is written once, along with a mask of the
+        /// views that can see it (bit N is set for cellToClipFrustums[N]). So there can be
+        /// at most 64 frustums per call; callers with more views should cull in groups.
+        /// Objects are written in traversal order (not sorted).
+        bool CalculateVisibleObjects(
+            IteratorRange<const AABBCullingFrustum*> cellToClipFrustums,
+            std::pair<unsigned, uint64_t> visObjs[], unsigned& visObjsCount, unsigned visObjMaxCount,
+            Metrics* metrics = nullptr) const;
+
         unsigned GetMaxResults() const;
 
+        static const unsigned MaxViewsPerQuery = 64;
+
+        /// <summary>Write the tree into a single block of memory</summary>
+        /// The block can be saved to disk, and used later with the constructor that takes
+        /// serialized data (without rebuilding the tree). Every array within the block starts
+        /// on a 16 byte boundary, relative to the start of the block.
+        std::vector<uint8_t> Serialize() const;
+
         PlacementsQuadTree(
             const BoundingBox objCellSpaceBoundingBoxes[], size_t objStride,
             size_t objCount);
+
+        /// <summary>Use a tree written by Serialize()</summary>
+        /// The data is used in place, not copied (so the tree can be used directly from a 
+        /// memory mapped file). It must remain valid and unchanged for the lifetime of the tree.
+        /// "objectCount" is the number of objects the tree was built from; the culling results
+        /// are indices into that array, so every object index in the data is checked against it.
+        PlacementsQuadTree(IteratorRange<const void*> serializedData, unsigned objectCount);
         ~PlacementsQuadTree();
 
     protected:
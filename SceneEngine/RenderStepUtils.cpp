@@ -12,6 +12,9 @@
 #include "../RenderCore/Metal/DeviceContext.h"
 #include "../Assets/AssetsCore.h"
 #include "../ConsoleRig/ResourceBox.h"
+#include "../ConsoleRig/Console.h"
+#include "../ConsoleRig/GlobalServices.h"
+#include "../Utility/Threading/CompletionThreadPool.h"
 
 namespace SceneEngine
 {
@@ -35,6 +38,32 @@ namespace SceneEngine
         CATCH_ASSETS_END(parserContext)
     }
 
+	void ExecuteDrawablesParallel(
+        IThreadContext& threadContext,
+		Techniques::ParsingContext& parserContext,
+		const Techniques::SequencerContext& sequencerContext,
+		const Techniques::DrawablesPacket& drawables,
+		const char name[])
+    {
+		auto& threadPool = ConsoleRig::GlobalServices::GetInstance().GetShortTaskThreadPool();
+			// (opt in -- only DX11 records in parallel; DrawParallel is the same as Draw elsewhere)
+		if (!Tweakable("ParallelDrawRecording", false) || !threadPool.IsGood()) {
+			ExecuteDrawables(threadContext, parserContext, sequencerContext, drawables, name);
+			return;
+		}
+
+        CATCH_ASSETS_BEGIN
+            GPUAnnotation anno(threadContext, name);
+				// (small packets are drawn on this thread only)
+			RenderCore::Techniques::DrawParallel(
+				threadContext, 
+				parserContext,
+				sequencerContext,
+				drawables,
+				threadPool);
+        CATCH_ASSETS_END(parserContext)
+    }
+
 	bool BatchHasContent(const RenderCore::Techniques::DrawablesPacket& drawables)
     {
         return !drawables._drawables.empty();
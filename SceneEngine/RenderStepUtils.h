@@ -22,6 +22,16 @@ namespace SceneEngine
 		unsigned techniqueIndex);
 
     void ExecuteDrawables(
+        RenderCore::IThreadContext& threadContext,
+		RenderCore::Techniques::ParsingContext& parserContext,
+		const RenderCore::Techniques::SequencerContext& sequencerContext,
+		const RenderCore::Techniques::DrawablesPacket& drawables,
+		const char name[]);
+
+		/// <summary>As ExecuteDrawables, but large packets are recorded on the short task thread pool</summary>
+		/// Intended for steps with many drawables (shadows, gbuffer). Can be disabled with the
+		/// "ParallelDrawRecording" tweakable. See RenderCore::Techniques::DrawParallel
+    void ExecuteDrawablesParallel(
         RenderCore::IThreadContext& threadContext,
 		RenderCore::Techniques::ParsingContext& parserContext,
 		const RenderCore::Techniques::SequencerContext& sequencerContext,
@@ -30,7 +30,7 @@ namespace SceneEngine
 	class ViewDelegate_Forward : public IViewDelegate
 	{
 	public:
-		Techniques::DrawablesPacket _preDepth;
+		Techniques::DrawablesPacket _preDepth { Techniques::DrawablesPacket::SortMode::MinimizeStateChanges };
 		Techniques::DrawablesPacket _general;
 
 		RenderCore::Techniques::DrawablesPacket* GetDrawablesPacket(Techniques::BatchFilter batch) override
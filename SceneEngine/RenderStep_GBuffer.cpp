@@ -146,11 +146,13 @@ namespace SceneEngine
 	class ViewDelegate_Deferred : public IViewDelegate
 	{
 	public:
-		Techniques::DrawablesPacket _transparentPreDepth;		// BatchFilter::TransparentPreDepth
-		Techniques::DrawablesPacket _transparent;				// BatchFilter::Transparent
-		Techniques::DrawablesPacket _oiTransparent;				// BatchFilter::OITransparent
+			// Depth-only and opaque batches are sorted to minimize state changes. Blended batches
+			// must keep the order the drawables were added in (in particular for SortedBlending)
+		Techniques::DrawablesPacket _transparentPreDepth { Techniques::DrawablesPacket::SortMode::MinimizeStateChanges };	// BatchFilter::TransparentPreDepth
+		Techniques::DrawablesPacket _transparent { Techniques::DrawablesPacket::SortMode::Stable };							// BatchFilter::Transparent
+		Techniques::DrawablesPacket _oiTransparent { Techniques::DrawablesPacket::SortMode::Stable };						// BatchFilter::OITransparent
 
-		Techniques::DrawablesPacket _gbufferOpaque;				// BatchFilter::General
+		Techniques::DrawablesPacket _gbufferOpaque { Techniques::DrawablesPacket::SortMode::MinimizeStateChanges };		// BatchFilter::General
 
 		RenderCore::Techniques::DrawablesPacket* GetDrawablesPacket(Techniques::BatchFilter batch) override
 		{
@@ -222,7 +224,7 @@ namespace SceneEngine
         CATCH_ASSETS_BEGIN {
 			// RenderStateDelegateChangeMarker marker(parsingContext, GetStateSetResolvers()._deferred);
 			// ExecuteDrawablesContext executeDrawablesContext(parsingContext);
-			ExecuteDrawables(
+			ExecuteDrawablesParallel(
 				threadContext, parsingContext, 
 				MakeSequencerContext(parsingContext, *rpi.GetSequencerConfig(), TechniqueIndex_Deferred),
 				drawables._gbufferOpaque,
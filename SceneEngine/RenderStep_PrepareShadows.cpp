@@ -116,7 +116,7 @@ namespace SceneEngine
             /////////////////////////////////////////////
 
         CATCH_ASSETS_BEGIN
-			ExecuteDrawables(
+			ExecuteDrawablesParallel(
 				threadContext, parserContext,
 				MakeSequencerContext(parserContext, *rpi.GetSequencerConfig(), TechniqueIndex_ShadowGen),
 				executedScene._general,
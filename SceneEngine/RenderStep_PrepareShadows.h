@@ -47,7 +47,7 @@ namespace SceneEngine
 	class ViewDelegate_Shadow : public IViewDelegate
 	{
 	public:
-		RenderCore::Techniques::DrawablesPacket _general;
+		RenderCore::Techniques::DrawablesPacket _general { RenderCore::Techniques::DrawablesPacket::SortMode::MinimizeStateChanges };
 		ShadowProjectionDesc _shadowProj;
 
 		RenderCore::Techniques::DrawablesPacket* GetDrawablesPacket(RenderCore::Techniques::BatchFilter batch) override;
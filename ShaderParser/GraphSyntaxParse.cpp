@@ -17,6 +17,7 @@
 #include "../Assets/Assets.h"
 #include "../Utility/FunctionUtils.h"
 #include "../Utility/Streams/PathUtils.h"
+#include "../Utility/Streams/PreprocessorInterpreter.h"
 #include "../ConsoleRig/Log.h"
 #include <unordered_map>
 #include <stack>
@@ -367,7 +368,9 @@ extern "C" void Connection_SetCondition(const void* ctx, GraphId gid, Connection
 	if (connection >= ng._graph.GetConnections().size())
 		return;
 
-	ng._graph.GetConnections()[connection]._condition = condition;
+	auto& c = ng._graph.GetConnections()[connection];
+	c._condition = condition;
+	c._compiledCondition = c._condition.empty() ? nullptr : GetPreprocessorExpression(MakeStringSection(c._condition));
 }
 
 extern "C" void Node_Name(const void* ctx, GraphId gid, NodeId id, const char name[])
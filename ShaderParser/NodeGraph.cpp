@@ -3,6 +3,7 @@
 // http://www.opensource.org/licenses/mit-license.php)
 
 #include "NodeGraph.h"
+#include "../Utility/Streams/PreprocessorInterpreter.h"
 
 namespace GraphLanguage 
 {
@@ -13,7 +14,12 @@ namespace GraphLanguage
     NodeGraph::~NodeGraph() {}
 
     void NodeGraph::Add(Node&& a) { _nodes.emplace_back(std::move(a)); }
-    void NodeGraph::Add(Connection&& a) { _connections.emplace_back(std::move(a)); }
+    void NodeGraph::Add(Connection&& a)
+    {
+        if (!a._condition.empty() && !a._compiledCondition)
+            a._compiledCondition = GetPreprocessorExpression(MakeStringSection(a._condition));
+        _connections.emplace_back(std::move(a));
+    }
 
     bool NodeGraph::IsUpstream(NodeId startNode, NodeId searchingForNode)
     {
@@ -9,6 +9,9 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <memory>
+
+namespace Utility { class PreprocessorExpression; }
 
 namespace GraphLanguage 
 {
@@ -47,6 +50,7 @@ namespace GraphLanguage
 		NodeId				_outputNodeId;
         std::string			_outputParameterName;
 		std::string			_condition;
+		std::shared_ptr<const Utility::PreprocessorExpression> _compiledCondition;	// (compiled from _condition by NodeGraph::Add & Connection_SetCondition)
 
         NodeId              InputNodeId() const				{ return _inputNodeId; }
         const std::string&  InputParameterName() const		{ return _inputParameterName; }
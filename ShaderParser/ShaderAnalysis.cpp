@@ -341,18 +341,18 @@ namespace ShaderSourceParser
 
 	ParameterBox FilterSelectors(
 		const ParameterBox& unfiltered,
-		const std::unordered_map<std::string, std::string>& relevance)
+		const PreprocessorExpressionTable& relevance)
 	{
 		const ParameterBox* unfilteredAsArray[] = { &unfiltered };
 
 		// Filter selectors based on the given relevance table
 		ParameterBox result;
 		for (const auto&p:unfiltered) {
-			auto i = relevance.find(p.Name().Cast<char>().AsString());
-			if (i == relevance.end())
+			auto* expression = relevance.Find(p.HashName());
+			if (!expression)
 				continue;
 
-			auto relevant = EvaluatePreprocessorExpression(MakeStringSection(i->second), MakeIteratorRange(unfilteredAsArray));
+			auto relevant = expression->Evaluate(MakeIteratorRange(unfilteredAsArray));
 			if (!relevant)
 				continue;
 
@@ -361,6 +361,13 @@ namespace ShaderSourceParser
 		return result;
 	}
 
+	ParameterBox FilterSelectors(
+		const ParameterBox& unfiltered,
+		const std::unordered_map<std::string, std::string>& relevance)
+	{
+		return FilterSelectors(unfiltered, PreprocessorExpressionTable(relevance));
+	}
+
 	static const std::string s_alwaysRelevant { "1" };
 
 	namespace Utility
@@ -6,6 +6,7 @@
 
 #include "../RenderCore/Assets/LocalCompiledShaderSource.h"
 #include "../Utility/ParameterBox.h"
+#include "../Utility/Streams/PreprocessorInterpreter.h"
 #include <unordered_map>
 #include <string>
 #include <set>
@@ -27,6 +28,10 @@ namespace ShaderSourceParser
 
 	ShaderSelectorAnalysis AnalyzeSelectors(const std::string& sourceCode);
 
+	ParameterBox FilterSelectors(
+		const ParameterBox& unfiltered,
+		const PreprocessorExpressionTable& relevance);
+
 	ParameterBox FilterSelectors(
 		const ParameterBox& unfiltered,
 		const std::unordered_map<std::string, std::string>& relevance);
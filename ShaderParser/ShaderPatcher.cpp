@@ -707,7 +707,7 @@ namespace ShaderSourceParser
 		for (const auto&n:graph.GetNodes())
 			filteredGraph.Add(Node{n});
 		for (const auto&c:graph.GetConnections())
-			if (c._condition.empty() || EvaluatePreprocessorExpression(c._condition, MakeIteratorRange(selectorsAsArray)))
+			if (!c._compiledCondition || c._compiledCondition->Evaluate(MakeIteratorRange(selectorsAsArray)))
 				filteredGraph.Add(Connection{c});
 		return filteredGraph;
 	}
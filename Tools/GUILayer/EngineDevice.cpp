@@ -21,6 +21,7 @@
 #include "../../RenderCore/Assets/Services.h"
 #include "../../RenderCore/Techniques/Techniques.h"
 #include "../../RenderCore/Techniques/Services.h"
+#include "../../RenderCore/Techniques/PipelineAccelerator.h"
 #include "../../RenderOverlays/Font.h"
 #include "../../BufferUploads/IBufferUploads.h"
 #include "../../ConsoleRig/Console.h"
@@ -104,6 +105,8 @@ namespace GUILayer
 		_divAssets = std::make_unique<ToolsRig::DivergentAssetManager>();
         _creationThreadId = System::Threading::Thread::CurrentThread->ManagedThreadId;
 		_pipelineAcceleratorPool = RenderCore::Techniques::CreatePipelineAcceleratorPool();
+		if (auto& store = ::Assets::Services::GetAsyncMan().GetIntermediateStore())
+			_pipelineAcceleratorPool->LoadPipelineCache(*store);
 
 		// hack for plugin startup -- need to find the resources for the plugin:
 		::Assets::MainFileSystem::GetMountingTree()->Mount(u("res"), ::Assets::CreateFileSystem_OS(u("C:/code/XLEExt/res")));
@@ -124,6 +127,9 @@ namespace GUILayer
 			System::Windows::Forms::Application::RemoveMessageFilter(_messageFilter.get());
 		PlatformRig::SetOSRunLoop(nullptr);
 		::ConsoleRig::GlobalServices::GetInstance().UnloadDefaultPlugins();
+		if (_pipelineAcceleratorPool)
+			if (auto& store = ::Assets::Services::GetAsyncMan().GetIntermediateStore())
+				_pipelineAcceleratorPool->SavePipelineCache(*store);
 		_pipelineAcceleratorPool.reset();
 		_divAssets.reset();
         _renderAssetsServices.reset();
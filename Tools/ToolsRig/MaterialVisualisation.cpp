@@ -134,6 +134,7 @@ namespace ToolsRig
 				drawable._geo = std::make_shared<Techniques::DrawableGeo>();
 				drawable._geo->_vertexStreams[0]._vbOffset = space._startOffset;
 				drawable._geo->_vertexStreamCount = 1;
+				drawable._geo->_flags = Techniques::DrawableGeo::Flags::Temporary;
 				drawable._drawFn = (Techniques::Drawable::ExecuteDrawFn*)&MaterialSceneParserDrawable::DrawFn;
 				drawable._vertexCount = (unsigned)dimof(vertices);
 				drawable._uniformsInterface = usi;
@@ -186,6 +187,7 @@ namespace ToolsRig
 			bool drawBoneNames) const {}
 		void BindAnimationState(const std::shared_ptr<VisAnimationState>& animState) {}
 		bool HasActiveAnimation() const { return false; }
+		void PrepareFrame() {}
 
 		void SetPatchCollection(const PatchCollectionFuture& patchCollectionFuture)
 		{
@@ -390,7 +392,8 @@ namespace ToolsRig
 
 			ShaderSelectorFiltering previewStructureFiltering;
 			previewStructureFiltering._relevanceMap["GEO_PRETRANSFORMED"] = "1";
-			auto filteredDefines = MakeFilteredDefinesTable(selectors, previewStructureFiltering, shaderPatches.GetInterface().GetSelectorRelevance());
+			previewStructureFiltering.GenerateHash();
+			auto filteredDefines = MakeFilteredDefinesTable(selectors, previewStructureFiltering, shaderPatches.GetInterface().GetCompiledSelectorRelevance());
 
 			auto structureForPreview = PatchAnalysisHelper::InstantiatePreviewStructure(shaderPatches, _previewOptions);
 			
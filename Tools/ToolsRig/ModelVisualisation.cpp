@@ -17,6 +17,7 @@
 #include "../../Assets/Assets.h"
 #include "../../Assets/AssetFuture.h"
 #include "../../Assets/AssetFutureContinuation.h"
+#include "../../ConsoleRig/GlobalServices.h"
 #include "../../Utility/TimeUtils.h"
 
 #pragma warning(disable:4505)
@@ -64,6 +65,22 @@ namespace ToolsRig
 				return;
 			}
 
+			// The deform ops were started in PrepareFrame(); the drawables upload their output
+			// when they are drawn
+			for (unsigned v=0; v<executeContext.GetViews().size(); ++v) {
+				RenderCore::Techniques::DrawablesPacket* pkts[unsigned(RenderCore::Techniques::BatchFilter::Max)];
+				for (unsigned c=0; c<unsigned(RenderCore::Techniques::BatchFilter::Max); ++c)
+					pkts[c] = executeContext.GetDrawablesPacket(v, RenderCore::Techniques::BatchFilter(c));
+
+				r->_renderer->BuildDrawables(MakeIteratorRange(pkts), Identity<Float4x4>(), _preDrawDelegate);
+			}
+		}
+
+		void PrepareFrame()
+		{
+			auto* r = TryActualize();
+			if (!r) return;
+
 			auto skeletonMachine = r->GetSkeletonMachine();
 			assert(skeletonMachine);
 
@@ -100,15 +117,7 @@ namespace ToolsRig
 					MakeIteratorRange(skeletonMachineOutput),
 					skeletonMachine->GetOutputInterface());
 			}
-			r->_renderer->GenerateDeformBuffer(threadContext);
-
-			for (unsigned v=0; v<executeContext.GetViews().size(); ++v) {
-				RenderCore::Techniques::DrawablesPacket* pkts[unsigned(RenderCore::Techniques::BatchFilter::Max)];
-				for (unsigned c=0; c<unsigned(RenderCore::Techniques::BatchFilter::Max); ++c)
-					pkts[c] = executeContext.GetDrawablesPacket(v, RenderCore::Techniques::BatchFilter(c));
-
-				r->_renderer->BuildDrawables(MakeIteratorRange(pkts), Identity<Float4x4>(), _preDrawDelegate);
-			}
+			r->_renderer->ExecuteDeformOps(&ConsoleRig::GlobalServices::GetInstance().GetShortTaskThreadPool());
 		}
 
 		DrawCallDetails GetDrawCallDetails(unsigned drawCallIndex, uint64_t materialGuid) const
@@ -346,8 +355,11 @@ namespace ToolsRig
 			}
 
 			_actualized = _rendererStateFuture->TryActualize();
-			if (_actualized && _animationState) {
-				_actualized->BindAnimState(*_animationState);
+			if (_actualized) {
+					// (the model has just finished loading; build its pipelines in the background)
+				_pipelineAcceleratorPool->PrecompilePipelines();
+				if (_animationState)
+					_actualized->BindAnimState(*_animationState);
 			}
 			return _actualized.get();
 		}
@@ -255,6 +255,11 @@ namespace ToolsRig
 		}
 
 		if (!_pimpl->_preparingEnvSettings && !_pimpl->_preparingScene && !_pimpl->_preparingPipelineAccelerators) {
+			// Start any animation work before the scene is parsed; it runs in the background
+			// until the drawables are drawn
+			if (auto* visContent = dynamic_cast<IVisContent*>(_pimpl->_scene.get()))
+				visContent->PrepareFrame();
+
 			auto& screenshot = Tweakable("Screenshot", 0);
 			if (screenshot) {
 				PlatformRig::TiledScreenshot(
@@ -411,6 +416,9 @@ namespace ToolsRig
 				pipelineAccelerators,
 				RenderCore::AsAttachmentDesc(renderTarget->GetDesc()));
 
+			if (auto* visContent = dynamic_cast<IVisContent*>(&scene))
+				visContent->PrepareFrame();
+
 			SceneEngine::LightingParser_ExecuteScene(
 				context, renderTarget, parserContext,
 				*compiledTechnique,
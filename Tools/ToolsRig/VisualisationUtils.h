@@ -128,6 +128,10 @@ namespace ToolsRig
 		virtual void BindAnimationState(const std::shared_ptr<VisAnimationState>& animState) = 0;
 		virtual bool HasActiveAnimation() const = 0;
 
+		/// Called once per frame, before the scene is executed. Animated content uses this to
+		/// start its deform operations, so they can run while the rest of the frame is prepared
+		virtual void PrepareFrame() = 0;
+
 		virtual ~IVisContent();
 	};
 
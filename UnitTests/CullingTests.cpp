@@ -0,0 +1,268 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#include "UnitTestHelper.h"
+#include "../SceneEngine/PlacementsQuadTree.h"
+#include "../RenderCore/Techniques/TechniqueUtils.h"
+#include "../Math/ProjectionMath.h"
+#include "../Math/Transformations.h"
+#include <CppUnitTest.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <iterator>
+
+namespace UnitTests
+{
+    using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+        // Similar to a placement in a placements cell (a large stride between bounding boxes)
+    struct CullingTestObject
+    {
+        Float3x4 _localToCell;
+        std::pair<Float3, Float3> _cellSpaceBoundary;
+        unsigned _modelFilenameOffset, _materialFilenameOffset, _supplementsOffset;
+        uint64_t _guid;
+    };
+
+    static std::vector<CullingTestObject> MakeCullingTestObjects(unsigned count, float worldSize, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> position(-worldSize, worldSize);
+        std::uniform_real_distribution<float> size(.1f, 20.f);
+        std::vector<CullingTestObject> result(count);
+        for (auto& o:result) {
+            Float3 center { position(rng), position(rng), .05f * position(rng) };
+            Float3 halfSize { size(rng), size(rng), size(rng) };
+            o._cellSpaceBoundary = { center - halfSize, center + halfSize };
+        }
+        return result;
+    }
+
+    static std::vector<AABBx4> MakeAABBx4Array(const std::vector<CullingTestObject>& objects)
+    {
+        std::vector<AABBx4> result((objects.size()+3)/4, AABBx4{});
+        for (unsigned c=0; c<objects.size(); ++c)
+            result[c/4].Set(c%4, objects[c]._cellSpaceBoundary.first, objects[c]._cellSpaceBoundary.second);
+        return result;
+    }
+
+        // One camera view and 4 shadow cascades (similar to a typical main scene render)
+    static std::vector<Float4x4> MakeCullingTestViews(ClipSpaceType clipSpaceType, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> dist(-1.f, 1.f);
+        std::vector<Float4x4> result;
+
+        auto cameraToWorld = MakeCameraToWorld(Normalize(Float3{dist(rng), dist(rng), -.25f}), Float3{0.f, 0.f, 1.f}, Float3{100.f * dist(rng), 100.f * dist(rng), 20.f});
+        result.push_back(Combine(
+            InvertOrthonormalTransform(cameraToWorld),
+            PerspectiveProjection(Deg2Rad(60.f), 16.f/9.f, 0.1f, 2000.f, GeometricCoordinateSpace::RightHanded, clipSpaceType)));
+
+        auto lightToWorld = MakeCameraToWorld(Normalize(Float3{.3f, .2f, -1.f}), Float3{0.f, 1.f, 0.f}, Float3{0.f, 0.f, 500.f});
+        auto worldToLight = InvertOrthonormalTransform(lightToWorld);
+        float cascadeSize = 64.f;
+        for (unsigned c=0; c<4; ++c, cascadeSize *= 4.f) {
+            float x = 100.f * dist(rng), y = 100.f * dist(rng);
+            result.push_back(Combine(
+                worldToLight,
+                OrthogonalProjection(x-cascadeSize, y+cascadeSize, x+cascadeSize, y-cascadeSize, 1.f, 1000.f, GeometricCoordinateSpace::RightHanded, clipSpaceType)));
+        }
+        return result;
+    }
+
+    TEST_CLASS(CullingTests)
+    {
+    public:
+        TEST_METHOD(BatchedAABBCulling)
+        {
+            std::mt19937 rng(3452);
+            const unsigned objectCount = 10*1024+3;      // (not a multiple of 4, so the final block is exercised)
+            auto objects = MakeCullingTestObjects(objectCount, 2000.f, rng);
+            auto boxes = MakeAABBx4Array(objects);
+
+            const ClipSpaceType clipSpaceTypes[] = { ClipSpaceType::Positive, ClipSpaceType::StraddlingZero };
+            for (auto clipSpaceType:clipSpaceTypes) {
+                for (const auto& view:MakeCullingTestViews(clipSpaceType, rng)) {
+                    AABBCullingFrustum frustum(view, clipSpaceType);
+
+                        // Compare against the test that transforms all 8 corners into clip space.
+                        // Rounding can give different results for boxes that are within a float
+                        // epsilon or so of a frustum plane (which happens occasionally for the far
+                        // plane of the perspective view); so a handful of differences are allowed
+                    std::vector<unsigned> reference;
+                    unsigned visibleMismatches = 0, withinMismatches = 0;
+                    for (unsigned c=0; c<objectCount; ++c) {
+                        auto test = TestAABB(view, objects[c]._cellSpaceBoundary.first, objects[c]._cellSpaceBoundary.second, clipSpaceType);
+                        if (test != AABBIntersection::Culled) reference.push_back(c);
+
+                        unsigned withinMask = 0;
+                        auto visibleMask = TestAABBx4(frustum, boxes[c/4], &withinMask);
+                        Assert::AreEqual(withinMask & ~visibleMask, 0u);
+                        visibleMismatches += ((visibleMask >> (c%4)) & 1) != unsigned(test != AABBIntersection::Culled);
+                        withinMismatches += ((withinMask >> (c%4)) & 1) != unsigned(test == AABBIntersection::Within);
+                    }
+                    Assert::IsTrue(!reference.empty() && reference.size() < objectCount);
+                    Assert::IsTrue(visibleMismatches <= objectCount/1000);
+                    Assert::IsTrue(withinMismatches <= objectCount/1000);
+
+                        // CullAABBs must agree exactly with TestAABBx4
+                    std::vector<unsigned> visible(objectCount), expected;
+                    visible.resize(CullAABBs(frustum, boxes.data(), objectCount, visible.data()));
+                    for (unsigned c=0; c<objectCount; ++c)
+                        if (TestAABBx4(frustum, boxes[c/4]) & (1u<<(c%4)))
+                            expected.push_back(c);
+                    Assert::IsTrue(visible == expected);
+                    Assert::IsTrue(std::abs(int(visible.size()) - int(reference.size())) <= int(visibleMismatches));
+
+                        // Offset indices, and culling a subrange
+                    visible.resize(objectCount);
+                    visible.resize(CullAABBs(frustum, &boxes[2], 6, visible.data(), 1u<<28));
+                    for (auto v:visible) {
+                        auto idx = (v & ~(1u<<28)) + 8;
+                        Assert::IsTrue(std::find(expected.begin(), expected.end(), idx) != expected.end());
+                    }
+                }
+            }
+        }
+
+        TEST_METHOD(BatchedAABBCullingAgainstAlignedTest)
+        {
+            std::mt19937 rng(7821);
+            const unsigned objectCount = 10*1000 + 3;       // (not a multiple of 4, so the last group of boxes is partially filled)
+            auto objects = MakeCullingTestObjects(objectCount, 2000.f, rng);
+            auto boxes = MakeAABBx4Array(objects);
+            auto clipSpaceType = ClipSpaceType::Positive;
+
+                // The batched culling should agree with the original one-box-at-a-time test (up to
+                // the same small number of rounding differences allowed above), return indices in
+                // order, and never return the padding in the last group
+            unsigned totalVisible = 0;
+            for (const auto& view:MakeCullingTestViews(clipSpaceType, rng)) {
+                std::vector<unsigned> reference;
+                for (unsigned c=0; c<objectCount; ++c)
+                    if (!CullAABB_Aligned(view, objects[c]._cellSpaceBoundary.first, objects[c]._cellSpaceBoundary.second, clipSpaceType))
+                        reference.push_back(c);
+
+                std::vector<unsigned> visible(objectCount);
+                visible.resize(CullAABBs(AABBCullingFrustum(view, clipSpaceType), boxes.data(), objectCount, visible.data()));
+                Assert::IsTrue(std::is_sorted(visible.begin(), visible.end()));
+                Assert::IsTrue(visible.empty() || visible.back() < objectCount);
+
+                std::vector<unsigned> mismatches;
+                std::set_symmetric_difference(
+                    visible.begin(), visible.end(), reference.begin(), reference.end(),
+                    std::back_inserter(mismatches));
+                Assert::IsTrue(mismatches.size() <= objectCount/1000);
+                totalVisible += (unsigned)visible.size();
+            }
+            Assert::IsTrue(totalVisible != 0);
+        }
+
+        TEST_METHOD(MultiViewQuadTreeCulling)
+        {
+            std::mt19937 rng(5619);
+            const unsigned objectCount = 20*1000;
+            auto objects = MakeCullingTestObjects(objectCount, 2000.f, rng);
+            SceneEngine::PlacementsQuadTree quadTree(&objects[0]._cellSpaceBoundary, sizeof(CullingTestObject), objectCount);
+
+                // Many shadow casting views (as if there were several lights with cascades)
+            auto clipSpaceType = RenderCore::Techniques::GetDefaultClipSpaceType();
+            std::vector<Float4x4> views;
+            while (views.size() < SceneEngine::PlacementsQuadTree::MaxViewsPerQuery) {
+                auto newViews = MakeCullingTestViews(clipSpaceType, rng);
+                views.insert(views.end(), newViews.begin(), newViews.end());
+            }
+            views.resize(SceneEngine::PlacementsQuadTree::MaxViewsPerQuery);
+            std::vector<AABBCullingFrustum> frustums;
+            for (const auto& v:views) frustums.emplace_back(v, clipSpaceType);
+
+            auto maxResults = quadTree.GetMaxResults();
+            std::vector<unsigned> singleView(maxResults);
+            std::vector<std::pair<unsigned, uint64_t>> multiView(maxResults);
+
+                // The result for each view must match culling that view by itself
+            std::vector<uint64_t> expectedMasks(objectCount, 0);
+            unsigned visibleCount = 0;
+            for (unsigned v=0; v<views.size(); ++v) {
+                Assert::IsTrue(quadTree.CalculateVisibleObjects(views[v], singleView.data(), visibleCount, maxResults, 0));
+                for (unsigned c=0; c<visibleCount; ++c)
+                    expectedMasks[singleView[c]] |= 1ull << uint64_t(v);
+            }
+
+            Assert::IsTrue(quadTree.CalculateVisibleObjects(MakeIteratorRange(frustums), multiView.data(), visibleCount, maxResults));
+
+            std::vector<uint64_t> masks(objectCount, 0);
+            for (unsigned c=0; c<visibleCount; ++c) {
+                Assert::AreEqual(masks[multiView[c].first], uint64_t(0));     // (each object at most once)
+                Assert::IsTrue(multiView[c].second != 0);
+                masks[multiView[c].first] = multiView[c].second;
+            }
+            Assert::IsTrue(masks == expectedMasks);
+
+                // Subsets of the views give the same bits
+            Assert::IsTrue(quadTree.CalculateVisibleObjects(MakeIteratorRange(&frustums[3], &frustums[5]), multiView.data(), visibleCount, maxResults));
+            for (unsigned c=0; c<visibleCount; ++c)
+                Assert::AreEqual(multiView[c].second, (expectedMasks[multiView[c].first] >> 3ull) & 3ull);
+            Assert::AreEqual(visibleCount, unsigned(std::count_if(expectedMasks.begin(), expectedMasks.end(), [](uint64_t m) { return ((m >> 3ull) & 3ull) != 0; })));
+        }
+
+        TEST_METHOD(SerializedQuadTree)
+        {
+            std::mt19937 rng(9127);
+            const unsigned objectCount = 5*1000;
+            auto objects = MakeCullingTestObjects(objectCount, 2000.f, rng);
+            SceneEngine::PlacementsQuadTree quadTree(&objects[0]._cellSpaceBoundary, sizeof(CullingTestObject), objectCount);
+
+                // The loaded tree uses the serialized block in place; and must give exactly the
+                // same results as the tree it was written from (including the order)
+            auto serialized = quadTree.Serialize();
+            SceneEngine::PlacementsQuadTree loadedTree(MakeIteratorRange(AsPointer(serialized.cbegin()), AsPointer(serialized.cend())), objectCount);
+            Assert::AreEqual(loadedTree.GetMaxResults(), quadTree.GetMaxResults());
+
+            auto clipSpaceType = RenderCore::Techniques::GetDefaultClipSpaceType();
+            auto views = MakeCullingTestViews(clipSpaceType, rng);
+            std::vector<AABBCullingFrustum> frustums;
+            for (const auto& v:views) frustums.emplace_back(v, clipSpaceType);
+
+            auto maxResults = quadTree.GetMaxResults();
+            std::vector<unsigned> expected(maxResults), loaded(maxResults);
+            unsigned expectedCount = 0, loadedCount = 0;
+            for (const auto& v:views) {
+                Assert::IsTrue(quadTree.CalculateVisibleObjects(v, expected.data(), expectedCount, maxResults, 0));
+                Assert::IsTrue(loadedTree.CalculateVisibleObjects(v, loaded.data(), loadedCount, maxResults, 0));
+                Assert::IsTrue(expectedCount != 0 && expectedCount == loadedCount);
+                Assert::IsTrue(std::equal(expected.begin(), expected.begin()+expectedCount, loaded.begin()));
+            }
+
+            std::vector<std::pair<unsigned, uint64_t>> expectedMulti(maxResults), loadedMulti(maxResults);
+            Assert::IsTrue(quadTree.CalculateVisibleObjects(MakeIteratorRange(frustums), expectedMulti.data(), expectedCount, maxResults));
+            Assert::IsTrue(loadedTree.CalculateVisibleObjects(MakeIteratorRange(frustums), loadedMulti.data(), loadedCount, maxResults));
+            Assert::AreEqual(expectedCount, loadedCount);
+            Assert::IsTrue(std::equal(expectedMulti.begin(), expectedMulti.begin()+expectedCount, loadedMulti.begin()));
+
+                // Serializing the loaded tree gives the same block again
+            Assert::IsTrue(loadedTree.Serialize() == serialized);
+
+                // Truncated or corrupted data must be rejected (not read past the end)
+            bool caughtException = false;
+            try {
+                SceneEngine::PlacementsQuadTree truncated(MakeIteratorRange(AsPointer(serialized.cbegin()), AsPointer(serialized.cend())-1), objectCount);
+            } catch (const std::exception&) {
+                caughtException = true;
+            }
+            Assert::IsTrue(caughtException);
+
+                // As must object indices beyond the end of the object array
+            caughtException = false;
+            try {
+                SceneEngine::PlacementsQuadTree tooFewObjects(MakeIteratorRange(AsPointer(serialized.cbegin()), AsPointer(serialized.cend())), objectCount-1);
+            } catch (const std::exception&) {
+                caughtException = true;
+            }
+            Assert::IsTrue(caughtException);
+        }
+    };
+}
+
@@ -0,0 +1,380 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#include "UnitTestHelper.h"
+#include "../RenderCore/Techniques/Drawables.h"
+#include "../RenderCore/Techniques/FrameArena.h"
+#include "../RenderCore/Techniques/SimpleModelRenderer.h"
+#include "../RenderCore/ResourceDesc.h"
+#include "../Utility/Threading/CompletionThreadPool.h"
+#include <CppUnitTest.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstring>
+
+namespace UnitTests
+{
+    using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+    struct SyntheticDrawable
+    {
+        float _localToWorld[16];
+        unsigned _pipeline, _descriptorSet, _indexCount;
+    };
+
+        // Stand in for the per-drawable CPU cost of recording (building the local transform
+        // constants and writing the commands), without requiring a device
+    static void RecordSyntheticDrawable(const SyntheticDrawable& drawable, const float worldToProjection[16], std::vector<uint8_t>& commandStream)
+    {
+        float localToProjection[16];
+        for (unsigned r=0; r<4; ++r)
+            for (unsigned c=0; c<4; ++c) {
+                float v = 0.f;
+                for (unsigned k=0; k<4; ++k)
+                    v += worldToProjection[r*4+k] * drawable._localToWorld[k*4+c];
+                localToProjection[r*4+c] = v;
+            }
+
+        auto start = commandStream.size();
+        commandStream.resize(start + sizeof(localToProjection) + 3*sizeof(unsigned));
+        auto* dst = &commandStream[start];
+        std::memcpy(dst, localToProjection, sizeof(localToProjection)); dst += sizeof(localToProjection);
+        std::memcpy(dst, &drawable._pipeline, 3*sizeof(unsigned));
+    }
+
+        // Device context with just the parts of the secondary command list interface used
+        // by DrawParallel; so the way ranges are forked, recorded and executed can be checked
+        // without a DX11 device
+    class FakeCommandList
+    {
+    public:
+        std::vector<uint8_t> _commandStream;
+    };
+
+    class FakeDeviceContext
+    {
+    public:
+        std::vector<uint8_t> _commandStream;
+        unsigned _renderTarget = 0;
+        bool _deferred = false, _recording = false;
+        unsigned _forkCount = 0, _executeCount = 0;
+        std::thread::id _owningThread = std::this_thread::get_id();
+
+        std::shared_ptr<FakeDeviceContext> Fork()
+        {
+            ++_forkCount;
+            auto result = std::make_shared<FakeDeviceContext>();
+            result->_deferred = true;
+            return result;
+        }
+
+        void BeginCommandList()
+        {
+            Assert::IsTrue(_deferred && !_recording);
+            _recording = true;
+        }
+
+        void BeginSecondaryCommandList(FakeDeviceContext& primary)
+        {
+            Assert::IsTrue(_recording && !primary._deferred);
+            _renderTarget = primary._renderTarget;
+        }
+
+        std::shared_ptr<FakeCommandList> ResolveCommandList()
+        {
+            Assert::IsTrue(_recording);
+            auto result = std::make_shared<FakeCommandList>();
+            result->_commandStream = std::move(_commandStream);
+            _commandStream.clear();
+            _recording = false;
+            return result;
+        }
+
+        void ExecuteCommandList(FakeCommandList& commandList, bool preserveRenderState)
+        {
+            Assert::IsTrue(preserveRenderState && !_deferred);
+            Assert::IsTrue(std::this_thread::get_id() == _owningThread);
+            _commandStream.insert(_commandStream.end(), commandList._commandStream.begin(), commandList._commandStream.end());
+            ++_executeCount;
+        }
+
+        void Record(const SyntheticDrawable& drawable, const float worldToProjection[16])
+        {
+                // Secondary contexts must have inherited the render target before recording,
+                // and the primary context may only be used by the thread that owns it
+            Assert::IsTrue(_deferred ? _recording : (std::this_thread::get_id() == _owningThread));
+            Assert::AreEqual(_renderTarget, 0x5eedu);
+            RecordSyntheticDrawable(drawable, worldToProjection, _commandStream);
+        }
+    };
+
+    class AppendTestDrawable : public RenderCore::Techniques::Drawable
+    {
+    public:
+        unsigned _index = 0;
+    };
+
+        // Stands in for a static vertex buffer; only its identity matters here
+    class FakeResource : public RenderCore::IResource
+    {
+    public:
+        RenderCore::ResourceDesc GetDesc() const override { return RenderCore::ResourceDesc{}; }
+        void* QueryInterface(size_t) override { return nullptr; }
+        uint64_t GetGUID() const override { return 0; }
+        std::vector<uint8_t> ReadBack(RenderCore::IThreadContext&, RenderCore::SubResourceId) const override { return {}; }
+    };
+
+    TEST_CLASS(DrawablesTests)
+    {
+    public:
+        TEST_METHOD(FrameArenaAllocation)
+        {
+            const unsigned frameLatency = 2;
+            RenderCore::Techniques::FrameArena arena(frameLatency, 4*1024);
+
+                // Allocations must be aligned, and must survive until the frame they were allocated
+                // in has been retired. After the first few frames, there should be no new pages
+            std::vector<std::pair<unsigned*, unsigned>> previousFrames[frameLatency];
+            unsigned heapAllocationsAfterWarmup = 0;
+            for (unsigned frame=0; frame<32; ++frame) {
+                auto& thisFrame = previousFrames[frame%frameLatency];
+                thisFrame.clear();
+                for (unsigned c=0; c<512; ++c) {
+                    auto size = 16 + (c*7)%100;
+                    auto alignment = (c%3 == 0) ? 64 : 16;
+                    auto space = arena.Allocate(size, alignment);
+                    Assert::AreEqual(space.size(), size_t(size));
+                    Assert::AreEqual(size_t(space.begin()) % alignment, size_t(0));
+                    *(unsigned*)space.begin() = frame*1000+c;
+                    thisFrame.push_back({(unsigned*)space.begin(), frame*1000+c});
+                }
+                SyntheticDrawable constants = {{1.f, 2.f, 3.f, 4.f}, 5, 6, 7};
+                auto pkt = arena.MakePkt(constants);
+                Assert::AreEqual(pkt.size(), sizeof(SyntheticDrawable));
+                Assert::AreEqual(((const float*)pkt.begin())[3], 4.f);
+
+                for (const auto& f:previousFrames)
+                    for (const auto& a:f)
+                        Assert::AreEqual(*a.first, a.second);
+
+                if (frame == 8)
+                    heapAllocationsAfterWarmup = arena.GetMetrics()._heapAllocations;
+                arena.OnFrameBarrier();
+            }
+            Assert::AreEqual(arena.GetMetrics()._heapAllocations, heapAllocationsAfterWarmup);
+        }
+
+        TEST_METHOD(ParallelPacketBuildAndAppend)
+        {
+            using namespace RenderCore::Techniques;
+            Utility::CompletionThreadPool threadPool(4);
+            const unsigned itemCount = 1200, rangeCount = 4;     // (ranges start on multiples of 3)
+            const unsigned vertexDataSize = 64;                 // (large enough that the packet storage must grow)
+
+                // Build packets on several threads. Some drawables use temporary vertex storage
+                // (and pairs of drawables share the same temporary geo, as instanced draw calls do).
+                // The temporary storage comes either from the heap, or from a frame arena; in which
+                // case the packets shouldn't allocate any more memory after the first few frames
+            FrameArena arena(2, 4*1024);
+            std::vector<DrawablesPacket> rangePkts(rangeCount);
+            DrawablesPacket combined;
+            for (auto* frameArena:{(FrameArena*)nullptr, &arena}) {
+                unsigned heapAllocationsAfterWarmup = 0;
+                for (unsigned frame=0; frame<8; ++frame) {
+                    for (auto& pkt:rangePkts) { pkt.Reset(); pkt.SetFrameArena(frameArena); }
+                    combined.Reset();
+                    combined.SetFrameArena(frameArena);
+
+                    Utility::ExecuteRangesParallel(
+                        threadPool, itemCount, rangeCount,
+                        [&rangePkts](unsigned rangeIndex, unsigned begin, unsigned end) {
+                            auto& pkt = rangePkts[rangeIndex];
+                            std::shared_ptr<DrawableGeo> geo;
+                            for (unsigned c=begin; c<end; ++c) {
+                                auto& drawable = *pkt._drawables.Allocate<AppendTestDrawable>();
+                                drawable._index = c;
+                                if ((c%3) == 0) {
+                                    auto storage = pkt.AllocateStorage(DrawablesPacket::Storage::VB, vertexDataSize);
+                                    *(unsigned*)storage._data.begin() = c;
+                                    geo = std::make_shared<DrawableGeo>();
+                                    geo->_vertexStreams[0]._vbOffset = storage._startOffset;
+                                    geo->_vertexStreamCount = 1;
+                                    geo->_flags = DrawableGeo::Flags::Temporary;
+                                }
+                                if ((c%3) != 2) drawable._geo = geo;
+                            }
+                        });
+
+                        // Append in range order; the result must be the same as building the drawables in
+                        // order on one thread
+                    auto initialStorage = combined.AllocateStorage(DrawablesPacket::Storage::VB, 3*sizeof(unsigned));
+                    std::memset(initialStorage._data.begin(), 0xff, initialStorage._data.size());
+                    for (auto& pkt:rangePkts) {
+                        combined.Append(std::move(pkt));
+                        Assert::IsTrue(pkt._drawables.empty() && pkt.GetStorage(DrawablesPacket::Storage::VB).empty());
+                    }
+
+                    auto vbStorage = combined.GetStorage(DrawablesPacket::Storage::VB);
+                    unsigned expectedIndex = 0;
+                    for (auto d=combined._drawables.begin(); d!=combined._drawables.end(); ++d, ++expectedIndex) {
+                        const auto& drawable = *(const AppendTestDrawable*)d.get();
+                        Assert::AreEqual(drawable._index, expectedIndex);
+                        if ((expectedIndex%3) == 2) {
+                            Assert::IsTrue(drawable._geo == nullptr);
+                            continue;
+                        }
+                        auto offset = drawable._geo->_vertexStreams[0]._vbOffset;
+                        Assert::IsTrue(offset + vertexDataSize <= vbStorage.size());
+                        Assert::AreEqual(*(const unsigned*)PtrAdd(vbStorage.begin(), offset), expectedIndex - (expectedIndex%3));
+                    }
+                    Assert::AreEqual(expectedIndex, itemCount);
+
+                        // Storage from the arena is only used when the packet has one
+                    auto arenaMetrics = arena.GetMetrics();
+                    if (frameArena) {
+                        Assert::IsTrue(arenaMetrics._cpuBytesAllocated >= vbStorage.size());
+                    } else {
+                        Assert::AreEqual(arenaMetrics._cpuBytesAllocated, size_t(0));
+                    }
+                    if (frame == 4)
+                        heapAllocationsAfterWarmup = arenaMetrics._heapAllocations;
+                    arena.OnFrameBarrier();
+                }
+                if (frameArena)
+                    Assert::AreEqual(arena.GetMetrics()._heapAllocations, heapAllocationsAfterWarmup);
+            }
+        }
+
+        TEST_METHOD(InstancedGeoAndTransforms)
+        {
+            using namespace RenderCore::Techniques;
+
+                // Small batches and models with skinned geometry are drawn one instance at a time
+            for (unsigned c=0; c<2*SimpleModelRenderer::s_minInstancedBatch; ++c) {
+                Assert::AreEqual(RenderCore::Techniques::Internal::UseInstancedDrawables(c, 0), c >= SimpleModelRenderer::s_minInstancedBatch);
+                Assert::IsFalse(RenderCore::Techniques::Internal::UseInstancedDrawables(c, 1));
+            }
+
+            const unsigned instanceCount = 6;
+            Float4x4 instances[instanceCount];
+            for (unsigned c=0; c<instanceCount; ++c)
+                for (unsigned r=0; r<4; ++r)
+                    for (unsigned q=0; q<4; ++q)
+                        instances[c](r, q) = float(c*100 + r*10 + q);
+
+            auto checkTransforms = [&instances](IteratorRange<const void*> storage, unsigned offset) {
+                Assert::IsTrue(offset + instanceCount*12*sizeof(float) <= storage.size());
+                auto* src = (const float*)PtrAdd(storage.begin(), offset);
+                for (unsigned c=0; c<instanceCount; ++c)
+                    for (unsigned r=0; r<3; ++r)
+                        for (unsigned q=0; q<4; ++q)
+                            Assert::AreEqual(*src++, instances[c](r, q));
+            };
+
+                // Each batch filter packet gets its own copy of the instance transforms, at
+                // whatever offset is free in that packet
+            DrawablesPacket pkts[2];
+            auto existing = pkts[1].AllocateStorage(DrawablesPacket::Storage::VB, 40);
+            std::memset(existing._data.begin(), 0xff, existing._data.size());
+            unsigned instanceDataOffset[2];
+            for (unsigned c=0; c<2; ++c)
+                instanceDataOffset[c] = RenderCore::Techniques::Internal::WriteInstanceTransforms(pkts[c], MakeIteratorRange(instances));
+            Assert::AreEqual(instanceDataOffset[0], 0u);
+            Assert::AreEqual(instanceDataOffset[1], 40u);
+            for (unsigned c=0; c<2; ++c)
+                checkTransforms(pkts[c].GetStorage(DrawablesPacket::Storage::VB), instanceDataOffset[c]);
+
+                // The instanced geo is a temporary copy with the instance stream appended; the
+                // model's own geo is unchanged
+            DrawableGeo geo;
+            geo._vertexStreams[0]._resource = std::make_shared<FakeResource>();
+            geo._vertexStreams[0]._vbOffset = 16;
+            geo._vertexStreamCount = 1;
+            std::shared_ptr<DrawableGeo> instancedGeos[2];
+            for (unsigned c=0; c<2; ++c) {
+                instancedGeos[c] = RenderCore::Techniques::Internal::MakeInstancedGeo(geo, instanceDataOffset[c]);
+                const auto& instancedGeo = *instancedGeos[c];
+                Assert::AreEqual(instancedGeo._vertexStreamCount, 2u);
+                Assert::IsTrue(instancedGeo._vertexStreams[0]._resource == geo._vertexStreams[0]._resource);
+                Assert::AreEqual(instancedGeo._vertexStreams[0]._vbOffset, 16u);
+                Assert::IsTrue(instancedGeo._vertexStreams[1]._resource == nullptr);
+                Assert::AreEqual(instancedGeo._vertexStreams[1]._vbOffset, instanceDataOffset[c]);
+                Assert::AreEqual(instancedGeo._flags, (unsigned)DrawableGeo::Flags::Temporary);
+            }
+            Assert::AreEqual(geo._vertexStreamCount, 1u);
+            Assert::AreEqual(geo._flags, 0u);
+
+                // Several draw calls share one instanced geo. When the packet is appended to another,
+                // the instance stream must be moved to the new location of the transforms just once,
+                // and the static stream left alone
+            for (unsigned c=0; c<2; ++c)
+                for (unsigned d=0; d<3; ++d)
+                    pkts[c]._drawables.Allocate<AppendTestDrawable>()->_geo = instancedGeos[c];
+
+            DrawablesPacket combined;
+            combined.AllocateStorage(DrawablesPacket::Storage::VB, 100);
+            for (auto& pkt:pkts)
+                combined.Append(std::move(pkt));
+
+            auto vbStorage = combined.GetStorage(DrawablesPacket::Storage::VB);
+            Assert::AreEqual(instancedGeos[0]->_vertexStreams[1]._vbOffset, 100u);
+            Assert::AreEqual(instancedGeos[1]->_vertexStreams[1]._vbOffset, 100u + unsigned(instanceCount*12*sizeof(float)) + instanceDataOffset[1]);
+            for (unsigned c=0; c<2; ++c) {
+                Assert::AreEqual(instancedGeos[c]->_vertexStreams[0]._vbOffset, 16u);
+                checkTransforms(vbStorage, instancedGeos[c]->_vertexStreams[1]._vbOffset);
+            }
+            unsigned drawableCount = 0;
+            for (auto d=combined._drawables.begin(); d!=combined._drawables.end(); ++d, ++drawableCount)
+                Assert::IsTrue(((const AppendTestDrawable*)d.get())->_geo == instancedGeos[drawableCount/3]);
+            Assert::AreEqual(drawableCount, 6u);
+        }
+
+        TEST_METHOD(ParallelRecordingMatchesSerial)
+        {
+            const unsigned drawableCount = 1001;
+            std::vector<SyntheticDrawable> drawables(drawableCount);
+            for (unsigned c=0; c<drawableCount; ++c) {
+                auto& d = drawables[c];
+                for (unsigned e=0; e<16; ++e) d._localToWorld[e] = (e%5 == 0) ? 1.f : float(c%13) * 0.01f;
+                d._pipeline = c%17; d._descriptorSet = c%101; d._indexCount = c;
+            }
+            float worldToProjection[16];
+            for (unsigned e=0; e<16; ++e) worldToProjection[e] = (e%5 == 0) ? 2.f : float(e) * 0.1f;
+
+            std::vector<uint8_t> serialStream;
+            for (const auto& d:drawables)
+                RecordSyntheticDrawable(d, worldToProjection, serialStream);
+
+                // Record in ranges through RecordRangesParallel (the same path DrawParallel uses), including
+                // range counts that don't divide the drawable count, and more ranges than threads. The primary
+                // context must end up with exactly what the serial recording gave, every frame
+            Utility::CompletionThreadPool threadPool(4);
+            for (unsigned rangeCount:{1u, 3u, 4u, 7u}) {
+                for (unsigned f=0; f<3; ++f) {
+                    FakeDeviceContext primary;
+                    primary._renderTarget = 0x5eed;
+                    std::vector<std::atomic<unsigned>> rangeVisits(rangeCount);
+                    RenderCore::Techniques::Internal::RecordRangesParallel(
+                        primary, threadPool, drawableCount, rangeCount,
+                        [&](FakeDeviceContext& context, unsigned rangeIndex, unsigned begin, unsigned end) {
+                            Assert::AreEqual(rangeIndex == 0, &context == &primary);
+                            ++rangeVisits[rangeIndex];
+                            for (unsigned c=begin; c<end; ++c)
+                                context.Record(drawables[c], worldToProjection);
+                        });
+
+                    for (const auto& v:rangeVisits) Assert::AreEqual(v.load(), 1u);
+                    Assert::AreEqual(primary._forkCount, rangeCount-1);
+                    Assert::AreEqual(primary._executeCount, rangeCount-1);
+                    Assert::AreEqual(primary._commandStream.size(), serialStream.size());
+                    Assert::IsTrue(primary._commandStream == serialStream);
+                }
+            }
+        }
+    };
+}
+
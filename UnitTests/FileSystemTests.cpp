@@ -0,0 +1,458 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#include "UnitTestHelper.h"
+#include "../Assets/MountingTree.h"
+#include "../Assets/MemoryFile.h"
+#include "../Assets/ArchiveCache.h"
+#include "../Assets/ArchiveFileSystem.h"
+#include "../Assets/IFileSystem.h"
+#include "../Assets/OSFileSystem.h"
+#include "../Utility/Streams/PathUtils.h"
+#include "../Utility/Streams/FileSystemMonitor.h"
+#include "../Utility/SystemUtils.h"
+#include "../Utility/StringFormat.h"
+#include <CppUnitTest.h>
+#include <atomic>
+
+namespace UnitTests
+{
+    using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+    static ::Assets::Blob MakeTestBlob(const char str[])
+    {
+        return std::make_shared<std::vector<uint8_t>>((const uint8_t*)str, (const uint8_t*)&str[XlStringLen(str)]);
+    }
+
+    static std::string ReadCandidate(const ::Assets::MountingTree::CandidateObject& candidate)
+    {
+        std::unique_ptr<::Assets::IFileInterface> file;
+        auto ioRes = candidate._fileSystem->TryOpen(file, candidate._marker, "rb");
+        if (ioRes != ::Assets::IFileSystem::IOReason::Success) return {};
+        std::string result(file->GetSize(), ' ');
+        file->Read(&result[0], 1, result.size());
+        return result;
+    }
+
+    static std::vector<std::string> AllCandidates(::Assets::MountingTree& mountingTree, const char filename[])
+    {
+        std::vector<std::string> result;
+        ::Assets::MountingTree::CandidateObject candidate;
+        auto lookup = mountingTree.Lookup(MakeStringSection((const utf8*)filename));
+        while (lookup.TryGetNext(candidate) == ::Assets::MountingTree::EnumerableLookup::Result::Success)
+            result.push_back(ReadCandidate(candidate));
+        return result;
+    }
+
+    static std::string AsString(IteratorRange<const void*> data)
+    {
+        return std::string((const char*)data.begin(), (const char*)data.end());
+    }
+
+    static void DeleteArchiveFiles(const char archiveName[])
+    {
+        std::string base = archiveName;
+        for (const char* suffix:{"", ".dir", ".dir.tmp", ".debug", ".1", ".2", ".3"})
+            XlDeleteFile((const utf8*)(base + suffix).c_str());
+    }
+
+    static void WriteFile(const std::string& filename, const ::Assets::Blob& contents)
+    {
+        auto file = ::Assets::MainFileSystem::OpenBasicFile(filename.c_str(), "wb");
+        file.Write(contents->data(), 1, contents->size());
+    }
+
+    static uint64_t GetFileSize(const std::string& filename)
+    {
+        auto desc = ::Assets::MainFileSystem::TryGetDesc(filename.c_str());
+        return (desc._state == ::Assets::FileDesc::State::Normal) ? desc._size : 0;
+    }
+
+    static std::vector<uint8_t> ReadFile(::Assets::IFileSystem& fs, const char filename[])
+    {
+        ::Assets::IFileSystem::Marker marker;
+        if (fs.TryTranslate(marker, MakeStringSection((const utf8*)filename)) != ::Assets::IFileSystem::TranslateResult::Success)
+            Throw(std::runtime_error("File not found in filesystem"));
+        std::unique_ptr<::Assets::IFileInterface> file;
+        if (fs.TryOpen(file, marker, "rb") != ::Assets::IFileSystem::IOReason::Success)
+            Throw(std::runtime_error("Could not open file"));
+        std::vector<uint8_t> result(file->GetSize());
+        if (!result.empty())
+            file->Read(result.data(), 1, result.size());
+        return result;
+    }
+
+    class CountingChangeCallback : public OnChangeCallback
+    {
+    public:
+        std::atomic<unsigned> _changeCount{0};
+        void OnChange() override { ++_changeCount; }
+    };
+
+    TEST_CLASS(FileSystemTests)
+    {
+    public:
+        TEST_METHOD(MountingTreeLookup)
+        {
+            FilenameRules rules('/', false);
+            ::Assets::MountingTree mountingTree(rules);
+
+            // Overlapping mounts at different depths. Candidates should always come back in
+            // the order the filesystems were mounted
+            mountingTree.Mount(u("one/two"), ::Assets::CreateFileSystem_Memory({{"file.txt", MakeTestBlob("one/two")}}));
+            mountingTree.Mount(u("one"), ::Assets::CreateFileSystem_Memory({{"two/file.txt", MakeTestBlob("one")}, {"other.txt", MakeTestBlob("one-other")}}));
+            auto rootMount = mountingTree.Mount(u(""), ::Assets::CreateFileSystem_Memory({{"one/two/file.txt", MakeTestBlob("root")}}));
+            mountingTree.Mount(u("ONE/Two/"), ::Assets::CreateFileSystem_Memory({{"file.txt", MakeTestBlob("one/two second")}}));
+
+            for (unsigned repeat=0; repeat<3; ++repeat) {      // (repeated to exercise the lookup cache)
+                auto candidates = AllCandidates(mountingTree, "one/two/file.txt");
+                Assert::AreEqual(candidates.size(), (size_t)4);
+                Assert::AreEqual(candidates[0], std::string("one/two"));
+                Assert::AreEqual(candidates[1], std::string("one"));
+                Assert::AreEqual(candidates[2], std::string("root"));
+                Assert::AreEqual(candidates[3], std::string("one/two second"));
+
+                candidates = AllCandidates(mountingTree, "One\\\\two/file.txt");
+                Assert::AreEqual(candidates.size(), (size_t)3);        // (memory filesystem is case sensitive, so "root" isn't found)
+
+                candidates = AllCandidates(mountingTree, "one/other.txt");
+                Assert::AreEqual(candidates.size(), (size_t)1);
+                Assert::AreEqual(candidates[0], std::string("one-other"));
+
+                Assert::AreEqual(AllCandidates(mountingTree, "one/missing.txt").size(), (size_t)0);
+                Assert::AreEqual(AllCandidates(mountingTree, "two/file.txt").size(), (size_t)0);
+            }
+
+            // Lookups in flight are invalidated by changes to the mounts, and the cached results
+            // must not survive the change
+            ::Assets::MountingTree::CandidateObject candidate;
+            auto lookup = mountingTree.Lookup(u("one/two/file.txt"));
+            Assert::IsTrue(lookup.TryGetNext(candidate) == ::Assets::MountingTree::EnumerableLookup::Result::Success);
+            mountingTree.Unmount(rootMount);
+            Assert::IsTrue(lookup.TryGetNext(candidate) == ::Assets::MountingTree::EnumerableLookup::Result::Invalidated);
+
+            auto candidates = AllCandidates(mountingTree, "one/two/file.txt");
+            Assert::AreEqual(candidates.size(), (size_t)3);
+            Assert::AreEqual(candidates[2], std::string("one/two second"));
+        }
+
+        TEST_METHOD(MountingTreeManyMounts)
+        {
+            FilenameRules rules('/', false);
+            ::Assets::MountingTree mountingTree(rules);
+
+            // Many mounts (similar to a project with many archives and mod directories). Every file
+            // should be found exactly once, with the right contents, both on the first lookup and
+            // when the result comes from the lookup cache
+            const unsigned mountCount = 40, fileCount = 400;
+            std::vector<std::pair<std::string, std::string>> filenamesAndContents;
+            std::vector<std::string> missingFilenames;
+            for (unsigned m=0; m<mountCount; ++m) {
+                std::string mountPoint = (StringMeld<64>() << "game/mount" << (m%16) << "/sub" << (m/16)).AsString();
+                std::unordered_map<std::string, ::Assets::Blob> files;
+                for (unsigned f=m; f<fileCount; f+=mountCount) {
+                    std::string contents = (StringMeld<64>() << "contents" << f).AsString();
+                    files.insert({(StringMeld<64>() << "dir" << (f%7) << "/file" << f << ".dat").AsString(), MakeTestBlob(contents.c_str())});
+                    filenamesAndContents.push_back({(StringMeld<128>() << mountPoint << "/dir" << (f%7) << "/file" << f << ".dat").AsString(), contents});
+                }
+                missingFilenames.push_back(mountPoint + "/dir0/missing.dat");
+                mountingTree.Mount(MakeStringSection((const utf8*)mountPoint.c_str()), ::Assets::CreateFileSystem_Memory(files));
+            }
+
+            for (unsigned repeat=0; repeat<2; ++repeat) {
+                for (const auto& f:filenamesAndContents) {
+                    auto candidates = AllCandidates(mountingTree, f.first.c_str());
+                    Assert::AreEqual(candidates.size(), (size_t)1);
+                    Assert::AreEqual(candidates[0], f.second);
+                }
+                for (const auto& f:missingFilenames)
+                    Assert::AreEqual(AllCandidates(mountingTree, f.c_str()).size(), (size_t)0);
+            }
+
+            // Mounting something new must clear cached results (including cached misses)
+            mountingTree.Mount(u("game/mount3/sub1"), ::Assets::CreateFileSystem_Memory({{"dir0/missing.dat", MakeTestBlob("found")}}));
+            auto candidates = AllCandidates(mountingTree, "game/mount3/sub1/dir0/missing.dat");
+            Assert::AreEqual(candidates.size(), (size_t)1);
+            Assert::AreEqual(candidates[0], std::string("found"));
+            Assert::AreEqual(AllCandidates(mountingTree, "game/mount3/sub0/dir0/missing.dat").size(), (size_t)0);
+        }
+
+        TEST_METHOD(ArchiveCacheViewLifetime)
+        {
+            FilenameRules rules('/', true);
+            ::Assets::MainFileSystem::Init(std::make_shared<::Assets::MountingTree>(rules), ::Assets::CreateFileSystem_OS());
+            const char archiveName[] = "int/unittests/archivecache-views";
+            DeleteArchiveFiles(archiveName);
+
+            ::Assets::ArchiveCache::BlockView pendingView, flushedView, compactedView;
+            {
+                ::Assets::ArchiveCache archive(archiveName, "unittest", "unittest");
+                archive.Commit(1, MakeTestBlob("first version"), "block1", "", [](){});
+                archive.Commit(2, MakeTestBlob("other block"), "block2", "", [](){});
+                pendingView = archive.TryOpenView(1);
+                Assert::IsTrue(bool(pendingView));
+                Assert::IsFalse(bool(archive.TryOpenView(3)));
+                archive.FlushToDisk();
+
+                flushedView = archive.TryOpenView(1);
+                Assert::AreEqual(AsString(flushedView.GetData()), std::string("first version"));
+
+                // Replacing the block doesn't change what existing views see, either after
+                // the flush appends the new version, or after compaction rewrites the data file
+                archive.Commit(1, MakeTestBlob("second version"), "block1", "", [](){});
+                archive.FlushToDisk();
+                Assert::AreEqual(AsString(archive.TryOpenView(1).GetData()), std::string("second version"));
+                Assert::AreEqual(AsString(flushedView.GetData()), std::string("first version"));
+
+                compactedView = archive.TryOpenView(2);
+                archive.Compact();
+                Assert::AreEqual(AsString(pendingView.GetData()), std::string("first version"));
+                Assert::AreEqual(AsString(flushedView.GetData()), std::string("first version"));
+                Assert::AreEqual(AsString(compactedView.GetData()), std::string("other block"));
+                Assert::AreEqual(AsString(archive.TryOpenView(1).GetData()), std::string("second version"));
+                Assert::AreEqual(AsString(archive.TryOpenView(2).GetData()), std::string("other block"));
+
+                auto blob = archive.TryOpenFromCache(1);
+                Assert::IsNotNull(blob.get());
+                Assert::AreEqual(std::string(blob->begin(), blob->end()), std::string("second version"));
+            }
+
+            // Views also outlive the archive itself
+            Assert::AreEqual(AsString(flushedView.GetData()), std::string("first version"));
+            Assert::AreEqual(AsString(compactedView.GetData()), std::string("other block"));
+
+            pendingView = flushedView = compactedView = {};
+            DeleteArchiveFiles(archiveName);
+            ::Assets::MainFileSystem::Shutdown();
+        }
+
+        TEST_METHOD(ArchiveCacheFlushAndCompact)
+        {
+            FilenameRules rules('/', true);
+            ::Assets::MainFileSystem::Init(std::make_shared<::Assets::MountingTree>(rules), ::Assets::CreateFileSystem_OS());
+            const char archiveName[] = "int/unittests/archivecache-flush";
+            const std::string dataFile = archiveName, compactedDataFile = dataFile + ".1", directoryFile = dataFile + ".dir";
+            DeleteArchiveFiles(archiveName);
+
+            auto makeBlock = [](uint64_t id, unsigned version) {
+                return std::make_shared<std::vector<uint8_t>>(size_t(1024*id*version), uint8_t(id + 16*version));
+            };
+            auto checkBlocks = [&makeBlock](::Assets::ArchiveCache& archive, unsigned block2Version) {
+                for (uint64_t id=1; id<=4; ++id) {
+                    auto blob = archive.TryOpenFromCache(id);
+                    Assert::IsNotNull(blob.get());
+                    Assert::IsTrue(*blob == *makeBlock(id, (id==2) ? block2Version : 1));
+                }
+                Assert::IsNull(archive.TryOpenFromCache(5).get());
+            };
+            const unsigned originalSize = 1024*(1+2+3+4), liveSize = 1024*(1+4+3+4);
+
+            {
+                ::Assets::ArchiveCache archive(archiveName, "unittest", "unittest");
+                for (uint64_t id=1; id<=4; ++id)
+                    archive.Commit(id, makeBlock(id, 1), "block", "", [](){});
+                archive.FlushToDisk();
+                checkBlocks(archive, 1);
+            }
+
+            {
+                // Replacing a block appends the new version to the data file, and leaves the old
+                // version behind as dead space
+                ::Assets::ArchiveCache archive(archiveName, "unittest", "unittest");
+                checkBlocks(archive, 1);
+                archive.Commit(2, makeBlock(2, 2), "block", "", [](){});
+                archive.FlushToDisk();
+                checkBlocks(archive, 2);
+                Assert::AreEqual(GetFileSize(dataFile), uint64_t(originalSize + 1024*4));
+            }
+
+            ::Assets::Blob previousDirectory, previousData;
+            {
+                ::Assets::ArchiveCache archive(archiveName, "unittest", "unittest");
+                checkBlocks(archive, 2);
+                auto metrics = archive.GetMetrics();
+                Assert::AreEqual(metrics._usedSpace, liveSize);
+                Assert::AreEqual(metrics._allocatedFileSize, originalSize + 1024*4);
+
+                previousDirectory = ::Assets::TryLoadFileAsBlob(directoryFile);
+                previousData = ::Assets::TryLoadFileAsBlob(dataFile);
+                Assert::IsNotNull(previousDirectory.get());
+                Assert::IsNotNull(previousData.get());
+
+                // Compaction writes the live blocks into the next generation of the data file,
+                // and removes the old generation
+                archive.Compact();
+                checkBlocks(archive, 2);
+                Assert::AreEqual(GetFileSize(compactedDataFile), uint64_t(liveSize));
+                Assert::IsTrue(::Assets::MainFileSystem::TryGetDesc(dataFile.c_str())._state == ::Assets::FileDesc::State::DoesNotExist);
+            }
+
+            {
+                ::Assets::ArchiveCache archive(archiveName, "unittest", "unittest");
+                checkBlocks(archive, 2);
+                auto metrics = archive.GetMetrics();
+                Assert::AreEqual(metrics._usedSpace, liveSize);
+                Assert::AreEqual(metrics._allocatedFileSize, liveSize);
+            }
+
+            // Put back the directory and data file from the previous generation, as if the
+            // compaction was interrupted before the directory was swapped. The stale directory
+            // still refers to the old data file, and must load as normal
+            WriteFile(directoryFile, previousDirectory);
+            WriteFile(dataFile, previousData);
+            {
+                ::Assets::ArchiveCache archive(archiveName, "unittest", "unittest");
+                checkBlocks(archive, 2);
+                Assert::AreEqual(archive.GetMetrics()._allocatedFileSize, originalSize + 1024*4);
+
+                // Compacting again replaces the orphaned generation
+                archive.Commit(3, makeBlock(3, 1), "block", "", [](){});
+                archive.Compact();
+                checkBlocks(archive, 2);
+                Assert::AreEqual(GetFileSize(compactedDataFile), uint64_t(liveSize));
+            }
+
+            {
+                ::Assets::ArchiveCache archive(archiveName, "unittest", "unittest");
+                checkBlocks(archive, 2);
+            }
+
+            DeleteArchiveFiles(archiveName);
+            ::Assets::MainFileSystem::Shutdown();
+        }
+
+        TEST_METHOD(FileSystemArchiveRoundTrip)
+        {
+            FilenameRules rules('/', true);
+            ::Assets::MainFileSystem::Init(std::make_shared<::Assets::MountingTree>(rules), ::Assets::CreateFileSystem_OS());
+            const char archiveName[] = "int/unittests/roundtrip.archive";
+            RawFS::CreateDirectoryRecursive(u("int/unittests"));
+
+            auto compressible = std::make_shared<std::vector<uint8_t>>(4096);
+            for (unsigned c=0; c<compressible->size(); ++c) (*compressible)[c] = uint8_t(c % 7);
+            auto incompressible = std::make_shared<std::vector<uint8_t>>(1024);
+            uint32_t seed = 0x1234567u;
+            for (auto& b:*incompressible) { seed = seed * 1664525u + 1013904223u; b = uint8_t(seed >> 24); }
+
+            std::vector<::Assets::ArchiveFileSystemEntry> entries;
+            entries.push_back({u("data/Stored.txt"), MakeTestBlob("small file"), 0});
+            entries.push_back({u("data\\sub\\Compressible.bin"), compressible, 0});
+            entries.push_back({u("data/Random.bin"), incompressible, 0});
+            entries.push_back({u("Empty.txt"), std::make_shared<std::vector<uint8_t>>(), 0});
+
+            for (auto compression:{::Assets::ArchiveCompression::Deflate, ::Assets::ArchiveCompression::None}) {
+                ::Assets::WriteFileSystemArchive(MakeStringSection((const utf8*)archiveName), MakeIteratorRange(entries), compression);
+                auto fs = ::Assets::CreateFileSystem_Archive(MakeStringSection((const utf8*)archiveName));
+
+                // Lookups are case insensitive, and accept either separator
+                Assert::IsTrue(ReadFile(*fs, "data/Stored.txt") == *entries[0]._data);
+                Assert::IsTrue(ReadFile(*fs, "DATA\\stored.TXT") == *entries[0]._data);
+                Assert::IsTrue(ReadFile(*fs, "/data//SUB/compressible.bin") == *compressible);
+                Assert::IsTrue(ReadFile(*fs, "data\\sub/Compressible.bin") == *compressible);
+                Assert::IsTrue(ReadFile(*fs, "Data/Random.bin") == *incompressible);
+                Assert::IsTrue(ReadFile(*fs, "empty.txt").empty());
+
+                ::Assets::IFileSystem::Marker marker;
+                Assert::IsTrue(fs->TryTranslate(marker, u("data/missing.txt")) == ::Assets::IFileSystem::TranslateResult::Invalid);
+                Assert::IsTrue(fs->TryTranslate(marker, u("data/sub")) == ::Assets::IFileSystem::TranslateResult::Invalid);
+
+                Assert::IsTrue(fs->TryTranslate(marker, u("empty.txt")) == ::Assets::IFileSystem::TranslateResult::Success);
+                auto desc = fs->TryGetDesc(marker);
+                Assert::IsTrue(desc._state == ::Assets::FileDesc::State::Normal);
+                Assert::AreEqual(desc._size, (uint64)0);
+
+                // Only files stored uncompressed can be memory mapped. With Deflate, the compressible
+                // file is compressed, but the random data isn't worth compressing
+                MemoryMappedFile mappedFile;
+                Assert::IsTrue(fs->TryTranslate(marker, u("data/sub/compressible.bin")) == ::Assets::IFileSystem::TranslateResult::Success);
+                Assert::AreEqual(fs->TryGetDesc(marker)._size, (uint64)compressible->size());
+                auto expectedMapResult = (compression == ::Assets::ArchiveCompression::Deflate) ? ::Assets::IFileSystem::IOReason::Invalid : ::Assets::IFileSystem::IOReason::Success;
+                Assert::IsTrue(fs->TryOpen(mappedFile, marker, 0, "rb") == expectedMapResult);
+                Assert::IsTrue(fs->TryTranslate(marker, u("data/random.bin")) == ::Assets::IFileSystem::TranslateResult::Success);
+                Assert::IsTrue(fs->TryOpen(mappedFile, marker, 0, "rb") == ::Assets::IFileSystem::IOReason::Success);
+                Assert::IsTrue(mappedFile.GetSize() == incompressible->size());
+                mappedFile = {};
+
+                auto& searchable = dynamic_cast<::Assets::ISearchableFileSystem&>(*fs);
+                Assert::AreEqual(searchable.FindFiles(u("data"), u(".*")).size(), (size_t)2);
+                Assert::AreEqual(searchable.FindFiles(u("DATA/"), u(".*\\.bin")).size(), (size_t)1);
+                Assert::AreEqual(searchable.FindFiles(u("data\\sub"), u(".*\\.bin")).size(), (size_t)1);
+                Assert::AreEqual(searchable.FindFiles(u(""), u(".*\\.txt")).size(), (size_t)1);
+                auto subDirs = searchable.FindSubDirectories(u("data"));
+                Assert::AreEqual(subDirs.size(), (size_t)1);
+                Assert::IsTrue(subDirs[0] == u("sub"));
+            }
+
+            XlDeleteFile((const utf8*)archiveName);
+            ::Assets::MainFileSystem::Shutdown();
+        }
+
+        TEST_METHOD(FileSystemMonitorDeferredDelivery)
+        {
+            RawFS::CreateDirectoryRecursive(u("int/unittests/monitor"));
+            auto directory = u("int/unittests/monitor");
+            auto callbackA = std::make_shared<CountingChangeCallback>();
+            auto callbackB = std::make_shared<CountingChangeCallback>();
+            auto callbackC = std::make_shared<CountingChangeCallback>();
+
+            auto initialMetrics = GetFileSystemMonitorMetrics();
+            AttachFileSystemMonitor(directory, u("a.txt"), callbackA);
+            AttachFileSystemMonitor(directory, u("a.txt"), callbackA);     // (no extra effect)
+            AttachFileSystemMonitor(directory, u("b.txt"), callbackA);
+            AttachFileSystemMonitor(directory, u("a.txt"), callbackB);
+            AttachFileSystemMonitor(directory, u("c.txt"), callbackC);
+            Assert::AreEqual(GetFileSystemMonitorMetrics()._attachedCallbackCount, initialMetrics._attachedCallbackCount + 4);
+
+            // With deferred delivery, many changes to the same files are coalesced, and each
+            // callback fires exactly once, on the flush
+            SetFileSystemMonitorDeferredDelivery(true);
+            for (unsigned c=0; c<3; ++c) FakeFileChange(directory, u("a.txt"));
+            for (unsigned c=0; c<2; ++c) FakeFileChange(directory, u("b.txt"));
+            Assert::AreEqual(callbackA->_changeCount.load(), 0u);
+            Assert::AreEqual(callbackB->_changeCount.load(), 0u);
+
+            auto metrics = GetFileSystemMonitorMetrics();
+            Assert::AreEqual(metrics._pendingCallbackCount, 2u);
+            Assert::AreEqual(metrics._changeEventCount - initialMetrics._changeEventCount, (uint64)5);
+            Assert::AreEqual(metrics._coalescedCallbackCount - initialMetrics._coalescedCallbackCount, (uint64)6);     // (2 for each repeat of a.txt, and 1 for each b.txt)
+            Assert::AreEqual(metrics._executedCallbackCount, initialMetrics._executedCallbackCount);
+
+            Assert::AreEqual(FlushFileSystemMonitorEvents(), 2u);
+            Assert::AreEqual(callbackA->_changeCount.load(), 1u);
+            Assert::AreEqual(callbackB->_changeCount.load(), 1u);
+            Assert::AreEqual(callbackC->_changeCount.load(), 0u);
+            metrics = GetFileSystemMonitorMetrics();
+            Assert::AreEqual(metrics._pendingCallbackCount, 0u);
+            Assert::AreEqual(metrics._executedCallbackCount - initialMetrics._executedCallbackCount, (uint64)2);
+            Assert::AreEqual(FlushFileSystemMonitorEvents(), 0u);
+
+            // Expired callbacks are never queued
+            callbackB.reset();
+            FakeFileChange(directory, u("a.txt"));
+            FakeFileChange(directory, u("c.txt"));
+            Assert::AreEqual(FlushFileSystemMonitorEvents(), 2u);
+            Assert::AreEqual(callbackA->_changeCount.load(), 2u);
+            Assert::AreEqual(callbackC->_changeCount.load(), 1u);
+
+            // Disabling deferred delivery flushes anything queued, and then callbacks are
+            // executed immediately
+            FakeFileChange(directory, u("b.txt"));
+            Assert::AreEqual(callbackA->_changeCount.load(), 2u);
+            SetFileSystemMonitorDeferredDelivery(false);
+            Assert::AreEqual(callbackA->_changeCount.load(), 3u);
+            FakeFileChange(directory, u("a.txt"));
+            Assert::AreEqual(callbackA->_changeCount.load(), 4u);
+
+            metrics = GetFileSystemMonitorMetrics();
+            Assert::AreEqual(metrics._pendingCallbackCount, 0u);
+            Assert::AreEqual(metrics._changeEventCount - initialMetrics._changeEventCount, (uint64)9);
+            Assert::AreEqual(metrics._coalescedCallbackCount - initialMetrics._coalescedCallbackCount, (uint64)6);
+            Assert::AreEqual(metrics._executedCallbackCount - initialMetrics._executedCallbackCount, (uint64)6);
+
+            TerminateFileSystemMonitoring();
+        }
+    };
+}
@@ -21,6 +21,8 @@
 #include "../RenderCore/FrameBufferDesc.h"
 #include "../BufferUploads/BufferUploads_Manager.h"
 #include "../Assets/AssetServices.h"
+#include "../Assets/CompileAndAsyncManager.h"
+#include "../Assets/IntermediateAssets.h"
 #include "../Assets/IFileSystem.h"
 #include "../Assets/OSFileSystem.h"
 #include "../Assets/MountingTree.h"
@@ -288,6 +290,104 @@ namespace UnitTests
 			}
 		}
 
+		TEST_METHOD(PipelineCacheRoundTrip)
+		{
+			using namespace RenderCore;
+
+			std::shared_ptr<Techniques::TechniqueSetFile> techniqueSetFile = ::Assets::AutoConstructAsset<Techniques::TechniqueSetFile>("ut-data/basic.tech");
+			auto techniqueSharedResources = std::make_shared<Techniques::TechniqueSharedResources>();
+			auto compiledPatches = GetCompiledPatchCollectionFromText(s_exampleTechniqueFragments);
+			auto& store = *::Assets::Services::GetAsyncMan().GetIntermediateStore();
+
+			RenderCore::Assets::RenderStateSet doubledSidedStateSet;
+			doubledSidedStateSet._doubleSided = true;
+
+				//
+				//	Complete a pipeline, and save the pool's pipeline cache
+				//
+			{
+				auto pool = Techniques::CreatePipelineAcceleratorPool();
+				auto cfgId = pool->CreateSequencerConfig(
+					Techniques::CreateTechniqueDelegate_Deferred(techniqueSetFile, techniqueSharedResources),
+					ParameterBox { std::make_pair(u("SEQUENCER_SEL"), "37") },
+					MakeSimpleFrameBufferDesc());
+				auto pipelineAccelerator = pool->CreatePipelineAccelerator(
+					compiledPatches,
+					ParameterBox { std::make_pair(u("SIMPLE_BIND"), "1") },
+					GlobalInputLayouts::PNT,
+					Topology::TriangleList,
+					doubledSidedStateSet);
+
+				auto finalPipeline = pool->GetPipeline(*pipelineAccelerator, *cfgId);
+				finalPipeline->StallWhilePending();
+				Assert::IsTrue(finalPipeline->GetAssetState() == ::Assets::AssetState::Ready);
+				pool->SavePipelineCache(store);
+			}
+
+				//
+				//	Check the file header (magic 'PPCH', version, key count)
+				//
+			::Assets::ResChar filename[MaxPath];
+			store.MakeIntermediateName(filename, dimof(filename), "pipelines/pipelineaccelerators.cache");
+			{
+				size_t fileSize = 0;
+				auto fileData = ::Assets::TryLoadFileAsMemoryBlock(filename, &fileSize);
+				Assert::IsTrue(fileData && fileSize >= sizeof(uint32_t)*3);
+				auto* header = (const uint32_t*)fileData.get();
+				Assert::AreEqual(0x48435050u, header[0]);
+				Assert::AreEqual(1u, header[1]);
+				Assert::IsTrue(header[2] >= 1);
+				Assert::AreEqual(sizeof(uint32_t)*3 + header[2]*sizeof(uint64_t), fileSize);
+			}
+
+				//
+				//	A new pool should load the keys, and recognize the same combination when it's created
+				//	again (ie, the keys don't depend on pointers, guids or creation order)
+				//
+			{
+				auto pool = Techniques::CreatePipelineAcceleratorPool();
+				pool->LoadPipelineCache(store);
+				Assert::IsTrue(pool->GetMetrics()._cachedPipelineKeys >= 1);
+				Assert::AreEqual(0u, pool->GetMetrics()._cachedPipelineHits);
+
+				auto unrelatedAccelerator = pool->CreatePipelineAccelerator(
+					compiledPatches,
+					ParameterBox {},
+					GlobalInputLayouts::P,
+					Topology::TriangleList,
+					doubledSidedStateSet);
+				auto pipelineAccelerator = pool->CreatePipelineAccelerator(
+					compiledPatches,
+					ParameterBox { std::make_pair(u("SIMPLE_BIND"), "1") },
+					GlobalInputLayouts::PNT,
+					Topology::TriangleList,
+					doubledSidedStateSet);
+				auto cfgId = pool->CreateSequencerConfig(
+					Techniques::CreateTechniqueDelegate_Deferred(techniqueSetFile, techniqueSharedResources),
+					ParameterBox { std::make_pair(u("SEQUENCER_SEL"), "37") },
+					MakeSimpleFrameBufferDesc());
+				Assert::AreEqual(1u, pool->GetMetrics()._cachedPipelineHits);
+			}
+
+				//
+				//	Files with the wrong version are ignored
+				//
+			{
+				size_t fileSize = 0;
+				auto fileData = ::Assets::TryLoadFileAsMemoryBlock(filename, &fileSize);
+				((uint32_t*)fileData.get())[1] = 0;
+				{
+					BasicFile file;
+					Assert::IsTrue(::Assets::MainFileSystem::TryOpen(file, filename, "wb") == ::Assets::IFileSystem::IOReason::Success);
+					file.Write(fileData.get(), 1, fileSize);
+				}
+
+				auto pool = Techniques::CreatePipelineAcceleratorPool();
+				pool->LoadPipelineCache(store);
+				Assert::AreEqual(0u, pool->GetMetrics()._cachedPipelineKeys);
+			}
+		}
+
 		TEST_METHOD(DescriptorSetAcceleratorConstruction)
 		{
 			{
@@ -0,0 +1,565 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#include "UnitTestHelper.h"
+#include "../ConsoleRig/AttachablePtr.h"
+#include "../SceneEngine/PlacementsManager.h"
+#include "../SceneEngine/PlacementsInternal.h"
+#include "../SceneEngine/PlacementsQuadTree.h"
+#include "../RenderCore/Techniques/TechniqueUtils.h"
+#include "../RenderCore/Techniques/SimpleModelRenderer.h"
+#include "../Assets/DepVal.h"
+#include "../Assets/AssetFuture.h"
+#include "../Assets/IFileSystem.h"
+#include "../Math/ProjectionMath.h"
+#include "../Math/Transformations.h"
+#include "../Utility/Streams/FileUtils.h"
+#include "../Utility/MemoryUtils.h"
+#include <CppUnitTest.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <map>
+#include <set>
+
+namespace UnitTests
+{
+    using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+    using namespace SceneEngine;
+
+    static const char* s_testModels[] = { "game/model/tree.dae", "game/model/rock.dae", "game/model/bush.dae" };
+    static const char* s_testMaterials[] = { "game/model/summer.material", "game/model/winter.material" };
+
+        // Objects scattered over a 100x100 cell, with a few models & materials and a mix
+        // of supplements (including objects without any)
+    static std::unique_ptr<DynamicPlacements> MakeTestPlacements(unsigned count, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> position(0.f, 100.f);
+        std::uniform_real_distribution<float> size(.5f, 5.f);
+        auto result = std::make_unique<DynamicPlacements>();
+        for (unsigned c=0; c<count; ++c) {
+            Float3 center { position(rng), position(rng), .1f * position(rng) };
+            Float3 halfSize { size(rng), size(rng), size(rng) };
+            const uint64_t supplements[] = { 0x100 + c%5, 0x200 + c%3 };
+            result->AddPlacement(
+                AsFloat3x4(center), std::make_pair(center - halfSize, center + halfSize),
+                MakeStringSection(s_testModels[c%dimof(s_testModels)]),
+                MakeStringSection(s_testMaterials[(c/7)%dimof(s_testMaterials)]),
+                MakeIteratorRange(supplements, &supplements[(c/3)%3]),
+                1000 + c*7919);
+        }
+        return result;
+    }
+
+    static std::string GetFilename(const Placements& placements, unsigned offset)
+    {
+        return (const char*)PtrAdd(placements.GetFilenamesBuffer(), offset + sizeof(uint64_t));
+    }
+
+    static uint64_t GetFilenameHash(const Placements& placements, unsigned offset)
+    {
+        return *(const uint64_t*)PtrAdd(placements.GetFilenamesBuffer(), offset);
+    }
+
+    static std::vector<uint64_t> GetSupplements(const Placements& placements, unsigned offset)
+    {
+        if (!offset) return {};
+        const auto* s = placements.GetSupplementsBuffer() + offset;
+        return std::vector<uint64_t>(s+1, s+1+*s);
+    }
+
+        // The two sets of placements must have the same objects (found by GUID, since the
+        // streaming format changes the order), with the same names and supplements
+    static void AssertSamePlacements(const Placements& expected, const Placements& actual)
+    {
+        Assert::AreEqual(expected.GetObjectReferenceCount(), actual.GetObjectReferenceCount());
+        const auto* expectedBegin = expected.GetObjectReferences();
+        const auto* expectedEnd = expectedBegin + expected.GetObjectReferenceCount();
+        std::vector<bool> found(expected.GetObjectReferenceCount(), false);
+        for (unsigned c=0; c<actual.GetObjectReferenceCount(); ++c) {
+            const auto& a = actual.GetObjectReferences()[c];
+            auto e = std::find_if(expectedBegin, expectedEnd, [&a](const Placements::ObjectReference& o) { return o._guid == a._guid; });
+            Assert::IsTrue(e != expectedEnd);
+            Assert::IsFalse(found[e-expectedBegin]);
+            found[e-expectedBegin] = true;
+
+            Assert::IsTrue(!XlCompareMemory(&e->_localToCell, &a._localToCell, sizeof(a._localToCell)));
+            Assert::IsTrue(!XlCompareMemory(&e->_cellSpaceBoundary, &a._cellSpaceBoundary, sizeof(a._cellSpaceBoundary)));
+
+            auto modelName = GetFilename(actual, a._modelFilenameOffset);
+            auto materialName = GetFilename(actual, a._materialFilenameOffset);
+            Assert::AreEqual(GetFilename(expected, e->_modelFilenameOffset), modelName);
+            Assert::AreEqual(GetFilename(expected, e->_materialFilenameOffset), materialName);
+            Assert::AreEqual(Hash64(modelName), GetFilenameHash(actual, a._modelFilenameOffset));
+            Assert::AreEqual(Hash64(materialName), GetFilenameHash(actual, a._materialFilenameOffset));
+            Assert::IsTrue(GetSupplements(expected, e->_supplementsOffset) == GetSupplements(actual, a._supplementsOffset));
+        }
+    }
+
+    static bool TryBindStreamingChunk(const std::vector<uint8_t>& chunk)
+    {
+        try {
+            StreamingPlacements placements(
+                MakeIteratorRange(AsPointer(chunk.cbegin()), AsPointer(chunk.cend())),
+                std::make_shared<::Assets::DependencyValidation>());
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+    static Placements::ObjectReference* GetChunkObjects(std::vector<uint8_t>& chunk)
+    {
+        const auto& hdr = *(const StreamingPlacementsHeader*)AsPointer(chunk.begin());
+        return (Placements::ObjectReference*)&chunk[hdr._objectsOffset];
+    }
+
+        // Checks the handles for a cell against the names in the table, and that the objects are
+        // grouped by handle. Returns the handle for each model/material pair
+    static std::map<std::pair<std::string, std::string>, unsigned> CheckCellHandles(
+        const PlacementsModelTable& table, const PlacementsModelTable::CellHandles& handles, const Placements& placements)
+    {
+        auto count = placements.GetObjectReferenceCount();
+        Assert::AreEqual(handles._objectHandles.size(), size_t(count));
+        Assert::AreEqual(handles._tableId, table.GetTableId());
+
+        std::map<std::pair<std::string, std::string>, unsigned> result;
+        std::vector<bool> drawn(count, false);
+        for (unsigned d=0; d<count; ++d) {
+            auto objectIndex = handles.GetObjectIndex(d);
+            Assert::IsTrue(objectIndex < count && !drawn[objectIndex]);
+            drawn[objectIndex] = true;
+
+            const auto& obj = placements.GetObjectReferences()[objectIndex];
+            const auto& entry = table.GetEntry(handles._objectHandles[d]);
+            auto names = std::make_pair(GetFilename(placements, obj._modelFilenameOffset), GetFilename(placements, obj._materialFilenameOffset));
+            Assert::AreEqual(entry._modelName, names.first);
+            Assert::AreEqual(entry._materialName, names.second);
+            auto i = result.insert(std::make_pair(names, handles._objectHandles[d])).first;
+            Assert::AreEqual(i->second, handles._objectHandles[d]);
+
+                // each handle is a single contiguous run of draw indices
+            if (d != 0 && handles._objectHandles[d] != handles._objectHandles[d-1])
+                Assert::IsTrue(std::find(handles._objectHandles.begin(), handles._objectHandles.begin()+d, handles._objectHandles[d]) == handles._objectHandles.begin()+d);
+        }
+
+        std::vector<unsigned> uniqueHandles;
+        for (const auto& r:result) uniqueHandles.push_back(r.second);
+        std::sort(uniqueHandles.begin(), uniqueHandles.end());
+        Assert::IsTrue(uniqueHandles == handles._uniqueHandles);
+        return result;
+    }
+
+    TEST_CLASS(PlacementsTests)
+    {
+    public:
+        TEST_METHOD(StreamingPlacementsRoundTrip)
+        {
+            std::mt19937 rng(8934);
+            const unsigned objectCount = 2000;
+            auto placements = MakeTestPlacements(objectCount, rng);
+            auto chunk = BuildStreamingPlacementsChunk(*placements);
+            StreamingPlacements streaming(
+                MakeIteratorRange(AsPointer(chunk.cbegin()), AsPointer(chunk.cend())),
+                std::make_shared<::Assets::DependencyValidation>());
+            Assert::AreEqual(streaming.GetResidentSize(), chunk.size());
+            AssertSamePlacements(*placements, streaming);
+
+                // Objects are grouped by model & material (the order the renderer draws them in)
+            const auto* objects = streaming.GetObjectReferences();
+            for (unsigned c=1; c<objectCount; ++c) {
+                auto prev = std::make_tuple(GetFilenameHash(streaming, objects[c-1]._modelFilenameOffset), GetFilenameHash(streaming, objects[c-1]._materialFilenameOffset), objects[c-1]._guid);
+                auto next = std::make_tuple(GetFilenameHash(streaming, objects[c]._modelFilenameOffset), GetFilenameHash(streaming, objects[c]._materialFilenameOffset), objects[c]._guid);
+                Assert::IsTrue(prev < next);
+            }
+
+                // The prebuilt quad tree must find the same objects as a tree built from the
+                // original placements
+            PlacementsQuadTree reference(
+                &placements->GetObjectReferences()[0]._cellSpaceBoundary,
+                sizeof(Placements::ObjectReference), objectCount);
+            const auto& quadTree = streaming.GetQuadTree();
+            Assert::AreEqual(quadTree.GetMaxResults(), objectCount);
+
+            std::uniform_real_distribution<float> dist(-1.f, 1.f);
+            auto clipSpaceType = RenderCore::Techniques::GetDefaultClipSpaceType();
+            std::vector<Float4x4> views;
+            for (unsigned v=0; v<8; ++v) {
+                auto cameraToWorld = MakeCameraToWorld(
+                    Normalize(Float3{dist(rng), dist(rng), -.5f}), Float3{0.f, 0.f, 1.f},
+                    Float3{50.f + 50.f * dist(rng), 50.f + 50.f * dist(rng), 30.f});
+                views.push_back(Combine(
+                    InvertOrthonormalTransform(cameraToWorld),
+                    PerspectiveProjection(Deg2Rad(60.f), 1.f, 0.1f, 500.f, GeometricCoordinateSpace::RightHanded, clipSpaceType)));
+            }
+
+            std::vector<unsigned> expected(objectCount), actual(objectCount);
+            unsigned totalVisible = 0;
+            for (const auto& view:views) {
+                unsigned expectedCount = 0, actualCount = 0;
+                Assert::IsTrue(reference.CalculateVisibleObjects(view, expected.data(), expectedCount, objectCount, 0));
+                Assert::IsTrue(quadTree.CalculateVisibleObjects(view, actual.data(), actualCount, objectCount, 0));
+
+                std::vector<uint64_t> expectedGuids, actualGuids;
+                for (unsigned c=0; c<expectedCount; ++c) expectedGuids.push_back(placements->GetObjectReferences()[expected[c]]._guid);
+                for (unsigned c=0; c<actualCount; ++c) actualGuids.push_back(objects[actual[c]]._guid);
+                std::sort(expectedGuids.begin(), expectedGuids.end());
+                std::sort(actualGuids.begin(), actualGuids.end());
+                Assert::IsTrue(expectedGuids == actualGuids);
+                totalVisible += actualCount;
+            }
+            Assert::IsTrue(totalVisible != 0);
+        }
+
+        TEST_METHOD(StreamingPlacementsRejectsBadChunks)
+        {
+            std::mt19937 rng(2271);
+            const unsigned objectCount = 200;
+            auto placements = MakeTestPlacements(objectCount, rng);
+            const auto chunk = BuildStreamingPlacementsChunk(*placements);
+            const auto& hdr = *(const StreamingPlacementsHeader*)AsPointer(chunk.begin());
+            Assert::IsTrue(TryBindStreamingChunk(chunk));
+
+            const auto* objects = (const Placements::ObjectReference*)&chunk[hdr._objectsOffset];
+            unsigned withSupplements = 0;
+            while (withSupplements < objectCount && !objects[withSupplements]._supplementsOffset)
+                ++withSupplements;
+            Assert::IsTrue(withSupplements < objectCount);
+
+                // Filename offsets beyond the end of the string table
+            auto corrupt = chunk;
+            GetChunkObjects(corrupt)[5]._modelFilenameOffset = hdr._filenamesSize;
+            Assert::IsFalse(TryBindStreamingChunk(corrupt));
+
+            corrupt = chunk;
+            GetChunkObjects(corrupt)[objectCount-1]._materialFilenameOffset = hdr._filenamesSize - 8;
+            Assert::IsFalse(TryBindStreamingChunk(corrupt));
+
+                // Filename offsets that aren't 8 byte aligned (the hashes are read directly)
+            corrupt = chunk;
+            GetChunkObjects(corrupt)[0]._materialFilenameOffset += 4;
+            Assert::IsFalse(TryBindStreamingChunk(corrupt));
+
+                // Supplements offset past the end of the supplements buffer
+            corrupt = chunk;
+            GetChunkObjects(corrupt)[withSupplements]._supplementsOffset = hdr._supplementsCount;
+            Assert::IsFalse(TryBindStreamingChunk(corrupt));
+
+                // Supplements count that runs past the end of the buffer (including one large
+                // enough to wrap around when added to the offset)
+            for (uint64_t badCount:{ uint64_t(hdr._supplementsCount), ~uint64_t(0) }) {
+                corrupt = chunk;
+                auto offset = GetChunkObjects(corrupt)[withSupplements]._supplementsOffset;
+                *(uint64_t*)&corrupt[hdr._supplementsOffset + offset * sizeof(uint64_t)] = badCount;
+                Assert::IsFalse(TryBindStreamingChunk(corrupt));
+            }
+
+                // Sections in the header that extend beyond the chunk
+            corrupt = chunk;
+            ((StreamingPlacementsHeader*)AsPointer(corrupt.begin()))->_supplementsCount = ~0u;
+            Assert::IsFalse(TryBindStreamingChunk(corrupt));
+
+            corrupt = chunk;
+            ((StreamingPlacementsHeader*)AsPointer(corrupt.begin()))->_filenamesOffset += 8;
+            Assert::IsFalse(TryBindStreamingChunk(corrupt));
+
+            corrupt = chunk;
+            corrupt.resize(corrupt.size()-1);
+            Assert::IsFalse(TryBindStreamingChunk(corrupt));
+        }
+
+        TEST_METHOD(ModelTableHandles)
+        {
+            std::mt19937 rng(1287);
+            auto cellA = MakeTestPlacements(400, rng);
+            auto cellB = MakeTestPlacements(250, rng);
+            auto chunk = BuildStreamingPlacementsChunk(*cellB);
+            StreamingPlacements streamingB(
+                MakeIteratorRange(AsPointer(chunk.cbegin()), AsPointer(chunk.cend())),
+                std::make_shared<::Assets::DependencyValidation>());
+
+            PlacementsModelTable table;
+            PlacementsModelTable::CellHandles handlesA, handlesB, handlesStreamingB;
+            table.BuildCellHandles(handlesA, *cellA, true);
+            table.BuildCellHandles(handlesB, *cellB, true);
+            table.BuildCellHandles(handlesStreamingB, streamingB, false);
+
+                // Every model/material pair gets one handle, shared by all of the cells that use it
+            auto pairsA = CheckCellHandles(table, handlesA, *cellA);
+            auto pairsB = CheckCellHandles(table, handlesB, *cellB);
+            auto pairsStreamingB = CheckCellHandles(table, handlesStreamingB, streamingB);
+            Assert::AreEqual(pairsA.size(), dimof(s_testModels) * dimof(s_testMaterials));
+            Assert::IsTrue(pairsA == pairsB);
+            Assert::IsTrue(pairsA == pairsStreamingB);
+
+                // The dynamic placements are in GUID order, so they're sorted into draw order. The
+                // sort is stable (objects with the same model keep their order). The streaming
+                // cell is already in draw order
+            Assert::AreEqual(handlesA._drawOrder.size(), size_t(cellA->GetObjectReferenceCount()));
+            Assert::IsFalse(std::is_sorted(handlesA._drawOrder.begin(), handlesA._drawOrder.end()));
+            Assert::IsTrue(std::is_sorted(handlesA._objectHandles.begin(), handlesA._objectHandles.end()));
+            for (unsigned d=1; d<handlesA._drawOrder.size(); ++d)
+                if (handlesA._objectHandles[d] == handlesA._objectHandles[d-1])
+                    Assert::IsTrue(handlesA._drawOrder[d-1] < handlesA._drawOrder[d]);
+            Assert::IsTrue(handlesStreamingB._drawOrder.empty());
+
+                // Building the handles again gives the same result
+            PlacementsModelTable::CellHandles handlesA2;
+            table.BuildCellHandles(handlesA2, *cellA, true);
+            Assert::IsTrue(handlesA2._objectHandles == handlesA._objectHandles && handlesA2._drawOrder == handlesA._drawOrder);
+
+                // Handles from another table can be recognised (they must be built again)
+            PlacementsModelTable otherTable;
+            Assert::AreNotEqual(otherTable.GetTableId(), table.GetTableId());
+        }
+
+        TEST_METHOD(ModelTableRendererLifetime)
+        {
+            std::mt19937 rng(5521);
+            auto cellA = MakeTestPlacements(300, rng);
+            auto cellB = MakeTestPlacements(100, rng);
+            DynamicPlacements singleModel;
+            for (unsigned c=0; c<10; ++c) {
+                Float3 center { 10.f * c, 0.f, 0.f };
+                singleModel.AddPlacement(
+                    AsFloat3x4(center), std::make_pair(center - Float3{1.f, 1.f, 1.f}, center + Float3{1.f, 1.f, 1.f}),
+                    MakeStringSection(s_testModels[0]), MakeStringSection(s_testMaterials[0]), {}, 50 + c);
+            }
+
+            PlacementsModelTable table;
+            PlacementsModelTable::CellHandles handlesA, handlesB, handlesSingle;
+            table.BuildCellHandles(handlesA, *cellA, true);
+            table.BuildCellHandles(handlesB, *cellB, true);
+            table.BuildCellHandles(handlesSingle, singleModel, true);
+            Assert::AreEqual(handlesSingle._uniqueHandles.size(), size_t(1));
+            auto singleHandle = handlesSingle._uniqueHandles[0];
+
+            using RendererFuture = ::Assets::AssetFuture<RenderCore::Techniques::SimpleModelRenderer>;
+            unsigned factoryCalls = 0;
+            auto factory = [&factoryCalls](StringSection<::Assets::ResChar> modelName, StringSection<::Assets::ResChar> materialName) {
+                ++factoryCalls;
+                return std::make_shared<RendererFuture>(modelName.AsString() + ":" + materialName.AsString());
+            };
+
+                // Each model is looked up once, no matter how many cells use it
+            table.BeginBuild();
+            table.UpdateRenderers(handlesA, factory);
+            table.UpdateRenderers(handlesB, factory);
+            table.UpdateRenderers(handlesSingle, factory);
+            Assert::AreEqual(factoryCalls, unsigned(handlesA._uniqueHandles.size()));
+            std::vector<std::shared_ptr<RendererFuture>> renderers;
+            for (auto h:handlesA._uniqueHandles) {
+                Assert::IsNotNull(table.GetEntry(h)._renderer.get());
+                renderers.push_back(table.GetEntry(h)._renderer);
+            }
+
+                // Renderers that aren't used are kept for s_releaseBuilds builds...
+            for (unsigned b=0; b<PlacementsModelTable::s_releaseBuilds; ++b) {
+                table.BeginBuild();
+                table.UpdateRenderers(handlesSingle, factory);
+            }
+            for (unsigned c=0; c<handlesA._uniqueHandles.size(); ++c)
+                Assert::IsTrue(table.GetEntry(handlesA._uniqueHandles[c])._renderer == renderers[c]);
+
+                // ... and then released (but the one that's still in use is kept)
+            table.BeginBuild();
+            table.UpdateRenderers(handlesSingle, factory);
+            for (unsigned c=0; c<handlesA._uniqueHandles.size(); ++c) {
+                auto h = handlesA._uniqueHandles[c];
+                if (h == singleHandle) {
+                    Assert::IsTrue(table.GetEntry(h)._renderer == renderers[c]);
+                } else {
+                    Assert::IsNull(table.GetEntry(h)._renderer.get());
+                }
+            }
+            Assert::AreEqual(factoryCalls, unsigned(handlesA._uniqueHandles.size()));
+
+                // Released renderers are looked up again the next time they're used
+            table.BeginBuild();
+            table.UpdateRenderers(handlesB, factory);
+            Assert::AreEqual(factoryCalls, unsigned(2*handlesA._uniqueHandles.size() - 1));
+            for (auto h:handlesA._uniqueHandles)
+                Assert::IsNotNull(table.GetEntry(h)._renderer.get());
+        }
+
+        TEST_METHOD(VisiblePlacementsGuidFilter)
+        {
+            std::mt19937 rng(9013);
+            auto placements = MakeTestPlacements(600, rng);
+            auto chunk = BuildStreamingPlacementsChunk(*placements);
+            StreamingPlacements streaming(
+                MakeIteratorRange(AsPointer(chunk.cbegin()), AsPointer(chunk.cend())),
+                std::make_shared<::Assets::DependencyValidation>());
+
+                // The filter is sorted by GUID, and includes some GUIDs that aren't in the cell
+            std::vector<uint64_t> filter { 1, ~uint64_t(0) };
+            for (unsigned c=0; c<placements->GetObjectReferenceCount(); c+=5)
+                filter.push_back(placements->GetObjectReferences()[c]._guid);
+            std::shuffle(filter.begin(), filter.end(), rng);
+            std::sort(filter.begin(), filter.end());
+            std::set<uint64_t> filterSet(filter.begin(), filter.end());
+
+                // Both with the objects sorted into draw order by the handles, and with
+                // objects that are already in draw order. Neither is in GUID order
+            PlacementsModelTable table;
+            const Placements* cells[] = { placements.get(), &streaming };
+            for (auto* cell:cells) {
+                PlacementsModelTable::CellHandles handles;
+                table.BuildCellHandles(handles, *cell, cell == placements.get());
+
+                std::vector<VisiblePlacement> visible, expected;
+                for (unsigned d=0; d<cell->GetObjectReferenceCount(); ++d) {
+                    if ((d%4) == 3) continue;
+                    visible.push_back(std::make_pair(d, 1ull << uint64_t(d%3)));
+                    if (filterSet.find(cell->GetObjectReferences()[handles.GetObjectIndex(d)]._guid) != filterSet.end())
+                        expected.push_back(visible.back());
+                }
+                Assert::IsTrue(!expected.empty() && expected.size() < visible.size());
+
+                FilterVisiblePlacements(visible, *cell, handles, MakeIteratorRange(filter));
+                Assert::IsTrue(visible == expected);
+            }
+        }
+
+        TEST_METHOD(ResidencyManagerBudgetAndDistance)
+        {
+            auto cfg = GetStartupConfig();
+            cfg._longTaskThreadPoolCount = 2;       // (cells are loaded on the long task pool)
+            auto globalServices = ConsoleRig::MakeAttachablePtr<ConsoleRig::GlobalServices>(cfg);
+            RawFS::CreateDirectoryRecursive(u("int/unittests/placements"));
+
+                // A row of cells along X, each 100 units wide. They are listed out of order in
+                // the configuration (so the load order comes from the distance, not the list)
+            std::mt19937 rng(6123);
+            const unsigned cellCount = 5;
+            const unsigned configOrder[] = { 3, 0, 4, 1, 2 };
+            std::vector<std::string> filenames;
+            std::vector<uint64_t> filenameHashes;
+            std::vector<size_t> cellSizes;
+            for (unsigned c=0; c<cellCount; ++c) {
+                filenames.push_back("int/unittests/placements/cell" + std::to_string(c) + ".plcs");
+                filenameHashes.push_back(Hash64(filenames[c]));
+                auto placements = MakeTestPlacements(300, rng);
+                placements->WriteStreaming(filenames[c].c_str());
+                cellSizes.push_back(BuildStreamingPlacementsChunk(*placements).size());
+            }
+
+            WorldPlacementsConfig worldCfg;
+            for (auto c:configOrder) {
+                WorldPlacementsConfig::Cell cell;
+                cell._offset = Float3{c * 100.f, 0.f, 0.f};
+                cell._mins = Float3{0.f, 0.f, -100.f};
+                cell._maxs = Float3{100.f, 100.f, 100.f};
+                XlCopyString(cell._file, filenames[c].c_str());
+                worldCfg._cells.push_back(cell);
+            }
+            PlacementCellSet cellSet(worldCfg, Float3{0.f, 0.f, 0.f});
+
+                // Room for the 3 closest cells (but not 4)
+            PlacementsResidencyManager::Config config;
+            config._memoryBudget = cellSizes[0] + cellSizes[1] + cellSizes[2] + cellSizes[3]/2;
+            config._loadDistance = 450.f;
+            config._releaseDistance = 650.f;
+            config._maxPendingLoads = 1;
+            PlacementsResidencyManager residency(config);
+
+            std::vector<unsigned> loadOrder;
+            auto settle = [&](const Float3& cameraPosition) {
+                for (unsigned i=0; i<10000; ++i) {
+                    residency.Update(cellSet, cameraPosition);
+                    auto metrics = residency.GetMetrics();
+                    Assert::IsTrue(metrics._residentBytes <= config._memoryBudget);
+                    for (const auto& c:residency._pimpl->_cells)
+                        if (c.second._pendingLoad) {
+                            auto cellIndex = unsigned(std::find(filenameHashes.begin(), filenameHashes.end(), c.first) - filenameHashes.begin());
+                            if (loadOrder.empty() || loadOrder.back() != cellIndex)
+                                loadOrder.push_back(cellIndex);
+                        }
+                    if (!metrics._pendingLoads) return;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                Assert::Fail(L"Placement cell loads did not complete");
+            };
+            auto isResident = [&](unsigned cellIndex) { return residency._pimpl->GetResidentCell(filenameHashes[cellIndex]) != nullptr; };
+
+                // From inside the first cell, every cell is within the load distance. They are
+                // loaded closest first; the 4th goes over the budget and is released again. Since
+                // it's now known not to fit, neither it nor anything further away is loaded while
+                // the closer cells are resident
+            settle(Float3{50.f, 50.f, 0.f});
+            Assert::IsTrue(loadOrder == std::vector<unsigned>{0, 1, 2, 3});
+            auto metrics = residency.GetMetrics();
+            Assert::AreEqual(metrics._residentCells, 3u);
+            Assert::AreEqual(metrics._residentBytes, cellSizes[0] + cellSizes[1] + cellSizes[2]);
+            Assert::AreEqual(metrics._loadsCompleted, 4u);
+            Assert::AreEqual(metrics._loadsFailed, 0u);
+            Assert::AreEqual(metrics._releases, 1u);
+            Assert::IsTrue(isResident(0) && isResident(1) && isResident(2));
+            settle(Float3{50.f, 50.f, 0.f});
+            Assert::AreEqual(residency.GetMetrics()._loadsCompleted, 4u);
+
+                // Cells beyond the load distance, but within the release distance, stay resident
+            settle(Float3{-300.f, 50.f, 0.f});
+            metrics = residency.GetMetrics();
+            Assert::AreEqual(metrics._residentCells, 3u);
+            Assert::AreEqual(metrics._releases, 1u);
+
+                // ... until they pass the release distance
+            settle(Float3{-500.f, 50.f, 0.f});
+            metrics = residency.GetMetrics();
+            Assert::IsTrue(isResident(0) && isResident(1) && !isResident(2));
+            Assert::AreEqual(metrics._residentCells, 2u);
+            Assert::AreEqual(metrics._residentBytes, cellSizes[0] + cellSizes[1]);
+            Assert::AreEqual(metrics._releases, 2u);
+            Assert::AreEqual(metrics._loadsCompleted, 4u);
+
+            settle(Float3{-5000.f, 50.f, 0.f});
+            Assert::AreEqual(residency.GetMetrics()._residentCells, 0u);
+            Assert::AreEqual(residency.GetMetrics()._residentBytes, size_t(0));
+
+            for (const auto& f:filenames)
+                XlDeleteFile((const utf8*)f.c_str());
+        }
+
+        TEST_METHOD(EditorWriteStreamingCell)
+        {
+            auto globalServices = ConsoleRig::MakeAttachablePtr<ConsoleRig::GlobalServices>(GetStartupConfig());
+            RawFS::CreateDirectoryRecursive(u("int/unittests/placements"));
+            const char filename[] = "int/unittests/placements/editorcell.plcs";
+
+            auto cellSet = std::make_shared<PlacementCellSet>(WorldPlacementsConfig(), Float3{0.f, 0.f, 0.f});
+            PlacementsEditor editor(cellSet, nullptr, std::make_shared<PlacementsCache>(), nullptr);
+            auto cellId = editor.CreateCell("[editorcell]", Float2{0.f, 0.f}, Float2{100.f, 100.f});
+
+            std::mt19937 rng(4410);
+            std::shared_ptr<DynamicPlacements> placements = MakeTestPlacements(500, rng);
+            cellSet->_pimpl->SetOverride(cellId, placements);
+            editor.WriteStreamingCell(cellId, filename);
+
+                // Loads the same way as the residency manager does (used in place, from the
+                // memory mapped file)
+            PlacementsResidencyManager::Pimpl::PendingLoad load;
+            PlacementsResidencyManager::Pimpl::LoadCell(load, filename);
+            Assert::IsNotNull(load._result.get());
+            AssertSamePlacements(*placements, *load._result);
+            Assert::AreEqual(load._result->GetResidentSize(), BuildStreamingPlacementsChunk(*placements).size());
+            load._result.reset();
+
+                // Unknown cells are an error
+            bool caughtException = false;
+            try {
+                editor.WriteStreamingCell(cellId+1, filename);
+            } catch (const std::exception&) {
+                caughtException = true;
+            }
+            Assert::IsTrue(caughtException);
+
+            XlDeleteFile((const utf8*)filename);
+        }
+    };
+}
@@ -0,0 +1,292 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#include "UnitTestHelper.h"
+#include "../RenderCore/Techniques/SkinDeformer.h"
+#include "../RenderCore/Techniques/SimpleModelDeform.h"
+#include "../Math/Transformations.h"
+#include "../Utility/Threading/CompletionThreadPool.h"
+#include <CppUnitTest.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <set>
+
+namespace UnitTests
+{
+    using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+    struct SkinningTestData
+    {
+        std::vector<Float3> _srcPositions, _srcNormals;
+        std::vector<Float4> _srcTangents;
+        std::vector<float> _weights;
+        std::vector<unsigned> _jointIndices;
+        std::vector<Float3x4> _joints;
+        static const unsigned s_influenceStride = 4;
+
+        SkinningTestData(unsigned vertexCount, unsigned jointCount, unsigned influenceCount)
+        {
+            std::mt19937 rng(vertexCount + influenceCount);
+            std::uniform_real_distribution<float> dist(-1.f, 1.f);
+            std::uniform_int_distribution<unsigned> jointDist(0, jointCount-1);
+
+            for (unsigned c=0; c<jointCount; ++c) {
+                auto rotation = MakeRotationMatrix(Normalize(Float3{dist(rng), dist(rng), dist(rng)+2.f}), dist(rng) * 3.f);
+                Float3x4 joint;
+                for (unsigned r=0; r<3; ++r) {
+                    for (unsigned q=0; q<3; ++q) joint(r, q) = rotation(r, q);
+                    joint(r, 3) = dist(rng) * 10.f;
+                }
+                _joints.push_back(joint);
+            }
+
+            for (unsigned v=0; v<vertexCount; ++v) {
+                _srcPositions.push_back(Float3{dist(rng), dist(rng), dist(rng)} * 5.f);
+                _srcNormals.push_back(Normalize(Float3{dist(rng), dist(rng), dist(rng)+2.f}));
+                _srcTangents.push_back(Expand(Normalize(Float3{dist(rng)+2.f, dist(rng), dist(rng)}), (v&1) ? 1.f : -1.f));
+
+                float totalWeight = 0.f;
+                for (unsigned b=0; b<s_influenceStride; ++b) {
+                    float w = (b < influenceCount) ? (dist(rng) + 1.1f) : 0.f;
+                    _weights.push_back(w);
+                    _jointIndices.push_back(jointDist(rng));
+                    totalWeight += w;
+                }
+                for (unsigned b=0; b<s_influenceStride; ++b)
+                    _weights[v*s_influenceStride+b] /= totalWeight;
+            }
+        }
+    };
+
+        // The original one-vertex-at-a-time implementation (positions only), for comparison
+    static void SkinPositions_Reference(
+        std::vector<Float3>& dst, const SkinningTestData& data, unsigned influenceCount)
+    {
+        auto srcJointWeight = data._weights.begin();
+        auto srcJointIndex = data._jointIndices.begin();
+        for (unsigned v=0; v<dst.size(); ++v, srcJointWeight+=SkinningTestData::s_influenceStride, srcJointIndex+=SkinningTestData::s_influenceStride) {
+            Float3 deformedPosition { 0.f, 0.f, 0.f };
+            for (unsigned b=0; b<influenceCount; ++b)
+                deformedPosition += srcJointWeight[b] * TransformPoint(data._joints[srcJointIndex[b]], data._srcPositions[v]);
+            dst[v] = deformedPosition;
+        }
+    }
+
+    static RenderCore::Techniques::Internal::SkinningStream MakeStream(const void* src, void* dst, size_t stride)
+    {
+        return RenderCore::Techniques::Internal::SkinningStream { src, dst, stride, stride };
+    }
+
+        // Applies a function to one float element per vertex, and records when (and on which thread) it ran
+    class FakeDeformOp : public RenderCore::Techniques::IDeformOperation
+    {
+    public:
+        std::function<float(float)> _fn;
+        unsigned _vertexCount = 0;
+        std::atomic<unsigned>* _clock = nullptr;
+        mutable unsigned _startTime = 0, _endTime = 0;
+        mutable std::thread::id _thread;
+
+        void Execute(
+            IteratorRange<const VertexElementRange*> sourceElements,
+            IteratorRange<const VertexElementRange*> destinationElements) const override
+        {
+            _startTime = (*_clock)++;
+            _thread = std::this_thread::get_id();
+            auto src = sourceElements[0].begin(), dst = destinationElements[0].begin();
+            for (unsigned v=0; v<_vertexCount; ++v) {
+                *(float*)PtrAdd(dst._data.begin(), v*dst._stride) = _fn(*(const float*)PtrAdd(src._data.begin(), v*src._stride));
+                std::this_thread::yield();      // (give any other op in flight a chance to interleave)
+            }
+            _endTime = (*_clock)++;
+        }
+    };
+
+    TEST_CLASS(SkinningTests)
+    {
+    public:
+        TEST_METHOD(SkinningKernel)
+        {
+            const unsigned vertexCount = 1027;      // (not a multiple of 4, so the tail is exercised)
+            const unsigned influenceCounts[] = { 1, 2, 3, 4 };
+            for (auto influenceCount:influenceCounts) {
+                SkinningTestData data(vertexCount, 48, influenceCount);
+
+                std::vector<Float3> positions(vertexCount), normals(vertexCount), reference(vertexCount);
+                std::vector<Float4> tangents(vertexCount);
+                RenderCore::Techniques::Internal::SkinningStreams streams;
+                streams._positions = MakeStream(data._srcPositions.data(), positions.data(), sizeof(Float3));
+                streams._normals = MakeStream(data._srcNormals.data(), normals.data(), sizeof(Float3));
+                streams._tangents = MakeStream(data._srcTangents.data(), tangents.data(), sizeof(Float4));
+                RenderCore::Techniques::Internal::SkinVertices(
+                    streams, 0, vertexCount, influenceCount, SkinningTestData::s_influenceStride,
+                    data._weights.data(), data._jointIndices.data(), MakeIteratorRange(data._joints));
+
+                SkinPositions_Reference(reference, data, influenceCount);
+                for (unsigned v=0; v<vertexCount; ++v) {
+                    Assert::IsTrue(Equivalent(positions[v], reference[v], 1e-3f));
+
+                    Float3x4 blended = data._weights[v*4] * data._joints[data._jointIndices[v*4]];
+                    for (unsigned b=1; b<influenceCount; ++b)
+                        blended += data._weights[v*4+b] * data._joints[data._jointIndices[v*4+b]];
+                    Assert::IsTrue(Equivalent(normals[v], Normalize(TransformDirectionVector(blended, data._srcNormals[v])), 1e-3f));
+                    Assert::IsTrue(Equivalent(Truncate(tangents[v]), Normalize(TransformDirectionVector(blended, Truncate(data._srcTangents[v]))), 1e-3f));
+                    Assert::AreEqual(tangents[v][3], data._srcTangents[v][3]);
+                }
+            }
+
+            // No influences just copies the source data
+            SkinningTestData data(64, 4, 1);
+            std::vector<Float3> positions(64);
+            RenderCore::Techniques::Internal::SkinningStreams streams;
+            streams._positions = MakeStream(data._srcPositions.data(), positions.data(), sizeof(Float3));
+            RenderCore::Techniques::Internal::SkinVertices(streams, 0, 64, 0, SkinningTestData::s_influenceStride, data._weights.data(), data._jointIndices.data(), MakeIteratorRange(data._joints));
+            for (unsigned v=0; v<64; ++v)
+                Assert::IsTrue(positions[v] == data._srcPositions[v]);
+        }
+
+        TEST_METHOD(SkinningKernelSubRangesAndInterleaving)
+        {
+                // Skin into an interleaved buffer (position, normal, then some padding that must
+                // never be written), in several pieces that don't start on a multiple of 4 vertices
+            const unsigned vertexCount = 259;
+            const unsigned influenceCounts[] = { 1, 2, 4 };
+            const float sentinel = -12345.f;
+            struct InterleavedVertex { Float3 _position; Float3 _normal; float _padding[2]; };
+            for (auto influenceCount:influenceCounts) {
+                SkinningTestData data(vertexCount, 16, influenceCount);
+                std::vector<Float3> reference(vertexCount);
+                SkinPositions_Reference(reference, data, influenceCount);
+
+                InterleavedVertex init;
+                init._position = init._normal = Float3{sentinel, sentinel, sentinel};
+                init._padding[0] = init._padding[1] = sentinel;
+                std::vector<InterleavedVertex> dst(vertexCount, init);
+
+                RenderCore::Techniques::Internal::SkinningStreams streams;
+                streams._positions = { data._srcPositions.data(), &dst[0]._position, sizeof(Float3), sizeof(InterleavedVertex) };
+                streams._normals = { data._srcNormals.data(), &dst[0]._normal, sizeof(Float3), sizeof(InterleavedVertex) };
+
+                const std::pair<unsigned, unsigned> ranges[] = { {1, 6}, {7, 3}, {10, 200}, {213, 45} };     // (vertices 0, 210-212 and 258 are skipped)
+                for (const auto& r:ranges)
+                    RenderCore::Techniques::Internal::SkinVertices(
+                        streams, r.first, r.second, influenceCount, SkinningTestData::s_influenceStride,
+                        data._weights.data(), data._jointIndices.data(), MakeIteratorRange(data._joints));
+
+                for (unsigned v=0; v<vertexCount; ++v) {
+                    bool skinned = std::any_of(std::begin(ranges), std::end(ranges), [v](const std::pair<unsigned, unsigned>& r) { return v >= r.first && v < r.first+r.second; });
+                    if (skinned) {
+                        Assert::IsTrue(Equivalent(dst[v]._position, reference[v], 1e-3f));
+                        Float3x4 blended = data._weights[v*4] * data._joints[data._jointIndices[v*4]];
+                        for (unsigned b=1; b<influenceCount; ++b)
+                            blended += data._weights[v*4+b] * data._joints[data._jointIndices[v*4+b]];
+                        Assert::IsTrue(Equivalent(dst[v]._normal, Normalize(TransformDirectionVector(blended, data._srcNormals[v])), 1e-3f));
+                    } else {
+                        Assert::IsTrue(dst[v]._position == init._position && dst[v]._normal == init._normal);
+                    }
+                    Assert::AreEqual(dst[v]._padding[0], sentinel);
+                    Assert::AreEqual(dst[v]._padding[1], sentinel);
+                }
+            }
+        }
+
+        TEST_METHOD(DeformOpWaveScheduling)
+        {
+            using namespace RenderCore::Techniques::Internal;
+            const unsigned vertexCount = 64;
+            const unsigned elementSize = vertexCount * sizeof(float);
+            std::atomic<unsigned> clock(0);
+
+            std::vector<std::shared_ptr<UnitTests::FakeDeformOp>> fakeOps;
+            auto makeOp = [&](unsigned srcVB, unsigned srcOffset, unsigned dstVB, unsigned dstOffset, std::function<float(float)>&& fn) {
+                auto fakeOp = std::make_shared<UnitTests::FakeDeformOp>();
+                fakeOp->_fn = std::move(fn);
+                fakeOp->_vertexCount = vertexCount;
+                fakeOp->_clock = &clock;
+                fakeOps.push_back(fakeOp);
+                DeformOp result;
+                result._deformOp = fakeOp;
+                result._inputElements.push_back({RenderCore::Format::R32_FLOAT, srcOffset, sizeof(float), srcVB});
+                result._outputElements.push_back({RenderCore::Format::R32_FLOAT, dstOffset, sizeof(float), dstVB});
+                result._vertexCount = vertexCount;
+                return result;
+            };
+
+                // temporary buffer: A, B      post deform buffer: X, Y, Z
+            const unsigned A = 0, B = elementSize, X = 0, Y = elementSize, Z = 2*elementSize;
+            std::vector<DeformOp> deformOps {
+                makeOp(VB_StaticData, 0, VB_TemporaryDeform, A, [](float x) { return 2.f*x + 1.f; }),     // 0
+                makeOp(VB_StaticData, 0, VB_PostDeform, Y, [](float x) { return x + 10.f; }),             // 1: independent
+                makeOp(VB_TemporaryDeform, A, VB_PostDeform, X, [](float x) { return 3.f*x; }),           // 2: reads 0's output
+                makeOp(VB_StaticData, 0, VB_TemporaryDeform, A, [](float x) { return x - 5.f; }),         // 3: overwrites what 2 reads (and 0 wrote)
+                makeOp(VB_TemporaryDeform, A, VB_PostDeform, Z, [](float x) { return x*x; }),             // 4: reads 3's output
+                makeOp(VB_StaticData, 0, VB_TemporaryDeform, B, [](float x) { return -x; })               // 5: independent (neighbours A)
+            };
+
+            Assert::IsTrue(HasDeformHazard(deformOps[0], deformOps[2]));        // read after write
+            Assert::IsTrue(HasDeformHazard(deformOps[2], deformOps[3]));        // write after read
+            Assert::IsTrue(HasDeformHazard(deformOps[0], deformOps[3]));        // write after write
+            Assert::IsTrue(HasDeformHazard(deformOps[3], deformOps[4]));
+            Assert::IsFalse(HasDeformHazard(deformOps[0], deformOps[1]));       // both only read the static data
+            Assert::IsFalse(HasDeformHazard(deformOps[0], deformOps[5]));       // adjacent, but not overlapping
+            Assert::IsFalse(HasDeformHazard(deformOps[1], deformOps[2]));
+
+            std::vector<unsigned> schedule, waveBounds;
+            ScheduleDeformOps(schedule, waveBounds, MakeIteratorRange(deformOps));
+            Assert::IsTrue(schedule == std::vector<unsigned>{0, 1, 5, 2, 3, 4});
+            Assert::IsTrue(waveBounds == std::vector<unsigned>{0, 3, 4, 5, 6});
+
+            std::vector<float> staticData(vertexCount);
+            for (unsigned v=0; v<vertexCount; ++v) staticData[v] = float(v) - 17.f;
+
+            auto execute = [&](Utility::CompletionThreadPool* threadPool) {
+                std::vector<float> temporaryData(2*vertexCount, 0.f), postDeform(3*vertexCount, 0.f);
+                ExecuteDeformOpWaves(
+                    MakeIteratorRange(deformOps), MakeIteratorRange(schedule), MakeIteratorRange(waveBounds),
+                    MakeIteratorRange(staticData.data(), staticData.data() + staticData.size()),
+                    MakeIteratorRange(temporaryData.data(), temporaryData.data() + temporaryData.size()),
+                    MakeIteratorRange(postDeform.data(), postDeform.data() + postDeform.size()),
+                    threadPool);
+                temporaryData.insert(temporaryData.end(), postDeform.begin(), postDeform.end());
+                return temporaryData;
+            };
+
+            auto serial = execute(nullptr);
+            for (unsigned v=0; v<vertexCount; ++v) {
+                float x = staticData[v];
+                Assert::AreEqual(serial[v], x - 5.f);                           // A (as last written by 3)
+                Assert::AreEqual(serial[vertexCount+v], -x);                    // B
+                Assert::AreEqual(serial[2*vertexCount+v], 3.f*(2.f*x + 1.f));   // X
+                Assert::AreEqual(serial[3*vertexCount+v], x + 10.f);            // Y
+                Assert::AreEqual(serial[4*vertexCount+v], (x - 5.f)*(x - 5.f)); // Z
+            }
+
+            Utility::CompletionThreadPool threadPool(4);
+            for (unsigned iteration=0; iteration<32; ++iteration) {
+                auto parallel = execute(&threadPool);
+                Assert::IsTrue(parallel == serial);
+
+                    // Every op that depends on another must start after it has finished
+                for (unsigned later=0; later<deformOps.size(); ++later)
+                    for (unsigned earlier=0; earlier<later; ++earlier)
+                        if (HasDeformHazard(deformOps[earlier], deformOps[later]))
+                            Assert::IsTrue(fakeOps[earlier]->_endTime < fakeOps[later]->_startTime);
+
+                    // The first wave is split between the calling thread and the pool (when there's more than one hardware thread)
+                if (std::thread::hardware_concurrency() > 1) {
+                    std::set<std::thread::id> firstWaveThreads { fakeOps[0]->_thread, fakeOps[1]->_thread, fakeOps[5]->_thread };
+                    Assert::IsTrue(firstWaveThreads.size() > 1);
+                    Assert::IsTrue(firstWaveThreads.count(std::this_thread::get_id()) == 1);
+                }
+            }
+        }
+    };
+}
+
@@ -18,6 +18,11 @@
 #include "../ConsoleRig/Console.h"
 #include "../ConsoleRig/Log.h"
 #include "../ConsoleRig/AttachablePtr.h"
+#include "../Utility/Streams/PreprocessorInterpreter.h"
+#include "../Utility/Threading/Mutex.h"
+#include <thread>
+#include <atomic>
+#include <set>
 
 #if !defined(XC_TEST_ADAPTER)
     #include <CppUnitTest.h>
@@ -37,9 +42,28 @@ namespace UnitTests
 
 		return RenderCore::Techniques::MakeFilteredDefinesTable(
 			MakeIteratorRange(prefilteredList),
-			entry._selectorFiltering, {});
+			entry._selectorFiltering, PreprocessorExpressionTable{});
 	}
 
+	class CountingShaderVariationFactory : public RenderCore::Techniques::IShaderVariationFactory
+	{
+	public:
+		std::atomic<unsigned> _calls { 0 };
+		std::vector<std::string> _defines;
+		Threading::Mutex _definesLock;
+
+		::Assets::FuturePtr<RenderCore::Metal::ShaderProgram> MakeShaderVariation(StringSection<> defines)
+		{
+			++_calls;
+			{
+				ScopedLock(_definesLock);
+				_defines.push_back(defines.AsString());
+			}
+			std::this_thread::yield();		// (give any other thread looking up the same variation a chance to race us)
+			return std::make_shared<::Assets::AssetFuture<RenderCore::Metal::ShaderProgram>>(defines.AsString());
+		}
+	};
+
 	TEST_CLASS(TechniqueFileTests)
 	{
 	public:
@@ -130,6 +154,116 @@ namespace UnitTests
 				Assert::AreEqual(std::string{"SELECTOR_1=3;"}, test1);
 			}
 		}
+
+		TEST_METHOD(ShaderVariationSetRelevance)
+		{
+			using namespace RenderCore::Techniques;
+			ShaderSelectorFiltering techniqueFiltering;
+			techniqueFiltering.GenerateHash();
+
+			ParameterBox selectors { std::make_pair(u("SELECTOR_0"), "1") };
+			const ParameterBox* selectorList[] = { &selectors };
+
+			PreprocessorExpressionTable noRelevance;
+			PreprocessorExpressionTable relevant { SelectorRelevanceMap{{"SELECTOR_0", "1"}} };
+			PreprocessorExpressionTable notRelevant { SelectorRelevanceMap{{"SELECTOR_0", "0"}} };
+			Assert::AreNotEqual(relevant.GetHash(), notRelevant.GetHash());
+
+			UniqueShaderVariationSet variationSet;
+			CountingShaderVariationFactory factory;
+
+				// Without a relevance entry, the selector is filtered out
+			auto& v0 = variationSet.FindVariation(MakeIteratorRange(selectorList), techniqueFiltering, noRelevance, factory);
+			auto& v1 = variationSet.FindVariation(MakeIteratorRange(selectorList), techniqueFiltering, noRelevance, factory);
+			Assert::IsTrue(&v0 == &v1);
+
+				// A relevance entry that passes keeps it, and so we get a new variation
+			auto& v2 = variationSet.FindVariation(MakeIteratorRange(selectorList), techniqueFiltering, relevant, factory);
+			Assert::IsTrue(&v2 != &v0);
+
+				// A relevance entry that fails is a different input, but filters to the same variation as no entry
+			auto& v3 = variationSet.FindVariation(MakeIteratorRange(selectorList), techniqueFiltering, notRelevant, factory);
+			Assert::IsTrue(&v3 == &v0);
+
+			Assert::AreEqual(2u, factory._calls.load());
+			Assert::AreEqual(std::string{}, factory._defines[0]);
+			Assert::AreEqual(std::string{"SELECTOR_0=1;"}, factory._defines[1]);
+
+			auto metrics = variationSet.GetMetrics();
+			Assert::AreEqual(1u, metrics._filterHits);
+			Assert::AreEqual(3u, metrics._filterMisses);
+			Assert::AreEqual(2u, metrics._variationHits);
+			Assert::AreEqual(2u, metrics._variationMisses);
+			Assert::AreEqual(0u, metrics._invalidatedVariations);
+			Assert::AreEqual(3u, metrics._uniqueFilteredSelectors);
+			Assert::AreEqual(2u, metrics._uniqueVariations);
+		}
+
+		TEST_METHOD(ShaderVariationSetConcurrentLookups)
+		{
+			using namespace RenderCore::Techniques;
+			ShaderSelectorFiltering techniqueFiltering;
+			techniqueFiltering.GenerateHash();
+			PreprocessorExpressionTable relevance { SelectorRelevanceMap{{"SELECTOR_0", "1"}} };
+
+			const unsigned selectorCount = 4, threadCount = 8, iterations = 200;
+			std::vector<ParameterBox> selectors;
+			for (unsigned c=0; c<selectorCount; ++c) {
+				selectors.push_back(ParameterBox { std::make_pair(u("SELECTOR_0"), std::to_string(c).c_str()) });
+					// ParameterBox calculates its hashes lazily, so do that before sharing it between threads
+				selectors.back().GetHash();
+				selectors.back().GetParameterNamesHash();
+			}
+
+			UniqueShaderVariationSet variationSet;
+			CountingShaderVariationFactory factory;
+
+				// Every thread looks up every selector set, each starting at a different one, so threads
+				// collide on both the same and different selectors
+			std::atomic<bool> go { false };
+			std::vector<std::vector<const UniqueShaderVariationSet::Variation*>> results(threadCount);
+			std::vector<std::thread> threads;
+			for (unsigned t=0; t<threadCount; ++t)
+				threads.emplace_back(
+					[&, t]() {
+						results[t].resize(selectorCount, nullptr);
+						while (!go.load()) std::this_thread::yield();
+						for (unsigned i=0; i<iterations; ++i) {
+							auto s = (t+i)%selectorCount;
+							const ParameterBox* selectorList[] = { &selectors[s] };
+							auto* v = &variationSet.FindVariation(MakeIteratorRange(selectorList), techniqueFiltering, relevance, factory);
+							if (!results[t][s]) results[t][s] = v;
+							else if (results[t][s] != v) results[t][s] = nullptr;		// (flagged as a failure below)
+						}
+					});
+			go.store(true);
+			for (auto& t:threads) t.join();
+
+				// Each selector set resolves to the same variation on every thread, and different
+				// selector sets resolve to different variations
+			std::set<const UniqueShaderVariationSet::Variation*> unique;
+			for (unsigned s=0; s<selectorCount; ++s) {
+				for (unsigned t=0; t<threadCount; ++t) {
+					Assert::IsTrue(results[t][s] != nullptr);
+					Assert::IsTrue(results[t][s] == results[0][s]);
+				}
+				unique.insert(results[0][s]);
+			}
+			Assert::AreEqual(size_t(selectorCount), unique.size());
+
+				// No variation is built twice
+			Assert::AreEqual(selectorCount, factory._calls.load());
+			std::set<std::string> uniqueDefines(factory._defines.begin(), factory._defines.end());
+			Assert::AreEqual(size_t(selectorCount), uniqueDefines.size());
+
+			auto metrics = variationSet.GetMetrics();
+			Assert::AreEqual(selectorCount, metrics._filterMisses);
+			Assert::AreEqual(threadCount*iterations - selectorCount, metrics._filterHits);
+			Assert::AreEqual(selectorCount, metrics._variationMisses);
+			Assert::AreEqual(threadCount*iterations - selectorCount, metrics._variationHits);
+			Assert::AreEqual(selectorCount, metrics._uniqueFilteredSelectors);
+			Assert::AreEqual(selectorCount, metrics._uniqueVariations);
+		}
 	};
 
 }
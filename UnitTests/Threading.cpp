@@ -6,11 +6,21 @@
 
 #include "UnitTestHelper.h"
 #include "../Assets/AsyncLoadOperation.h"
+#include "../Assets/CompilationThread.h"
+#include "../Assets/IArtifact.h"
+#include "../ConsoleRig/IProgress.h"
 #include "../Utility/Threading/CompletionThreadPool.h"
+#include "../Utility/Threading/LockFree.h"
+#include "../Utility/Streams/FileUtils.h"
 #include <CppUnitTest.h>
+#include <atomic>
+#include <stdexcept>
+#include <chrono>
 
 namespace UnitTests
 {
+    using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
     class AsyncLoadTest : public ::Assets::AsyncLoadOperation
     {
     public:
@@ -24,6 +34,131 @@ namespace UnitTests
         }
     };
 
+    class AsyncLoadRecorder : public ::Assets::AsyncLoadOperation
+    {
+    public:
+        std::atomic<unsigned>* _finishedCount;
+        std::vector<uint8> _contents;
+        bool _failed = false;
+    protected:
+        virtual void Complete(const void* buffer, size_t bufferSize) override
+        {
+            _contents.insert(_contents.end(), (const uint8*)buffer, PtrAdd((const uint8*)buffer, bufferSize));
+            ++*_finishedCount;
+        }
+
+		virtual void OnFailure() override
+        {
+            _failed = true;
+            ++*_finishedCount;
+        }
+    };
+
+    static std::vector<uint8> LoadFileSynchronously(const std::string& filename)
+    {
+        RawFS::BasicFile file;
+        if (file.TryOpen((const utf8*)filename.c_str(), "rb", FileShareMode::Read) != Utility::Exceptions::IOException::Reason::Success)
+            return {};
+        std::vector<uint8> result((size_t)file.GetSize());
+        if (!result.empty())
+            file.Read(result.data(), 1, result.size());
+        return result;
+    }
+
+    template<typename Pool>
+        static void CheckEnqueueFromOutside(Pool& pool, unsigned taskCount)
+    {
+            // Enqueue from this (non-worker) thread; every task must run exactly once
+        std::vector<std::atomic<unsigned>> visits(taskCount);
+        for (auto& v:visits) v.store(0);
+        std::atomic<unsigned> completed(0);
+        for (unsigned c=0; c<taskCount; ++c)
+            pool.EnqueueBasic([&visits, &completed, c]() { ++visits[c]; ++completed; });
+        while (completed.load() < taskCount) Utility::Threading::YieldTimeSlice();
+        for (const auto& v:visits) Assert::AreEqual(v.load(), 1u);
+    }
+
+    template<typename Pool>
+        static void CheckFanOut(Pool& pool, unsigned rootCount, unsigned childCount)
+    {
+            // Each root task spawns children from within a worker thread. Those children go
+            // onto the worker's own deque, and are either run by that worker or stolen by
+            // another; either way every child must run exactly once
+        std::vector<std::atomic<unsigned>> visits(rootCount*childCount);
+        for (auto& v:visits) v.store(0);
+        std::atomic<unsigned> completed(0);
+        for (unsigned c=0; c<rootCount; ++c)
+            pool.EnqueueBasic(
+                [&pool, &visits, &completed, c, childCount]() {
+                    for (unsigned q=0; q<childCount; ++q)
+                        pool.EnqueueBasic([&visits, &completed, index=c*childCount+q]() { ++visits[index]; ++completed; });
+                });
+        while (completed.load() < rootCount*childCount) Utility::Threading::YieldTimeSlice();
+        for (const auto& v:visits) Assert::AreEqual(v.load(), 1u);
+    }
+
+    template<typename Queue>
+        static void CheckQueueContention(unsigned producerCount, unsigned consumerCount, unsigned itemsPerProducer)
+    {
+            // Every item must arrive exactly once, and each consumer must see the items from
+            // any one producer in the order they were pushed
+        Queue queue;
+        const unsigned totalItems = producerCount * itemsPerProducer;
+        std::vector<std::atomic<unsigned>> arrivals(totalItems);
+        for (auto& a:arrivals) a.store(0);
+        std::atomic<unsigned> consumedCount(0), orderErrors(0);
+        std::vector<std::thread> threads;
+
+        for (unsigned p=0; p<producerCount; ++p)
+            threads.emplace_back(
+                [&queue, p, itemsPerProducer]() {
+                    for (unsigned c=0; c<itemsPerProducer; ++c)
+                        queue.push(uint64(p)*itemsPerProducer+c);
+                });
+        for (unsigned c=0; c<consumerCount; ++c)
+            threads.emplace_back(
+                [&, producerCount, itemsPerProducer, totalItems]() {
+                    std::vector<uint64> lastFromProducer(producerCount, ~uint64(0));
+                    uint64 item;
+                    while (consumedCount.load() < totalItems) {
+                        if (queue.try_pop(item)) {
+                            auto producer = unsigned(item / itemsPerProducer);
+                            if (lastFromProducer[producer] != ~uint64(0) && lastFromProducer[producer] >= item)
+                                ++orderErrors;
+                            lastFromProducer[producer] = item;
+                            ++arrivals[item];
+                            ++consumedCount;
+                        } else
+                            Utility::Threading::YieldTimeSlice();
+                    }
+                });
+        for (auto&t:threads) t.join();
+
+        Assert::AreEqual(0u, orderErrors.load());
+        for (const auto& a:arrivals) Assert::AreEqual(a.load(), 1u);
+    }
+
+    class RecordingProgress : public ConsoleRig::IProgress
+    {
+    public:
+        class Step : public ConsoleRig::IStep
+        {
+        public:
+            RecordingProgress* _progress; unsigned _max;
+            void SetProgress(unsigned progress) override { _progress->_lastProgress = progress; _progress->_lastMax = _max; }
+            void Advance() override {}
+            bool IsCancelled() const override { return false; }
+        };
+        std::shared_ptr<ConsoleRig::IStep> BeginStep(const char[], unsigned progressMax, bool) override
+        {
+            ++_stepCount;
+            auto result = std::make_shared<Step>();
+            result->_progress = this; result->_max = progressMax;
+            return result;
+        }
+        unsigned _stepCount = 0, _lastProgress = 0, _lastMax = 0;    // (only changed while the scheduler holds its lock)
+    };
+
     TEST_CLASS(Threading)
 	{
 	public:
@@ -53,6 +188,337 @@ namespace UnitTests
                 }
             }
         }
+
+        TEST_METHOD(AsyncLoadBatch)
+        {
+            UnitTest_SetWorkingDirectory();
+
+            auto files = RawFS::FindFilesHierarchical("Game/xleres", "*", RawFS::FindFilesFilter::File);
+            Assert::IsTrue(!files.empty());
+            if (files.size() > 256) files.resize(256);
+            files.insert(files.begin() + files.size()/2, "Game/xleres/missing-file.txt");
+
+                // Every op in a batched Enqueue must complete with the full contents of its own
+                // file (no matter how the reads were split up or completed), and a missing or
+                // empty file must fail without affecting the rest of the batch
+            CompletionThreadPool pool(4);
+            std::atomic<unsigned> finishedCount(0);
+            std::vector<std::shared_ptr<AsyncLoadRecorder>> recorders;
+            std::vector<std::shared_ptr<::Assets::AsyncLoadOperation>> ops;
+            std::vector<StringSection<::Assets::ResChar>> filenames;
+            for (const auto& f:files) {
+                auto op = std::make_shared<AsyncLoadRecorder>();
+                op->_finishedCount = &finishedCount;
+                recorders.push_back(op);
+                ops.push_back(op);
+                filenames.push_back(MakeStringSection(f));
+            }
+
+            ::Assets::AsyncLoadOperation::Enqueue(MakeIteratorRange(ops), MakeIteratorRange(filenames), pool);
+            while (finishedCount.load() < files.size()) Utility::Threading::YieldTimeSlice();
+
+            for (unsigned c=0; c<files.size(); ++c) {
+                auto expected = LoadFileSynchronously(files[c]);
+                if (expected.empty()) {     // (missing and empty files both fail)
+                    Assert::IsTrue(recorders[c]->_failed);
+                    continue;
+                }
+                Assert::IsFalse(recorders[c]->_failed);
+                Assert::IsTrue(recorders[c]->_contents == expected);
+            }
+        }
+
+        TEST_METHOD(CompilationThreadScheduling)
+        {
+            using namespace ::Assets;
+            CompilationThread compilationThread(1);
+            auto progress = std::make_shared<RecordingProgress>();
+            compilationThread.SetProgress(progress);
+
+                // Hold the only worker, so everything below is queued before anything runs
+            std::atomic<bool> releaseGate(false);
+            auto gateFuture = compilationThread.Push(
+                std::make_shared<ArtifactFuture>(),
+                [&releaseGate](ArtifactFuture& future) {
+                    while (!releaseGate.load()) Utility::Threading::YieldTimeSlice();
+                    future.SetState(AssetState::Ready);
+                });
+            while (compilationThread.GetMetrics()._runningCount == 0) Utility::Threading::YieldTimeSlice();
+
+            Utility::Threading::Mutex orderLock;
+            std::vector<std::string> order;
+            auto recordOp = [&order, &orderLock](const char name[]) {
+                return [&order, &orderLock, name](ArtifactFuture& future) {
+                    { ScopedLock(orderLock); order.push_back(name); }
+                    future.SetState(AssetState::Ready);
+                };
+            };
+
+                // Requests with the same artifact hash share one operation and one future
+            auto first = compilationThread.Push(std::make_shared<ArtifactFuture>(), recordOp("general"), CompileStage::General, 0x1234);
+            auto duplicate = compilationThread.Push(std::make_shared<ArtifactFuture>(), recordOp("duplicate"), CompileStage::General, 0x1234);
+            Assert::IsTrue(first == duplicate);
+            Assert::AreEqual(1u, compilationThread.GetMetrics()._dedupedCount);
+
+                // Earlier stages start first, regardless of the order they were pushed in
+            std::vector<std::shared_ptr<ArtifactFuture>> futures;
+            futures.push_back(compilationThread.Push(std::make_shared<ArtifactFuture>(), recordOp("model"), CompileStage::Model));
+            futures.push_back(compilationThread.Push(std::make_shared<ArtifactFuture>(), recordOp("material"), CompileStage::Material));
+            futures.push_back(compilationThread.Push(std::make_shared<ArtifactFuture>(), recordOp("shader"), CompileStage::Shader));
+            Assert::AreEqual(5u, compilationThread.GetMetrics()._queuedCount + compilationThread.GetMetrics()._runningCount);
+
+            releaseGate.store(true);
+            compilationThread.StallOnPendingOperations(false);
+            Assert::IsTrue((order == std::vector<std::string>{"shader", "material", "model", "general"}));
+            Assert::IsTrue(first->GetAssetState() == AssetState::Ready);
+            Assert::AreEqual(5u, compilationThread.GetMetrics()._completedCount);
+
+                // Progress was reported for the whole batch
+            Assert::IsTrue(progress->_stepCount > 0);
+            Assert::AreEqual(progress->_lastMax, progress->_lastProgress);
+            Assert::AreEqual(5u, progress->_lastProgress);
+        }
+
+        TEST_METHOD(CompilationThreadStallOnOwner)
+        {
+            using namespace ::Assets;
+            CompilationThread compilationThread(2);
+            int ownerA = 0, ownerB = 0;
+
+                // Stalling on owner B must not wait for owner A's (long running) operation. If it
+                // did, it would only return once owner A's operation timed out
+            std::atomic<bool> releaseA(false), timedOutA(false), finishedB(false);
+            auto futureA = compilationThread.Push(
+                std::make_shared<ArtifactFuture>(),
+                [&releaseA, &timedOutA](ArtifactFuture& future) {
+                    auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+                    while (!releaseA.load()) {
+                        if (std::chrono::steady_clock::now() > timeout) { timedOutA.store(true); break; }
+                        Utility::Threading::YieldTimeSlice();
+                    }
+                    future.SetState(AssetState::Ready);
+                }, CompileStage::General, 0, &ownerA);
+            while (compilationThread.GetMetrics()._runningCount == 0) Utility::Threading::YieldTimeSlice();
+
+            auto futureB = compilationThread.Push(
+                std::make_shared<ArtifactFuture>(),
+                [&finishedB](ArtifactFuture& future) { finishedB.store(true); future.SetState(AssetState::Ready); },
+                CompileStage::General, 0, &ownerB);
+            compilationThread.StallOnPendingOperations(false, &ownerB);
+            Assert::IsTrue(finishedB.load());
+            Assert::IsTrue(futureB->GetAssetState() == AssetState::Ready);
+            Assert::IsTrue(futureA->GetAssetState() == AssetState::Pending);
+
+            releaseA.store(true);
+            compilationThread.StallOnPendingOperations(false, &ownerA);
+            Assert::IsFalse(timedOutA.load());
+            Assert::IsTrue(futureA->GetAssetState() == AssetState::Ready);
+
+                // Cancelling one owner's queued operations leaves the other owner's alone
+            releaseA.store(false);
+            auto blockA = compilationThread.Push(
+                std::make_shared<ArtifactFuture>(),
+                [&releaseA](ArtifactFuture& future) { while (!releaseA.load()) Utility::Threading::YieldTimeSlice(); future.SetState(AssetState::Ready); },
+                CompileStage::General, 0, &ownerA);
+            auto blockB = compilationThread.Push(
+                std::make_shared<ArtifactFuture>(),
+                [&releaseA](ArtifactFuture& future) { while (!releaseA.load()) Utility::Threading::YieldTimeSlice(); future.SetState(AssetState::Ready); },
+                CompileStage::General, 0, &ownerB);
+            while (compilationThread.GetMetrics()._runningCount < 2) Utility::Threading::YieldTimeSlice();
+            auto queuedA = compilationThread.Push(std::make_shared<ArtifactFuture>(), [](ArtifactFuture& future) { future.SetState(AssetState::Ready); }, CompileStage::General, 0, &ownerA);
+            auto queuedB = compilationThread.Push(std::make_shared<ArtifactFuture>(), [](ArtifactFuture& future) { future.SetState(AssetState::Ready); }, CompileStage::General, 0, &ownerB);
+            std::thread cancelA([&compilationThread, &ownerA]() { compilationThread.StallOnPendingOperations(true, &ownerA); });
+            while (compilationThread.GetMetrics()._queuedCount != 1) Utility::Threading::YieldTimeSlice();
+            releaseA.store(true);
+            cancelA.join();
+            compilationThread.StallOnPendingOperations(false);
+            Assert::IsTrue(queuedA->GetAssetState() == AssetState::Invalid);
+            Assert::IsTrue(queuedB->GetAssetState() == AssetState::Ready);
+            Assert::IsTrue(blockA->GetAssetState() == AssetState::Ready && blockB->GetAssetState() == AssetState::Ready);
+        }
+
+        TEST_METHOD(TaskParentContinuations)
+        {
+            ThreadPool pool(4);
+            std::atomic<unsigned> childCount(0);
+            std::atomic<unsigned> continuationCount(0);
+            unsigned childCountAtContinuation = 0;
+
+            auto outer = pool.CreateParent([&continuationCount]() { ++continuationCount; });
+            auto inner = pool.CreateParent(
+                [&]() { childCountAtContinuation = childCount.load(); ++continuationCount; },
+                TaskPriority::High, outer);
+            for (unsigned c=0; c<256; ++c)
+                pool.EnqueueChild(inner, [&childCount]() { ++childCount; });
+            inner->Seal();
+            outer->Seal();
+
+            while (!outer->IsComplete()) Utility::Threading::YieldTimeSlice();
+            while (continuationCount.load() < 2) Utility::Threading::YieldTimeSlice();
+            Assert::AreEqual(256u, childCountAtContinuation);
+            Assert::AreEqual(256u, childCount.load());
+        }
+
+        TEST_METHOD(ParallelRangeExecution)
+        {
+            CompletionThreadPool threadPool(4);
+
+                // every item must be visited exactly once, for any combination of item and range counts
+            for (unsigned itemCount:{0u, 1u, 7u, 1000u}) {
+                for (unsigned rangeCount:{1u, 2u, 3u, 8u}) {
+                    std::vector<std::atomic<unsigned>> visits(itemCount);
+                    for (auto& v:visits) v.store(0);
+                    ExecuteRangesParallel(
+                        threadPool, itemCount, rangeCount,
+                        [&visits](unsigned, unsigned begin, unsigned end) {
+                            for (unsigned c=begin; c<end; ++c) ++visits[c];
+                        });
+                    for (const auto& v:visits) Assert::AreEqual(v.load(), 1u);
+                }
+            }
+
+                // exceptions from worker ranges must reach the caller
+            bool caughtException = false;
+            try {
+                ExecuteRangesParallel(
+                    threadPool, 100, 4,
+                    [](unsigned rangeIndex, unsigned, unsigned) {
+                        if (rangeIndex == 2) throw std::runtime_error("Failure in worker range");
+                    });
+            } catch (const std::runtime_error&) {
+                caughtException = true;
+            }
+            Assert::IsTrue(caughtException);
+        }
+
+        TEST_METHOD(InlineTaskStorage)
+        {
+                // small, move-only captures should be stored inline
+            auto startMetrics = GetInlineTaskMetrics();
+            unsigned result = 0;
+            auto ptr = std::make_unique<unsigned>(5);
+            InlineTask small([ptr=std::move(ptr), &result]() { result += *ptr; });
+            InlineTask moved = std::move(small);
+            Assert::IsFalse(bool(small));
+            moved();
+            Assert::AreEqual(5u, result);
+            Assert::AreEqual(startMetrics._heapFallbackCount, GetInlineTaskMetrics()._heapFallbackCount);
+
+                // large captures fall back to the heap, and get counted
+            uint8 largeCapture[InlineTask::InlineCapacity+1] = { 3 };
+            InlineTask large([largeCapture, &result]() { result += largeCapture[0]; });
+            large();
+            Assert::AreEqual(8u, result);
+            Assert::AreEqual(startMetrics._heapFallbackCount+1, GetInlineTaskMetrics()._heapFallbackCount);
+        }
+
+        TEST_METHOD(WorkStealingTaskDistribution)
+        {
+            const unsigned threadCount = std::max(4u, std::thread::hardware_concurrency());
+
+            {
+                ThreadPool pool(threadCount);
+                CheckEnqueueFromOutside(pool, 16*1024);
+                CheckFanOut(pool, 64, 256);
+            }
+
+            {
+                CompletionThreadPool pool(threadCount);
+                CheckEnqueueFromOutside(pool, 16*1024);
+                CheckFanOut(pool, 64, 256);
+            }
+        }
+
+        TEST_METHOD(MPMCQueueOverflow)
+        {
+                // Start with a tiny initial ring, so pushing forces the queue to grow through
+                // several rings. Items must come out in order, and must never move in memory
+                // while they are in the queue
+            {
+                LockFree::MPMCQueue<std::string, 2> queue;
+                for (unsigned c=0; c<1000; ++c)
+                    queue.push(std::to_string(c));
+                Assert::AreEqual(size_t(1000), queue.size());
+
+                std::string* front = nullptr;
+                Assert::IsTrue(queue.try_front(front));
+                auto* originalFront = front;
+                queue.push("extra");
+                Assert::IsTrue(queue.try_front(front));
+                Assert::IsTrue(front == originalFront);
+
+                for (unsigned c=0; c<1000; ++c) {
+                    std::string item;
+                    Assert::IsTrue(queue.try_pop(item));
+                    Assert::AreEqual(std::to_string(c), item);
+                }
+                std::string last;
+                Assert::IsTrue(queue.try_pop(last));
+                Assert::AreEqual(std::string("extra"), last);
+                Assert::IsFalse(queue.try_pop(last));
+            }
+
+                // Once a burst has been drained, the old rings are released (apart from a
+                // small free list); only the newest ring stays allocated
+            {
+                LockFree::MPMCQueue<std::string, 2> queue;
+                for (unsigned c=0; c<100000; ++c)
+                    queue.push(std::to_string(c));
+                auto peakCapacity = queue.allocated_capacity();
+
+                std::string item;
+                while (queue.try_pop(item)) {}
+                for (unsigned c=0; c<8; ++c) {     // (rings are recycled after a grace period, by later operations)
+                    queue.push(item);
+                    Assert::IsTrue(queue.try_pop(item));
+                }
+                Assert::IsTrue(queue.allocated_capacity() * 3 < peakCapacity * 2);
+            }
+
+                // FixedSizeQueue::push_overflow now spills into an MPMCQueue
+            {
+                LockFree::FixedSizeQueue<unsigned, 8> queue;
+                for (unsigned c=0; c<100; ++c)
+                    queue.push_overflow(c);
+                unsigned* front = nullptr;
+                unsigned count = 0;
+                while (queue.try_front(front)) {
+                    ++count;
+                    queue.pop();
+                }
+                Assert::AreEqual(100u, count);
+            }
+        }
+
+        TEST_METHOD(MPMCQueueContention)
+        {
+                // Several producers and consumers at once, with a small initial ring so that the
+                // queue grows while it's contended
+            const std::pair<unsigned, unsigned> configurations[] = { {1, 1}, {4, 1}, {1, 4}, {4, 4}, {8, 8} };
+            for (const auto& cfg:configurations)
+                CheckQueueContention<LockFree::MPMCQueue<uint64, 4>>(cfg.first, cfg.second, 16*1024);
+
+                // Ping-pong between two threads through a pair of queues; every handoff must
+                // deliver the item that was pushed
+            LockFree::MPMCQueue<uint64> ping, pong;
+            const unsigned roundTrips = 4*1024;
+            std::thread echo(
+                [&ping, &pong, roundTrips]() {
+                    uint64 item;
+                    for (unsigned c=0; c<roundTrips; ++c) {
+                        while (!ping.try_pop(item)) Utility::Threading::YieldTimeSlice();
+                        pong.push(item+1);
+                    }
+                });
+            for (unsigned c=0; c<roundTrips; ++c) {
+                ping.push(uint64(c));
+                uint64 item;
+                while (!pong.try_pop(item)) Utility::Threading::YieldTimeSlice();
+                Assert::IsTrue(item == uint64(c)+1);
+            }
+            echo.join();
+            Assert::IsTrue(ping.size() == 0 && pong.size() == 0);
+        }
     };
 }
 
@@ -14,6 +14,7 @@
 #include "../Utility/FunctionUtils.h"
 #include "../Utility/MemoryUtils.h"
 #include "../Utility/Streams/ConditionalPreprocessingTokenizer.h"
+#include "../Utility/Streams/PreprocessorInterpreter.h"
 #include "../Math/Vector.h"
 #include <CppUnitTest.h>
 #include <stdexcept>
@@ -300,6 +301,60 @@ namespace UnitTests
 
 			Assert::IsTrue(tokenizer.PeekNextToken()._value.IsEmpty());
 		}
+
+		TEST_METHOD(PreprocessorExpressionTest)
+		{
+			ParameterBox lower, upper;
+			lower.SetParameter(u("SELECTOR_0"), 3);
+			lower.SetParameter(u("SELECTOR_1"), 0.5f);
+			upper.SetParameter(u("SELECTOR_0"), 0);
+			upper.SetParameter(u("SELECTOR_2"), true);
+			const ParameterBox* boxes[] = { &lower, &upper };
+
+			const char* trueExpressions[] = {
+				"SELECTOR_0 == 0",		// (the last box takes precedence)
+				"defined(SELECTOR_0) && defined SELECTOR_2 && !defined(SELECTOR_3)",
+				"SELECTOR_3 == 0 && !SELECTOR_3",
+				"SELECTOR_1 > 0.25 && SELECTOR_1 < 1",
+				"1 + 2 * 3 == 7 && (1 + 2) * 3 == 9 && 10 - 4 - 3 == 3",
+				"0x10 == 16 && 1 << 4 == 16 && 7 % 4 == 3 && -1 < 0",
+				"1 || 0 && 0"
+			};
+			for (auto e:trueExpressions) {
+				Assert::IsTrue(GetPreprocessorExpression(e)->IsCompiled());
+				Assert::IsTrue(GetPreprocessorExpression(e)->Evaluate(MakeIteratorRange(boxes)));
+			}
+			Assert::IsFalse(EvaluatePreprocessorExpression("(1 || 0) && 0", MakeIteratorRange(boxes)));
+			Assert::IsFalse(EvaluatePreprocessorExpression("SELECTOR_3", MakeIteratorRange(boxes)));
+
+			std::unordered_map<std::string, int> definedTokens { { "SELECTOR_0", 2 } };
+			Assert::IsTrue(EvaluatePreprocessorExpression("SELECTOR_0 == 2 && !defined(SELECTOR_1)", definedTokens));
+
+			// Compiled expressions are cached, and syntax the compiler doesn't support is left to the interpreter
+			Assert::IsTrue(GetPreprocessorExpression("SELECTOR_0 == 0") == GetPreprocessorExpression("SELECTOR_0 == 0"));
+			Assert::IsFalse(GetPreprocessorExpression("SELECTOR_0 ? 1 : 0")->IsCompiled());
+
+			// The cache is bounded; expressions held by the caller survive being evicted
+			auto held = GetPreprocessorExpression("SELECTOR_0 == 0 && SELECTOR_2");
+			for (unsigned c=0; c<8192; ++c)
+				GetPreprocessorExpression(("SELECTOR_0 == " + std::to_string(c)).c_str());
+			Assert::IsTrue(held->Evaluate(MakeIteratorRange(boxes)));
+			Assert::AreEqual(std::string("SELECTOR_0 == 0 && SELECTOR_2"), held->GetSource());
+
+			// Tables of named expressions are compiled up front, and found by parameter name hash
+			std::unordered_map<std::string, std::string> relevance {
+				{ "SELECTOR_0", "SELECTOR_0 == 0" },
+				{ "SELECTOR_1", "defined(SELECTOR_3)" },
+				{ "SELECTOR_2", "1" } };
+			PreprocessorExpressionTable table(relevance);
+			Assert::IsTrue(table.GetExpressions().size() == 3);
+			Assert::IsTrue(table.Find(ParameterBox::MakeParameterNameHash("SELECTOR_0")) == GetPreprocessorExpression("SELECTOR_0 == 0").get());
+			Assert::IsTrue(table.Find(ParameterBox::MakeParameterNameHash("SELECTOR_0"))->Evaluate(MakeIteratorRange(boxes)));
+			Assert::IsFalse(table.Find(ParameterBox::MakeParameterNameHash("SELECTOR_1"))->Evaluate(MakeIteratorRange(boxes)));
+			Assert::IsTrue(table.Find(ParameterBox::MakeParameterNameHash("SELECTOR_2"))->Evaluate(MakeIteratorRange(boxes)));
+			Assert::IsTrue(table.Find(ParameterBox::MakeParameterNameHash("SELECTOR_3")) == nullptr);
+			Assert::IsTrue(PreprocessorExpressionTable{}.IsEmpty());
+		}
     };
 }
 
@@ -217,17 +217,14 @@ namespace Utility
     }
     
     void KQueueMonitor::RunCallbacks(MonitorEntry &entry) {
-        for (unsigned i = 0; i < entry.callbacks.size(); ++i) {
-            auto weakCallback = entry.callbacks[i];
-            auto callback = weakCallback.lock();
-            if (callback) {
-                callback->OnChange();
-            } else {
-                // The callback no longer exists, let's remove it
-                entry.callbacks.erase(entry.callbacks.begin() + i);
-                --i;
-            }
-        }
+        // Remove callbacks that no longer exist
+        entry.callbacks.erase(
+            std::remove_if(entry.callbacks.begin(), entry.callbacks.end(),
+                [](const std::weak_ptr<OnChangeCallback>& c) { return c.expired(); }),
+            entry.callbacks.end());
+        // Executed immediately or queued, depending on SetFileSystemMonitorDeferredDelivery
+        auto callbacks = entry.callbacks;
+        Internal::DispatchFileSystemChange(MakeIteratorRange(callbacks));
     }
     
     KQueueMonitor::KQueueMonitor() : _kq(kqueue()),
@@ -446,6 +443,12 @@ namespace Utility
         std::remove((const char*)path);
     }
 
+    bool XlReplaceFile(const utf8 destination[], const utf8 source[])
+    {
+            // rename() replaces the destination atomically on POSIX filesystems
+        return std::rename((const char*)source, (const char*)destination) == 0;
+    }
+
 }
 
 
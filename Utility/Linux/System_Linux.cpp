@@ -3,6 +3,7 @@
 #include "../../Core/SelectConfiguration.h"
 #include "../../Core/Types.h"
 #include <sys/time.h>
+#include <cstdio>
 
 #ifdef ANDROID
 #include <time.h>
@@ -65,4 +66,20 @@ namespace Utility
 
     ModuleId GetCurrentModuleId() { return 0; }
 
+    void XlDeleteFile(const utf8 path[])
+    {
+        std::remove((const char*)path);
+    }
+
+    void XlMoveFile(const utf8 destination[], const utf8 source[])
+    {
+        std::rename((const char*)source, (const char*)destination);
+    }
+
+    bool XlReplaceFile(const utf8 destination[], const utf8 source[])
+    {
+            // rename() replaces the destination atomically on POSIX filesystems
+        return std::rename((const char*)source, (const char*)destination) == 0;
+    }
+
 }
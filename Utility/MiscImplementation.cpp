@@ -5,6 +5,7 @@
 #include "MemoryUtils.h"
 #include "VariantUtils.h"
 #include "PtrUtils.h"
+#include <algorithm>
 
 namespace Utility
 {
@@ -111,6 +112,33 @@ namespace Utility
         _entries.clear();
     }
 
+    void VariantArray::append(VariantArray&& src)
+    {
+        if (src._entries.empty()) return;
+        assert(&src != this);
+
+        auto requiredSize = _dataStoreSize + src._dataStoreSize;
+        if (requiredSize > _dataStoreAllocated)
+            reserve(std::max(requiredSize, _dataStoreAllocated + _dataStoreAllocated / 2));
+
+            // The move functions assign into the destination; like the moves in reserve(), that
+            // relies on the destination being zeroed (and space freed by clear() might not be)
+        auto* dstPtr = (void*)&_dataStore[_dataStoreSize];
+        XlClearMemory(dstPtr, src._dataStoreSize);
+        auto* srcPtr = (void*)src._dataStore.get();
+        for (auto i=src._entries.begin(); i!=src._entries.end(); ++i) {
+            (*i->_moveFn)(dstPtr, srcPtr);
+            (*i->_destroyFn)(srcPtr);
+            dstPtr = PtrAdd(dstPtr, i->_size);
+            srcPtr = PtrAdd(srcPtr, i->_size);
+        }
+        _dataStoreSize = requiredSize;
+        _entries.insert(_entries.end(), src._entries.begin(), src._entries.end());
+
+        src._dataStoreSize = 0;
+        src._entries.clear();
+    }
+
     VariantArray::VariantArray(VariantArray&& moveFrom)
     : _dataStore(std::move(moveFrom._dataStore))
     , _dataStoreSize(moveFrom._dataStoreSize)
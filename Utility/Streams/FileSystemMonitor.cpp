@@ -0,0 +1,198 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#include "FileSystemMonitor.h"
+#include "../Threading/Mutex.h"
+#include "../TimeUtils.h"
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+namespace Utility
+{
+    namespace Internal
+    {
+        class PendingFileSystemChange
+        {
+        public:
+            std::weak_ptr<OnChangeCallback> _callback;
+            uint64      _firstChangeTime;
+        };
+
+        struct ComparePendingChange
+        {
+            bool operator()(const PendingFileSystemChange& lhs, const std::weak_ptr<OnChangeCallback>& rhs) const { return lhs._callback.owner_before(rhs); }
+            bool operator()(const std::weak_ptr<OnChangeCallback>& lhs, const PendingFileSystemChange& rhs) const { return lhs.owner_before(rhs._callback); }
+        };
+
+        class FileSystemMonitorQueue
+        {
+        public:
+            Threading::Mutex    _lock;
+                // sorted by callback owner, so a callback attached to many files in the same batch
+                // is only queued once
+            std::vector<PendingFileSystemChange> _pending;
+            std::atomic<bool>   _deferred;
+
+            std::atomic<int>    _watchedDirectoryCount;
+            std::atomic<int>    _attachedCallbackCount;
+            uint64              _changeEventCount = 0;
+            uint64              _coalescedCallbackCount = 0;
+            uint64              _executedCallbackCount = 0;
+            uint64              _totalLatency = 0;
+            uint64              _maxLatency = 0;
+
+            FileSystemMonitorQueue() : _deferred(false), _watchedDirectoryCount(0), _attachedCallbackCount(0) {}
+        };
+
+        static FileSystemMonitorQueue& GetQueue()
+        {
+            static FileSystemMonitorQueue queue;
+            return queue;
+        }
+
+        static void ExecuteCallbacks(IteratorRange<const PendingFileSystemChange*> changes)
+        {
+                // Callbacks are always executed without any monitoring locks held, so they're free
+                // to attach new monitors or reload assets
+            auto& queue = GetQueue();
+            uint64 totalLatency = 0, maxLatency = 0, executedCount = 0;
+            for (const auto& c:changes) {
+                auto l = c._callback.lock();
+                if (!l) continue;
+                l->OnChange();
+                auto latency = GetPerformanceCounter() - c._firstChangeTime;
+                totalLatency += latency;
+                maxLatency = std::max(maxLatency, latency);
+                ++executedCount;
+            }
+
+            ScopedLock(queue._lock);
+            queue._executedCallbackCount += executedCount;
+            queue._totalLatency += totalLatency;
+            queue._maxLatency = std::max(queue._maxLatency, maxLatency);
+        }
+
+        void DispatchFileSystemChange(IteratorRange<const std::weak_ptr<OnChangeCallback>*> callbacks)
+        {
+            auto& queue = GetQueue();
+            auto now = GetPerformanceCounter();
+            {
+                    // (the deferred flag is checked while holding the lock, so a change can't
+                    // slip into the queue after SetFileSystemMonitorDeferredDelivery(false) flushed it)
+                ScopedLock(queue._lock);
+                ++queue._changeEventCount;
+                if (queue._deferred.load()) {
+                    for (const auto& c:callbacks) {
+                        if (c.expired()) continue;
+                        auto i = std::lower_bound(queue._pending.begin(), queue._pending.end(), c, ComparePendingChange());
+                        if (i != queue._pending.end() && !c.owner_before(i->_callback)) {
+                            ++queue._coalescedCallbackCount;
+                            continue;
+                        }
+                        queue._pending.insert(i, PendingFileSystemChange{c, now});
+                    }
+                    return;
+                }
+            }
+
+            std::vector<PendingFileSystemChange> immediate;
+            immediate.reserve(callbacks.size());
+            for (const auto& c:callbacks) immediate.push_back({c, now});
+            ExecuteCallbacks(MakeIteratorRange(immediate));
+        }
+
+        void RecordFileSystemMonitorAttachments(int watchedDirectoryDelta, int callbackDelta)
+        {
+            auto& queue = GetQueue();
+            queue._watchedDirectoryCount += watchedDirectoryDelta;
+            queue._attachedCallbackCount += callbackDelta;
+        }
+
+        void MonitoredFileCallbacks::Attach(uint64 filenameHash, std::shared_ptr<OnChangeCallback> callback)
+        {
+            ScopedLock(_lock);
+            auto range = std::equal_range(
+                _callbacks.begin(), _callbacks.end(),
+                filenameHash, CompareFirst<uint64, std::weak_ptr<OnChangeCallback>>());
+
+                // take the opportunity to clear out expired callbacks for this file
+            auto newEnd = std::remove_if(range.first, range.second,
+                [](std::pair<uint64, std::weak_ptr<OnChangeCallback>>& i) { return i.second.expired(); });
+            auto removed = int(range.second - newEnd);
+            auto insertionPoint = _callbacks.erase(newEnd, range.second);
+            RecordFileSystemMonitorAttachments(0, -removed);
+
+            for (auto i=range.first; i!=insertionPoint; ++i)
+                if (!i->second.owner_before(callback) && !callback.owner_before(i->second))
+                    return;
+
+            _callbacks.insert(insertionPoint, std::make_pair(filenameHash, std::move(callback)));
+            RecordFileSystemMonitorAttachments(0, 1);
+        }
+
+        void MonitoredFileCallbacks::Find(std::vector<std::weak_ptr<OnChangeCallback>>& result, uint64 filenameHash) const
+        {
+            ScopedLock(_lock);
+            auto range = std::equal_range(
+                _callbacks.begin(), _callbacks.end(),
+                filenameHash, CompareFirst<uint64, std::weak_ptr<OnChangeCallback>>());
+            for (auto i=range.first; i!=range.second; ++i)
+                result.push_back(i->second);
+        }
+
+        MonitoredFileCallbacks::MonitoredFileCallbacks() {}
+        MonitoredFileCallbacks::~MonitoredFileCallbacks()
+        {
+            RecordFileSystemMonitorAttachments(0, -int(_callbacks.size()));
+        }
+    }
+
+    unsigned FlushFileSystemMonitorEvents()
+    {
+        auto& queue = Internal::GetQueue();
+        std::vector<Internal::PendingFileSystemChange> changes;
+        {
+            ScopedLock(queue._lock);
+            if (queue._pending.empty()) return 0;
+            std::swap(changes, queue._pending);
+        }
+        Internal::ExecuteCallbacks(MakeIteratorRange(changes));
+        return (unsigned)changes.size();
+    }
+
+    void SetFileSystemMonitorDeferredDelivery(bool deferred)
+    {
+        auto& queue = Internal::GetQueue();
+        bool previous;
+        {
+            ScopedLock(queue._lock);
+            previous = queue._deferred.exchange(deferred);
+        }
+        if (previous && !deferred)
+            FlushFileSystemMonitorEvents();
+    }
+
+    FileSystemMonitorMetrics GetFileSystemMonitorMetrics()
+    {
+        auto& queue = Internal::GetQueue();
+        FileSystemMonitorMetrics result;
+        result._watchedDirectoryCount = (unsigned)std::max(0, queue._watchedDirectoryCount.load());
+        result._attachedCallbackCount = (unsigned)std::max(0, queue._attachedCallbackCount.load());
+
+        ScopedLock(queue._lock);
+        result._pendingCallbackCount = (unsigned)queue._pending.size();
+        result._changeEventCount = queue._changeEventCount;
+        result._coalescedCallbackCount = queue._coalescedCallbackCount;
+        result._executedCallbackCount = queue._executedCallbackCount;
+        float toMilliseconds = 1000.f / float(GetPerformanceCounterFrequency());
+        if (queue._executedCallbackCount)
+            result._averageCallbackLatency = float(queue._totalLatency) / float(queue._executedCallbackCount) * toMilliseconds;
+        result._maxCallbackLatency = float(queue._maxLatency) * toMilliseconds;
+        return result;
+    }
+}
+
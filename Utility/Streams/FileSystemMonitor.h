@@ -7,7 +7,11 @@
 #pragma once
 
 #include "../StringUtils.h" // for StringSection
+#include "../IteratorUtils.h"
+#include "../Threading/Mutex.h"
+#include "../../Core/Types.h"
 #include <memory>
+#include <vector>
 
 namespace Utility
 {
@@ -23,6 +27,11 @@ namespace Utility
     /// executed whenever the file changes.
     /// This is typically used to reload source assets after they receive 
     /// changes form an external source.
+    ///
+    /// Attaching the same callback to the same file more than once has no extra effect.
+    /// Callbacks are executed from the monitoring thread, unless deferred delivery has
+    /// been enabled (see SetFileSystemMonitorDeferredDelivery). In that case, they are only
+    /// executed when FlushFileSystemMonitorEvents() is called.
     void    AttachFileSystemMonitor(StringSection<utf8> directoryName, StringSection<utf8> filename, std::shared_ptr<OnChangeCallback> callback);
 	void    AttachFileSystemMonitor(StringSection<utf16> directoryName, StringSection<utf16> filename, std::shared_ptr<OnChangeCallback> callback);
 
@@ -36,5 +45,59 @@ namespace Utility
     /// Intended to be called on application shutdown, this frees all resources
     /// used by file system monitoring.
     void    TerminateFileSystemMonitoring();
+
+    /// <summary>Queue change events until the next call to FlushFileSystemMonitorEvents</summary>
+    /// By default, callbacks are executed from the monitoring thread as soon as the change
+    /// is detected. With deferred delivery enabled, changes are queued instead, and each callback
+    /// is executed at most once per flush (even if many of the files it's attached to changed).
+    /// Disabling deferred delivery flushes any queued changes.
+    ///
+    /// Only enable this if something will call FlushFileSystemMonitorEvents() regularly,
+    /// otherwise callbacks will never be executed. (AssetSetManager enables it on the first
+    /// OnFrameBarrier, and flushes on every one after that)
+    void    SetFileSystemMonitorDeferredDelivery(bool deferred);
+
+    /// <summary>Executes the callbacks for all queued change events</summary>
+    /// Callbacks are executed on the calling thread. Returns the number of callbacks executed.
+    unsigned FlushFileSystemMonitorEvents();
+
+    class FileSystemMonitorMetrics
+    {
+    public:
+        unsigned    _watchedDirectoryCount = 0;     ///< number of OS level watches
+        unsigned    _attachedCallbackCount = 0;     ///< number of (directory, file, callback) attachments
+        unsigned    _pendingCallbackCount = 0;      ///< callbacks queued for the next flush
+        uint64      _changeEventCount = 0;          ///< change events received from the OS (or FakeFileChange)
+        uint64      _coalescedCallbackCount = 0;    ///< callbacks skipped because they were already queued
+        uint64      _executedCallbackCount = 0;
+        float       _averageCallbackLatency = 0.f;  ///< in milliseconds, from the change event to the callback
+        float       _maxCallbackLatency = 0.f;      ///< in milliseconds
+    };
+    FileSystemMonitorMetrics GetFileSystemMonitorMetrics();
+
+    namespace Internal
+    {
+            // Used by the platform specific implementations
+        void    DispatchFileSystemChange(IteratorRange<const std::weak_ptr<OnChangeCallback>*> callbacks);
+        void    RecordFileSystemMonitorAttachments(int watchedDirectoryDelta, int callbackDelta);
+
+            /// <summary>The callbacks attached to the files within a single monitored directory</summary>
+            /// Sorted by filename hash. The same callback is frequently attached to the same file
+            /// many times (eg, when many assets share a dependency), so it's only stored once.
+        class MonitoredFileCallbacks
+        {
+        public:
+            void    Attach(uint64 filenameHash, std::shared_ptr<OnChangeCallback> callback);
+            void    Find(std::vector<std::weak_ptr<OnChangeCallback>>& result, uint64 filenameHash) const;
+
+            MonitoredFileCallbacks();
+            ~MonitoredFileCallbacks();
+            MonitoredFileCallbacks(const MonitoredFileCallbacks&) = delete;
+            MonitoredFileCallbacks& operator=(const MonitoredFileCallbacks&) = delete;
+        private:
+            std::vector<std::pair<uint64, std::weak_ptr<OnChangeCallback>>> _callbacks;
+            mutable Threading::Mutex _lock;
+        };
+    }
 }
 
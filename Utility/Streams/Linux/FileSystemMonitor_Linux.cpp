@@ -12,14 +12,16 @@
 #include "../../Conversion.h"
 #include <vector>
 #include <memory>
+#include <thread>
+#include <unordered_map>
 #include <cctype>
 
 #include <sys/inotify.h>
+#include <sys/eventfd.h>
 #include <poll.h>
+#include <unistd.h>
 
-// #include <iostream>
-
-// #define ENABLE_FILESYSTEM_MONITORING
+#define ENABLE_FILESYSTEM_MONITORING
 
 #if defined(ENABLE_FILESYSTEM_MONITORING)
 
@@ -29,7 +31,7 @@ namespace Utility
     {
     public:
         void            AttachCallback(uint64_t filenameHash, std::shared_ptr<OnChangeCallback> callback);
-        void            OnChange(StringSection<> filename);
+        void            FindCallbacks(std::vector<std::weak_ptr<OnChangeCallback>>& result, StringSection<> filename);
         int             wd() const { return _wd; }
 
         static uint64_t HashFilename(StringSection<utf16> filename);
@@ -39,28 +41,33 @@ namespace Utility
         MonitoredDirectory(const std::string& directoryName, int wd);
         ~MonitoredDirectory();
     private:
-        std::vector<std::pair<uint64_t, std::weak_ptr<OnChangeCallback>>>  _callbacks;
-        Threading::Mutex	_callbacksLock;
+        Internal::MonitoredFileCallbacks _callbacks;
 
 		std::string     _directoryName;
-        unsigned        _monitoringUpdateId;
         int             _wd;
     };
 
+        //  One inotify watch per directory; all of the files monitored within that directory share
+        //  it. MonitoredDirectories is sorted by directory name hash (for attaching), and
+        //  WatchDescriptorToDirectory finds the directory for incoming events
     static Utility::Threading::Mutex MonitoredDirectoriesLock;
     static std::vector<std::pair<uint64_t, std::unique_ptr<MonitoredDirectory>>>  MonitoredDirectories;
-    static unsigned CreationOrderId_Foreground = 0;
+    static std::unordered_map<int, MonitoredDirectory*> WatchDescriptorToDirectory;
 
     static int inotify_fd = -1;
+    static int wakeup_fd = -1;
 
     MonitoredDirectory::MonitoredDirectory(const std::string& directoryName, int wd)
     : _directoryName(directoryName), _wd(wd)
 	{
-        _monitoringUpdateId = CreationOrderId_Foreground;
+        Internal::RecordFileSystemMonitorAttachments(1, 0);
     }
 
     MonitoredDirectory::~MonitoredDirectory()
     {
+        if (_wd >= 0 && inotify_fd >= 0)
+            inotify_rm_watch(inotify_fd, _wd);
+        Internal::RecordFileSystemMonitorAttachments(-1, 0);
     }
 
 	uint64_t MonitoredDirectory::HashFilename(StringSection<utf16> filename)  { return Utility::HashFilename(filename); }
@@ -71,96 +78,79 @@ namespace Utility
         uint64 filenameHash,
         std::shared_ptr<OnChangeCallback> callback)
     {
-        ScopedLock(_callbacksLock);
-        _callbacks.insert(
-            LowerBound(_callbacks, filenameHash),
-            std::make_pair(filenameHash, std::move(callback)));
+        _callbacks.Attach(filenameHash, std::move(callback));
     }
 
-    void MonitoredDirectory::OnChange(StringSection<> filename)
+    void MonitoredDirectory::FindCallbacks(std::vector<std::weak_ptr<OnChangeCallback>>& result, StringSection<> filename)
     {
-        // std::cout << "OnChange for filename: " << filename.AsString().c_str() << std::endl;
-
-        auto hash = MonitoredDirectory::HashFilename(filename);
-        ScopedLock(_callbacksLock);
-        #if 0 //(STL_ACTIVE == STL_MSVC) && (_ITERATOR_DEBUG_LEVEL >= 2)
-            auto range = std::_Equal_range(
-                _callbacks.begin(), _callbacks.end(), hash,
-                CompareFirst<uint64, std::weak_ptr<OnChangeCallback>>(),
-                _Dist_type(_callbacks.begin()));
-        #else
-            auto range = std::equal_range(
-                _callbacks.begin(), _callbacks.end(),
-                hash, CompareFirst<uint64, std::weak_ptr<OnChangeCallback>>());
-        #endif
-
-        bool foundExpired = false;
-        for (auto i2=range.first; i2!=range.second; ++i2) {
-                // todo -- what happens if OnChange() results in a change to _callbacks?
-            auto l = i2->second.lock();
-            if (l) l->OnChange();
-            else foundExpired = true;
-        }
+        _callbacks.Find(result, MonitoredDirectory::HashFilename(filename));
+    }
+
+    static std::unique_ptr<std::thread> MonitoringThread;
 
-        if (foundExpired) {
-                // Remove any pointers that have expired
-                // (note that we only check matching pointers. Non-matching pointers
-                // that have expired are untouched)
-            _callbacks.erase(
-                std::remove_if(range.first, range.second,
-                    [](std::pair<uint64, std::weak_ptr<OnChangeCallback>>& i)
-                    { return i.second.expired(); }),
-                range.second);
+    static void MonitoringEntryPoint()
+    {
+        struct pollfd fds[2];
+        fds[0].fd = inotify_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = wakeup_fd;
+        fds[1].events = POLLIN;
+        std::vector<std::weak_ptr<OnChangeCallback>> callbacks;
+        for (;;) {
+            fds[0].revents = fds[1].revents = 0;
+            auto poll_num = poll(fds, dimof(fds), -1);
+            if (poll_num == -1) {
+                if (errno == EINTR) continue;
+                break;
+            }
+
+            if (fds[1].revents & POLLIN)
+                break;      // TerminateFileSystemMonitoring() was called
+
+            if (fds[0].revents & POLLIN) {
+                char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+                auto len = read(inotify_fd, buf, sizeof buf);
+                if (len <= 0)
+                    continue;
+
+                    //  Collect the callbacks for the entire read buffer under a single lock, and
+                    //  then dispatch them all at once. Callbacks are never executed while holding
+                    //  MonitoredDirectoriesLock (so they may freely attach new monitors)
+                callbacks.clear();
+                {
+                    ScopedLock(MonitoredDirectoriesLock);
+                    const struct inotify_event *event;
+                    for (auto* ptr = buf; ptr < buf + len;
+                         ptr += sizeof(struct inotify_event) + event->len) {
+
+                        event = (const struct inotify_event *) ptr;
+                        if (!event->len) continue;
+                        auto i = WatchDescriptorToDirectory.find(event->wd);
+                        if (i != WatchDescriptorToDirectory.end())
+                            i->second->FindCallbacks(callbacks, MakeStringSection(event->name));
+                    }
+                }
+
+                if (!callbacks.empty())
+                    Internal::DispatchFileSystemChange(MakeIteratorRange(callbacks));
+            }
         }
     }
 
-    static std::unique_ptr<std::thread> MonitoringThread;
+        //  std::thread will terminate the process if it's destroyed while still joinable; so
+        //  make sure the monitoring thread is shut down, even if the client never called
+        //  TerminateFileSystemMonitoring()
+    static struct MonitoringThreadShutdown
+    {
+        ~MonitoringThreadShutdown() { if (MonitoringThread) TerminateFileSystemMonitoring(); }
+    } s_monitoringThreadShutdown;
 
     static void RestartMonitoring()
     {
         if (!MonitoringThread) {
-            MonitoringThread = std::make_unique<std::thread>([]() {
-                struct pollfd fds[1];
-                fds[0].fd = inotify_fd;
-                fds[0].events = POLLIN;
-                fds[0].revents = 0;
-                for (;;) {
-                    auto poll_num = poll(fds, dimof(fds), -1);
-                    if (poll_num == -1)
-                        break;
-
-                    if (poll_num > 0) {
-                        bool cancelPolling = false;
-                        if (fds[0].revents & POLLIN) {
-                            char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
-                            for (;;) {
-                                /* Read some events. */
-                                auto len = read(inotify_fd, buf, sizeof buf);
-                                /*if (len == -1 && errno != EAGAIN) {
-                                    cancelPolling = true;
-                                    break;
-                                }*/
-                                if (len <= 0)
-                                    break;
-
-                                const struct inotify_event *event;
-                                for (auto* ptr = buf; ptr < buf + len;
-                                     ptr += sizeof(struct inotify_event) + event->len) {
-
-                                    event = (const struct inotify_event *) ptr;
-
-                                    ScopedLock(MonitoredDirectoriesLock);
-                                    for (const auto&m:MonitoredDirectories)
-                                        if (m.second->wd() == event->wd)
-                                            m.second->OnChange(event->name);
-                                }
-                            }
-                        }
-                        if (cancelPolling)
-                            break;
-                    }
-                }
-            });
+            if (wakeup_fd == -1)
+                wakeup_fd = eventfd(0, EFD_CLOEXEC);
+            MonitoringThread = std::make_unique<std::thread>(MonitoringEntryPoint);
         }
     }
 
@@ -168,7 +158,21 @@ namespace Utility
     {
         {
             ScopedLock(MonitoredDirectoriesLock);
+            if (MonitoringThread) {
+                uint64_t one = 1;
+                auto written = write(wakeup_fd, &one, sizeof(one)); (void)written;
+            }
+        }
+        if (MonitoringThread) {
+            MonitoringThread->join();
+            MonitoringThread.reset();
+        }
+        {
+            ScopedLock(MonitoredDirectoriesLock);
+            WatchDescriptorToDirectory.clear();
             MonitoredDirectories.clear();
+            if (inotify_fd != -1) { close(inotify_fd); inotify_fd = -1; }
+            if (wakeup_fd != -1) { close(wakeup_fd); wakeup_fd = -1; }
         }
     }
 
@@ -177,7 +181,9 @@ namespace Utility
         StringSection<utf16> filename,
         std::shared_ptr<OnChangeCallback> callback)
     {
-        assert(0);      // not implemented
+        auto dirNameCopy = Conversion::Convert<std::basic_string<utf8>>(directoryName.AsString());
+        auto filenameCopy = Conversion::Convert<std::basic_string<utf8>>(filename.AsString());
+        AttachFileSystemMonitor(MakeStringSection(dirNameCopy), MakeStringSection(filenameCopy), std::move(callback));
     }
 
 	void AttachFileSystemMonitor(
@@ -185,13 +191,13 @@ namespace Utility
 		StringSection<utf8> filename,
 		std::shared_ptr<OnChangeCallback> callback)
 	{
-        if (inotify_fd == -1)
-            inotify_fd = inotify_init();
-
         // std::cout << "Register (" << (char*)directoryName.AsString().c_str() << ", " << (char*)filename.AsString().c_str() << ")" << std::endl;
 
         {
             ScopedLock(MonitoredDirectoriesLock);
+            if (inotify_fd == -1)
+                inotify_fd = inotify_init1(IN_CLOEXEC);
+
             if (directoryName.IsEmpty())
                 directoryName = StringSection<utf8>(u("./"));
 
@@ -207,23 +213,52 @@ namespace Utility
             auto directoryNameCopy = Conversion::Convert<std::string>(directoryName.AsString());
             auto wd = inotify_add_watch(inotify_fd, directoryNameCopy.c_str(), IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
 
-            ++CreationOrderId_Foreground;
+                //  Different names for the same directory (eg, "a/b" and "a/./b") get the same
+                //  watch descriptor from inotify. In this case, the directory entries share the
+                //  watch, but only one of them is found from incoming events; so just attach
+                //  to that one
+            if (wd >= 0) {
+                auto existing = WatchDescriptorToDirectory.find(wd);
+                if (existing != WatchDescriptorToDirectory.end()) {
+                    existing->second->AttachCallback(MonitoredDirectory::HashFilename(filename), std::move(callback));
+                    return;
+                }
+            }
+
             auto i2 = MonitoredDirectories.insert(
                 i, std::make_pair(hash, std::make_unique<MonitoredDirectory>(directoryNameCopy, wd)));
+            if (wd >= 0)
+                WatchDescriptorToDirectory.insert(std::make_pair(wd, i2->second.get()));
             i2->second->AttachCallback(MonitoredDirectory::HashFilename(filename), std::move(callback));
-        }
 
-		//  we need to trigger the background thread so that it begins the the ReadDirectoryChangesW operation
-		//  (that operation must begin and be handled in the same thread when using completion routines)
-		RestartMonitoring();
+            RestartMonitoring();
+        }
 	}
 
     void    FakeFileChange(StringSection<utf16> directoryName, StringSection<utf16> filename)
     {
+        auto dirNameCopy = Conversion::Convert<std::basic_string<utf8>>(directoryName.AsString());
+        auto filenameCopy = Conversion::Convert<std::basic_string<utf8>>(filename.AsString());
+        FakeFileChange(MakeStringSection(dirNameCopy), MakeStringSection(filenameCopy));
     }
 
 	void    FakeFileChange(StringSection<utf8> directoryName, StringSection<utf8> filename)
 	{
+        std::vector<std::weak_ptr<OnChangeCallback>> callbacks;
+        {
+            ScopedLock(MonitoredDirectoriesLock);
+            if (directoryName.IsEmpty())
+                directoryName = StringSection<utf8>(u("./"));
+            auto hash = MonitoredDirectory::HashFilename(directoryName);
+            auto i = std::lower_bound(
+                MonitoredDirectories.cbegin(), MonitoredDirectories.cend(),
+                hash, CompareFirst<uint64, std::unique_ptr<MonitoredDirectory>>());
+            if (i == MonitoredDirectories.cend() || i->first != hash)
+                return;
+            i->second->FindCallbacks(callbacks, MakeStringSection((const char*)filename.begin(), (const char*)filename.end()));
+        }
+        if (!callbacks.empty())
+            Internal::DispatchFileSystemChange(MakeIteratorRange(callbacks));
 	}
 
 
@@ -5,7 +5,14 @@
 #include "../FileUtils.h"
 #include "../../Core/Exceptions.h"
 #include "../../Conversion.h"
+#include "../../StringUtils.h"
+#include "../../PtrUtils.h"
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
 
 namespace Utility
 {
@@ -135,10 +142,70 @@ namespace Utility
     
     namespace RawFS
     {
+        static Exceptions::IOException::Reason AsExceptionReason(int errorCode)
+        {
+            switch (errorCode) {
+            case ENOENT: return Exceptions::IOException::Reason::FileNotFound;
+            case EACCES:
+            case EPERM: return Exceptions::IOException::Reason::AccessDenied;
+            case EROFS: return Exceptions::IOException::Reason::WriteProtect;
+            default: return Exceptions::IOException::Reason::Complex;
+            }
+        }
+
         Exceptions::IOException::Reason MemoryMappedFile::TryOpen(const utf8 filename[], uint64 size, const char openMode[], FileShareMode::BitField shareMode) never_throws
         {
-            assert(0);      // not implemented yet
-            return Exceptions::IOException::Reason::Complex;
+            assert(_data.empty() && !_closeFn);
+
+                // Following fopen() conventions for the open mode. Any write access
+                // results in a writable (shared) mapping
+            bool writeAccess = XlFindChar(openMode, 'w') || XlFindChar(openMode, '+') || XlFindChar(openMode, 'a');
+            int flags = O_CLOEXEC | (writeAccess ? O_RDWR : O_RDONLY);
+            if (XlFindChar(openMode, 'w')) flags |= O_CREAT;
+
+            int fd = open((const char*)filename, flags, 0664);
+            if (fd < 0)
+                return AsExceptionReason(errno);
+
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                auto reason = AsExceptionReason(errno);
+                close(fd);
+                return reason;
+            }
+
+                // As with CreateFileMapping, a non-zero size will extend the file (if we have write access)
+            auto mappingSize = (size_t)st.st_size;
+            if (size && size > (uint64)st.st_size) {
+                if (!writeAccess || ftruncate(fd, (off_t)size) != 0) {
+                    close(fd);
+                    return Exceptions::IOException::Reason::Complex;
+                }
+                mappingSize = (size_t)size;
+            }
+
+                // mmap won't map empty files; we treat this the same way as a failure
+                // on Windows
+            if (!mappingSize) {
+                close(fd);
+                return Exceptions::IOException::Reason::Complex;
+            }
+
+            auto* mappingStart = mmap(nullptr, mappingSize, PROT_READ | (writeAccess ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+            if (mappingStart == MAP_FAILED) {
+                auto reason = AsExceptionReason(errno);
+                close(fd);
+                return reason;
+            }
+
+            _data = MakeIteratorRange(mappingStart, PtrAdd(mappingStart, mappingSize));
+            _closeFn = [fd](IteratorRange<const void*> data)
+                {
+                    assert(!data.empty());
+                    munmap(const_cast<void*>(data.begin()), data.size());
+                    close(fd);
+                };
+            return Exceptions::IOException::Reason::Success;
         }
         
         Exceptions::IOException::Reason MemoryMappedFile::TryOpen(const utf16 filename[], uint64 size, const char openMode[], FileShareMode::BitField shareMode) never_throws
@@ -153,7 +220,9 @@ namespace Utility
                          const char openMode[],
                          FileShareMode::BitField shareMode)
         {
-            assert(0);      // not implemented yet
+            auto reason = TryOpen(filename, size, openMode, shareMode);
+            if (reason != Exceptions::IOException::Reason::Success)
+                Throw(Exceptions::IOException(reason, "Failure while mapping file (%s) in mode (%s)", filename, openMode));
         }
         
         MemoryMappedFile::MemoryMappedFile(
@@ -9,12 +9,16 @@
 #include "PreprocessorInterpreter.h"
 #include "../ParameterBox.h"
 #include "../Threading/ThreadingUtils.h"
+#include "../Threading/Mutex.h"
+#include "../MemoryUtils.h"
 #include "../../Core/Exceptions.h"
 #include "../../Foreign/cparse/shunting-yard.h"
 #include "../../Foreign/cparse/shunting-yard-exceptions.h"
 
 #include <cmath>
 #include <atomic>
+#include <memory>
+#include <algorithm>
 
 namespace preprocessor_operations
 {
@@ -180,7 +184,7 @@ namespace Utility
     static std::atomic_bool static_hasSetupPreprocOps { false };
     static std::atomic_bool static_setupThreadAssigned { false };
 
-    bool EvaluatePreprocessorExpression(
+    static bool EvaluateWithInterpreter(
         StringSection<> input,
         const std::unordered_map<std::string, int>& definedTokens)
     {
@@ -208,7 +212,7 @@ namespace Utility
         // those that this can throw exceptions back to the caller (for example, if the input can't be parsed)
     }
 
-	bool EvaluatePreprocessorExpression(
+	static bool EvaluateWithInterpreter(
         StringSection<> input,
         IteratorRange<const ParameterBox**> definedTokens)
 	{
@@ -275,6 +279,397 @@ namespace Utility
 	}
 
 
+    enum class ExpressionOp : uint8_t
+    {
+        PushConstant, PushSymbol, PushDefined,
+        Negate, LogicalNot,
+        Multiply, Divide, Modulo, Add, Subtract, ShiftLeft, ShiftRight, Power,
+        Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual,
+        LogicalAnd, LogicalOr
+    };
+
+    struct PreprocessorExpression::Instruction
+    {
+        ExpressionOp    _op;
+        unsigned        _symbol;        // index into the symbol tables, for PushSymbol & PushDefined
+        double          _constant;
+    };
+
+    namespace Internal
+    {
+        static const unsigned s_maxExpressionStackDepth = 32;
+
+        struct BinaryOperator
+        {
+            const char*     _token;
+            ExpressionOp    _op;
+            unsigned        _precedence;        // (lower binds more tightly, as per the precedence table used with the interpreter)
+            bool            _rightAssociative;
+        };
+
+            // (longer tokens first, so "<<" isn't matched as "<")
+        static const BinaryOperator s_binaryOperators[] = {
+            { "**", ExpressionOp::Power, 4, true },
+            { "<<", ExpressionOp::ShiftLeft, 7, false }, { ">>", ExpressionOp::ShiftRight, 7, false },
+            { "<=", ExpressionOp::LessEqual, 8, false }, { ">=", ExpressionOp::GreaterEqual, 8, false },
+            { "==", ExpressionOp::Equal, 9, false }, { "!=", ExpressionOp::NotEqual, 9, false },
+            { "&&", ExpressionOp::LogicalAnd, 13, false }, { "||", ExpressionOp::LogicalOr, 14, false },
+            { "*", ExpressionOp::Multiply, 5, false }, { "/", ExpressionOp::Divide, 5, false }, { "%", ExpressionOp::Modulo, 5, false },
+            { "+", ExpressionOp::Add, 6, false }, { "-", ExpressionOp::Subtract, 6, false },
+            { "<", ExpressionOp::Less, 8, false }, { ">", ExpressionOp::Greater, 8, false }
+        };
+        static const unsigned s_lowestPrecedence = 14;
+
+        class ExpressionCompiler
+        {
+        public:
+            bool Compile()
+            {
+                ParseExpression(s_lowestPrecedence);
+                SkipWhitespace();
+                return !_failed && _i == _end && _depth == 1;
+            }
+
+            ExpressionCompiler(
+                StringSection<> input,
+                std::vector<PreprocessorExpression::Instruction>& instructions,
+                std::vector<std::string>& symbolNames)
+            : _i(input.begin()), _end(input.end()), _instructions(instructions), _symbolNames(symbolNames) {}
+
+        private:
+            const char* _i;
+            const char* _end;
+            std::vector<PreprocessorExpression::Instruction>& _instructions;
+            std::vector<std::string>& _symbolNames;
+            unsigned _depth = 0;
+            bool _failed = false;
+
+            static bool IsIdentifierStart(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+            static bool IsIdentifierChar(char c) { return IsIdentifierStart(c) || (c >= '0' && c <= '9'); }
+
+            void SkipWhitespace() { while (_i < _end && (*_i == ' ' || *_i == '\t' || *_i == '\r' || *_i == '\n')) ++_i; }
+
+            bool TryConsume(char c)
+            {
+                SkipWhitespace();
+                if (_i < _end && *_i == c) { ++_i; return true; }
+                return false;
+            }
+
+            StringSection<> ParseIdentifier()
+            {
+                SkipWhitespace();
+                auto start = _i;
+                if (_i < _end && IsIdentifierStart(*_i))
+                    while (_i < _end && IsIdentifierChar(*_i)) ++_i;
+                return MakeStringSection(start, _i);
+            }
+
+            unsigned FindOrAddSymbol(StringSection<> name)
+            {
+                for (unsigned c=0; c<_symbolNames.size(); ++c)
+                    if (XlEqString(name, _symbolNames[c])) return c;
+                _symbolNames.push_back(name.AsString());
+                return unsigned(_symbolNames.size()-1);
+            }
+
+            void Emit(ExpressionOp op, unsigned symbol = 0, double constant = 0.0)
+            {
+                _instructions.push_back({op, symbol, constant});
+                if (op == ExpressionOp::PushConstant || op == ExpressionOp::PushSymbol || op == ExpressionOp::PushDefined) {
+                    ++_depth;
+                    if (_depth > s_maxExpressionStackDepth) _failed = true;
+                } else if (op != ExpressionOp::Negate && op != ExpressionOp::LogicalNot) {
+                    --_depth;       // (binary operators pop 2 & push 1)
+                }
+            }
+
+            void ParsePrimary()
+            {
+                SkipWhitespace();
+                if (_i == _end) { _failed = true; return; }
+
+                if (*_i == '(') {
+                    ++_i;
+                    ParseExpression(s_lowestPrecedence);
+                    if (!TryConsume(')')) _failed = true;
+                    return;
+                }
+
+                if ((*_i >= '0' && *_i <= '9') || *_i == '.') {
+                        // (the source is always null terminated, so the C library parsing functions are safe here)
+                    char* numberEnd = nullptr;
+                    double value;
+                    if (*_i == '0' && (_i+1) < _end && (_i[1] == 'x' || _i[1] == 'X')) {
+                        value = double(std::strtoull(_i, &numberEnd, 16));
+                    } else
+                        value = std::strtod(_i, &numberEnd);
+                    if (!numberEnd || numberEnd == _i || numberEnd > _end) { _failed = true; return; }
+                    _i = numberEnd;
+                    while (_i < _end && (*_i == 'u' || *_i == 'U' || *_i == 'l' || *_i == 'L' || *_i == 'f' || *_i == 'F')) ++_i;
+                    Emit(ExpressionOp::PushConstant, 0, value);
+                    return;
+                }
+
+                auto identifier = ParseIdentifier();
+                if (identifier.IsEmpty()) { _failed = true; return; }
+
+                if (XlEqString(identifier, "defined")) {
+                    bool parens = TryConsume('(');
+                    auto symbol = ParseIdentifier();
+                    if (symbol.IsEmpty() || (parens && !TryConsume(')'))) { _failed = true; return; }
+                    Emit(ExpressionOp::PushDefined, FindOrAddSymbol(symbol));
+                } else if (XlEqString(identifier, "true")) {
+                    Emit(ExpressionOp::PushConstant, 0, 1.0);
+                } else if (XlEqString(identifier, "false")) {
+                    Emit(ExpressionOp::PushConstant, 0, 0.0);
+                } else
+                    Emit(ExpressionOp::PushSymbol, FindOrAddSymbol(identifier));
+            }
+
+            void ParseUnary()
+            {
+                if (TryConsume('!')) {
+                    ParseUnary();
+                    Emit(ExpressionOp::LogicalNot);
+                } else if (TryConsume('-')) {
+                    ParseUnary();
+                    Emit(ExpressionOp::Negate);
+                } else if (TryConsume('+')) {
+                    ParseUnary();
+                } else
+                    ParsePrimary();
+            }
+
+            const BinaryOperator* PeekBinaryOperator()
+            {
+                SkipWhitespace();
+                for (const auto& o:s_binaryOperators) {
+                    auto len = XlStringLen(o._token);
+                    if (size_t(_end - _i) >= len && !XlComparePrefix(_i, o._token, len))
+                        return &o;
+                }
+                return nullptr;
+            }
+
+            void ParseExpression(unsigned maxPrecedence)
+            {
+                ParseUnary();
+                while (!_failed) {
+                    auto* op = PeekBinaryOperator();
+                    if (!op || op->_precedence > maxPrecedence) break;
+                    _i += XlStringLen(op->_token);
+                    ParseExpression(op->_rightAssociative ? op->_precedence : op->_precedence - 1);
+                    Emit(op->_op);
+                }
+            }
+        };
+
+        enum class SymbolLookup { Undefined, Scalar, NonScalar };
+        enum class ExpressionResult { False, True, Unsupported };
+
+        template<typename LookupFn>
+            static ExpressionResult RunExpression(IteratorRange<const PreprocessorExpression::Instruction*> instructions, LookupFn&& lookupFn)
+        {
+            double stack[s_maxExpressionStackDepth];
+            unsigned top = 0;
+            for (const auto& inst:instructions) {
+                switch (inst._op) {
+                case ExpressionOp::PushConstant: stack[top++] = inst._constant; continue;
+                case ExpressionOp::PushSymbol:
+                    {
+                        double value = 0.0;
+                        if (lookupFn(inst._symbol, value) == SymbolLookup::NonScalar)
+                            return ExpressionResult::Unsupported;
+                        stack[top++] = value;
+                        continue;
+                    }
+                case ExpressionOp::PushDefined:
+                    {
+                        double value;
+                        stack[top++] = (lookupFn(inst._symbol, value) != SymbolLookup::Undefined) ? 1.0 : 0.0;
+                        continue;
+                    }
+                case ExpressionOp::Negate: stack[top-1] = -stack[top-1]; continue;
+                case ExpressionOp::LogicalNot: stack[top-1] = (stack[top-1] == 0.0) ? 1.0 : 0.0; continue;
+                default: break;
+                }
+
+                    // binary operators. Like the interpreter, arithmetic and comparisons are done
+                    // in floating point, and the integer operators work on truncated values
+                assert(top >= 2);
+                double lhs = stack[top-2], rhs = stack[top-1];
+                int64_t lhsi = int64_t(lhs), rhsi = int64_t(rhs);
+                double& result = stack[top-2];
+                --top;
+                switch (inst._op) {
+                case ExpressionOp::Multiply: result = lhs * rhs; break;
+                case ExpressionOp::Divide: result = lhs / rhs; break;
+                case ExpressionOp::Modulo:
+                    if (rhsi == 0) return ExpressionResult::Unsupported;
+                    result = double(lhsi % rhsi); break;
+                case ExpressionOp::Add: result = lhs + rhs; break;
+                case ExpressionOp::Subtract: result = lhs - rhs; break;
+                case ExpressionOp::ShiftLeft:
+                case ExpressionOp::ShiftRight:
+                    if (rhsi < 0 || rhsi >= 64) return ExpressionResult::Unsupported;
+                    result = double((inst._op == ExpressionOp::ShiftLeft) ? (lhsi << rhsi) : (lhsi >> rhsi)); break;
+                case ExpressionOp::Power: result = std::pow(lhs, rhs); break;
+                case ExpressionOp::Less: result = lhs < rhs; break;
+                case ExpressionOp::LessEqual: result = lhs <= rhs; break;
+                case ExpressionOp::Greater: result = lhs > rhs; break;
+                case ExpressionOp::GreaterEqual: result = lhs >= rhs; break;
+                case ExpressionOp::Equal: result = lhs == rhs; break;
+                case ExpressionOp::NotEqual: result = lhs != rhs; break;
+                case ExpressionOp::LogicalAnd: result = lhsi && rhsi; break;
+                case ExpressionOp::LogicalOr: result = lhsi || rhsi; break;
+                default: return ExpressionResult::Unsupported;
+                }
+            }
+            assert(top == 1);
+            return (stack[0] != 0.0) ? ExpressionResult::True : ExpressionResult::False;
+        }
+    }
+
+    bool PreprocessorExpression::Evaluate(IteratorRange<const ParameterBox**> definedTokens) const
+    {
+        if (_compiled) {
+            auto result = Internal::RunExpression(
+                MakeIteratorRange(_instructions),
+                [this, definedTokens](unsigned symbol, double& value) {
+                        // When the same name appears in multiple boxes, the last one wins
+                    auto hash = _symbolHashes[symbol];
+                    for (auto b=definedTokens.end(); b!=definedTokens.begin();) {
+                        --b;
+                        if (!(*b)->HasParameter(hash)) continue;
+                        auto type = (*b)->GetParameterType(hash);
+                        if (type._arrayCount > 1 || type._type == ImpliedTyping::TypeCat::Void
+                            || !(*b)->GetParameter(hash, &value, ImpliedTyping::TypeCat::Double))
+                            return Internal::SymbolLookup::NonScalar;
+                        return Internal::SymbolLookup::Scalar;
+                    }
+                    return Internal::SymbolLookup::Undefined;
+                });
+            if (result != Internal::ExpressionResult::Unsupported)
+                return result == Internal::ExpressionResult::True;
+        }
+        return EvaluateWithInterpreter(MakeStringSection(_source), definedTokens);
+    }
+
+    bool PreprocessorExpression::Evaluate(const std::unordered_map<std::string, int>& definedTokens) const
+    {
+        if (_compiled) {
+            auto result = Internal::RunExpression(
+                MakeIteratorRange(_instructions),
+                [this, &definedTokens](unsigned symbol, double& value) {
+                    auto i = definedTokens.find(_symbolNames[symbol]);
+                    if (i == definedTokens.end()) return Internal::SymbolLookup::Undefined;
+                    value = double(i->second);
+                    return Internal::SymbolLookup::Scalar;
+                });
+            if (result != Internal::ExpressionResult::Unsupported)
+                return result == Internal::ExpressionResult::True;
+        }
+        return EvaluateWithInterpreter(MakeStringSection(_source), definedTokens);
+    }
+
+    PreprocessorExpression::PreprocessorExpression(StringSection<> input)
+    : _source(input.AsString())
+    {
+        Internal::ExpressionCompiler compiler(MakeStringSection(_source), _instructions, _symbolNames);
+        _compiled = compiler.Compile();
+        if (_compiled) {
+            _symbolHashes.reserve(_symbolNames.size());
+            for (const auto& n:_symbolNames)
+                _symbolHashes.push_back(ParameterBox::MakeParameterNameHash(MakeStringSection(n)));
+        } else {
+            _instructions.clear();
+            _symbolNames.clear();
+        }
+    }
+
+    PreprocessorExpression::~PreprocessorExpression() {}
+
+    std::shared_ptr<const PreprocessorExpression> GetPreprocessorExpression(StringSection<> input)
+    {
+            // The cache is split into shards by hash, each with its own lock, so that threads
+            // evaluating different expressions rarely contend. Each shard is bounded; when it's
+            // full an arbitrary entry is dropped (callers holding it keep it alive)
+        static const unsigned s_shardCount = 16;
+        static const unsigned s_maxExpressionsPerShard = 256;
+        struct ExpressionCacheShard
+        {
+            Threading::Mutex _lock;
+            std::unordered_map<uint64_t, std::shared_ptr<const PreprocessorExpression>> _expressions;
+        };
+        static ExpressionCacheShard cache[s_shardCount];
+
+        auto hash = Hash64(input.begin(), input.end());
+        auto& shard = cache[hash % s_shardCount];
+        {
+            ScopedLock(shard._lock);
+            auto i = shard._expressions.find(hash);
+            if (i != shard._expressions.end() && XlEqString(input, i->second->GetSource()))
+                return i->second;
+        }
+
+            // Compile outside of the lock, so other threads can still read this shard
+        auto result = std::make_shared<const PreprocessorExpression>(input);
+        {
+            ScopedLock(shard._lock);
+            auto i = shard._expressions.find(hash);
+            if (i != shard._expressions.end()) {
+                if (XlEqString(input, i->second->GetSource()))
+                    return i->second;   // (another thread got there first)
+                i->second = result;     // (hash collision; replace the other expression)
+            } else {
+                if (shard._expressions.size() >= s_maxExpressionsPerShard)
+                    shard._expressions.erase(shard._expressions.begin());
+                shard._expressions.insert(std::make_pair(hash, result));
+            }
+        }
+        return result;
+    }
+
+    const PreprocessorExpression* PreprocessorExpressionTable::Find(uint64_t nameHash) const
+    {
+        auto i = LowerBound(_expressions, nameHash);
+        if (i != _expressions.end() && i->first == nameHash)
+            return i->second.get();
+        return nullptr;
+    }
+
+    PreprocessorExpressionTable::PreprocessorExpressionTable(const std::unordered_map<std::string, std::string>& expressions)
+    {
+        _expressions.reserve(expressions.size());
+        for (const auto& e:expressions)
+            _expressions.push_back(std::make_pair(
+                ParameterBox::MakeParameterNameHash(MakeStringSection(e.first)),
+                GetPreprocessorExpression(MakeStringSection(e.second))));
+        std::sort(_expressions.begin(), _expressions.end(), CompareFirst<uint64_t, std::shared_ptr<const PreprocessorExpression>>());
+
+        for (const auto& e:_expressions)
+            _hash = HashCombine(HashCombine(e.first, Hash64(e.second->GetSource())), _hash);
+    }
+
+    PreprocessorExpressionTable::PreprocessorExpressionTable() {}
+    PreprocessorExpressionTable::~PreprocessorExpressionTable() {}
+
+    bool EvaluatePreprocessorExpression(
+        StringSection<> input,
+        const std::unordered_map<std::string, int>& definedTokens)
+    {
+        return GetPreprocessorExpression(input)->Evaluate(definedTokens);
+    }
+
+    bool EvaluatePreprocessorExpression(
+        StringSection<> input,
+        IteratorRange<const ParameterBox**> definedTokens)
+    {
+        return GetPreprocessorExpression(input)->Evaluate(definedTokens);
+    }
+
+
     /* TokenMap vars;
     vars["__VERSION__"] = 300;
     vars["DEFINED_NO_VALUE"] = packToken(nullptr, NONE);        // tokens with no value can't be part of expressions
@@ -7,6 +7,9 @@
 #include "../StringUtils.h"
 #include "../IteratorUtils.h"
 #include <unordered_map>
+#include <vector>
+#include <string>
+#include <memory>
 
 namespace Utility
 {
@@ -19,6 +22,59 @@ namespace Utility
 	bool EvaluatePreprocessorExpression(
         StringSection<> input,
         IteratorRange<const ParameterBox**> definedTokens);
+
+    /// <summary>Preprocessor expression compiled into a small stack based bytecode</summary>
+    /// Symbols are resolved to ParameterBox name hashes at compile time, so evaluation doesn't
+    /// need to tokenize the input or allocate. Undefined symbols evaluate as 0.
+    /// Expressions using syntax that the compiler doesn't handle (or symbols with values that
+    /// aren't simple scalars) fall back to the general purpose interpreter.
+    class PreprocessorExpression
+    {
+    public:
+        bool Evaluate(IteratorRange<const ParameterBox**> definedTokens) const;
+        bool Evaluate(const std::unordered_map<std::string, int>& definedTokens) const;
+
+        bool IsCompiled() const { return _compiled; }
+        const std::string& GetSource() const { return _source; }
+
+        PreprocessorExpression(StringSection<> input);
+        ~PreprocessorExpression();
+
+        struct Instruction;
+    private:
+        std::vector<Instruction> _instructions;
+        std::vector<uint64_t> _symbolHashes;
+        std::vector<std::string> _symbolNames;
+        std::string _source;
+        bool _compiled;
+    };
+
+    /// <summary>Find or compile an expression in the global expression cache</summary>
+    /// The cache is bounded, so expressions can be evicted; but the returned pointer keeps the
+    /// expression alive for as long as the caller holds it. Thread safe.
+    std::shared_ptr<const PreprocessorExpression> GetPreprocessorExpression(StringSection<> input);
+
+    /// <summary>A set of named expressions (such as a selector relevance table), compiled ahead of time</summary>
+    /// Build this once, where the expressions are owned. Finding and evaluating an expression
+    /// afterwards doesn't touch the global expression cache, so takes no locks.
+    /// Expressions are found by ParameterBox name hash. GetHash() covers every name and expression
+    /// source, and is calculated on construction.
+    class PreprocessorExpressionTable
+    {
+    public:
+        using Entry = std::pair<uint64_t, std::shared_ptr<const PreprocessorExpression>>;
+        const PreprocessorExpression* Find(uint64_t nameHash) const;
+        IteratorRange<const Entry*> GetExpressions() const { return MakeIteratorRange(_expressions); }
+        bool IsEmpty() const { return _expressions.empty(); }
+        uint64_t GetHash() const { return _hash; }
+
+        PreprocessorExpressionTable(const std::unordered_map<std::string, std::string>& expressions);
+        PreprocessorExpressionTable();
+        ~PreprocessorExpressionTable();
+    private:
+        std::vector<Entry> _expressions;
+        uint64_t _hash = 0;
+    };
 }
 
 using namespace Utility;
@@ -47,8 +47,7 @@ namespace Utility
 
         void OnChange(StringSection<utf16> filename);
     private:
-        std::vector<std::pair<uint64, std::weak_ptr<OnChangeCallback>>>  _callbacks;
-        Threading::Mutex	_callbacksLock;
+        Internal::MonitoredFileCallbacks _callbacks;
         XlHandle			_directoryHandle;
         uint8				_resultBuffer[1024];
         DWORD				_bytesReturned;
@@ -81,10 +80,12 @@ namespace Utility
         _bytesReturned = 0;
         _monitoringUpdateId = CreationOrderId_Foreground;
         XlSetMemory(_resultBuffer, dimof(_resultBuffer), 0);
+        Internal::RecordFileSystemMonitorAttachments(1, 0);
     }
 
     MonitoredDirectory::~MonitoredDirectory()
     {
+        Internal::RecordFileSystemMonitorAttachments(-1, 0);
         if (_directoryHandle != INVALID_HANDLE_VALUE) {
             #if _WIN32_WINNT >= _WIN32_WINNT_VISTA
                 CancelIoEx(_directoryHandle, &_overlapped);
@@ -108,10 +109,7 @@ namespace Utility
         uint64 filenameHash, 
         std::shared_ptr<OnChangeCallback> callback)
     {
-        ScopedLock(_callbacksLock);
-        _callbacks.insert(
-            LowerBound(_callbacks, filenameHash),
-            std::make_pair(filenameHash, std::move(callback)));
+        _callbacks.Attach(filenameHash, std::move(callback));
     }
 
     void            MonitoredDirectory::OnTriggered()
@@ -146,37 +144,13 @@ namespace Utility
 
     void MonitoredDirectory::OnChange(StringSection<utf16> filename)
     {
-        auto hash = MonitoredDirectory::HashFilename(filename);
-        ScopedLock(_callbacksLock);
-        #if 0 //(STL_ACTIVE == STL_MSVC) && (_ITERATOR_DEBUG_LEVEL >= 2)
-            auto range = std::_Equal_range(
-                _callbacks.begin(), _callbacks.end(), hash, 
-                CompareFirst<uint64, std::weak_ptr<OnChangeCallback>>(),
-                _Dist_type(_callbacks.begin()));
-        #else
-            auto range = std::equal_range(
-                _callbacks.begin(), _callbacks.end(), 
-                hash, CompareFirst<uint64, std::weak_ptr<OnChangeCallback>>());
-        #endif
-
-        bool foundExpired = false;
-        for (auto i2=range.first; i2!=range.second; ++i2) {
-                // todo -- what happens if OnChange() results in a change to _callbacks?
-            auto l = i2->second.lock();
-            if (l) l->OnChange();
-            else foundExpired = true;
-        }
+        std::vector<std::weak_ptr<OnChangeCallback>> callbacks;
+        _callbacks.Find(callbacks, MonitoredDirectory::HashFilename(filename));
 
-        if (foundExpired) {
-                // Remove any pointers that have expired
-                // (note that we only check matching pointers. Non-matching pointers
-                // that have expired are untouched)
-            _callbacks.erase(
-                std::remove_if(range.first, range.second, 
-                    [](std::pair<uint64, std::weak_ptr<OnChangeCallback>>& i)
-                    { return i.second.expired(); }),
-                range.second);
-        }
+            // Callbacks are either executed immediately, or queued until the next
+            // FlushFileSystemMonitorEvents() (see SetFileSystemMonitorDeferredDelivery)
+        if (!callbacks.empty())
+            Internal::DispatchFileSystemChange(MakeIteratorRange(callbacks));
     }
 
     void CALLBACK MonitoredDirectory::CompletionRoutine(
@@ -25,6 +25,8 @@ namespace Utility
 	void XlDeleteFile(const utf8 path[]);
 	void XlDeleteFile(const ucs2 path[]);
     void XlMoveFile(const utf8 destination[], const utf8 source[]);
+        /// Atomically replaces "destination" with "source" (which must be on the same volume)
+    bool XlReplaceFile(const utf8 destination[], const utf8 source[]);
 
     void XlOutputDebugString(const char* format);
     void XlMessageBox(const char* content, const char* title);
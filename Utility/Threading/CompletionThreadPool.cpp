@@ -10,17 +10,354 @@
 #include "../../Utility/SystemUtils.h"
 #include "../../Core/Exceptions.h"
 #include <functional>
+#include <exception>
 
 namespace Utility
 {
-    void CompletionThreadPool::EnqueueBasic(PendingTask&& task)
+    namespace Internal
+    {
+        class PooledTask
+        {
+        public:
+            InlineTask _fn;
+            std::shared_ptr<TaskParent> _parent;      // (parent this task is a child of, if any)
+        };
+
+        class WorkStealingQueues
+        {
+        public:
+            PooledTask* AllocateTask();
+            void Push(PooledTask* task, TaskPriority priority);
+            PooledTask* TryPop();
+            void Execute(PooledTask* task);
+            unsigned GetQueuedCount() const { return _queuedCount.load(); }
+
+            void BindCurrentThread(unsigned workerIndex);
+            void UnbindCurrentThread();
+
+            WorkStealingQueues(unsigned workerCount, std::function<void()>&& wakeFn);
+            ~WorkStealingQueues();
+        private:
+            static const unsigned s_priorityCount = unsigned(TaskPriority::Max);
+
+            class Worker
+            {
+            public:
+                LockFree::WorkStealingDeque<PooledTask> _deques[s_priorityCount];
+                std::vector<PooledTask*> _freeTasks;
+            };
+            std::vector<std::unique_ptr<Worker>> _workers;
+
+                // Tasks pushed from threads outside of the pool can't go into a worker
+                // deque (since only the owner may push there), so they go into this
+                // shared (lock free) injection queue, instead
+            LockFree::MPMCQueue<PooledTask*> _injected[s_priorityCount];
+
+            std::atomic<unsigned> _queuedCount;
+            std::function<void()> _wakeFn;
+
+                // PooledTask objects are recycled, so that a steady state of task dispatch
+                // doesn't allocate. Each worker keeps its own free list, and spills over into
+                // (or refills from) the shared list in batches
+            Threading::Mutex _sharedFreeTasksLock;
+            std::vector<PooledTask*> _sharedFreeTasks;
+            static const unsigned s_freeTaskBatchSize = 64;
+
+            int CurrentWorkerIndex() const;
+            PooledTask* TryPopInjected(unsigned priority);
+            void ReleaseTask(PooledTask* task);
+        };
+
+        class WorkerBinding
+        {
+        public:
+            const WorkStealingQueues* _owner = nullptr;
+            unsigned _workerIndex = ~0u;
+        };
+
+        #if !FEATURE_THREAD_LOCAL_KEYWORD
+            static thread_local_ptr<WorkerBinding> s_currentWorker;
+            static WorkerBinding GetCurrentWorkerBinding()
+            {
+                auto* binding = s_currentWorker.get();
+                return binding ? *binding : WorkerBinding{};
+            }
+            static void SetCurrentWorkerBinding(const WorkerBinding& binding) { s_currentWorker.allocate(binding); }
+        #else
+            static thread_local WorkerBinding s_currentWorker;
+            static WorkerBinding GetCurrentWorkerBinding() { return s_currentWorker; }
+            static void SetCurrentWorkerBinding(const WorkerBinding& binding) { s_currentWorker = binding; }
+        #endif
+
+        int WorkStealingQueues::CurrentWorkerIndex() const
+        {
+            auto binding = GetCurrentWorkerBinding();
+            return (binding._owner == this) ? int(binding._workerIndex) : -1;
+        }
+
+        void WorkStealingQueues::BindCurrentThread(unsigned workerIndex)
+        {
+            assert(workerIndex < _workers.size());
+            SetCurrentWorkerBinding(WorkerBinding{this, workerIndex});
+        }
+
+        void WorkStealingQueues::UnbindCurrentThread()
+        {
+            SetCurrentWorkerBinding(WorkerBinding{});
+        }
+
+        PooledTask* WorkStealingQueues::AllocateTask()
+        {
+            auto workerIndex = CurrentWorkerIndex();
+            if (workerIndex >= 0) {
+                auto& freeTasks = _workers[workerIndex]->_freeTasks;
+                if (freeTasks.empty()) {
+                    ScopedLock(_sharedFreeTasksLock);
+                    auto count = std::min((size_t)s_freeTaskBatchSize, _sharedFreeTasks.size());
+                    freeTasks.insert(freeTasks.end(), _sharedFreeTasks.end()-count, _sharedFreeTasks.end());
+                    _sharedFreeTasks.erase(_sharedFreeTasks.end()-count, _sharedFreeTasks.end());
+                }
+                if (!freeTasks.empty()) {
+                    auto* result = freeTasks.back();
+                    freeTasks.pop_back();
+                    return result;
+                }
+            } else {
+                ScopedLock(_sharedFreeTasksLock);
+                if (!_sharedFreeTasks.empty()) {
+                    auto* result = _sharedFreeTasks.back();
+                    _sharedFreeTasks.pop_back();
+                    return result;
+                }
+            }
+            return new PooledTask;
+        }
+
+        void WorkStealingQueues::ReleaseTask(PooledTask* task)
+        {
+            task->_fn = nullptr;
+            task->_parent.reset();
+
+            auto workerIndex = CurrentWorkerIndex();
+            assert(workerIndex >= 0);
+            auto& freeTasks = _workers[workerIndex]->_freeTasks;
+            freeTasks.push_back(task);
+            if (freeTasks.size() >= 4*s_freeTaskBatchSize) {
+                    // Tasks tend to be allocated on one thread and freed on another, so
+                    // we must periodically move free tasks back into the shared pool
+                ScopedLock(_sharedFreeTasksLock);
+                _sharedFreeTasks.insert(_sharedFreeTasks.end(), freeTasks.end()-2*s_freeTaskBatchSize, freeTasks.end());
+                freeTasks.erase(freeTasks.end()-2*s_freeTaskBatchSize, freeTasks.end());
+            }
+        }
+
+        void WorkStealingQueues::Push(PooledTask* task, TaskPriority priority)
+        {
+            assert(unsigned(priority) < s_priorityCount);
+            auto workerIndex = CurrentWorkerIndex();
+            if (workerIndex >= 0) {
+                    // Pushing from one of our own workers (eg, a task spawning children)
+                    // This is lock free, and other workers will steal from here when idle
+                _workers[workerIndex]->_deques[unsigned(priority)].push_bottom(task);
+            } else {
+                _injected[unsigned(priority)].push(task);
+            }
+
+            ++_queuedCount;
+            _wakeFn();
+        }
+
+        PooledTask* WorkStealingQueues::TryPopInjected(unsigned priority)
+        {
+            PooledTask* result = nullptr;
+            _injected[priority].try_pop(result);
+            return result;
+        }
+
+        PooledTask* WorkStealingQueues::TryPop()
+        {
+            auto workerIndex = CurrentWorkerIndex();
+            assert(workerIndex >= 0);     // only our own workers should be popping tasks
+            auto workerCount = (unsigned)_workers.size();
+
+                // Search in priority order. For each priority, check our own deque first,
+                // then the injection queue and then finally attempt to steal from the
+                // other workers (starting with our neighbour, so thieves spread out)
+            for (unsigned p=0; p<s_priorityCount; ++p) {
+                auto* task = _workers[workerIndex]->_deques[p].pop_bottom();
+                if (!task)
+                    task = TryPopInjected(p);
+                for (unsigned c=1; c<workerCount && !task; ++c)
+                    task = _workers[(workerIndex+c)%workerCount]->_deques[p].steal();
+
+                if (task) {
+                    --_queuedCount;
+                    return task;
+                }
+            }
+            return nullptr;
+        }
+
+        void WorkStealingQueues::Execute(PooledTask* task)
+        {
+            TRY
+            {
+                task->_fn();
+            } CATCH(const std::exception& e) {
+                Log(Error) << "Suppressing exception in thread pool thread: " << e.what() << std::endl;
+                (void)e;
+            } CATCH(...) {
+                Log(Error) << "Suppressing unknown exception in thread pool thread." << std::endl;
+            } CATCH_END
+
+            if (task->_parent)
+                task->_parent->ChildCompleted();
+
+            ReleaseTask(task);
+        }
+
+        WorkStealingQueues::WorkStealingQueues(unsigned workerCount, std::function<void()>&& wakeFn)
+        : _wakeFn(std::move(wakeFn))
+        {
+            _queuedCount = 0;
+            _workers.reserve(workerCount);
+            for (unsigned c=0; c<workerCount; ++c)
+                _workers.emplace_back(std::make_unique<Worker>());
+        }
+
+        WorkStealingQueues::~WorkStealingQueues()
+        {
+                // All worker threads should be shut down by now; so it's safe to
+                // drain the worker deques from this thread
+            for (auto& w:_workers)
+                for (auto& d:w->_deques)
+                    while (auto* t = d.pop_bottom())
+                        delete t;
+            for (auto& q:_injected) {
+                PooledTask* t = nullptr;
+                while (q.try_pop(t))
+                    delete t;
+            }
+            for (auto& w:_workers)
+                for (auto* t:w->_freeTasks)
+                    delete t;
+            for (auto* t:_sharedFreeTasks)
+                delete t;
+        }
+    }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    static std::atomic<uint64> s_inlineTaskHeapFallbackCount(0);
+    static std::atomic<uint64> s_inlineTaskHeapFallbackBytes(0);
+
+    namespace Internal
+    {
+        void RecordInlineTaskHeapFallback(size_t size)
+        {
+            ++s_inlineTaskHeapFallbackCount;
+            s_inlineTaskHeapFallbackBytes += size;
+        }
+    }
+
+    InlineTaskMetrics GetInlineTaskMetrics()
+    {
+        InlineTaskMetrics result;
+        result._heapFallbackCount = s_inlineTaskHeapFallbackCount.load();
+        result._heapFallbackBytes = s_inlineTaskHeapFallbackBytes.load();
+        return result;
+    }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    void TaskParent::Seal()
+    {
+        bool expected = false;
+        if (_sealed.compare_exchange_strong(expected, true))
+            ChildCompleted();       // (release the reference held until sealing)
+    }
+
+    void TaskParent::AddChild()
+    {
+            // Children may be added after sealing, but only from within another
+            // child of the same parent (since the parent is otherwise already complete)
+        auto prevCount = _pendingCount.fetch_add(1);
+        assert(prevCount != 0); (void)prevCount;
+    }
+
+    void TaskParent::ChildCompleted()
+    {
+        auto prevCount = _pendingCount.fetch_sub(1);
+        assert(prevCount != 0);
+        if (prevCount != 1) return;
+
+        if (_continuation) {
+                // the continuation becomes a child of our own parent (so that
+                // the grandparent doesn't complete until the continuation has run)
+            auto* continuation = _queues->AllocateTask();
+            continuation->_fn = std::move(_continuation);
+            continuation->_parent = std::move(_parent);
+            _complete.store(true);
+            _queues->Push(continuation, _priority);
+        } else {
+            _complete.store(true);
+            if (_parent) {
+                auto parent = std::move(_parent);
+                parent->ChildCompleted();
+            }
+        }
+    }
+
+    TaskParent::TaskParent(
+        Internal::WorkStealingQueues& queues,
+        InlineTask&& continuation, TaskPriority priority,
+        std::shared_ptr<TaskParent> parent)
+    : _continuation(std::move(continuation))
+    , _priority(priority)
+    , _parent(std::move(parent))
+    , _queues(&queues)
+    {
+        _pendingCount = 1;      // released when sealed
+        _sealed = false;
+        _complete = false;
+        if (_parent)
+            _parent->AddChild();
+    }
+
+    TaskParent::~TaskParent()
+    {
+            // A parent that was never sealed still holds a reference on its own parent
+        if (!_sealed.load() && _parent)
+            _parent->ChildCompleted();
+    }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    void CompletionThreadPool::EnqueueBasic(InlineTask&& task, TaskPriority priority)
     {
         assert(IsGood());
-        _pendingTasks.push_overflow(std::forward<PendingTask>(task));
+        auto* pooledTask = _queues->AllocateTask();
+        pooledTask->_fn = std::move(task);
+        _queues->Push(pooledTask, priority);
+    }
 
-            // set event should wake one thread -- and that thread should
-            // then take over and execute the task
-        XlSetEvent(_events[0]);
+    std::shared_ptr<TaskParent> CompletionThreadPool::CreateParent(
+        InlineTask&& continuation, TaskPriority priority,
+        const std::shared_ptr<TaskParent>& parent)
+    {
+        return std::make_shared<TaskParent>(*_queues, std::move(continuation), priority, parent);
+    }
+
+    void CompletionThreadPool::EnqueueChild(
+        const std::shared_ptr<TaskParent>& parent, InlineTask&& task,
+        TaskPriority priority)
+    {
+        assert(IsGood() && parent);
+        parent->AddChild();
+        auto* pooledTask = _queues->AllocateTask();
+        pooledTask->_fn = std::move(task);
+        pooledTask->_parent = parent;
+        _queues->Push(pooledTask, priority);
     }
 
     CompletionThreadPool::CompletionThreadPool(unsigned threadCount)
@@ -31,84 +368,42 @@ namespace Utility
         _events[1] = XlCreateEvent(true);
         _workerQuit = false;
 
+            // set event should wake one thread -- and that thread should
+            // then take over and execute the task
+        _queues = std::make_unique<Internal::WorkStealingQueues>(
+            threadCount, [this]() { XlSetEvent(this->_events[0]); });
+
         for (unsigned i = 0; i<threadCount; ++i)
             _workerThreads.emplace_back(
-                [this]
+                [this, i]
                 {
-                    SetYieldToPoolFunction([this]() {
-                        bool gotTask = false;
-                        std::function<void()> task;
-
-                        {
-                            ScopedLock(this->_pendingsTaskLock);
-                            std::function<void()>* t = nullptr;
-                            if (_pendingTasks.try_front(t)) {
-                                task = std::move(*t);
-                                _pendingTasks.pop();
-                                gotTask = true;
-                            }
-                        }
+                    _queues->BindCurrentThread(i);
 
-                        // Attempt a short wait if we didn't get a task
-                        if (!gotTask) {
+                    SetYieldToPoolFunction([this]() {
+                            // Execute something from our own deque, or steal something from
+                            // another worker. If there's nothing at all, attempt a short wait
+                        auto task = _queues->TryPop();
+                        if (!task) {
                             XlWaitForMultipleSyncObjects(
                                 2, this->_events,
                                 false, 1, true);
-
-                            {
-                               ScopedLock(this->_pendingsTaskLock);
-                                std::function<void()>* t = nullptr;
-                                if (_pendingTasks.try_front(t)) {
-                                    task = std::move(*t);
-                                    _pendingTasks.pop();
-                                    gotTask = true;
-                                }
-                            }
+                            task = _queues->TryPop();
                         }
 
-                        if (gotTask) {
-                            TRY
-                            {
-                                task();
-                            } CATCH(const std::exception& e) {
-                                Log(Error) << "Suppressing exception in thread pool thread: " << e.what() << std::endl;
-								(void)e;
-                            } CATCH(...) {
-                                Log(Error) << "Suppressing unknown exception in thread pool thread." << std::endl;
-                            } CATCH_END
-                        }
+                        if (task)
+                            _queues->Execute(task);
                     });
 
                     while (!this->_workerQuit) {
-                        bool gotTask = false;
-                        std::function<void()> task;
-
-                        {
-                                // note that _pendingTasks is safe for multiple pushing threads,
-                                // but not safe for multiple popping threads. So we have to
-                                // lock to prevent more than one thread from attempt to pop
-                                // from it at the same time.
-                            ScopedLock(this->_pendingsTaskLock);
-
-                            std::function<void()>*t = nullptr;
-                            if (_pendingTasks.try_front(t)) {
-                                task = std::move(*t);
-                                _pendingTasks.pop();
-                                gotTask = true;
-                            }
-                        }
+                        auto task = _queues->TryPop();
+                        if (task) {
+                                // If there's still more work queued, pass the wake up along to
+                                // another thread (the event can only hold a single signal)
+                            if (_queues->GetQueuedCount())
+                                XlSetEvent(this->_events[0]);
 
-                        if (gotTask) {
                                 // if we got this far, we can execute the task....
-                            TRY
-                            {
-                                task();
-                            } CATCH(const std::exception& e) {
-                                Log(Error) << "Suppressing exception in thread pool thread: " << e.what() << std::endl;
-								(void)e;
-                            } CATCH(...) {
-                                Log(Error) << "Suppressing unknown exception in thread pool thread." << std::endl;
-                            } CATCH_END
+                            _queues->Execute(task);
 
                                 // That that when using completion routines, we want to attempt to
                                 // distribute the tasks evenly between threads (so that the completion
@@ -130,6 +425,7 @@ namespace Utility
                     }
 
                     SetYieldToPoolFunction(nullptr);
+                    _queues->UnbindCurrentThread();
                 }
             );
     }
@@ -139,6 +435,7 @@ namespace Utility
         _workerQuit = true;
         XlSetEvent(_events[1]);   // trigger a manual reset event should wake all threads (and keep them awake)
         for (auto&t : _workerThreads) t.join();
+        _queues.reset();
 
         XlCloseSyncObject(_events[0]);
         XlCloseSyncObject(_events[1]);
@@ -146,94 +443,99 @@ namespace Utility
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    void ThreadPool::EnqueueBasic(PendingTask&& task)
+    void ThreadPool::EnqueueBasic(InlineTask&& task, TaskPriority priority)
     {
         assert(IsGood());
-        _pendingTasks.push_overflow(std::forward<PendingTask>(task));
-        _pendingTaskVariable.notify_one();
+        auto* pooledTask = _queues->AllocateTask();
+        pooledTask->_fn = std::move(task);
+        _queues->Push(pooledTask, priority);
+    }
+
+    std::shared_ptr<TaskParent> ThreadPool::CreateParent(
+        InlineTask&& continuation, TaskPriority priority,
+        const std::shared_ptr<TaskParent>& parent)
+    {
+        return std::make_shared<TaskParent>(*_queues, std::move(continuation), priority, parent);
+    }
+
+    void ThreadPool::EnqueueChild(
+        const std::shared_ptr<TaskParent>& parent, InlineTask&& task,
+        TaskPriority priority)
+    {
+        assert(IsGood() && parent);
+        parent->AddChild();
+        auto* pooledTask = _queues->AllocateTask();
+        pooledTask->_fn = std::move(task);
+        pooledTask->_parent = parent;
+        _queues->Push(pooledTask, priority);
     }
 
     ThreadPool::ThreadPool(unsigned threadCount)
     {
         _workerQuit = false;
+        _sleepingWorkers = 0;
+
+            // We only need to take the lock and signal the condition variable when
+            // some worker is actually asleep. Note that the order of operations here
+            // (queued count is incremented before _sleepingWorkers is checked, and vice
+            // versa in the worker) ensures that we can't miss a wake up
+        _queues = std::make_unique<Internal::WorkStealingQueues>(
+            threadCount,
+            [this]() {
+                if (this->_sleepingWorkers.load()) {
+                    ScopedLock(this->_pendingTaskLock);
+                    this->_pendingTaskVariable.notify_one();
+                }
+            });
 
         for (unsigned i = 0; i<threadCount; ++i)
             _workerThreads.emplace_back(
-                [this]
+                [this, i]
                 {
+                    _queues->BindCurrentThread(i);
+
                     SetYieldToPoolFunction([this]() {
-                        std::function<void()> task;
-                        {
-                            std::unique_lock<decltype(this->_pendingTaskLock)> autoLock(this->_pendingTaskLock);
-                            if (this->_workerQuit) return;
-
-                            std::function<void()>*t = nullptr;
-                            if (!_pendingTasks.try_front(t)) {
-                                this->_pendingTaskVariable.wait(autoLock);
-                                if (this->_workerQuit) return;
-                                if (!_pendingTasks.try_front(t))
-                                    return;
-                            }
-
-                            task = std::move(*t);
-                            _pendingTasks.pop();
+                        auto task = _queues->TryPop();
+                        if (!task) {
+                            Threading::YieldTimeSlice();
+                            task = _queues->TryPop();
                         }
 
-                        TRY
-                        {
-                            task();
-                        } CATCH(const std::exception& e) {
-                            Log(Error) << "Suppressing exception in thread pool thread: " << e.what() << std::endl;
-                            (void)e;
-                        } CATCH(...) {
-                            Log(Error) << "Suppressing unknown exception in thread pool thread." << std::endl;
-                        } CATCH_END
+                        if (task)
+                            _queues->Execute(task);
                     });
 
                     for (;;) {
-                        std::function<void()> task;
-
-                        {
-                                // note that _pendingTasks is safe for multiple pushing threads,
-                                // but not safe for multiple popping threads. So we have to
-                                // lock to prevent more than one thread from attempt to pop
-                                // from it at the same time.
-                            std::unique_lock<decltype(this->_pendingTaskLock)> autoLock(this->_pendingTaskLock);
-                            if (this->_workerQuit) break;
-
-                            std::function<void()>*t = nullptr;
-                            if (!_pendingTasks.try_front(t)) {
-                                this->_pendingTaskVariable.wait(autoLock);
-                                if (this->_workerQuit) break;
-                                if (!_pendingTasks.try_front(t))
-                                    continue;
-                            }
-
-                            task = std::move(*t);
-                            _pendingTasks.pop();
+                        if (this->_workerQuit) break;
+
+                        auto task = _queues->TryPop();
+                        if (task) {
+                            _queues->Execute(task);
+                            continue;
                         }
 
-                        TRY
-                        {
-                            task();
-                        } CATCH(const std::exception& e) {
-                            Log(Error) << "Suppressing exception in thread pool thread: " << e.what() << std::endl;
-                            (void)e;
-                        } CATCH(...) {
-                            Log(Error) << "Suppressing unknown exception in thread pool thread." << std::endl;
-                        } CATCH_END
+                        std::unique_lock<decltype(this->_pendingTaskLock)> autoLock(this->_pendingTaskLock);
+                        ++this->_sleepingWorkers;
+                        while (!this->_workerQuit && !_queues->GetQueuedCount())
+                            this->_pendingTaskVariable.wait(autoLock);
+                        --this->_sleepingWorkers;
                     }
 
                     SetYieldToPoolFunction(nullptr);
+                    _queues->UnbindCurrentThread();
                 }
             );
     }
 
     ThreadPool::~ThreadPool()
     {
-        _workerQuit = true;
+        {
+            ScopedLock(_pendingTaskLock);
+            _workerQuit = true;
+        }
         _pendingTaskVariable.notify_all();
         for (auto&t : _workerThreads) t.join();
+        _queues.reset();
     }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -274,5 +576,46 @@ namespace Utility
 
 #endif
 
+    void ExecuteRangesParallel(
+        CompletionThreadPool& threadPool,
+        unsigned itemCount, unsigned rangeCount,
+        const std::function<void(unsigned, unsigned, unsigned)>& fn)
+    {
+        assert(rangeCount != 0);
+        auto rangeBegin = [itemCount, rangeCount](unsigned rangeIndex) { return unsigned(uint64_t(itemCount) * rangeIndex / rangeCount); };
+
+        std::exception_ptr firstException;
+        Threading::Mutex exceptionLock;
+        std::atomic<unsigned> pendingRanges(rangeCount-1);
+        for (unsigned r=1; r<rangeCount; ++r) {
+            threadPool.EnqueueBasic(
+                [&, r]() {
+                    TRY {
+                        fn(r, rangeBegin(r), rangeBegin(r+1));
+                    } CATCH(...) {
+                        ScopedLock(exceptionLock);
+                        if (!firstException) firstException = std::current_exception();
+                    } CATCH_END
+                    --pendingRanges;
+                });
+        }
+
+        TRY {
+            fn(0, rangeBegin(0), rangeBegin(1));
+        } CATCH(...) {
+            ScopedLock(exceptionLock);
+            if (!firstException) firstException = std::current_exception();
+        } CATCH_END
+
+            // (the other ranges reference this stack frame, so we must wait for them even if range 0 threw)
+            // When this is called from a pool thread, YieldToPool() picks up other tasks while we wait,
+            // so nested calls can't starve the pool
+        while (pendingRanges.load() != 0)
+            YieldToPool();
+
+        if (firstException)
+            std::rethrow_exception(firstException);
+    }
+
 }
 
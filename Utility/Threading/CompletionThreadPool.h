@@ -8,9 +8,12 @@
 
 #include "Mutex.h"
 #include "LockFree.h"
+#include "InlineTask.h"
 #include <vector>
 #include <thread>
 #include <functional>
+#include <memory>
+#include <atomic>
 
 namespace Utility
 {
@@ -26,7 +29,8 @@ namespace Utility
      * find some other operation that can take over this worker thread temporarily.
      * 
      * When run on a thread pool worker thread, YieldToPool does exactly that. It does not
-     * stall, but it will attempt pop another operation from the pending queue. It will
+     * stall, but it will attempt to execute another operation -- either from this worker's
+     * own deque, from the pool's injection queue, or stolen from another worker. It will
      * return execution back to the caller after this operation has completed, so that the
      * original operation can resume from where it left off.
      * 
@@ -35,13 +39,65 @@ namespace Utility
     void YieldToPool();
     void SetYieldToPoolFunction(const std::function<void()>& yieldToPoolFunction);
 
+    /// <summary>Scheduling priority for thread pool tasks</summary>
+    /// Workers will always search for High priority tasks (in their own deque,
+    /// the injection queue and then by stealing from other workers) before
+    /// considering Normal priority tasks, and likewise before Low.
+    enum class TaskPriority { High, Normal, Low, Max };
+
+    namespace Internal { class WorkStealingQueues; class PooledTask; }
+
+    /** <summary>Parent for a set of child tasks, with an optional continuation</summary>
+     *
+     * Children are enqueued against the parent via EnqueueChild(). Once the parent has been
+     * sealed and every child has completed, the continuation is scheduled on the same pool.
+     * Parents may themselves be children of another parent; in that case the grandparent
+     * is considered incomplete until the continuation has finished.
+     */
+    class TaskParent
+    {
+    public:
+        void Seal();
+        bool IsComplete() const { return _complete.load(); }
+
+        TaskParent(
+            Internal::WorkStealingQueues& queues,
+            InlineTask&& continuation, TaskPriority priority,
+            std::shared_ptr<TaskParent> parent);
+        ~TaskParent();
+
+        TaskParent(const TaskParent&) = delete;
+        TaskParent& operator=(const TaskParent&) = delete;
+    private:
+        std::atomic<unsigned> _pendingCount;
+        std::atomic<bool> _sealed;
+        std::atomic<bool> _complete;
+        InlineTask _continuation;
+        TaskPriority _priority;
+        std::shared_ptr<TaskParent> _parent;
+        Internal::WorkStealingQueues* _queues;
+
+        void AddChild();
+        void ChildCompleted();
+        friend class Internal::WorkStealingQueues;
+        friend class CompletionThreadPool;
+        friend class ThreadPool;
+    };
+
     class CompletionThreadPool
     {
     public:
         template<class Fn, class... Args>
             void Enqueue(Fn&& fn, Args&&... args);
 
-		void EnqueueBasic(std::function<void()>&& task);
+		void EnqueueBasic(InlineTask&& task, TaskPriority priority = TaskPriority::Normal);
+
+        std::shared_ptr<TaskParent> CreateParent(
+            InlineTask&& continuation = nullptr, TaskPriority priority = TaskPriority::Normal,
+            const std::shared_ptr<TaskParent>& parent = nullptr);
+        void EnqueueChild(
+            const std::shared_ptr<TaskParent>& parent, InlineTask&& task,
+            TaskPriority priority = TaskPriority::Normal);
 
         bool IsGood() const { return !_workerThreads.empty(); }
 
@@ -54,33 +110,44 @@ namespace Utility
         CompletionThreadPool& operator=(CompletionThreadPool&&) = delete;
     private:
         std::vector<std::thread> _workerThreads;
-        
-        Threading::Mutex _pendingsTaskLock;
-        typedef std::function<void()> PendingTask;
-        LockFree::FixedSizeQueue<PendingTask, 256> _pendingTasks;
+        std::unique_ptr<Internal::WorkStealingQueues> _queues;
 
         XlHandle _events[2];
-        volatile bool _workerQuit;
+        std::atomic<bool> _workerQuit;
     };
 
     template<class Fn, class... Args>
         void CompletionThreadPool::Enqueue(Fn&& fn, Args&&... args)
         {
-			// note -- we seem to get a forced invocation of the copy constructor
-			// for std::function<void> here, for an input lambda (even if that lamdba
-			// takes no parameters and returns void). It seems like there is no way to
-			// move from a lamdba of any kind into a std::function<void()> (presumably
-			// because of the fake/unnamed type given with lamdbas by the compile)
-			EnqueueBasic(std::bind(std::move(fn), std::forward<Args>(args)...));
+			// note -- InlineTask is move-only, so the bound functor is moved (not copied)
+			// into the task. Provided it fits into InlineTask::InlineCapacity, there's no
+			// heap allocation here
+			EnqueueBasic(InlineTask(std::bind(std::forward<Fn>(fn), std::forward<Args>(args)...)));
         }
 
+    /// <summary>Splits [0, itemCount) into "rangeCount" contiguous ranges, and executes fn(rangeIndex, begin, end) for each</summary>
+    /// Range 0 is executed on the calling thread, and the rest on the thread pool. Returns once all ranges are complete.
+    /// If any range throws, the first exception is rethrown on the calling thread.
+    /// This may be called from a pool worker (it yields to the pool while waiting for the other ranges).
+    void ExecuteRangesParallel(
+        CompletionThreadPool& threadPool,
+        unsigned itemCount, unsigned rangeCount,
+        const std::function<void(unsigned, unsigned, unsigned)>& fn);
+
     class ThreadPool
     {
     public:
         template<class Fn, class... Args>
             void Enqueue(Fn&& fn, Args&&... args);
 
-		void EnqueueBasic(std::function<void()>&& task);
+		void EnqueueBasic(InlineTask&& task, TaskPriority priority = TaskPriority::Normal);
+
+        std::shared_ptr<TaskParent> CreateParent(
+            InlineTask&& continuation = nullptr, TaskPriority priority = TaskPriority::Normal,
+            const std::shared_ptr<TaskParent>& parent = nullptr);
+        void EnqueueChild(
+            const std::shared_ptr<TaskParent>& parent, InlineTask&& task,
+            TaskPriority priority = TaskPriority::Normal);
 
         bool IsGood() const { return !_workerThreads.empty(); }
 
@@ -93,19 +160,19 @@ namespace Utility
         ThreadPool& operator=(ThreadPool&&) = delete;
     private:
         std::vector<std::thread> _workerThreads;
+        std::unique_ptr<Internal::WorkStealingQueues> _queues;
 
         Threading::Conditional _pendingTaskVariable;
         Threading::Mutex _pendingTaskLock;
-        typedef std::function<void()> PendingTask;
-        LockFree::FixedSizeQueue<PendingTask, 256> _pendingTasks;
+        std::atomic<unsigned> _sleepingWorkers;
 
-        volatile bool _workerQuit;
+        std::atomic<bool> _workerQuit;
     };
 
     template<class Fn, class... Args>
         void ThreadPool::Enqueue(Fn&& fn, Args&&... args)
         {
-			EnqueueBasic(std::bind(std::forward<Fn>(fn), std::forward<Args>(args)...));
+			EnqueueBasic(InlineTask(std::bind(std::forward<Fn>(fn), std::forward<Args>(args)...)));
         }
 }
 
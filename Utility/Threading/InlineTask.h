@@ -0,0 +1,212 @@
+// Copyright 2015 XLGAMES Inc.
+//
+// Distributed under the MIT License (See
+// accompanying file "LICENSE" or the website
+// http://www.opensource.org/licenses/mit-license.php)
+
+#pragma once
+
+#include "../../Core/Prefix.h"
+#include "../../Core/Types.h"
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <cstddef>
+#include <assert.h>
+
+namespace Utility
+{
+    namespace Internal { void RecordInlineTaskHeapFallback(size_t size); }
+
+    template<typename Signature, size_t Capacity = 64>
+        class InlineFunction;
+
+    /** <summary>Move-only callable with inline storage, used for thread pool tasks</summary>
+     *
+     * Functors up to InlineCapacity bytes are constructed directly within the InlineFunction
+     * object itself, so creating, moving and destroying one doesn't touch the heap.
+     * This differs from std::function<> in two important ways:
+     *  <list>
+     *      <item>the small buffer is much larger (enough for a few shared_ptrs and a std::string)</item>
+     *      <item>InlineFunction is move-only, so move-only captures are allowed, and we never
+     *            get a forced copy of the functor</item>
+     *  </list>
+     *
+     * Larger functors fall back to a heap allocation. This is still correct, but it's
+     * counted in the InlineTaskMetrics, so that we can find callers that should trim their
+     * captures.
+    */
+    template<typename Result, typename... Args, size_t Capacity>
+        class InlineFunction<Result(Args...), Capacity>
+    {
+    public:
+        static const size_t InlineCapacity = Capacity;
+
+        Result operator()(Args... args);
+        explicit operator bool() const { return _ops != nullptr; }
+
+        template<typename Fn, typename std::enable_if<!std::is_same<typename std::decay<Fn>::type, InlineFunction>::value>::type* =nullptr>
+            InlineFunction(Fn&& fn);
+        InlineFunction(std::function<Result(Args...)>&& fn);
+        InlineFunction(std::nullptr_t) : _ops(nullptr) {}
+        InlineFunction() : _ops(nullptr) {}
+        ~InlineFunction();
+
+        InlineFunction(InlineFunction&& moveFrom) never_throws;
+        InlineFunction& operator=(InlineFunction&& moveFrom) never_throws;
+        InlineFunction& operator=(std::nullptr_t) never_throws;
+
+        InlineFunction(const InlineFunction&) = delete;
+        InlineFunction& operator=(const InlineFunction&) = delete;
+    private:
+        class Ops
+        {
+        public:
+            Result (*_invoke)(void*, Args&&...);
+            void (*_moveConstruct)(void* dst, void* src);
+            void (*_destroy)(void*);
+        };
+
+        typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type _storage;
+        const Ops* _ops;
+
+        template<typename Fn>
+            struct InlineOps
+        {
+            static Result Invoke(void* storage, Args&&... args) { return (*(Fn*)storage)(std::forward<Args>(args)...); }
+            static void MoveConstruct(void* dst, void* src) { new(dst) Fn(std::move(*(Fn*)src)); }
+            static void Destroy(void* storage) { ((Fn*)storage)->~Fn(); }
+            static const Ops s_ops;
+        };
+
+        template<typename Fn>
+            struct HeapOps
+        {
+            static Result Invoke(void* storage, Args&&... args) { return (**(Fn**)storage)(std::forward<Args>(args)...); }
+            static void MoveConstruct(void* dst, void* src) { *(Fn**)dst = *(Fn**)src; *(Fn**)src = nullptr; }
+            static void Destroy(void* storage) { delete *(Fn**)storage; }
+            static const Ops s_ops;
+        };
+
+        template<typename Fn>
+            void Construct(Fn&& fn, std::true_type);
+        template<typename Fn>
+            void Construct(Fn&& fn, std::false_type);
+    };
+
+    /// <summary>Task type used by CompletionThreadPool and ThreadPool</summary>
+    /// The inline capacity here is large enough for a task that captures a shared_ptr
+    /// and another (64 byte) InlineFunction
+    using InlineTask = InlineFunction<void(), 96>;
+
+    class InlineTaskMetrics
+    {
+    public:
+        uint64 _heapFallbackCount = 0;      ///< number of functors that were too large for inline storage
+        uint64 _heapFallbackBytes = 0;      ///< total size of those functors
+    };
+
+    InlineTaskMetrics GetInlineTaskMetrics();
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    template<typename Result, typename... Args, size_t Capacity>
+        template<typename Fn>
+            const typename InlineFunction<Result(Args...), Capacity>::Ops InlineFunction<Result(Args...), Capacity>::InlineOps<Fn>::s_ops = { &Invoke, &MoveConstruct, &Destroy };
+
+    template<typename Result, typename... Args, size_t Capacity>
+        template<typename Fn>
+            const typename InlineFunction<Result(Args...), Capacity>::Ops InlineFunction<Result(Args...), Capacity>::HeapOps<Fn>::s_ops = { &Invoke, &MoveConstruct, &Destroy };
+
+    template<typename Result, typename... Args, size_t Capacity>
+        template<typename Fn>
+            void InlineFunction<Result(Args...), Capacity>::Construct(Fn&& fn, std::true_type)
+    {
+        using StoredType = typename std::decay<Fn>::type;
+        new(&_storage) StoredType(std::forward<Fn>(fn));
+        _ops = &InlineOps<StoredType>::s_ops;
+    }
+
+    template<typename Result, typename... Args, size_t Capacity>
+        template<typename Fn>
+            void InlineFunction<Result(Args...), Capacity>::Construct(Fn&& fn, std::false_type)
+    {
+        using StoredType = typename std::decay<Fn>::type;
+        Internal::RecordInlineTaskHeapFallback(sizeof(StoredType));
+        *(StoredType**)&_storage = new StoredType(std::forward<Fn>(fn));
+        _ops = &HeapOps<StoredType>::s_ops;
+    }
+
+    template<typename Result, typename... Args, size_t Capacity>
+        template<typename Fn, typename std::enable_if<!std::is_same<typename std::decay<Fn>::type, InlineFunction<Result(Args...), Capacity>>::value>::type*>
+            InlineFunction<Result(Args...), Capacity>::InlineFunction(Fn&& fn)
+    {
+        using StoredType = typename std::decay<Fn>::type;
+            // We require a noexcept move constructor for inline storage, because moving
+            // an InlineFunction must never throw
+        using FitsInline = std::integral_constant<bool,
+            (sizeof(StoredType) <= Capacity)
+            && (alignof(StoredType) <= alignof(std::max_align_t))
+            && std::is_nothrow_move_constructible<StoredType>::value>;
+        Construct(std::forward<Fn>(fn), FitsInline());
+    }
+
+    template<typename Result, typename... Args, size_t Capacity>
+        InlineFunction<Result(Args...), Capacity>::InlineFunction(std::function<Result(Args...)>&& fn)
+    {
+            // an empty std::function becomes an empty InlineFunction
+        if (fn) {
+            Construct(std::move(fn), std::integral_constant<bool, sizeof(std::function<Result(Args...)>) <= Capacity>());
+        } else
+            _ops = nullptr;
+    }
+
+    template<typename Result, typename... Args, size_t Capacity>
+        Result InlineFunction<Result(Args...), Capacity>::operator()(Args... args)
+    {
+        assert(_ops);
+        return (*_ops->_invoke)(&_storage, std::forward<Args>(args)...);
+    }
+
+    template<typename Result, typename... Args, size_t Capacity>
+        InlineFunction<Result(Args...), Capacity>::~InlineFunction()
+    {
+        if (_ops) (*_ops->_destroy)(&_storage);
+    }
+
+    template<typename Result, typename... Args, size_t Capacity>
+        InlineFunction<Result(Args...), Capacity>::InlineFunction(InlineFunction&& moveFrom) never_throws
+    {
+        _ops = moveFrom._ops;
+        if (_ops) {
+            (*_ops->_moveConstruct)(&_storage, &moveFrom._storage);
+            (*_ops->_destroy)(&moveFrom._storage);
+            moveFrom._ops = nullptr;
+        }
+    }
+
+    template<typename Result, typename... Args, size_t Capacity>
+        auto InlineFunction<Result(Args...), Capacity>::operator=(InlineFunction&& moveFrom) never_throws -> InlineFunction&
+    {
+        if (this == &moveFrom) return *this;
+        if (_ops) (*_ops->_destroy)(&_storage);
+        _ops = moveFrom._ops;
+        if (_ops) {
+            (*_ops->_moveConstruct)(&_storage, &moveFrom._storage);
+            (*_ops->_destroy)(&moveFrom._storage);
+            moveFrom._ops = nullptr;
+        }
+        return *this;
+    }
+
+    template<typename Result, typename... Args, size_t Capacity>
+        auto InlineFunction<Result(Args...), Capacity>::operator=(std::nullptr_t) never_throws -> InlineFunction&
+    {
+        if (_ops) (*_ops->_destroy)(&_storage);
+        _ops = nullptr;
+        return *this;
+    }
+}
+
+using namespace Utility;
@@ -9,9 +9,11 @@
 #include "ThreadingUtils.h"
 #include "../PtrUtils.h"
 #include "Mutex.h"
-#include <queue>
+#include <vector>
+#include <memory>
 #include <assert.h>
 #include <atomic>
+#include <algorithm>
 
 namespace Utility
 {
@@ -36,6 +38,510 @@ static const XlHandle XlHandle_Invalid = XlHandle(~size_t(0x0));
 
 namespace LockFree
 {
+    template<typename Type, int InitialCapacity = 256>
+        class MPMCQueue
+    {
+    public:
+
+            //
+            //      Unbounded multi-producer / multi-consumer queue.
+            //
+            //      Items are stored in a chain of ring buffers. Each ring works
+            //      like a bounded MPMC queue with a sequence number per cell, so
+            //      pushing and popping is a single compare-exchange (no locks).
+            //      When a ring fills up, it is closed to further pushes and a new
+            //      ring of twice the size is linked after it. Consumers move on to
+            //      the next ring once the closed ring has been completely drained.
+            //
+            //      A drained ring can't be released immediately, because a slow
+            //      thread might still be looking at it. So drained rings are retired,
+            //      and only recycled after a grace period: every operation registers
+            //      itself in one of 2 epoch counters, and a ring retired during epoch
+            //      N is safe once no operation from epoch N or earlier is still
+            //      running. Safe rings go onto a small free list (to be reused by the
+            //      next burst), and the rest are deleted. So after a burst, the
+            //      memory drops back to the newest ring (which is just reused
+            //      continuously in the steady state), plus the free list.
+            //      Retiring and recycling take a lock, but this only happens when
+            //      consumers move from one ring to the next.
+            //
+            //      try_pop() is safe for any number of consumers. try_front() & pop()
+            //      match the FixedSizeQueue interface; they must only be used by a
+            //      single consuming thread (and not mixed with try_pop()).
+            //      Items never move while they are in the queue.
+            //
+
+        void push(const Type&);
+        void push(Type&&);
+
+        bool try_pop(Type&);
+
+        bool try_front(Type*&) const;
+        void pop();
+
+        size_t size() const;
+        size_t allocated_capacity() const;      ///< total cells in all rings (including retired & free rings)
+
+        MPMCQueue();
+        ~MPMCQueue();
+
+        MPMCQueue(const MPMCQueue&) = delete;
+        MPMCQueue& operator=(const MPMCQueue&) = delete;
+    private:
+        class Cell
+        {
+        public:
+            std::atomic<uint64> _sequence;
+            typename std::aligned_storage<sizeof(Type), alignof(Type)>::type _storage;
+            Type* Get() { return (Type*)&_storage; }
+        };
+
+        class Ring
+        {
+        public:
+            static const uint64 s_closedBit = uint64(1) << uint64(63);
+
+            uint64 _mask;
+            std::unique_ptr<Cell[]> _cells;
+            std::atomic<Ring*> _next;
+            uint8 _padding0[64];            // (keep pushers & poppers on separate cache lines)
+            std::atomic<uint64> _pushPos;   // top bit is set when the ring is closed
+            uint8 _padding1[64];
+            std::atomic<uint64> _popPos;
+
+            template<typename Param>
+                bool TryPush(Param&& item);
+            bool TryPop(Type& result);
+            Cell* TryFront();
+            void PopFront();
+            void Close() { _pushPos.fetch_or(s_closedBit); }
+            bool IsDrained() const;
+            size_t Size() const;
+            uint64 Capacity() const { return _mask+1; }
+            void Reset();
+
+            Ring(uint64 capacity);
+        };
+
+            // Registers an operation in the current epoch, for the duration of its scope
+        class OperationScope
+        {
+        public:
+            OperationScope(const MPMCQueue& queue);
+            ~OperationScope();
+        private:
+            const MPMCQueue* _queue;
+            unsigned _epoch;
+        };
+
+        mutable std::atomic<Ring*> _popRing;
+        mutable std::atomic<Ring*> _pushRing;
+
+        mutable std::atomic<unsigned> _epoch;
+        mutable std::atomic<unsigned> _activeOperations[2];
+        mutable std::atomic<unsigned> _retiredCount;
+        mutable Threading::Mutex _reclaimLock;
+        mutable std::vector<Ring*> _retired[2];         // indexed by the epoch they were retired in
+        mutable std::vector<Ring*> _freeRings;
+        mutable std::atomic<size_t> _allocatedCapacity;
+        static const unsigned s_maxFreeRings = 2;
+
+        template<typename Param>
+            void PushInternal(Param&& item);
+        template<typename Param>
+            void PushInScope(Param&& item);
+        Ring* AdvancePopRing(Ring* ring) const;
+        Ring* AllocateRing(uint64 minCapacity);
+        void Retire(Ring* ring) const;
+        void TryReclaim() const;
+    };
+
+    template<typename Type, int InitialCapacity>
+        MPMCQueue<Type, InitialCapacity>::Ring::Ring(uint64 capacity)
+        : _mask(capacity-1), _cells(new Cell[size_t(capacity)])
+        {
+            assert((capacity & (capacity-1)) == 0);     // must be a power of 2
+            Reset();
+        }
+
+    template<typename Type, int InitialCapacity>
+        void MPMCQueue<Type, InitialCapacity>::Ring::Reset()
+        {
+                // (only for rings that no other thread can see)
+            for (uint64 c=0; c<=_mask; ++c)
+                _cells[size_t(c)]._sequence.store(c, std::memory_order_relaxed);
+            _next.store(nullptr, std::memory_order_relaxed);
+            _pushPos.store(0, std::memory_order_relaxed);
+            _popPos.store(0, std::memory_order_relaxed);
+        }
+
+    template<typename Type, int InitialCapacity>
+        MPMCQueue<Type, InitialCapacity>::OperationScope::OperationScope(const MPMCQueue& queue)
+        : _queue(&queue)
+        {
+                //  If the epoch changes between reading it & registering, the registration
+                //  might not have been seen by a thread advancing the epoch; so try again
+            for (;;) {
+                _epoch = queue._epoch.load();
+                queue._activeOperations[_epoch&1].fetch_add(1);
+                if (queue._epoch.load() == _epoch) break;
+                queue._activeOperations[_epoch&1].fetch_sub(1);
+            }
+        }
+
+    template<typename Type, int InitialCapacity>
+        MPMCQueue<Type, InitialCapacity>::OperationScope::~OperationScope()
+        {
+            _queue->_activeOperations[_epoch&1].fetch_sub(1);
+        }
+
+    #undef new
+
+    template<typename Type, int InitialCapacity>
+        template<typename Param>
+            bool MPMCQueue<Type, InitialCapacity>::Ring::TryPush(Param&& item)
+        {
+            auto pos = _pushPos.load(std::memory_order_relaxed);
+            for (;;) {
+                if (pos & s_closedBit) return false;
+                auto& cell = _cells[size_t(pos & _mask)];
+                auto seq = cell._sequence.load(std::memory_order_acquire);
+                auto diff = int64(seq - pos);
+                if (diff == 0) {
+                        // (this fails if another thread closes the ring in the meantime)
+                    if (_pushPos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+                        new(&cell._storage) Type(std::forward<Param>(item));
+                        cell._sequence.store(pos+1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;       // full
+                } else {
+                    pos = _pushPos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    #if defined(DEBUG_NEW)
+        #define new DEBUG_NEW
+    #endif
+
+    template<typename Type, int InitialCapacity>
+        bool MPMCQueue<Type, InitialCapacity>::Ring::TryPop(Type& result)
+        {
+            auto pos = _popPos.load(std::memory_order_relaxed);
+            for (;;) {
+                auto& cell = _cells[size_t(pos & _mask)];
+                auto seq = cell._sequence.load(std::memory_order_acquire);
+                auto diff = int64(seq - (pos+1));
+                if (diff == 0) {
+                    if (_popPos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+                        result = std::move(*cell.Get());
+                        cell.Get()->~Type();
+                        cell._sequence.store(pos+_mask+1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                        // either empty, or a pusher has claimed this cell but not
+                        // finished writing to it yet
+                    return false;
+                } else {
+                    pos = _popPos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    template<typename Type, int InitialCapacity>
+        auto MPMCQueue<Type, InitialCapacity>::Ring::TryFront() -> Cell*
+        {
+            auto pos = _popPos.load(std::memory_order_relaxed);
+            auto& cell = _cells[size_t(pos & _mask)];
+            if (cell._sequence.load(std::memory_order_acquire) == pos+1)
+                return &cell;
+            return nullptr;
+        }
+
+    template<typename Type, int InitialCapacity>
+        void MPMCQueue<Type, InitialCapacity>::Ring::PopFront()
+        {
+            auto pos = _popPos.load(std::memory_order_relaxed);
+            auto& cell = _cells[size_t(pos & _mask)];
+            assert(cell._sequence.load(std::memory_order_relaxed) == pos+1);
+            cell.Get()->~Type();
+            _popPos.store(pos+1, std::memory_order_release);
+            cell._sequence.store(pos+_mask+1, std::memory_order_release);
+        }
+
+    template<typename Type, int InitialCapacity>
+        bool MPMCQueue<Type, InitialCapacity>::Ring::IsDrained() const
+        {
+            auto pushPos = _pushPos.load(std::memory_order_acquire);
+            return (pushPos & s_closedBit) && ((pushPos & ~s_closedBit) == _popPos.load(std::memory_order_acquire));
+        }
+
+    template<typename Type, int InitialCapacity>
+        size_t MPMCQueue<Type, InitialCapacity>::Ring::Size() const
+        {
+            auto pushPos = _pushPos.load(std::memory_order_relaxed) & ~s_closedBit;
+            auto popPos = _popPos.load(std::memory_order_relaxed);
+            return (pushPos > popPos) ? size_t(pushPos - popPos) : 0;
+        }
+
+    template<typename Type, int InitialCapacity>
+        template<typename Param>
+            void MPMCQueue<Type, InitialCapacity>::PushInternal(Param&& item)
+        {
+            {
+                OperationScope scope(*this);
+                PushInScope(std::forward<Param>(item));
+            }
+            if (_retiredCount.load(std::memory_order_relaxed)) TryReclaim();
+        }
+
+    template<typename Type, int InitialCapacity>
+        template<typename Param>
+            void MPMCQueue<Type, InitialCapacity>::PushInScope(Param&& item)
+        {
+            for (;;) {
+                auto* ring = _pushRing.load(std::memory_order_acquire);
+                if (ring->TryPush(std::forward<Param>(item)))
+                    return;
+
+                    //  The ring is full (or another thread has already closed it). Make sure
+                    //  it's closed, so consumers know nothing more will be written there,
+                    //  and then move on to the next ring (creating it if necessary)
+                ring->Close();
+                auto* next = ring->_next.load(std::memory_order_acquire);
+                if (!next) {
+                    const uint64 maxRingCapacity = 1024*1024;
+                    auto* newRing = AllocateRing(std::min(ring->Capacity()*2, maxRingCapacity));
+                    Ring* expected = nullptr;
+                    if (ring->_next.compare_exchange_strong(expected, newRing)) {
+                        next = newRing;
+                    } else {
+                        next = expected;
+                        ScopedLock(_reclaimLock);       // (never seen by another thread, so it can go straight back)
+                        _freeRings.push_back(newRing);
+                    }
+                }
+                _pushRing.compare_exchange_strong(ring, next);
+            }
+        }
+
+    template<typename Type, int InitialCapacity>
+        auto MPMCQueue<Type, InitialCapacity>::AllocateRing(uint64 minCapacity) -> Ring*
+        {
+            {
+                ScopedLock(_reclaimLock);
+                auto i = std::find_if(_freeRings.begin(), _freeRings.end(), [minCapacity](Ring* r) { return r->Capacity() >= minCapacity; });
+                if (i != _freeRings.end()) {
+                    auto* result = *i;
+                    _freeRings.erase(i);
+                    result->Reset();
+                    return result;
+                }
+            }
+            _allocatedCapacity.fetch_add(size_t(minCapacity));
+            return new Ring(minCapacity);
+        }
+
+    template<typename Type, int InitialCapacity>
+        void MPMCQueue<Type, InitialCapacity>::Retire(Ring* ring) const
+        {
+                //  The epoch is read under the same lock used when advancing it, so the ring
+                //  is always added to the list for an epoch no earlier than the one it was
+                //  unlinked in
+            ScopedLock(_reclaimLock);
+            _retired[_epoch.load()&1].push_back(ring);
+            _retiredCount.fetch_add(1);
+        }
+
+    template<typename Type, int InitialCapacity>
+        void MPMCQueue<Type, InitialCapacity>::TryReclaim() const
+        {
+            std::unique_lock<Threading::Mutex> lock(_reclaimLock, std::try_to_lock);
+            if (!lock.owns_lock()) return;
+
+                //  We can move from epoch N to N+1 once there are no operations left from
+                //  epoch N-1 (which shares a counter with N+1). At that point nothing can be
+                //  looking at the rings retired in epoch N-1. It takes 2 steps to recycle
+                //  rings retired in the current epoch
+            for (unsigned step=0; step<2 && _retiredCount.load(); ++step) {
+                auto epoch = _epoch.load();
+                auto& previous = _retired[(epoch+1)&1];
+                if (_activeOperations[(epoch+1)&1].load() != 0) break;
+                for (auto* ring:previous) {
+                    if (_freeRings.size() < s_maxFreeRings) {
+                        _freeRings.push_back(ring);
+                    } else {
+                        _allocatedCapacity.fetch_sub(size_t(ring->Capacity()));
+                        delete ring;
+                    }
+                }
+                _retiredCount.fetch_sub(unsigned(previous.size()));
+                previous.clear();
+                _epoch.store(epoch+1);
+            }
+        }
+
+    template<typename Type, int InitialCapacity>
+        void MPMCQueue<Type, InitialCapacity>::push(const Type& item) { PushInternal(item); }
+
+    template<typename Type, int InitialCapacity>
+        void MPMCQueue<Type, InitialCapacity>::push(Type&& item) { PushInternal(std::move(item)); }
+
+    template<typename Type, int InitialCapacity>
+        auto MPMCQueue<Type, InitialCapacity>::AdvancePopRing(Ring* ring) const -> Ring*
+        {
+                //  We can only move on from this ring once it's closed and every item
+                //  pushed into it has been popped. Otherwise returns nullptr
+            if (!ring->IsDrained()) return nullptr;
+            auto* next = ring->_next.load(std::memory_order_acquire);
+            if (!next) return nullptr;      // (closed, but the next ring hasn't been linked in yet)
+
+                //  Make sure the push ring has moved on as well, before this ring is retired.
+                //  (it can't be any earlier than the pop ring)
+            auto* pushRing = ring;
+            _pushRing.compare_exchange_strong(pushRing, next);
+
+            if (_popRing.compare_exchange_strong(ring, next))
+                Retire(ring);       // (only the thread that unlinks the ring retires it)
+            return _popRing.load(std::memory_order_acquire);
+        }
+
+    template<typename Type, int InitialCapacity>
+        bool MPMCQueue<Type, InitialCapacity>::try_pop(Type& result)
+        {
+            bool gotItem = false;
+            {
+                OperationScope scope(*this);
+                auto* ring = _popRing.load(std::memory_order_acquire);
+                while (ring && !(gotItem = ring->TryPop(result)))
+                    ring = AdvancePopRing(ring);
+            }
+            if (_retiredCount.load(std::memory_order_relaxed)) TryReclaim();
+            return gotItem;
+        }
+
+    template<typename Type, int InitialCapacity>
+        bool MPMCQueue<Type, InitialCapacity>::try_front(Type*& result) const
+        {
+                //  The ring holding the front item can't be retired until that item is popped,
+                //  so the result remains valid after the scope ends
+            Cell* cell = nullptr;
+            {
+                OperationScope scope(*this);
+                auto* ring = _popRing.load(std::memory_order_acquire);
+                while (ring && !(cell = ring->TryFront()))
+                    ring = AdvancePopRing(ring);
+            }
+            if (_retiredCount.load(std::memory_order_relaxed)) TryReclaim();
+            if (!cell) return false;
+            result = cell->Get();
+            return true;
+        }
+
+    template<typename Type, int InitialCapacity>
+        void MPMCQueue<Type, InitialCapacity>::pop()
+        {
+                // only valid after a successful try_front() (and only from the single consumer thread)
+            _popRing.load(std::memory_order_relaxed)->PopFront();
+        }
+
+    template<typename Type, int InitialCapacity>
+        size_t MPMCQueue<Type, InitialCapacity>::size() const
+        {
+                // because of threading, this can only be an approximate result
+            OperationScope scope(*this);
+            size_t result = 0;
+            for (auto* ring = _popRing.load(std::memory_order_acquire); ring; ring = ring->_next.load(std::memory_order_acquire))
+                result += ring->Size();
+            return result;
+        }
+
+    template<typename Type, int InitialCapacity>
+        size_t MPMCQueue<Type, InitialCapacity>::allocated_capacity() const
+        {
+            return _allocatedCapacity.load(std::memory_order_relaxed);
+        }
+
+    template<typename Type, int InitialCapacity>
+        MPMCQueue<Type, InitialCapacity>::MPMCQueue()
+        {
+            static_assert((InitialCapacity & (InitialCapacity-1)) == 0, "MPMCQueue capacity must be a power of 2");
+            _epoch.store(0, std::memory_order_relaxed);
+            _activeOperations[0].store(0, std::memory_order_relaxed);
+            _activeOperations[1].store(0, std::memory_order_relaxed);
+            _retiredCount.store(0, std::memory_order_relaxed);
+            _allocatedCapacity.store(InitialCapacity, std::memory_order_relaxed);
+            auto* firstRing = new Ring(InitialCapacity);
+            _popRing.store(firstRing, std::memory_order_relaxed);
+            _pushRing.store(firstRing, std::memory_order_relaxed);
+        }
+
+    template<typename Type, int InitialCapacity>
+        MPMCQueue<Type, InitialCapacity>::~MPMCQueue()
+        {
+            Type* t = nullptr;
+            while (try_front(t)) { pop(); }     // pop everything to make sure the destructors are called on all remaining things
+
+                // (retired & free rings are all empty, and are no longer linked to the live rings)
+            auto* ring = _popRing.load(std::memory_order_relaxed);
+            while (ring) {
+                auto* next = ring->_next.load(std::memory_order_relaxed);
+                delete ring;
+                ring = next;
+            }
+            for (auto* r:_retired[0]) delete r;
+            for (auto* r:_retired[1]) delete r;
+            for (auto* r:_freeRings) delete r;
+        }
+
+    template<typename Type, int InitialCapacity = 256>
+        class MPMCQueue_Waitable : public MPMCQueue<Type, InitialCapacity>
+    {
+    public:
+        void push(const Type&);
+        void push(Type&&);
+        XlHandle get_event();
+        MPMCQueue_Waitable();
+        ~MPMCQueue_Waitable();
+    private:
+        XlHandle _event;
+    };
+
+    template<typename Type, int InitialCapacity>
+        void MPMCQueue_Waitable<Type, InitialCapacity>::push(const Type& newItem)
+        {
+            MPMCQueue<Type, InitialCapacity>::push(newItem);
+            XlSetEvent(_event);
+        }
+
+    template<typename Type, int InitialCapacity>
+        void MPMCQueue_Waitable<Type, InitialCapacity>::push(Type&& newItem)
+        {
+            MPMCQueue<Type, InitialCapacity>::push(std::move(newItem));
+            XlSetEvent(_event);
+        }
+
+    template<typename Type, int InitialCapacity>
+        MPMCQueue_Waitable<Type, InitialCapacity>::MPMCQueue_Waitable()
+        {
+            _event = XlCreateEvent(false);
+        }
+
+    template<typename Type, int InitialCapacity>
+        MPMCQueue_Waitable<Type, InitialCapacity>::~MPMCQueue_Waitable()
+        {
+            XlCloseSyncObject(_event);
+        }
+
+    template<typename Type, int InitialCapacity>
+        XlHandle MPMCQueue_Waitable<Type, InitialCapacity>::get_event()
+        {
+            return _event;
+        }
+
     template<typename Type, int Count>
         class FixedSizeQueue
     {
@@ -50,9 +556,8 @@ namespace LockFree
             //      Type::operator= might be called on push(), but it won't
             //      be called again after that.
             //
-            //      This could be extended to support variable length queues,
-            //      but it would require maintaining multiple pages, and might
-            //      require locks for determining when pages are full or empty.
+            //      push_overflow() falls back to an unbounded MPMCQueue when
+            //      the fixed size buffer is full.
             //
 
         bool push(const Type&);
@@ -86,11 +591,8 @@ namespace LockFree
         FixedSizeQueue(const FixedSizeQueue<Type,Count>&);
         const FixedSizeQueue<Type,Count>& operator=(const FixedSizeQueue<Type,Count>&);
 
-        bool _overflowQueue_isEmpty;
-        bool _overflowQueue_needsCompression;
         mutable bool _popNextFromOverflow;
-        mutable Threading::Mutex _overflowQueue_Lock;
-        std::queue<Type> _overflowQueue;
+        MPMCQueue<Type, 16> _overflowQueue;
     };
 
             
@@ -107,9 +609,7 @@ namespace LockFree
                 assert(test0 == _buffer && test1 == _buffer);
             #endif
 
-            _overflowQueue_isEmpty = true;
             _popNextFromOverflow = false;
-            _overflowQueue_needsCompression = false;
         }
 
     template<typename Type, int Count>
@@ -242,23 +742,15 @@ namespace LockFree
     template<typename Type, int Count>
         void FixedSizeQueue<Type,Count>::push_overflow(const Type&newItem)
         {
-            if (!push(newItem)) {
-                ScopedLock(_overflowQueue_Lock);
-                _overflowQueue_isEmpty = false;
-                _overflowQueue_needsCompression = true;
+            if (!push(newItem))
                 _overflowQueue.push(newItem);
-            }
         }
 
     template<typename Type, int Count>
         void FixedSizeQueue<Type,Count>::push_overflow(Type&& newItem)
         {
-            if (!push(std::forward<Type>(newItem))) {
-                ScopedLock(_overflowQueue_Lock);
-                _overflowQueue_isEmpty = false;
-                _overflowQueue_needsCompression = true;
-                _overflowQueue.emplace(std::forward<Type>(newItem));
-            }
+            if (!push(std::forward<Type>(newItem)))
+                _overflowQueue.push(std::forward<Type>(newItem));
         }
 
     template<typename Type, int Count>
@@ -267,13 +759,10 @@ namespace LockFree
                 //  This is safe, so long as only this thread is doing "pop"
             Type* currentPushPtr = (Type*)Interlocked::LoadPointer(&_pushPtr);
             if (currentPushPtr == _popPtr) {
-                if (!_overflowQueue_isEmpty) {
-                    ScopedLock(_overflowQueue_Lock);
-                    if (_overflowQueue.empty()) {
-                        return false;
-                    }
+                    //  The overflow queue is lock free, and since this is the only
+                    //  popping thread, we can use its single consumer interface
+                if (_overflowQueue.try_front(result)) {
                     _popNextFromOverflow = true;
-                    result = const_cast<Type*>(&_overflowQueue.front());
                     return true;
                 }
                 return false;
@@ -295,7 +784,6 @@ namespace LockFree
                 }
                 _popPtr = newPopPtr;
             } else {
-                ScopedLock(_overflowQueue_Lock);
                 _overflowQueue.pop();
             }
         }
@@ -318,69 +806,139 @@ namespace LockFree
     template<typename Type, int Count>
         void FixedSizeQueue<Type,Count>::compress_overflow()
     {
-        if (_overflowQueue_isEmpty && _overflowQueue_needsCompression) {
-            ScopedLock(_overflowQueue_Lock);
-            _overflowQueue = std::queue<Type>();    // destroy memory
-            _overflowQueue_needsCompression = false;
-        }
+            //  The overflow queue is now lock free, and reuses its ring buffers, so it
+            //  can't grow beyond about twice the peak overflow. There's nothing to
+            //  release here; this is retained for compatibility with existing callers
     }
 
-    template<typename Type, int Count>
-        class FixedSizeQueue_Waitable : public FixedSizeQueue<Type,Count>
+    template<typename Type>
+        class WorkStealingDeque
     {
     public:
-        bool push(const Type&);
-        void push_stall(const Type&);
-        XlHandle get_event();
-        FixedSizeQueue_Waitable();
-        ~FixedSizeQueue_Waitable();
+
+            //
+            //      Chase-Lev style work stealing deque of pointers.
+            //      Only the owning thread may call push_bottom() and pop_bottom()
+            //      (which operate in LIFO order, for cache locality). Any other
+            //      thread may call steal(), which takes from the opposite end.
+            //
+            //      The ring buffer grows when full. Retired rings are kept alive
+            //      until the deque is destroyed, because a stealing thread may still
+            //      be reading from an old ring while the owner is growing it.
+            //
+
+        void push_bottom(Type* item);
+        Type* pop_bottom();
+        Type* steal();
+        size_t size() const;
+
+        WorkStealingDeque(unsigned initialCapacityLog2 = 8);
+        ~WorkStealingDeque();
+
+        WorkStealingDeque(const WorkStealingDeque&) = delete;
+        WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
     private:
-        XlHandle _event;
+        class Ring
+        {
+        public:
+            int64 _mask;
+            std::unique_ptr<std::atomic<Type*>[]> _slots;
+
+            Type* Get(int64 index) const { return _slots[size_t(index & _mask)].load(std::memory_order_relaxed); }
+            void Put(int64 index, Type* item) { _slots[size_t(index & _mask)].store(item, std::memory_order_relaxed); }
+            Ring(int64 capacity) : _mask(capacity-1), _slots(new std::atomic<Type*>[size_t(capacity)]) {}
+        };
+
+        std::atomic<int64> _top;
+        std::atomic<int64> _bottom;
+        std::atomic<Ring*> _ring;
+        std::vector<std::unique_ptr<Ring>> _rings;      // (only modified by the owner thread)
     };
 
-    template<typename Type, int Count>
-        bool FixedSizeQueue_Waitable<Type,Count>::push(const Type&newItem)
+    template<typename Type>
+        void WorkStealingDeque<Type>::push_bottom(Type* item)
         {
-            bool result = FixedSizeQueue<Type,Count>::push(newItem);
-            if (result) {
-                XlSetEvent(_event);
+            int64 b = _bottom.load(std::memory_order_relaxed);
+            int64 t = _top.load(std::memory_order_acquire);
+            Ring* ring = _ring.load(std::memory_order_relaxed);
+            if ((b - t) > ring->_mask) {
+                    // grow -- copy the live range into a ring twice the size
+                auto newRing = std::make_unique<Ring>((ring->_mask+1) * 2);
+                for (int64 i=t; i<b; ++i)
+                    newRing->Put(i, ring->Get(i));
+                ring = newRing.get();
+                _rings.emplace_back(std::move(newRing));
+                _ring.store(ring, std::memory_order_release);
             }
-            return result;
+            ring->Put(b, item);
+            _bottom.store(b+1, std::memory_order_release);     // (publishes the item to stealing threads)
         }
 
-    template<typename Type, int Count>
-        void FixedSizeQueue_Waitable<Type,Count>::push_stall(const Type&newItem)
+    template<typename Type>
+        Type* WorkStealingDeque<Type>::pop_bottom()
         {
-            while (!push(newItem)) {
-                // HPC startTime = GetHPC();
-                while (!push(newItem)) {
-                    // HPC currentTime = GetHPC();
-                    // if (hpc2sec(currentTime - startTime) > 1) {
-                    //     LogAlwaysWarning("Warning -- exceeded queue limit in fixed size queue. Stalling!");
-                    //     startTime = currentTime;
-                    // }
-                    XlSetEvent(_event); // raise the event, just to make sure the other thread is processing
-                    Threading::YieldTimeSlice();
-                }
+            int64 b = _bottom.load(std::memory_order_relaxed) - 1;
+            Ring* ring = _ring.load(std::memory_order_relaxed);
+            _bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64 t = _top.load(std::memory_order_relaxed);
+
+            if (t > b) {
+                    // empty
+                _bottom.store(b+1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            Type* result = ring->Get(b);
+            if (t == b) {
+                    // last item -- we must race against any stealing threads for it
+                if (!_top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    result = nullptr;
+                _bottom.store(b+1, std::memory_order_relaxed);
             }
+            return result;
         }
 
-    template<typename Type, int Count>
-        FixedSizeQueue_Waitable<Type,Count>::FixedSizeQueue_Waitable()
+    template<typename Type>
+        Type* WorkStealingDeque<Type>::steal()
         {
-            _event = XlCreateEvent(false);
+            int64 t = _top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64 b = _bottom.load(std::memory_order_acquire);
+            if (t >= b) return nullptr;
+
+            Ring* ring = _ring.load(std::memory_order_acquire);
+            Type* result = ring->Get(t);
+                // If we lose the race here, just return nothing. The caller
+                // will move on to another victim and come back later
+            if (!_top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+            return result;
         }
 
-    template<typename Type, int Count>
-        FixedSizeQueue_Waitable<Type,Count>::~FixedSizeQueue_Waitable()
+    template<typename Type>
+        size_t WorkStealingDeque<Type>::size() const
         {
-            XlCloseSyncObject(_event);
+                // approximate (only accurate when called from the owner thread)
+            int64 b = _bottom.load(std::memory_order_relaxed);
+            int64 t = _top.load(std::memory_order_relaxed);
+            return (b > t) ? size_t(b - t) : 0;
         }
 
-    template<typename Type, int Count>
-        XlHandle FixedSizeQueue_Waitable<Type,Count>::get_event()
+    template<typename Type>
+        WorkStealingDeque<Type>::WorkStealingDeque(unsigned initialCapacityLog2)
+        : _top(0), _bottom(0)
         {
-            return _event;
+            _rings.emplace_back(std::make_unique<Ring>(int64(1) << int64(initialCapacityLog2)));
+            _ring.store(_rings[0].get(), std::memory_order_relaxed);
+        }
+
+    template<typename Type>
+        WorkStealingDeque<Type>::~WorkStealingDeque()
+        {
+                // Note that we don't own the pointers in the deque. Anything
+                // remaining must be cleaned up by the client before destruction
+            assert(size() == 0);
         }
 }
 
@@ -73,6 +73,10 @@ namespace Utility
         size_t size_entries() const { return _entries.size(); }
         void clear();
 
+            /// Moves every object in "src" onto the end of this array (in order). "src" is left
+            /// empty, but keeps its allocation.
+        void append(VariantArray&& src);
+
         VariantArray();
         ~VariantArray();
         VariantArray(VariantArray&&);
@@ -251,6 +251,11 @@ void XlMoveFile(const utf8 destination[], const utf8 source[])
     MoveFileA((const char*)source, (const char*)destination);
 }
 
+bool XlReplaceFile(const utf8 destination[], const utf8 source[])
+{
+    return MoveFileExA((const char*)source, (const char*)destination, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+}
+
 const char* XlGetCommandLine()
 {
     return GetCommandLineA();
@@ -17,6 +17,10 @@ struct DeformedVertex
 
 DeformedVertex DeformedVertex_Initialize(VSIN input)
 {
+	#if GEO_HAS_INSTANCE_TRANSFORM>=1
+		SysUniform_SetInstanceTransform(float3x4(input.instanceTransform0, input.instanceTransform1, input.instanceTransform2));
+	#endif
+
 	DeformedVertex deformedVertex;
 	deformedVertex.position = VSIN_GetLocalPosition(input);
 	deformedVertex.tangentFrame = VSIN_GetCompressedTangentFrame(input);
@@ -70,6 +70,12 @@ struct VSIN //////////////////////////////////////////////////////
 		float ambientOcclusion : PER_VERTEX_AO;
 	#endif
 
+	#if GEO_HAS_INSTANCE_TRANSFORM>=1
+		float4 instanceTransform0 : INSTANCE_TRANSFORM0;
+		float4 instanceTransform1 : INSTANCE_TRANSFORM1;
+		float4 instanceTransform2 : INSTANCE_TRANSFORM2;
+	#endif
+
 	VSINPUT_EXTRA
 }; //////////////////////////////////////////////////////////////////
 
@@ -30,8 +30,30 @@ cbuffer LocalTransform BIND_MAT_B1
 	float3 LocalSpaceView;
 }
 
-float3x4 	SysUniform_GetLocalToWorld() { return LocalToWorld; }
-float3 		SysUniform_GetLocalSpaceView() { return LocalSpaceView; }
+#if GEO_HAS_INSTANCE_TRANSFORM>=1
+	// With instanced geometry, "LocalToWorld" is the transform from the geometry into the
+	// space of the instance, and the per-instance transform comes from the vertex input.
+	// DeformedVertex_Initialize() records the instance transform; so these are only valid
+	// in the vertex shader, after that has been called
+	static float3x4 InstanceTransform;
+
+	void		SysUniform_SetInstanceTransform(float3x4 instanceTransform) { InstanceTransform = instanceTransform; }
+
+	float3x4 	SysUniform_GetLocalToWorld()
+	{
+		return mul(InstanceTransform, float4x4(LocalToWorld[0], LocalToWorld[1], LocalToWorld[2], float4(0,0,0,1)));
+	}
+
+	float3 		SysUniform_GetLocalSpaceView()
+	{
+		float3x4 localToWorld = SysUniform_GetLocalToWorld();
+		float3 translation = float3(localToWorld[0][3], localToWorld[1][3], localToWorld[2][3]);
+		return mul(WorldSpaceView - translation, (float3x3)localToWorld);
+	}
+#else
+	float3x4 	SysUniform_GetLocalToWorld() { return LocalToWorld; }
+	float3 		SysUniform_GetLocalSpaceView() { return LocalSpaceView; }
+#endif
 
 cbuffer GlobalState BIND_SEQ_B2
 {